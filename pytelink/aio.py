@@ -0,0 +1,88 @@
+""" asyncio interface to Telink lights.
+    Author: Vincent Paeder
+    License: GPL v3
+"""
+import asyncio
+import functools
+from concurrent.futures import ThreadPoolExecutor
+
+from . import TelinkLight
+
+# Blocking calls release the GIL, so a small shared pool serves any number of lights.
+_executor = None
+
+def set_executor(executor):
+    """ Sets the executor running blocking device operations for all lights. """
+    global _executor
+    _executor = executor
+
+def _get_executor():
+    global _executor
+    if _executor is None:
+        _executor = ThreadPoolExecutor(max_workers=8, thread_name_prefix="pytelink")
+    return _executor
+
+class AsyncTelinkLight:
+    """ Telink light whose device operations are awaitables and whose reports are read
+        with an async iterator:
+
+            light = AsyncTelinkLight("AA:BB:CC:DD:EE:FF", "DeviceName", "Password")
+            await light.connect()
+            await light.set_state(True)
+            async for opcode, packet in light:
+                pass # do something here with packet content
+
+        Reports are queued natively and signalled through a file descriptor watched by the
+        event loop; the Bluetooth thread never takes the GIL. Device operations of one light
+        run one at a time, in call order, as a connection cannot send concurrently.
+    """
+
+    # methods waiting for the device; all others are called directly
+    _blocking = {"connect", "disconnect", "is_connected", "send_packet",
+                 "query_mesh_id", "query_groups", "query_time", "query_alarm",
+                 "query_device_info", "query_device_version", "query_scenario", "query_status",
+                 "set_mesh_id", "add_group", "delete_group", "set_time", "set_state",
+                 "add_scenario", "delete_scenario", "set_brightness", "set_color",
+                 "set_temperature", "set_attributes", "load_scenario", "set_alarm",
+                 "delete_alarm", "edit_scenario"}
+
+    def __init__(self, address, name, password, loop=None, max_reports=1024):
+        self._lock = None # created on first call, in the running loop
+        self.light = TelinkLight(address, name, password)
+        self.loop = loop or asyncio.get_event_loop()
+        self.reports = asyncio.Queue(max_reports)
+        self.fd = self.light.get_report_fd()
+        if self.fd < 0:
+            raise OSError("cannot create report event descriptor")
+        self.loop.add_reader(self.fd, self._read_reports)
+
+    def _read_reports(self):
+        for report in self.light.read_reports():
+            if self.reports.full():
+                self.reports.get_nowait() # drop oldest report
+            self.reports.put_nowait(report)
+
+    def __getattr__(self, name):
+        method = getattr(self.light, name)
+        if name not in self._blocking:
+            return method
+        async def call(*args):
+            if self._lock is None:
+                self._lock = asyncio.Lock()
+            async with self._lock:
+                return await self.loop.run_in_executor(_get_executor(), functools.partial(method, *args))
+        call.__name__ = name
+        call.__doc__ = method.__doc__
+        return call
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        return await self.reports.get()
+
+    def close(self):
+        """ Stops watching reports. Call disconnect() first to close the connection. """
+        if self.fd >= 0:
+            self.loop.remove_reader(self.fd)
+            self.fd = -1
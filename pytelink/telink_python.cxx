@@ -4,6 +4,11 @@
  *  License: GPL v3
  */
 #include "telink_python.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 namespace boost { namespace python {
     bool hasattr(PyObject * o, const char* name) {
@@ -15,65 +20,314 @@ namespace boost { namespace python {
 
 namespace telink {
   
-  static void call_python_callback(PyObject * o, const char * method_name, const std::string & arg) {
+  bool TelinkPythonDispatcher::has_method(const char * name) {
+    auto it = this->methods.find(name);
+    if (it == this->methods.end())
+      it = this->methods.emplace(name, bp::hasattr(this->self, name)).first;
+    return it->second;
+  }
+  
+  void TelinkPythonDispatcher::dispatch(const char * method_name, const std::string & packet) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (this->batch || this->event_fd >= 0) {
+        // leave packet for delivery thread or event loop; the Bluetooth thread never waits for the GIL here
+        bool signal = this->pending.empty();
+        this->pending.emplace_back(static_cast<unsigned char>(packet[7]), packet);
+        if (this->event_fd < 0)
+          this->wakeup.notify_one();
+        else if (signal) {
+          uint64_t one = 1;
+          if (write(this->event_fd, &one, sizeof(one)) < 0) {}
+        }
+        return;
+      }
+    }
     PyGILState_STATE gstate = PyGILState_Ensure();
-    if (bp::hasattr(o, method_name))
-      bp::call_method<void>(o, method_name, arg);
+    try {
+      if (this->has_method(method_name))
+        bp::call_method<void>(this->self, method_name, packet);
+    } catch (const bp::error_already_set &) {
+      PyErr_Print();
+    }
     PyGILState_Release(gstate);
   }
   
+  TelinkPythonDispatcher::~TelinkPythonDispatcher() {
+    this->stop();
+    if (this->event_fd >= 0)
+      close(this->event_fd);
+  }
+  
+  void TelinkPythonDispatcher::deliver() {
+    std::vector<std::pair<int, std::string>> reports;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+      this->wakeup.wait(lock, [this]() { return this->stopping || !this->pending.empty(); });
+      if (this->pending.empty()) break;
+      reports.swap(this->pending);
+      lock.unlock();
+      
+      PyGILState_STATE gstate = PyGILState_Ensure();
+      try {
+        if (this->has_method("parse_reports")) {
+          bp::list list_reports;
+          for (auto & report : reports) {
+            bp::object data(bp::handle<>(PyBytes_FromStringAndSize(report.second.data(), report.second.size())));
+            list_reports.append(bp::make_tuple(report.first, data));
+          }
+          bp::call_method<void>(this->self, "parse_reports", list_reports);
+        }
+      } catch (const bp::error_already_set &) {
+        PyErr_Print();
+      }
+      PyGILState_Release(gstate);
+      
+      reports.clear();
+      lock.lock();
+    }
+  }
+  
+  void TelinkPythonDispatcher::stop() {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->batch = false;
+      this->stopping = true;
+      this->wakeup.notify_one();
+    }
+    if (this->worker.joinable()) {
+      // delivery thread may be waiting for the GIL
+      if (PyGILState_Check()) {
+        ScopedGILRelease release;
+        this->worker.join();
+      } else {
+        this->worker.join();
+      }
+    }
+    this->stopping = false;
+  }
+  
+  void TelinkPythonDispatcher::set_batch_delivery(bool enable) {
+    if (!enable) {
+      this->stop();
+      return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->batch) return;
+    this->batch = true;
+    this->worker = std::thread(&TelinkPythonDispatcher::deliver, this);
+  }
+  
+  int TelinkPythonDispatcher::get_event_fd() {
+    if (this->event_fd >= 0)
+      return this->event_fd;
+    this->stop();
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+      std::cerr << "Cannot create report event descriptor." << std::endl;
+      return -1;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->event_fd = fd;
+    return fd;
+  }
+  
+  bp::list TelinkPythonDispatcher::read_reports() {
+    std::vector<std::pair<int, std::string>> reports;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      reports.swap(this->pending);
+      uint64_t count;
+      if (this->event_fd >= 0 && read(this->event_fd, &count, sizeof(count)) < 0) {}
+    }
+    bp::list list_reports;
+    for (auto & report : reports) {
+      bp::object data(bp::handle<>(PyBytes_FromStringAndSize(report.second.data(), report.second.size())));
+      list_reports.append(bp::make_tuple(report.first, data));
+    }
+    return list_reports;
+  }
+  
   void TelinkLightPython::set_alarm(unsigned char alarm_id, bp::list & list_weekdays, unsigned char hour, unsigned char minute, unsigned char second, unsigned char action) {
     std::vector<bool> weekdays(7);
     for (int i=0; i<7; i++)
       weekdays.push_back(bp::extract<bool>(list_weekdays[i]));
-  
+    
+    ScopedGILRelease release;
     TelinkLight::set_alarm(alarm_id, weekdays, hour, minute, second, action);
   }
 
   void TelinkLightPython::set_alarm(unsigned char alarm_id, bool state) {
+    ScopedGILRelease release;
     TelinkLight::set_alarm(alarm_id, state);
   }
 
   void TelinkLightPythonCallback::parse_online_status_report(const std::string & packet) {
     TelinkLightPython::parse_online_status_report(packet);
-    call_python_callback(self, "parse_online_status_report", packet);
+    this->dispatcher.dispatch("parse_online_status_report", packet);
   }
 
   void TelinkLightPythonCallback::parse_status_report(const std::string & packet) {
     TelinkLight::parse_status_report(packet);
-    call_python_callback(self, "parse_status_report", packet);
+    this->dispatcher.dispatch("parse_status_report", packet);
   }
 
   void TelinkLightPythonCallback::parse_alarm_report(const std::string & packet) {
     TelinkLight::parse_alarm_report(packet);
-    call_python_callback(self, "parse_alarm_report", packet);
+    this->dispatcher.dispatch("parse_alarm_report", packet);
   }
 
   void TelinkLightPythonCallback::parse_scenario_report(const std::string & packet) {
     TelinkLight::parse_scenario_report(packet);
-    call_python_callback(self, "parse_scenario_report", packet);
+    this->dispatcher.dispatch("parse_scenario_report", packet);
   }
 
   void TelinkMeshPythonCallback::parse_time_report(const std::string & packet) {
     TelinkMesh::parse_time_report(packet);
-    call_python_callback(self, "parse_time_report", packet);
+    this->dispatcher.dispatch("parse_time_report", packet);
   }
 
   void TelinkMeshPythonCallback::parse_address_report(const std::string & packet) {
     TelinkMesh::parse_address_report(packet);
-    call_python_callback(self, "parse_address_report", packet);
+    this->dispatcher.dispatch("parse_address_report", packet);
   }
 
   void TelinkMeshPythonCallback::parse_device_info_report(const std::string & packet) {
     TelinkMesh::parse_device_info_report(packet);
-    call_python_callback(self, "parse_device_info_report", packet);
+    this->dispatcher.dispatch("parse_device_info_report", packet);
   }
 
   void TelinkMeshPythonCallback::parse_group_id_report(const std::string & packet) {
     TelinkMesh::parse_group_id_report(packet);
-    call_python_callback(self, "parse_group_id_report", packet);
+    this->dispatcher.dispatch("parse_group_id_report", packet);
+  }
+
+  void TelinkMeshPythonCallback::parse_ota_status_report(const std::string & packet) {
+    TelinkMesh::parse_ota_status_report(packet);
+    this->dispatcher.dispatch("parse_ota_status_report", packet);
+  }
+  
+  void TelinkLightPythonCallback::parse_time_report(const std::string & packet) {
+    TelinkLight::parse_time_report(packet);
+    this->dispatcher.dispatch("parse_time_report", packet);
+  }
+
+  void TelinkLightPythonCallback::parse_address_report(const std::string & packet) {
+    TelinkLight::parse_address_report(packet);
+    this->dispatcher.dispatch("parse_address_report", packet);
+  }
+
+  void TelinkLightPythonCallback::parse_device_info_report(const std::string & packet) {
+    TelinkLight::parse_device_info_report(packet);
+    this->dispatcher.dispatch("parse_device_info_report", packet);
+  }
+
+  void TelinkLightPythonCallback::parse_group_id_report(const std::string & packet) {
+    TelinkLight::parse_group_id_report(packet);
+    this->dispatcher.dispatch("parse_group_id_report", packet);
+  }
+
+  void TelinkLightPythonCallback::parse_ota_status_report(const std::string & packet) {
+    TelinkLight::parse_ota_status_report(packet);
+    this->dispatcher.dispatch("parse_ota_status_report", packet);
+  }
+  
+  static void set_batch_delivery(TelinkLightPython & light, bool enable) {
+    auto callback = dynamic_cast<TelinkLightPythonCallback*>(&light);
+    if (callback != nullptr)
+      callback->set_batch_delivery(enable);
+  }
+  
+  static int get_report_fd(TelinkLightPython & light) {
+    auto callback = dynamic_cast<TelinkLightPythonCallback*>(&light);
+    return callback != nullptr ? callback->get_report_fd() : -1;
+  }
+  
+  static bp::list read_reports(TelinkLightPython & light) {
+    auto callback = dynamic_cast<TelinkLightPythonCallback*>(&light);
+    return callback != nullptr ? callback->read_reports() : bp::list();
+  }
+  
+  /** \fn static bool read_integer(const char * item, char format, Py_ssize_t size, long long & value)
+   *  \brief Reads an integer element of a Python buffer.
+   *  \param item : pointer to element.
+   *  \param format : struct module format character of the element.
+   *  \param size : element size in bytes.
+   *  \param value : element value (output).
+   *  \returns true if format is a supported integer type.
+   */
+  static bool read_integer(const char * item, char format, Py_ssize_t size, long long & value) {
+    if (std::strchr("bhilq", format) != nullptr) {
+      switch (size) {
+        case 1: value = *reinterpret_cast<const int8_t*>(item); return true;
+        case 2: value = *reinterpret_cast<const int16_t*>(item); return true;
+        case 4: value = *reinterpret_cast<const int32_t*>(item); return true;
+        case 8: value = *reinterpret_cast<const int64_t*>(item); return true;
+      }
+    } else if (std::strchr("BHILQ", format) != nullptr) {
+      switch (size) {
+        case 1: value = *reinterpret_cast<const uint8_t*>(item); return true;
+        case 2: value = *reinterpret_cast<const uint16_t*>(item); return true;
+        case 4: value = *reinterpret_cast<const uint32_t*>(item); return true;
+        case 8: value = static_cast<long long>(*reinterpret_cast<const uint64_t*>(item)); return true;
+      }
+    }
+    return false;
+  }
+  
+  static std::size_t set_frame(TelinkLightPython & light, bp::object frame) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(frame.ptr(), &view, PyBUF_RECORDS_RO) != 0)
+      bp::throw_error_already_set();
+    
+    const char * format = view.format != nullptr ? view.format : "B";
+    if (*format == '@' || *format == '=' || *format == '<')
+      format++; // sizes are taken from itemsize
+    std::vector<uint16_t> addresses;
+    std::vector<unsigned char> R, G, B, brightness;
+    bool valid = true;
+    if (view.ndim == 2 && view.shape[1] == 5) {
+      // array of (address, R, G, B, brightness) rows of any integer type
+      std::size_t count = view.shape[0];
+      addresses.resize(count);
+      R.resize(count); G.resize(count); B.resize(count); brightness.resize(count);
+      unsigned char * columns[4] = {R.data(), G.data(), B.data(), brightness.data()};
+      for (std::size_t i=0; i<count && valid; i++) {
+        const char * row = static_cast<const char*>(view.buf) + i*view.strides[0];
+        long long value;
+        valid = read_integer(row, *format, view.itemsize, value);
+        addresses[i] = value & 0xffff;
+        for (int j=0; j<4 && valid; j++) {
+          valid = read_integer(row + (j+1)*view.strides[1], *format, view.itemsize, value);
+          columns[j][i] = std::min<long long>(std::max<long long>(value, 0), j == 3 ? 100 : 255);
+        }
+      }
+    } else if (view.ndim <= 1 && view.itemsize == 1 && view.len % 6 == 0 && PyBuffer_IsContiguous(&view, 'C')) {
+      // packed little-endian rows: uint16 address, R, G, B, brightness
+      std::size_t count = view.len / 6;
+      const unsigned char * row = static_cast<const unsigned char*>(view.buf);
+      for (std::size_t i=0; i<count; i++, row+=6) {
+        addresses.push_back(row[0] | (row[1] << 8));
+        R.push_back(row[2]);
+        G.push_back(row[3]);
+        B.push_back(row[4]);
+        brightness.push_back(std::min<unsigned char>(row[5], 100));
+      }
+    } else {
+      valid = false;
+    }
+    PyBuffer_Release(&view);
+    if (!valid) {
+      PyErr_SetString(PyExc_ValueError, "frame must be an integer array of (address, R, G, B, brightness) rows, or bytes of packed 6-byte rows");
+      bp::throw_error_already_set();
+    }
+    
+    ScopedGILRelease release;
+    return light.set_frame(addresses.data(), R.data(), G.data(), B.data(), brightness.data(), addresses.size());
   }
   
+  BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(set_cache_overloads, set_cache, 1, 2)
+  
   // Python classes definitions - module will be called telink_wrapper.so
   BOOST_PYTHON_MODULE(telink_wrapper) {
     
@@ -82,6 +336,26 @@ namespace telink {
     doc_options.enable_py_signatures();
     doc_options.disable_cpp_signatures();
     
+    // TelinkTrace
+    bp::class_<TelinkTrace, boost::noncopyable>("TelinkTrace", "Preallocated ring of packet records, kept in memory or in a memory-mapped file.", bp::no_init)
+      .def(bp::init<std::size_t>((bp::arg("capacity")=65536)))
+      .def("map_file", &TelinkTrace::map_file, bp::args("path"), "Moves the ring into a memory-mapped file.")
+      .def("save", &TelinkTrace::save, bp::args("path"), "Writes the ring to a trace file.");
+    
+    // TelinkTimeline
+    bp::class_<TelinkTimeline, boost::noncopyable>("TelinkTimeline", "Records packet stage spans into per-thread rings, for latency analysis.", bp::no_init)
+      .def(bp::init<std::size_t>((bp::arg("capacity")=16384)))
+      .def("set_enabled", &TelinkTimeline::set_enabled, bp::args("enabled"), "Pauses or resumes recording.")
+      .def("is_enabled", &TelinkTimeline::is_enabled, "Tells if spans are recorded.")
+      .def("export_chrome", &TelinkTimeline::export_chrome, bp::args("path"), "Writes all spans as a Chrome trace-event JSON file, which the Perfetto UI opens.");
+    
+    // TelinkCache
+    bp::class_<TelinkCache, boost::noncopyable>("TelinkCache", "Set of device metadata, loaded from and saved to a compact binary file.", bp::no_init)
+      .def(bp::init<std::string>((bp::arg("path"))))
+      .def("load", &TelinkCache::load, "Replaces entries with the content of the cache file.")
+      .def("save", &TelinkCache::save, "Writes entries to the cache file.")
+      .def("remove", &TelinkCache::remove, bp::args("address"), "Removes the entry of a device.");
+    
     // TelinkMesh
     bp::class_<TelinkMesh, boost::noncopyable>("TelinkMesh", "Class handling connection with a Bluetooth LE device with Telink mesh protocol.", bp::no_init)
       .def(bp::init<std::string>((bp::arg("address"))))
@@ -90,19 +364,24 @@ namespace telink {
       .def("set_name", &TelinkMesh::set_name, bp::args("name"), "Sets the device name to be used for connecting.")
       .def("set_password", &TelinkMesh::set_password, bp::args("password"), "Sets the password to be used for connecting.")
       .def("set_vendor", &TelinkMesh::set_vendor, bp::args("vendor"), "Sets the Bluetooth vendor code (0x0211 for Telink).")
-      .def("query_mesh_id", &TelinkLightPython::query_mesh_id, "Queries mesh ID from device.")
-      .def("set_mesh_id", &TelinkMesh::set_mesh_id, bp::args("mesh_id"), "Sets device mesh ID.")
-      .def("send_packet", &TelinkMesh::send_packet, bp::args("command", "data"), "Sends a command packet to the device.")
-      .def("connect", &TelinkMesh::connect, "Connects to Bluetooth device.")
-      .def("disconnect", &TelinkMesh::disconnect, "Disconnects from Bluetooth device.")
-      .def("is_connected", &TelinkMesh::is_connected, "Probes whether the connection with the device is established.")
-      .def("query_groups", &TelinkLightPython::query_groups, "Queries mesh group IDs from device.")
-      .def("add_group", &TelinkMesh::add_group, bp::args("group_id"), "Adds device to given group.")
-      .def("delete_group", &TelinkMesh::delete_group, bp::args("group_id"), "Removes device from given group.")
-      .def("set_time", &TelinkLightPython::set_time, "Sets device date and time.")
-      .def("query_time", &TelinkLightPython::query_time, "Queries device date and time.")
-      .def("query_device_info", &TelinkLightPython::query_device_info, "Queries device information.")
-      .def("query_device_version", &TelinkLightPython::query_device_version, "Queries device firmware version.");
+      .def("query_mesh_id", NOGIL(TelinkMesh, TelinkLightPython::query_mesh_id), "Queries mesh ID from device.")
+      .def("set_mesh_id", NOGIL(TelinkMesh, TelinkMesh::set_mesh_id), bp::args("mesh_id"), "Sets device mesh ID.")
+      .def("send_packet", NOGIL(TelinkMesh, TelinkMesh::send_packet), bp::args("command", "data"), "Sends a command packet to the device.")
+      .def("set_trace", &TelinkMesh::set_trace, bp::with_custodian_and_ward<1, 2>(), bp::args("trace"), "Records all sent and received packets into given trace.")
+      .def("set_timeline", &TelinkMesh::set_timeline, bp::with_custodian_and_ward<1, 2>(), bp::args("timeline"), "Records the time packets spend in each stage into given timeline.")
+      .def("set_cache", &TelinkMesh::set_cache, set_cache_overloads(bp::args("cache", "max_age"), "Uses given cache to persist device metadata.")[bp::with_custodian_and_ward<1, 2>()])
+      .def("connect", NOGIL(TelinkMesh, TelinkMesh::connect), "Connects to Bluetooth device.")
+      .def("disconnect", NOGIL(TelinkMesh, TelinkMesh::disconnect), "Disconnects from Bluetooth device.")
+      .def("forget_device", NOGIL(TelinkMesh, TelinkMesh::forget_device), "Drops characteristics and handles kept from previous connections, so that next connection looks them up again.")
+      .def("is_connected", NOGIL(TelinkMesh, TelinkMesh::is_connected), "Tells whether the connection with the device is established, as tracked from connection notifications.")
+      .def("query_groups", NOGIL(TelinkMesh, TelinkLightPython::query_groups), "Queries mesh group IDs from device.")
+      .def("add_group", NOGIL(TelinkMesh, TelinkMesh::add_group), bp::args("group_id"), "Adds device to given group.")
+      .def("delete_group", NOGIL(TelinkMesh, TelinkMesh::delete_group), bp::args("group_id"), "Removes device from given group.")
+      .def("set_time", NOGIL(TelinkMesh, TelinkLightPython::set_time), "Sets device date and time.")
+      .def("query_time", NOGIL(TelinkMesh, TelinkLightPython::query_time), "Queries device date and time.")
+      .def("query_device_info", NOGIL(TelinkMesh, TelinkLightPython::query_device_info), "Queries device information.")
+      .def("query_device_version", NOGIL(TelinkMesh, TelinkLightPython::query_device_version), "Queries device firmware version.")
+      .def("query_ota_state", NOGIL(TelinkMesh, TelinkMesh::query_ota_state), "Queries OTA update state from device.");
   
     // TelinkColor
     void (TelinkColor::*set_temperature)(int) = &TelinkColor::set_temperature;
@@ -134,41 +413,50 @@ namespace telink {
     void (TelinkLightPython::*set_alarm_on_off)(unsigned char, bool) = &TelinkLightPython::set_alarm;
     bp::class_<TelinkLightPython, TelinkLightPythonCallback, boost::noncopyable>("TelinkLight", bp::no_init)
       .def(bp::init<std::string, std::string, std::string>((bp::arg("address"), bp::arg("name"), bp::arg("password"))))
-      .def("query_groups", &TelinkLightPython::query_groups, "Queries mesh group IDs from device.")
-      .def("add_group", &TelinkMesh::add_group, bp::args("group_id"), "Queries mesh group IDs from device.")
-      .def("delete_group", &TelinkMesh::delete_group, bp::args("group_id"), "Removes device from given group.")
-      .def("set_time", &TelinkLightPython::set_time, "Sets device date and time.")
-      .def("query_time", &TelinkLightPython::query_time, "Queries device date and time.")
-      .def("query_alarm", &TelinkLightPython::query_alarm, "Queries alarm status from device.")
-      .def("query_device_info", &TelinkLightPython::query_device_info, "Queries device information.")
-      .def("query_device_version", &TelinkLightPython::query_device_version, "Queries device firmware version.")
-      .def("query_scenario", &TelinkLightPython::query_scenario, "Queries scenario details from device.")
-      .def("query_status", &TelinkLightPython::query_status, "Queries device status.")
-      .def("query_mesh_id", &TelinkLightPython::query_mesh_id, "Queries mesh ID from device.")
-      .def("set_state", &TelinkLightPython::set_state, bp::args("state"), "Sets device power state.")
-      .def("set_mesh_id", &TelinkLightPython::set_mesh_id, bp::args("mesh_id"), "Sets device mesh ID.")
-      .def("add_group", &TelinkLightPython::add_group, bp::args("group_id"), "Adds device to given group.")
-      .def("delete_group", &TelinkLightPython::delete_group, bp::args("group_id"), "Removes device from given group.")
-      .def("add_scenario", &TelinkLightPython::add_scenario, bp::args("scenario_id"), "Adds given scenario to device.")
-      .def("delete_scenario", &TelinkLightPython::delete_scenario, bp::args("scenario_id"), "Deletes given scenario from device.")
-      .def("set_brightness", &TelinkLightPython::set_brightness, bp::args("brightness"), "Sets light brightness.")
-      .def("set_color", &TelinkLightPython::set_color, bp::args("R", "G", "B"), "Sets light RGB color.")
-      .def("set_temperature", &TelinkLightPython::set_temperature, bp::args("temperature"), "Sets light color temperature.")
+      .def("query_groups", NOGIL(TelinkLightPython, TelinkLightPython::query_groups), "Queries mesh group IDs from device.")
+      .def("add_group", NOGIL(TelinkLightPython, TelinkMesh::add_group), bp::args("group_id"), "Queries mesh group IDs from device.")
+      .def("delete_group", NOGIL(TelinkLightPython, TelinkMesh::delete_group), bp::args("group_id"), "Removes device from given group.")
+      .def("set_time", NOGIL(TelinkLightPython, TelinkLightPython::set_time), "Sets device date and time.")
+      .def("query_time", NOGIL(TelinkLightPython, TelinkLightPython::query_time), "Queries device date and time.")
+      .def("query_alarm", NOGIL(TelinkLightPython, TelinkLightPython::query_alarm), "Queries alarm status from device.")
+      .def("query_device_info", NOGIL(TelinkLightPython, TelinkLightPython::query_device_info), "Queries device information.")
+      .def("query_device_version", NOGIL(TelinkLightPython, TelinkLightPython::query_device_version), "Queries device firmware version.")
+      .def("query_scenario", NOGIL(TelinkLightPython, TelinkLightPython::query_scenario), "Queries scenario details from device.")
+      .def("query_status", NOGIL(TelinkLightPython, TelinkLightPython::query_status), "Queries device status.")
+      .def("query_mesh_id", NOGIL(TelinkLightPython, TelinkLightPython::query_mesh_id), "Queries mesh ID from device.")
+      .def("set_state", NOGIL(TelinkLightPython, TelinkLightPython::set_state), bp::args("state"), "Sets device power state.")
+      .def("set_mesh_id", NOGIL(TelinkLightPython, TelinkLightPython::set_mesh_id), bp::args("mesh_id"), "Sets device mesh ID.")
+      .def("add_group", NOGIL(TelinkLightPython, TelinkLightPython::add_group), bp::args("group_id"), "Adds device to given group.")
+      .def("delete_group", NOGIL(TelinkLightPython, TelinkLightPython::delete_group), bp::args("group_id"), "Removes device from given group.")
+      .def("add_scenario", NOGIL(TelinkLightPython, TelinkLightPython::add_scenario), bp::args("scenario_id"), "Adds given scenario to device.")
+      .def("delete_scenario", NOGIL(TelinkLightPython, TelinkLightPython::delete_scenario), bp::args("scenario_id"), "Deletes given scenario from device.")
+      .def("set_brightness", NOGIL(TelinkLightPython, TelinkLightPython::set_brightness), bp::args("brightness"), "Sets light brightness.")
+      .def("set_color", NOGIL(TelinkLightPython, TelinkLightPython::set_color), bp::args("R", "G", "B"), "Sets light RGB color.")
+      .def("set_temperature", NOGIL(TelinkLightPython, TelinkLightPython::set_temperature), bp::args("temperature"), "Sets light color temperature.")
+      .def("set_attributes", NOGIL(TelinkLightPython, TelinkLightPython::set_attributes), bp::args("payload"), "Sets light brightness and color from a precomputed payload.")
+      .def("set_frame", &set_frame, bp::args("frame"), "Sets color and brightness of several mesh nodes at once. frame is a buffer (e.g. a NumPy array) of (address, R, G, B, brightness) rows, or bytes of packed rows (little-endian 16-bit address followed by 4 bytes). Returns the number of packets sent.")
       .def("set_music_mode", &TelinkLightPython::set_music_mode, bp::args("music_mode"), "Sets device music mode: color/brightness changes are faster, but aren't acknowledged by replies.")
-      .def("load_scenario", &TelinkLightPython::load_scenario, bp::args("scenario_id", "speed"), "Loads the scenario with given scenario ID on device.")
+      .def("load_scenario", NOGIL(TelinkLightPython, TelinkLightPython::load_scenario), bp::args("scenario_id", "speed"), "Loads the scenario with given scenario ID on device.")
       .def("set_alarm", set_alarm, bp::args("alarm_id", "weekdays", "hour", "minute", "second", "action"), "Sets an alarm with given parameters.")
       .def("set_alarm", set_alarm_on_off, bp::args("alarm_id", "state"), "Changes the state of an alarm.")
-      .def("delete_alarm", &TelinkLightPython::delete_alarm, bp::args("alarm_id"), "Deletes an alarm.")
-      .def("edit_scenario", &TelinkLightPython::edit_scenario, bp::args("scenario_id", "scenario"), "Edits a light scenario. A light scenario is a series of colors that are cycled through.")
+      .def("delete_alarm", NOGIL(TelinkLightPython, TelinkLightPython::delete_alarm), bp::args("alarm_id"), "Deletes an alarm.")
+      .def("edit_scenario", NOGIL(TelinkLightPython, TelinkLightPython::edit_scenario), bp::args("scenario_id", "scenario"), "Edits a light scenario. A light scenario is a series of colors that are cycled through.")
   		.def("set_address", &TelinkLightPython::set_address, bp::args("address"), "Sets the MAC address to connect to.")
     	.def("set_name", &TelinkLightPython::set_name, bp::args("name"), "Sets the device name to be used for connecting.")
       .def("set_password", &TelinkLightPython::set_password, bp::args("password"), "Sets the password to be used for connecting.")
       .def("set_vendor", &TelinkLightPython::set_vendor, bp::args("vendor"), "Sets the Bluetooth vendor code (0x0211 for Telink).")
-      .def("set_mesh_id", &TelinkLightPython::set_mesh_id, bp::args("mesh_id"), "Sets device mesh ID.")
-      .def("send_packet", &TelinkLightPython::send_packet, bp::args("command", "data"), "Sends a command packet to the device.")
-      .def("connect", &TelinkLightPython::connect, "Connects to Bluetooth device.")
-      .def("disconnect", &TelinkLightPython::disconnect, "Disconnects from Bluetooth device.")
-      .def("is_connected", &TelinkLightPython::is_connected, "Probes whether the connection with the device is established.");
+      .def("set_mesh_id", NOGIL(TelinkLightPython, TelinkLightPython::set_mesh_id), bp::args("mesh_id"), "Sets device mesh ID.")
+      .def("send_packet", NOGIL(TelinkLightPython, TelinkLightPython::send_packet), bp::args("command", "data"), "Sends a command packet to the device.")
+      .def("set_trace", &TelinkLightPython::set_trace, bp::with_custodian_and_ward<1, 2>(), bp::args("trace"), "Records all sent and received packets into given trace.")
+      .def("set_timeline", &TelinkLightPython::set_timeline, bp::with_custodian_and_ward<1, 2>(), bp::args("timeline"), "Records the time packets spend in each stage into given timeline.")
+      .def("set_cache", &TelinkLightPython::set_cache, set_cache_overloads(bp::args("cache", "max_age"), "Uses given cache to persist device metadata.")[bp::with_custodian_and_ward<1, 2>()])
+      .def("connect", NOGIL(TelinkLightPython, TelinkLightPython::connect), "Connects to Bluetooth device.")
+      .def("disconnect", NOGIL(TelinkLightPython, TelinkLightPython::disconnect), "Disconnects from Bluetooth device.")
+      .def("forget_device", NOGIL(TelinkLightPython, TelinkLightPython::forget_device), "Drops characteristics and handles kept from previous connections, so that next connection looks them up again.")
+      .def("is_connected", NOGIL(TelinkLightPython, TelinkLightPython::is_connected), "Tells whether the connection with the device is established, as tracked from connection notifications.")
+      .def("set_batch_delivery", &set_batch_delivery, bp::args("enable"), "Delivers reports in batches to parse_reports(reports) from a separate thread instead of calling one method per report.")
+      .def("get_report_fd", &get_report_fd, "Queues reports instead of calling Python methods, and returns a file descriptor readable when reports are pending.")
+      .def("read_reports", &read_reports, "Takes all queued reports as a list of (opcode, bytes) tuples.");
     
   }
 }
@@ -8,12 +8,153 @@
 
 #include <boost/python.hpp>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "../telink_light.h"
 
 namespace bp = boost::python;
 
 namespace telink {
   
+  /** \class ScopedGILRelease
+   *  \brief Releases the Python global interpreter lock for the lifetime of the object.
+   */
+  class ScopedGILRelease {
+  private:
+    /** \property PyThreadState * state
+     *  \brief Saved Python thread state.
+     */
+    PyThreadState * state;
+    
+  public:
+    ScopedGILRelease() : state(PyEval_SaveThread()) {}
+    ~ScopedGILRelease() { PyEval_RestoreThread(this->state); }
+  };
+  
+  /** \class NoGIL
+   *  \brief Wraps a member function so that it runs with the GIL released.
+   *  Use as NOGIL(WrappedClass, Class::method) in place of &Class::method.
+   */
+  template <class F> class NoGIL;
+  template <class R, class T, class... A> class NoGIL<R (T::*)(A...)> {
+  public:
+    template <class W, R (T::*F)(A...)> static R call(W & self, A... args) {
+      ScopedGILRelease release;
+      return (self.*F)(args...);
+    }
+  };
+  #define NOGIL(W, f) &NoGIL<decltype(&f)>::template call<W, &f>
+  
+  /** \class TelinkPythonDispatcher
+   *  \brief Delivers reports to Python callbacks.
+   *  By default, each report calls the matching Python method (e.g. parse_status_report) from
+   *  the Bluetooth thread. In batch mode, reports are queued without touching the GIL and a
+   *  delivery thread hands everything queued since its last wakeup to a single
+   *  parse_reports(reports) call, with reports as a list of (opcode, bytes) tuples.
+   *  In event mode, reports are queued and an eventfd is signalled; an event loop watching it
+   *  collects them with read_reports().
+   */
+  class TelinkPythonDispatcher {
+  private:
+    /** \property PyObject * self
+     *  \brief Pointer to the Python object receiving callbacks.
+     */
+    PyObject * self;
+    
+    /** \property std::map<std::string, bool> methods
+     *  \brief Resolved presence of Python callback methods; accessed with the GIL held.
+     */
+    std::map<std::string, bool> methods;
+    
+    /** \property bool batch
+     *  \brief true if batch delivery is enabled.
+     */
+    bool batch = false;
+    
+    /** \property int event_fd
+     *  \brief eventfd signalled when reports are queued in event mode; -1 if event mode is off.
+     */
+    int event_fd = -1;
+    
+    /** \property bool stopping
+     *  \brief true when the delivery thread must stop.
+     */
+    bool stopping = false;
+    
+    /** \property std::vector<std::pair<int, std::string>> pending
+     *  \brief Reports waiting for batch delivery.
+     */
+    std::vector<std::pair<int, std::string>> pending;
+    
+    /** \property std::mutex mutex
+     *  \brief Protects pending reports and delivery state.
+     */
+    std::mutex mutex;
+    
+    /** \property std::condition_variable wakeup
+     *  \brief Signals the delivery thread.
+     */
+    std::condition_variable wakeup;
+    
+    /** \property std::thread worker
+     *  \brief Batch delivery thread.
+     */
+    std::thread worker;
+    
+    /** \fn bool has_method(const char * name)
+     *  \brief Checks once whether the Python object has a method. Must be called with the GIL held.
+     *  \param name : method name.
+     *  \returns true if the method exists.
+     */
+    bool has_method(const char * name);
+    
+    /** \fn void deliver()
+     *  \brief Batch delivery thread loop.
+     */
+    void deliver();
+    
+    /** \fn void stop()
+     *  \brief Stops the delivery thread.
+     */
+    void stop();
+    
+  public:
+    /** \fn TelinkPythonDispatcher(PyObject * self)
+     *  \brief Object instantiation.
+     *  \param self : pointer to the Python object receiving callbacks.
+     */
+    TelinkPythonDispatcher(PyObject * self) : self(self) {}
+    
+    ~TelinkPythonDispatcher();
+    
+    /** \fn void dispatch(const char * method_name, const std::string & packet)
+     *  \brief Delivers a report to Python, or queues it in batch mode.
+     *  \param method_name : name of the Python method handling this report.
+     *  \param packet : decrypted packet.
+     */
+    void dispatch(const char * method_name, const std::string & packet);
+    
+    /** \fn void set_batch_delivery(bool enable)
+     *  \brief Enables or disables batch delivery. Must be called with the GIL held.
+     *  \param enable : true to enable batch delivery.
+     */
+    void set_batch_delivery(bool enable);
+    
+    /** \fn int get_event_fd()
+     *  \brief Switches to event mode if needed and returns the file descriptor to watch.
+     *  \returns a non-blocking eventfd readable when reports are pending, or -1 on error.
+     */
+    int get_event_fd();
+    
+    /** \fn bp::list read_reports()
+     *  \brief Takes all pending reports. Must be called with the GIL held.
+     *  \returns a list of (opcode, bytes) tuples.
+     */
+    bp::list read_reports();
+  };
+  
   /** \class TelinkLightPython
    *  \brief Translator class for TelinkLight.
    */
@@ -45,6 +186,7 @@ namespace telink {
      */
     void set_alarm(unsigned char alarm_id, bool state);
     
+    virtual ~TelinkLightPython() {}
   };
   
  /** \class TelinkMeshPythonCallback
@@ -56,6 +198,11 @@ namespace telink {
     *  \brief Pointer to a Python TelinkLight class instance.
     */
    PyObject * self;
+   
+   /** \property TelinkPythonDispatcher dispatcher
+    *  \brief Delivers reports to Python.
+    */
+   TelinkPythonDispatcher dispatcher;
  
  public:
    /** \fn TelinkMeshPythonCallback(PyObject *self_, const std::string address, const std::string name, const std::string password)
@@ -65,12 +212,18 @@ namespace telink {
     *  \param name : device name.
     *  \param password : device password.
     */
-   TelinkMeshPythonCallback(PyObject *self_, const std::string & address, const std::string & name, const std::string & password) : self(self_), TelinkMesh(address, name, password) {
+   TelinkMeshPythonCallback(PyObject *self_, const std::string & address, const std::string & name, const std::string & password) : TelinkMesh(address, name, password), self(self_), dispatcher(self_) {
      if (!PyEval_ThreadsInitialized())
        PyEval_InitThreads();
    }
    
-   ~TelinkMeshPythonCallback() {}
+   /** \fn ~TelinkMeshPythonCallback()
+    *  \brief Disconnects while the dispatcher is still alive, so that no
+    *  notification reaches the parse methods after it is destroyed.
+    */
+   ~TelinkMeshPythonCallback() {
+     this->disconnect();
+   }
    
    /** \fn virtual void parse_time_report(const std::string & packet)
     *  \brief Parses a command packet from a time report.
@@ -96,6 +249,12 @@ namespace telink {
     */
    virtual void parse_group_id_report(const std::string & packet);
    
+   /** \fn virtual void parse_ota_status_report(const std::string & packet)
+    *  \brief Parses a command packet from an OTA status report.
+    *  \param packet : decrypted packet to be parsed.
+    */
+   virtual void parse_ota_status_report(const std::string & packet);
+   
  };
 
   /** \class TelinkLightPythonCallback
@@ -107,6 +266,11 @@ namespace telink {
      *  \brief Pointer to a Python TelinkLight class instance.
      */
     PyObject * self;
+    
+    /** \property TelinkPythonDispatcher dispatcher
+     *  \brief Delivers reports to Python.
+     */
+    TelinkPythonDispatcher dispatcher;
   
   public:
     /** \fn TelinkLightPythonCallback(PyObject *self_, const std::string address, const std::string name, const std::string password)
@@ -116,9 +280,15 @@ namespace telink {
      *  \param name : device name.
      *  \param password : device password.
      */
-    TelinkLightPythonCallback(PyObject *self_, const std::string & address, const std::string & name, const std::string & password) : self(self_), TelinkLightPython(address, name, password), TelinkMeshPythonCallback(self_, address, name, password) {}
+    TelinkLightPythonCallback(PyObject *self_, const std::string & address, const std::string & name, const std::string & password) : TelinkLightPython(address, name, password), TelinkMeshPythonCallback(self_, address, name, password), self(self_), dispatcher(self_) {}
     
-    ~TelinkLightPythonCallback() {}
+    /** \fn ~TelinkLightPythonCallback()
+     *  \brief Disconnects while the dispatcher is still alive, so that no
+     *  notification reaches the parse methods after it is destroyed.
+     */
+    ~TelinkLightPythonCallback() {
+      TelinkLightPython::disconnect();
+    }
     
     /** \fn virtual void parse_online_status_report(const std::string & packet)
      *  \brief Parses a command packet from an online status report.
@@ -143,6 +313,55 @@ namespace telink {
      *  \param packet : decrypted packet to be parsed.
      */
     virtual void parse_scenario_report(const std::string & packet);
+    
+    /** \fn virtual void parse_time_report(const std::string & packet)
+     *  \brief Parses a command packet from a time report.
+     *  \param packet : decrypted packet to be parsed.
+     */
+    virtual void parse_time_report(const std::string & packet);
+    
+    /** \fn virtual void parse_address_report(const std::string & packet)
+     *  \brief Parses a command packet from an address report.
+     *  \param packet : decrypted packet to be parsed.
+     */
+    virtual void parse_address_report(const std::string & packet);
+    
+    /** \fn virtual void parse_device_info_report(const std::string & packet)
+     *  \brief Parses a command packet from a device info report.
+     *  \param packet : decrypted packet to be parsed.
+     */
+    virtual void parse_device_info_report(const std::string & packet);
+    
+    /** \fn virtual void parse_group_id_report(const std::string & packet)
+     *  \brief Parses a command packet from a group ID report.
+     *  \param packet : decrypted packet to be parsed.
+     */
+    virtual void parse_group_id_report(const std::string & packet);
+    
+    /** \fn virtual void parse_ota_status_report(const std::string & packet)
+     *  \brief Parses a command packet from an OTA status report.
+     *  \param packet : decrypted packet to be parsed.
+     */
+    virtual void parse_ota_status_report(const std::string & packet);
+    
+    /** \fn void set_batch_delivery(bool enable)
+     *  \brief Enables or disables batch delivery of reports to parse_reports(reports).
+     *  \param enable : true to enable batch delivery.
+     */
+    void set_batch_delivery(bool enable) { this->dispatcher.set_batch_delivery(enable); }
+    
+    /** \fn int get_report_fd()
+     *  \brief Queues reports instead of calling Python methods, and returns a file descriptor
+     *  that becomes readable when reports are pending.
+     *  \returns the file descriptor, or -1 on error.
+     */
+    int get_report_fd() { return this->dispatcher.get_event_fd(); }
+    
+    /** \fn bp::list read_reports()
+     *  \brief Takes all reports queued since last call.
+     *  \returns a list of (opcode, bytes) tuples.
+     */
+    bp::list read_reports() { return this->dispatcher.read_reports(); }
   };
   
 }
@@ -0,0 +1,108 @@
+/** \file telink_adapter.cxx
+ *  Spreads mesh connections across several Bluetooth adapters.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <algorithm>
+
+#include "telink_adapter.h"
+
+namespace telink {
+
+  typedef std::chrono::steady_clock clock;
+
+  // weight of the last sample in rate averages
+  static const double rate_weight = 0.3;
+
+  TelinkAdapterManager::TelinkAdapterManager() : last_update(clock::now()) {
+  }
+
+  std::size_t TelinkAdapterManager::discover() {
+    BluetoothManager * manager = nullptr;
+    try {
+      manager = BluetoothManager::get_bluetooth_manager();
+    } catch (const std::runtime_error & e) {
+      std::cerr << "Error while initializing libtinyb: " << e.what() << std::endl;
+      return this->adapters.size();
+    }
+    for (auto & adapter : manager->get_adapters())
+      this->add_adapter(adapter->get_address());
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->adapters.size();
+  }
+
+  void TelinkAdapterManager::add_adapter(const std::string & address) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & adapter : this->adapters)
+      if (adapter.metrics.address == address) return;
+    Adapter adapter;
+    adapter.metrics.address = address;
+    this->adapters.push_back(adapter);
+  }
+
+  void TelinkAdapterManager::set_capacity(double capacity) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->capacity = std::max(1.0, capacity);
+  }
+
+  std::string TelinkAdapterManager::assign(TelinkMesh & mesh) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Adapter * best = nullptr;
+    for (auto & adapter : this->adapters) {
+      adapter.meshes.erase(&mesh);
+      adapter.metrics.connections = adapter.meshes.size();
+    }
+    for (auto & adapter : this->adapters) {
+      if (best == nullptr
+          || adapter.metrics.connections < best->metrics.connections
+          || (adapter.metrics.connections == best->metrics.connections && adapter.metrics.rate < best->metrics.rate))
+        best = &adapter;
+    }
+    if (best == nullptr) return "";
+    best->meshes[&mesh] = mesh.get_packets_sent();
+    best->metrics.connections = best->meshes.size();
+    mesh.set_adapter(best->metrics.address);
+    return best->metrics.address;
+  }
+
+  void TelinkAdapterManager::release(TelinkMesh & mesh) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & adapter : this->adapters) {
+      auto it = adapter.meshes.find(&mesh);
+      if (it == adapter.meshes.end()) continue;
+      // account for packets sent since last update
+      adapter.metrics.packets += mesh.get_packets_sent() - it->second;
+      adapter.meshes.erase(it);
+      adapter.metrics.connections = adapter.meshes.size();
+    }
+  }
+
+  void TelinkAdapterManager::update() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    clock::time_point now = clock::now();
+    double elapsed = std::chrono::duration<double>(now - this->last_update).count();
+    if (elapsed <= 0) return;
+    this->last_update = now;
+    for (auto & adapter : this->adapters) {
+      uint64_t packets = 0;
+      for (auto & entry : adapter.meshes) {
+        uint64_t count = entry.first->get_packets_sent();
+        packets += count - entry.second;
+        entry.second = count;
+      }
+      adapter.metrics.packets += packets;
+      adapter.metrics.rate = (1 - rate_weight) * adapter.metrics.rate + rate_weight * packets / elapsed;
+      adapter.metrics.utilization = adapter.metrics.rate / this->capacity;
+    }
+  }
+
+  std::vector<TelinkAdapterMetrics> TelinkAdapterManager::get_metrics() const {
+    std::vector<TelinkAdapterMetrics> result;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & adapter : this->adapters)
+      result.push_back(adapter.metrics);
+    return result;
+  }
+
+}
@@ -0,0 +1,153 @@
+/** \file telink_adapter.h
+ *  Spreads mesh connections across several Bluetooth adapters.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_ADAPTER_H__
+#define __TELINK_ADAPTER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include "telink_mesh.h"
+
+namespace telink {
+
+  /** \brief Default packet rate an adapter is assumed to sustain, in packets per second. */
+  #define ADAPTER_CAPACITY 100
+
+  /** \class TelinkAdapterMetrics
+   *  \brief Load of a Bluetooth adapter.
+   */
+  class TelinkAdapterMetrics {
+  public:
+    /** \property std::string address
+     *  \brief Adapter MAC address or name.
+     */
+    std::string address;
+
+    /** \property std::size_t connections
+     *  \brief Number of connections assigned to the adapter.
+     */
+    std::size_t connections = 0;
+
+    /** \property uint64_t packets
+     *  \brief Number of packets sent through the adapter since it was added.
+     */
+    uint64_t packets = 0;
+
+    /** \property double rate
+     *  \brief Moving average of the packet rate, in packets per second.
+     */
+    double rate = 0;
+
+    /** \property double utilization
+     *  \brief Packet rate relative to the adapter capacity, from 0 (idle) to 1 (saturated) or more.
+     */
+    double utilization = 0;
+  };
+
+  /** \class TelinkAdapterManager
+   *  \brief Assigns mesh connections to the least loaded of several Bluetooth adapters.
+   *
+   *  A BLE controller serves all its links in turn, so packet throughput of one adapter is
+   *  bounded whatever the number of connections. Spreading connections over adapters lets the
+   *  aggregate throughput grow with the number of controllers. Load is the number of assigned
+   *  connections, then the measured packet rate. Rates are sampled from the packet counters of
+   *  assigned connections each time update() is called.
+   */
+  class TelinkAdapterManager {
+  private:
+    /** \class Adapter
+     *  \brief Adapter and its assigned connections.
+     */
+    class Adapter {
+    public:
+      /** \property TelinkAdapterMetrics metrics
+       *  \brief Adapter load.
+       */
+      TelinkAdapterMetrics metrics;
+
+      /** \property std::map<TelinkMesh*, uint64_t> meshes
+       *  \brief Assigned connections, with their packet counter at last update.
+       */
+      std::map<TelinkMesh*, uint64_t> meshes;
+    };
+
+    /** \property std::vector<Adapter> adapters
+     *  \brief Managed adapters.
+     */
+    std::vector<Adapter> adapters;
+
+    /** \property double capacity
+     *  \brief Packet rate an adapter is assumed to sustain, in packets per second.
+     */
+    double capacity = ADAPTER_CAPACITY;
+
+    /** \property std::chrono::steady_clock::time_point last_update
+     *  \brief Time of last rate update.
+     */
+    std::chrono::steady_clock::time_point last_update;
+
+    /** \property std::mutex mutex
+     *  \brief Protects adapters.
+     */
+    mutable std::mutex mutex;
+
+  public:
+    TelinkAdapterManager();
+
+    TelinkAdapterManager(const TelinkAdapterManager &) = delete;
+    TelinkAdapterManager & operator=(const TelinkAdapterManager &) = delete;
+
+    /** \fn std::size_t discover()
+     *  \brief Adds all adapters known to the Bluetooth stack.
+     *  \returns the number of managed adapters.
+     */
+    std::size_t discover();
+
+    /** \fn void add_adapter(const std::string & address)
+     *  \brief Adds an adapter.
+     *  \param address : adapter MAC address or name.
+     */
+    void add_adapter(const std::string & address);
+
+    /** \fn void set_capacity(double capacity)
+     *  \brief Sets the packet rate an adapter is assumed to sustain, used for utilization.
+     *  \param capacity : rate in packets per second.
+     */
+    void set_capacity(double capacity);
+
+    /** \fn std::string assign(TelinkMesh & mesh)
+     *  \brief Pins a connection to the least loaded adapter. Must be done while disconnected, and
+     *  the connection must be released before it is destroyed.
+     *  \param mesh : connection.
+     *  \returns the adapter address; empty if no adapter is managed.
+     */
+    std::string assign(TelinkMesh & mesh);
+
+    /** \fn void release(TelinkMesh & mesh)
+     *  \brief Removes a connection from its adapter.
+     *  \param mesh : connection.
+     */
+    void release(TelinkMesh & mesh);
+
+    /** \fn void update()
+     *  \brief Updates packet rates from packet counters of assigned connections.
+     */
+    void update();
+
+    /** \fn std::vector<TelinkAdapterMetrics> get_metrics() const
+     *  \brief Returns the load of all adapters.
+     *  \returns the metrics, in order adapters were added.
+     */
+    std::vector<TelinkAdapterMetrics> get_metrics() const;
+  };
+
+}
+
+#endif // __TELINK_ADAPTER_H__
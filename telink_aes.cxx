@@ -0,0 +1,445 @@
+/** \file telink_aes.cxx
+ *  Self-contained AES-128 block encryption, with hardware acceleration selected at runtime.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#include "telink_aes.h"
+
+#if !defined(TELINK_NO_AES_ACCEL) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #define TELINK_AES_NI
+  #include <wmmintrin.h>
+  #include <emmintrin.h>
+#elif !defined(TELINK_NO_AES_ACCEL) && defined(__aarch64__) && defined(__GNUC__)
+  #define TELINK_AES_ARMV8
+  #include <arm_neon.h>
+  #include <sys/auxv.h>
+  #include <asm/hwcap.h>
+  #if defined(__clang__)
+    #define TARGET_CRYPTO __attribute__((target("crypto")))
+  #else
+    #define TARGET_CRYPTO __attribute__((target("+crypto")))
+  #endif
+#endif
+
+namespace telink {
+
+  typedef void (*block_function)(const unsigned char * round_keys, const uint16_t (*sliced_keys)[8], const unsigned char * input, unsigned char * output, std::size_t count);
+
+  /* Portable implementation, bitsliced after the ctaes approach: the 16 bytes of a block are
+     spread over 8 16-bit words, one per bit. Bit 4*row+column of word b holds bit b of the
+     state byte at (row, column). The S-box is computed with the Boyar-Peralta circuit, so no
+     table lookup depends on secret data. Batches pack 4 blocks in 64-bit words, one per
+     16-bit lane, so that each logic operation works on all of them. */
+
+  // copies a 16-bit pattern into all lanes of a word
+  template <typename Word>
+  static inline Word lanes(uint16_t v) {
+    return static_cast<Word>(v * (static_cast<Word>(~Word(0)) / 0xffff));
+  }
+
+  // slices must be zero in the given lane
+  template <typename Word>
+  static void load_block(Word * slices, const unsigned char * block, int lane = 0) {
+    for (int i=0; i<16; i++) {
+      int bit = 4*(i & 3) + (i >> 2) + 16*lane; // input bytes are column by column
+      for (int b=0; b<8; b++)
+        slices[b] |= static_cast<Word>((block[i] >> b) & 1) << bit;
+    }
+  }
+
+  template <typename Word>
+  static void store_block(const Word * slices, unsigned char * block, int lane = 0) {
+    for (int i=0; i<16; i++) {
+      int bit = 4*(i & 3) + (i >> 2) + 16*lane;
+      unsigned char value = 0;
+      for (int b=0; b<8; b++)
+        value |= ((slices[b] >> bit) & 1) << b;
+      block[i] = value;
+    }
+  }
+
+  template <typename Word>
+  static void sub_bytes(Word * s) {
+    Word U0 = s[7], U1 = s[6], U2 = s[5], U3 = s[4];
+    Word U4 = s[3], U5 = s[2], U6 = s[1], U7 = s[0];
+
+    // linear preprocessing
+    Word T1 = U0 ^ U3, T2 = U0 ^ U5, T3 = U0 ^ U6, T4 = U3 ^ U5;
+    Word T5 = U4 ^ U6, T6 = T1 ^ T5, T7 = U1 ^ U2, T8 = U7 ^ T6;
+    Word T9 = U7 ^ T7, T10 = T6 ^ T7, T11 = U1 ^ U5, T12 = U2 ^ U5;
+    Word T13 = T3 ^ T4, T14 = T6 ^ T11, T15 = T5 ^ T11, T16 = T5 ^ T12;
+    Word T17 = T9 ^ T16, T18 = U3 ^ U7, T19 = T7 ^ T18, T20 = T1 ^ T19;
+    Word T21 = U6 ^ U7, T22 = T7 ^ T21, T23 = T2 ^ T22, T24 = T2 ^ T10;
+    Word T25 = T20 ^ T17, T26 = T3 ^ T16, T27 = T1 ^ T12, D = U7;
+
+    // inversion in GF(2^8)
+    Word M1 = T13 & T6, M6 = T3 & T16, M11 = T1 & T15;
+    Word M13 = (T4 & T27) ^ M11, M15 = (T2 & T10) ^ M11;
+    Word M20 = T14 ^ M1 ^ (T23 & T8) ^ M13;
+    Word M21 = (T19 & D) ^ M1 ^ T24 ^ M15;
+    Word M22 = T26 ^ M6 ^ (T22 & T9) ^ M13;
+    Word M23 = (T20 & T17) ^ M6 ^ M15 ^ T25;
+    Word M25 = M22 & M20;
+    Word M37 = M21 ^ ((M20 ^ M21) & (M23 ^ M25));
+    Word M38 = M20 ^ M25 ^ (M21 | (M20 & M23));
+    Word M39 = M23 ^ ((M22 ^ M23) & (M21 ^ M25));
+    Word M40 = M22 ^ M25 ^ (M23 | (M21 & M22));
+    Word M41 = M38 ^ M40, M42 = M37 ^ M39, M43 = M37 ^ M38, M44 = M39 ^ M40;
+    Word M45 = M42 ^ M41;
+    Word M46 = M44 & T6, M47 = M40 & T8, M48 = M39 & D, M49 = M43 & T16;
+    Word M50 = M38 & T9, M51 = M37 & T17, M52 = M42 & T15, M53 = M45 & T27;
+    Word M54 = M41 & T10, M55 = M44 & T13, M56 = M40 & T23, M57 = M39 & T19;
+    Word M58 = M43 & T3, M59 = M38 & T22, M60 = M37 & T20, M61 = M42 & T1;
+    Word M62 = M45 & T4, M63 = M41 & T2;
+
+    // linear postprocessing
+    Word L0 = M61 ^ M62, L1 = M50 ^ M56, L2 = M46 ^ M48, L3 = M47 ^ M55;
+    Word L4 = M54 ^ M58, L5 = M49 ^ M61, L6 = M62 ^ L5, L7 = M46 ^ L3;
+    Word L8 = M51 ^ M59, L9 = M52 ^ M53, L10 = M53 ^ L4, L11 = M60 ^ L2;
+    Word L12 = M48 ^ M51, L13 = M50 ^ L0, L14 = M52 ^ M61, L15 = M55 ^ L1;
+    Word L16 = M56 ^ L0, L17 = M57 ^ L1, L18 = M58 ^ L8, L19 = M63 ^ L4;
+    Word L20 = L0 ^ L1, L21 = L1 ^ L7, L22 = L3 ^ L12, L23 = L18 ^ L2;
+    Word L24 = L15 ^ L9, L25 = L6 ^ L10, L26 = L7 ^ L9, L27 = L8 ^ L10;
+    Word L28 = L11 ^ L14, L29 = L11 ^ L17;
+    s[7] = L6 ^ L24;
+    s[6] = ~(L16 ^ L26);
+    s[5] = ~(L19 ^ L28);
+    s[4] = L6 ^ L21;
+    s[3] = L20 ^ L22;
+    s[2] = L25 ^ L29;
+    s[1] = ~(L13 ^ L27);
+    s[0] = ~(L6 ^ L23);
+  }
+
+  // selects bits [from, to) of each lane
+  #define BIT_RANGE(from, to) lanes<Word>(((1 << ((to) - (from))) - 1) << (from))
+
+  template <typename Word>
+  static void shift_rows(Word * s) {
+    // row r rotates left by r positions: new column c takes old column (c+r) mod 4
+    for (int b=0; b<8; b++) {
+      Word v = s[b];
+      s[b] = (v & BIT_RANGE(0, 4))
+        | ((v & BIT_RANGE(5, 8)) >> 1) | ((v & BIT_RANGE(4, 5)) << 3)
+        | ((v & BIT_RANGE(10, 12)) >> 2) | ((v & BIT_RANGE(8, 10)) << 2)
+        | ((v & BIT_RANGE(15, 16)) >> 3) | ((v & BIT_RANGE(12, 15)) << 1);
+    }
+  }
+
+  // moves row r+k to row r, for all columns
+  template <typename Word>
+  static inline Word rotate_rows(Word v, int k) {
+    return static_cast<Word>(((v >> (4*k)) & BIT_RANGE(0, 16 - 4*k)) | ((v << (16 - 4*k)) & BIT_RANGE(16 - 4*k, 16)));
+  }
+
+  template <typename Word>
+  static void mix_columns(Word * s) {
+    // out[r] = 2*(a[r] ^ a[r+1]) ^ a[r+1] ^ a[r+2] ^ a[r+3]
+    Word t[8], r1[8], rest[8];
+    for (int b=0; b<8; b++) {
+      r1[b] = rotate_rows(s[b], 1);
+      t[b] = s[b] ^ r1[b];
+      rest[b] = r1[b] ^ rotate_rows(s[b], 2) ^ rotate_rows(s[b], 3);
+    }
+    // multiplication of t by x, modulo x^8 + x^4 + x^3 + x + 1
+    s[0] = t[7] ^ rest[0];
+    s[1] = t[0] ^ t[7] ^ rest[1];
+    s[2] = t[1] ^ rest[2];
+    s[3] = t[2] ^ t[7] ^ rest[3];
+    s[4] = t[3] ^ t[7] ^ rest[4];
+    s[5] = t[4] ^ rest[5];
+    s[6] = t[5] ^ rest[6];
+    s[7] = t[6] ^ rest[7];
+  }
+
+  template <typename Word>
+  static void encrypt_sliced(const uint16_t (*sliced_keys)[8], const unsigned char * input, unsigned char * output, std::size_t count) {
+    const std::size_t width = sizeof(Word)/2;
+    for (std::size_t n=0; n<count; n+=width) {
+      int blocks = count - n < width ? count - n : width;
+      Word s[8] = {0};
+      for (int lane=0; lane<blocks; lane++)
+        load_block(s, input + (n+lane)*AES_BLOCK_SIZE, lane);
+      for (int b=0; b<8; b++)
+        s[b] ^= lanes<Word>(sliced_keys[0][b]);
+      for (int round=1; round<=AES_ROUNDS; round++) {
+        sub_bytes(s);
+        shift_rows(s);
+        if (round != AES_ROUNDS)
+          mix_columns(s);
+        for (int b=0; b<8; b++)
+          s[b] ^= lanes<Word>(sliced_keys[round][b]);
+      }
+      for (int lane=0; lane<blocks; lane++)
+        store_block(s, output + (n+lane)*AES_BLOCK_SIZE, lane);
+      secure_zero(s, sizeof(s));
+    }
+  }
+
+  static void encrypt_portable(const unsigned char *, const uint16_t (*sliced_keys)[8], const unsigned char * input, unsigned char * output, std::size_t count) {
+    // a single block is faster in narrow words
+    if (count == 1)
+      encrypt_sliced<uint16_t>(sliced_keys, input, output, count);
+    else
+      encrypt_sliced<uint64_t>(sliced_keys, input, output, count);
+  }
+
+#ifdef TELINK_AES_NI
+  // number of blocks kept in flight by the AES-NI implementation
+  #define AESNI_INTERLEAVE 8
+
+  __attribute__((target("aes,sse2")))
+  static void encrypt_aesni(const unsigned char * round_keys, const uint16_t (*)[8], const unsigned char * input, unsigned char * output, std::size_t count) {
+    __m128i k[AES_ROUNDS+1];
+    for (int i=0; i<=AES_ROUNDS; i++)
+      k[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(round_keys + i*AES_BLOCK_SIZE));
+    std::size_t n = 0;
+    // independent blocks are interleaved to hide the latency of AESENC
+    for (; n+AESNI_INTERLEAVE<=count; n+=AESNI_INTERLEAVE) {
+      __m128i b[AESNI_INTERLEAVE];
+      for (int j=0; j<AESNI_INTERLEAVE; j++)
+        b[j] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + (n+j)*AES_BLOCK_SIZE)), k[0]);
+      for (int i=1; i<AES_ROUNDS; i++)
+        for (int j=0; j<AESNI_INTERLEAVE; j++)
+          b[j] = _mm_aesenc_si128(b[j], k[i]);
+      for (int j=0; j<AESNI_INTERLEAVE; j++)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + (n+j)*AES_BLOCK_SIZE), _mm_aesenclast_si128(b[j], k[AES_ROUNDS]));
+    }
+    for (; n<count; n++) {
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + n*AES_BLOCK_SIZE));
+      b = _mm_xor_si128(b, k[0]);
+      for (int i=1; i<AES_ROUNDS; i++)
+        b = _mm_aesenc_si128(b, k[i]);
+      b = _mm_aesenclast_si128(b, k[AES_ROUNDS]);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + n*AES_BLOCK_SIZE), b);
+    }
+  }
+
+  static bool has_aesni() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+  }
+#endif
+
+#ifdef TELINK_AES_ARMV8
+  // number of blocks kept in flight by the ARMv8 implementation
+  #define ARMV8_INTERLEAVE 4
+
+  TARGET_CRYPTO
+  static void encrypt_armv8(const unsigned char * round_keys, const uint16_t (*)[8], const unsigned char * input, unsigned char * output, std::size_t count) {
+    uint8x16_t k[AES_ROUNDS+1];
+    for (int i=0; i<=AES_ROUNDS; i++)
+      k[i] = vld1q_u8(round_keys + i*AES_BLOCK_SIZE);
+    std::size_t n = 0;
+    // independent blocks are interleaved to hide the latency of AESE/AESMC pairs
+    for (; n+ARMV8_INTERLEAVE<=count; n+=ARMV8_INTERLEAVE) {
+      uint8x16_t b[ARMV8_INTERLEAVE];
+      for (int j=0; j<ARMV8_INTERLEAVE; j++)
+        b[j] = vld1q_u8(input + (n+j)*AES_BLOCK_SIZE);
+      for (int i=0; i<AES_ROUNDS-1; i++)
+        for (int j=0; j<ARMV8_INTERLEAVE; j++)
+          b[j] = vaesmcq_u8(vaeseq_u8(b[j], k[i]));
+      for (int j=0; j<ARMV8_INTERLEAVE; j++)
+        vst1q_u8(output + (n+j)*AES_BLOCK_SIZE, veorq_u8(vaeseq_u8(b[j], k[AES_ROUNDS-1]), k[AES_ROUNDS]));
+    }
+    for (; n<count; n++) {
+      uint8x16_t b = vld1q_u8(input + n*AES_BLOCK_SIZE);
+      // AESE adds the round key before substitution, so keys are shifted by one round
+      for (int i=0; i<AES_ROUNDS-1; i++)
+        b = vaesmcq_u8(vaeseq_u8(b, k[i]));
+      b = vaeseq_u8(b, k[AES_ROUNDS-1]);
+      b = veorq_u8(b, k[AES_ROUNDS]);
+      vst1q_u8(output + n*AES_BLOCK_SIZE, b);
+    }
+  }
+
+  static bool has_armv8_aes() {
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+  }
+#endif
+
+  static void expand_key(const unsigned char * key, unsigned char * round_keys, uint16_t (*sliced_keys)[8]) {
+    static const unsigned char rcon[AES_ROUNDS] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+    std::memcpy(round_keys, key, AES_BLOCK_SIZE);
+    for (int i=4; i<4*(AES_ROUNDS+1); i++) {
+      unsigned char word[4];
+      std::memcpy(word, round_keys + 4*(i-1), 4);
+      if (i % 4 == 0) {
+        // RotWord, then SubWord through the bitsliced S-box to stay constant-time
+        unsigned char block[AES_BLOCK_SIZE] = {word[1], word[2], word[3], word[0]};
+        uint16_t s[8] = {0};
+        load_block(s, block);
+        sub_bytes(s);
+        store_block(s, block);
+        std::memcpy(word, block, 4);
+        word[0] ^= rcon[i/4 - 1];
+        secure_zero(s, sizeof(s));
+        secure_zero(block, sizeof(block));
+      }
+      for (int j=0; j<4; j++)
+        round_keys[4*i + j] = round_keys[4*(i-4) + j] ^ word[j];
+      secure_zero(word, sizeof(word));
+    }
+    for (int round=0; round<=AES_ROUNDS; round++) {
+      std::memset(sliced_keys[round], 0, sizeof(sliced_keys[round]));
+      load_block(sliced_keys[round], round_keys + round*AES_BLOCK_SIZE);
+    }
+  }
+
+  static bool self_test(block_function function) {
+    // FIPS-197 appendix C.1
+    static const unsigned char key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    static const unsigned char plain[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    static const unsigned char cipher[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+    alignas(16) unsigned char round_keys[(AES_ROUNDS+1)*AES_BLOCK_SIZE];
+    uint16_t sliced_keys[AES_ROUNDS+1][8];
+    expand_key(key, round_keys, sliced_keys);
+    // several blocks, to cover batch paths
+    const int count = 9;
+    unsigned char blocks[count*AES_BLOCK_SIZE];
+    for (int i=0; i<count; i++)
+      std::memcpy(blocks + i*AES_BLOCK_SIZE, plain, AES_BLOCK_SIZE);
+    function(round_keys, sliced_keys, blocks, blocks, count);
+    for (int i=0; i<count; i++)
+      if (std::memcmp(blocks + i*AES_BLOCK_SIZE, cipher, AES_BLOCK_SIZE) != 0)
+        return false;
+    return true;
+  }
+
+  class Backend {
+  public:
+    const char * name;
+    block_function function;
+    bool (*available)();
+  };
+
+  static bool always() {
+    return true;
+  }
+
+  // by order of preference
+  static const Backend backends[] = {
+#ifdef TELINK_AES_NI
+    {"aesni", encrypt_aesni, has_aesni},
+#endif
+#ifdef TELINK_AES_ARMV8
+    {"armv8", encrypt_armv8, has_armv8_aes},
+#endif
+    {"portable", encrypt_portable, always},
+  };
+
+  static std::atomic<const Backend*> & active_backend() {
+    static std::atomic<const Backend*> active([]() {
+      for (auto & backend : backends)
+        if (backend.available() && self_test(backend.function))
+          return &backend;
+      return &backends[sizeof(backends)/sizeof(Backend) - 1];
+    }());
+    return active;
+  }
+
+  TelinkAes::TelinkAes() {
+    this->clear();
+  }
+
+  TelinkAes::TelinkAes(const unsigned char * key) {
+    this->set_key(key);
+  }
+
+  TelinkAes::TelinkAes(const TelinkAes & other) {
+    std::memcpy(this->round_keys, other.round_keys, sizeof(this->round_keys));
+    std::memcpy(this->sliced_keys, other.sliced_keys, sizeof(this->sliced_keys));
+  }
+
+  TelinkAes & TelinkAes::operator=(const TelinkAes & other) {
+    if (this != &other) {
+      std::memcpy(this->round_keys, other.round_keys, sizeof(this->round_keys));
+      std::memcpy(this->sliced_keys, other.sliced_keys, sizeof(this->sliced_keys));
+    }
+    return *this;
+  }
+
+  TelinkAes::~TelinkAes() {
+    this->clear();
+  }
+
+  void TelinkAes::set_key(const unsigned char * key) {
+    expand_key(key, this->round_keys, this->sliced_keys);
+  }
+
+  void TelinkAes::clear() {
+    secure_zero(this->round_keys, sizeof(this->round_keys));
+    secure_zero(this->sliced_keys, sizeof(this->sliced_keys));
+  }
+
+  void TelinkAes::encrypt(const unsigned char * input, unsigned char * output) const {
+    active_backend().load(std::memory_order_relaxed)->function(this->round_keys, this->sliced_keys, input, output, 1);
+  }
+
+  void TelinkAes::encrypt_blocks(const unsigned char * input, unsigned char * output, std::size_t count) const {
+    active_backend().load(std::memory_order_relaxed)->function(this->round_keys, this->sliced_keys, input, output, count);
+  }
+
+  std::string TelinkAes::get_backend() {
+    return active_backend().load()->name;
+  }
+
+  bool TelinkAes::set_backend(const std::string & name) {
+    for (auto & backend : backends) {
+      if (name != backend.name) continue;
+      if (!backend.available() || !self_test(backend.function))
+        return false;
+      active_backend().store(&backend);
+      return true;
+    }
+    return false;
+  }
+
+  void secure_zero(void * data, std::size_t size) {
+    volatile unsigned char * pointer = static_cast<volatile unsigned char*>(data);
+    while (size--)
+      *pointer++ = 0;
+  }
+
+  bool secure_equal(const void * a, const void * b, std::size_t size) {
+    const unsigned char * pa = static_cast<const unsigned char*>(a);
+    const unsigned char * pb = static_cast<const unsigned char*>(b);
+    unsigned char difference = 0;
+    for (std::size_t i=0; i<size; i++)
+      difference |= pa[i] ^ pb[i];
+    return difference == 0;
+  }
+
+  bool random_bytes(unsigned char * buffer, std::size_t size) {
+    std::size_t filled = 0;
+#ifdef SYS_getrandom
+    while (filled < size) {
+      long n = syscall(SYS_getrandom, buffer + filled, size - filled, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        break; // not supported by kernel: use device below
+      }
+      filled += n;
+    }
+    if (filled == size) return true;
+#endif
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    while (filled < size) {
+      ssize_t n = read(fd, buffer + filled, size - filled);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      filled += n;
+    }
+    close(fd);
+    return filled == size;
+  }
+
+}
@@ -0,0 +1,120 @@
+/** \file telink_aes.h
+ *  Self-contained AES-128 block encryption, with hardware acceleration selected at runtime.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_AES_H__
+#define __TELINK_AES_H__
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace telink {
+
+  /** \brief AES block size, in bytes. */
+  #define AES_BLOCK_SIZE 16
+  /** \brief Number of AES-128 rounds. */
+  #define AES_ROUNDS 10
+
+  /** \class TelinkAes
+   *  \brief AES-128 encryption with an expanded key schedule.
+   *
+   *  Blocks are encrypted with AES-NI on x86-64 or ARMv8 Crypto Extensions when the CPU has
+   *  them, and with a bitsliced constant-time implementation otherwise. The backend is chosen
+   *  once, after checking it against the FIPS-197 known-answer vector. Only encryption is
+   *  needed by the Telink protocol. Key material is zeroed on destruction.
+   */
+  class TelinkAes {
+  private:
+    /** \property unsigned char round_keys[(AES_ROUNDS+1)*AES_BLOCK_SIZE]
+     *  \brief Expanded key schedule.
+     */
+    alignas(16) unsigned char round_keys[(AES_ROUNDS+1)*AES_BLOCK_SIZE];
+
+    /** \property uint16_t sliced_keys[AES_ROUNDS+1][8]
+     *  \brief Key schedule in bitsliced form, for the portable implementation.
+     */
+    uint16_t sliced_keys[AES_ROUNDS+1][8];
+
+  public:
+    TelinkAes();
+
+    /** \fn TelinkAes(const unsigned char * key)
+     *  \brief Object instantiation.
+     *  \param key : 16-byte key.
+     */
+    TelinkAes(const unsigned char * key);
+
+    TelinkAes(const TelinkAes & other);
+    TelinkAes & operator=(const TelinkAes & other);
+
+    ~TelinkAes();
+
+    /** \fn void set_key(const unsigned char * key)
+     *  \brief Expands a key.
+     *  \param key : 16-byte key.
+     */
+    void set_key(const unsigned char * key);
+
+    /** \fn void clear()
+     *  \brief Zeroes the key schedule.
+     */
+    void clear();
+
+    /** \fn void encrypt(const unsigned char * input, unsigned char * output) const
+     *  \brief Encrypts a block.
+     *  \param input : 16-byte plain block.
+     *  \param output : 16-byte encrypted block (may be the same as input).
+     */
+    void encrypt(const unsigned char * input, unsigned char * output) const;
+
+    /** \fn void encrypt_blocks(const unsigned char * input, unsigned char * output, std::size_t count) const
+     *  \brief Encrypts independent blocks (ECB).
+     *  \param input : count x 16-byte plain blocks.
+     *  \param output : count x 16-byte encrypted blocks (may be the same as input).
+     *  \param count : number of blocks.
+     */
+    void encrypt_blocks(const unsigned char * input, unsigned char * output, std::size_t count) const;
+
+    /** \fn static std::string get_backend()
+     *  \brief Returns the name of the implementation in use.
+     *  \returns "aesni", "armv8" or "portable".
+     */
+    static std::string get_backend();
+
+    /** \fn static bool set_backend(const std::string & backend)
+     *  \brief Forces an implementation, e.g. to compare them. Not thread-safe with encryption.
+     *  \param backend : "aesni", "armv8" or "portable".
+     *  \returns true if the implementation is available and passed its self test.
+     */
+    static bool set_backend(const std::string & backend);
+  };
+
+  /** \fn void secure_zero(void * data, std::size_t size)
+   *  \brief Zeroes memory in a way the compiler cannot optimize away.
+   *  \param data : memory to clear.
+   *  \param size : size in bytes.
+   */
+  void secure_zero(void * data, std::size_t size);
+
+  /** \fn bool secure_equal(const void * a, const void * b, std::size_t size)
+   *  \brief Compares memory in constant time.
+   *  \param a : first buffer.
+   *  \param b : second buffer.
+   *  \param size : size in bytes.
+   *  \returns true if buffers are equal.
+   */
+  bool secure_equal(const void * a, const void * b, std::size_t size);
+
+  /** \fn bool random_bytes(unsigned char * buffer, std::size_t size)
+   *  \brief Fills a buffer from the system random generator.
+   *  \param buffer : buffer to fill.
+   *  \param size : size in bytes.
+   *  \returns true on success.
+   */
+  bool random_bytes(unsigned char * buffer, std::size_t size);
+
+}
+
+#endif // __TELINK_AES_H__
@@ -0,0 +1,123 @@
+/** \file telink_aes_test.cxx
+ *  Known-answer check of TelinkAes: FIPS-197 and SP 800-38A vectors through single-block and
+ *  batched encryption, on every backend available on this CPU, with odd batch sizes, unaligned
+ *  and in-place buffers.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "telink_aes.h"
+
+using namespace telink;
+
+// FIPS-197 appendix C.1
+static const unsigned char fips_key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const unsigned char fips_plain[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+static const unsigned char fips_cipher[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+
+// SP 800-38A F.1.1, ECB-AES128
+static const unsigned char ecb_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static const unsigned char ecb_plain[4][16] = {
+  {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a},
+  {0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51},
+  {0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef},
+  {0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10},
+};
+static const unsigned char ecb_cipher[4][16] = {
+  {0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60, 0xa8, 0x9e, 0xca, 0xf3, 0x24, 0x66, 0xef, 0x97},
+  {0xf5, 0xd3, 0xd5, 0x85, 0x03, 0xb9, 0x69, 0x9d, 0xe7, 0x85, 0x89, 0x5a, 0x96, 0xfd, 0xba, 0xaf},
+  {0x43, 0xb1, 0xcd, 0x7f, 0x59, 0x8e, 0xce, 0x23, 0x88, 0x1b, 0x00, 0xe3, 0xed, 0x03, 0x06, 0x88},
+  {0x7b, 0x0c, 0x78, 0x5e, 0x27, 0xe8, 0xad, 0x3f, 0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5d, 0xd4},
+};
+
+/** \fn static bool check(bool condition, const std::string & description)
+ *  \brief Prints out the outcome of a check.
+ *  \param condition : check result.
+ *  \param description : what was checked.
+ *  \returns the check result.
+ */
+static bool check(bool condition, const std::string & description) {
+  std::cout << (condition ? "ok     " : "FAILED ") << description << std::endl;
+  return condition;
+}
+
+/** \fn static bool check_single(const TelinkAes & aes, const unsigned char * plain, const unsigned char * cipher)
+ *  \brief Encrypts one block with encrypt(), out of place then in place.
+ *  \param aes : keyed cipher.
+ *  \param plain : 16-byte plain block.
+ *  \param cipher : expected 16-byte encrypted block.
+ *  \returns true if both results match.
+ */
+static bool check_single(const TelinkAes & aes, const unsigned char * plain, const unsigned char * cipher) {
+  unsigned char output[AES_BLOCK_SIZE];
+  aes.encrypt(plain, output);
+  if (std::memcmp(output, cipher, AES_BLOCK_SIZE) != 0)
+    return false;
+  std::memcpy(output, plain, AES_BLOCK_SIZE);
+  aes.encrypt(output, output);
+  return std::memcmp(output, cipher, AES_BLOCK_SIZE) == 0;
+}
+
+/** \fn static bool check_batch(const TelinkAes & aes, std::size_t count, std::size_t offset, bool in_place)
+ *  \brief Encrypts the SP 800-38A blocks, repeated up to count, with encrypt_blocks().
+ *  \param aes : cipher keyed with the SP 800-38A key.
+ *  \param count : number of blocks.
+ *  \param offset : byte offset of the buffers from a 16-byte boundary.
+ *  \param in_place : true to encrypt the input buffer over itself.
+ *  \returns true if every block matches.
+ */
+static bool check_batch(const TelinkAes & aes, std::size_t count, std::size_t offset, bool in_place) {
+  std::vector<unsigned char> input(count*AES_BLOCK_SIZE + AES_BLOCK_SIZE), output(input.size(), 0);
+  for (std::size_t i=0; i<count; i++)
+    std::memcpy(input.data() + offset + i*AES_BLOCK_SIZE, ecb_plain[i%4], AES_BLOCK_SIZE);
+  unsigned char * result = in_place ? input.data() + offset : output.data() + offset;
+  aes.encrypt_blocks(input.data() + offset, result, count);
+  for (std::size_t i=0; i<count; i++)
+    if (std::memcmp(result + i*AES_BLOCK_SIZE, ecb_cipher[i%4], AES_BLOCK_SIZE) != 0)
+      return false;
+  return true;
+}
+
+int main() {
+  const char * backends[] = {"aesni", "armv8", "portable"};
+  const std::size_t counts[] = {1, 2, 3, 4, 5, 7, 8, 9, 13, 17, 31, 33};
+  const std::string default_backend = TelinkAes::get_backend();
+  bool ok = true;
+  int tested = 0;
+
+  for (auto name : backends) {
+    if (!TelinkAes::set_backend(name)) {
+      std::cout << "skip   " << name << " (not available)" << std::endl;
+      continue;
+    }
+    tested++;
+    const std::string prefix = std::string(name) + ": ";
+
+    TelinkAes fips(fips_key);
+    ok &= check(check_single(fips, fips_plain, fips_cipher), prefix + "FIPS-197 C.1 with encrypt()");
+
+    TelinkAes ecb(ecb_key);
+    bool single = true;
+    for (int i=0; i<4; i++)
+      single &= check_single(ecb, ecb_plain[i], ecb_cipher[i]);
+    ok &= check(single, prefix + "SP 800-38A F.1.1 with encrypt()");
+
+    bool batch = true, in_place = true, unaligned = true;
+    for (auto count : counts) {
+      batch &= check_batch(ecb, count, 0, false);
+      in_place &= check_batch(ecb, count, 0, true);
+      unaligned &= check_batch(ecb, count, 1, false) && check_batch(ecb, count, 3, true);
+    }
+    ok &= check(batch, prefix + "SP 800-38A F.1.1 with encrypt_blocks()");
+    ok &= check(in_place, prefix + "SP 800-38A F.1.1 with encrypt_blocks() in place");
+    ok &= check(unaligned, prefix + "SP 800-38A F.1.1 with encrypt_blocks() on unaligned buffers");
+  }
+  ok &= check(tested > 0 && TelinkAes::get_backend() == "portable", "portable backend tested");
+  ok &= check(TelinkAes::set_backend(default_backend), "default backend restored");
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,483 @@
+/** \file telink_att.cxx
+ *  Minimal ATT client over an L2CAP socket, bypassing D-Bus and bluetoothd.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/socket.h>
+
+#include "telink_att.h"
+#include "telink_cache.h"
+
+namespace telink {
+
+  /* L2CAP socket definitions from BlueZ <bluetooth/bluetooth.h> and <bluetooth/l2cap.h>,
+     repeated here so that libbluetooth is not needed */
+  #define BTPROTO_L2CAP    0
+  #define BDADDR_LE_PUBLIC 0x01
+  #define BDADDR_LE_RANDOM 0x02
+  #define SOL_BLUETOOTH    274
+  #define BT_SECURITY      4
+  #define BT_SECURITY_LOW  1
+
+  class L2capAddress {
+  public:
+    sa_family_t family;
+    uint16_t psm;
+    uint8_t bdaddr[6]; // little-endian
+    uint16_t cid;
+    uint8_t bdaddr_type;
+  };
+
+  class BtSecurity {
+  public:
+    uint8_t level;
+    uint8_t key_size;
+  };
+
+  // number of PDUs received per system call
+  #define ATT_RECEIVE_BATCH 16
+
+  static bool to_bdaddr(const std::string & address, uint8_t * bdaddr) {
+    uint8_t mac[6];
+    if (!parse_mac_address(address, mac)) return false;
+    for (int i=0; i<6; i++)
+      bdaddr[i] = mac[5-i];
+    return true;
+  }
+
+  static inline uint16_t get_le16(const unsigned char * data) {
+    return data[0] | (data[1] << 8);
+  }
+
+  static inline void put_le16(std::vector<unsigned char> & pdu, uint16_t value) {
+    pdu.push_back(value & 0xff);
+    pdu.push_back(value >> 8);
+  }
+
+  bool parse_uuid(const std::string & uuid, unsigned char * bytes) {
+    std::string digits;
+    for (char c : uuid)
+      if (c != '-') digits += c;
+    if (digits.size() != 32) return false;
+    for (int i=0; i<16; i++) {
+      unsigned int value;
+      if (std::sscanf(digits.c_str() + 2*i, "%2x", &value) != 1) return false;
+      bytes[15-i] = value;
+    }
+    return true;
+  }
+
+  std::string format_uuid(const unsigned char * bytes, std::size_t size) {
+    // 16-bit UUIDs are offsets in the Bluetooth base UUID 00000000-0000-1000-8000-00805f9b34fb
+    unsigned char full[16] = {0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    if (size == 2) {
+      full[12] = bytes[0];
+      full[13] = bytes[1];
+    } else if (size == 16) {
+      std::memcpy(full, bytes, 16);
+    } else {
+      return "";
+    }
+    char buffer[37];
+    std::snprintf(buffer, sizeof(buffer), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+      full[15], full[14], full[13], full[12], full[11], full[10], full[9], full[8],
+      full[7], full[6], full[5], full[4], full[3], full[2], full[1], full[0]);
+    return buffer;
+  }
+
+  TelinkAttClient::TelinkAttClient() : mtu(ATT_DEFAULT_MTU), running(false), generation(0) {
+  }
+
+  TelinkAttClient::~TelinkAttClient() {
+    this->close();
+  }
+
+  bool TelinkAttClient::open(const std::string & address, bool random_address, const std::string & adapter) {
+    this->close();
+    L2capAddress local = {}, remote = {};
+    if (!to_bdaddr(address, remote.bdaddr)) {
+      std::cerr << "Invalid Bluetooth address " << address << std::endl;
+      return false;
+    }
+    if (!adapter.empty() && !to_bdaddr(adapter, local.bdaddr)) {
+      std::cerr << "Invalid Bluetooth adapter address " << adapter << std::endl;
+      return false;
+    }
+
+    int fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_CLOEXEC, BTPROTO_L2CAP);
+    if (fd < 0) {
+      std::cerr << "Cannot create L2CAP socket: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    local.family = AF_BLUETOOTH;
+    local.cid = htole16(ATT_CID);
+    local.bdaddr_type = BDADDR_LE_PUBLIC;
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) < 0) {
+      std::cerr << "Cannot bind L2CAP socket: " << std::strerror(errno) << std::endl;
+      ::close(fd);
+      return false;
+    }
+    BtSecurity security = {BT_SECURITY_LOW, 0};
+    setsockopt(fd, SOL_BLUETOOTH, BT_SECURITY, &security, sizeof(security));
+
+    /* connect, with a timeout as LE connection attempts otherwise last until the device shows up */
+    remote.family = AF_BLUETOOTH;
+    remote.cid = htole16(ATT_CID);
+    remote.bdaddr_type = random_address ? BDADDR_LE_RANDOM : BDADDR_LE_PUBLIC;
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int result = connect(fd, reinterpret_cast<struct sockaddr*>(&remote), sizeof(remote));
+    if (result < 0 && errno == EINPROGRESS) {
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      result = poll(&pfd, 1, 10000);
+      if (result == 0) {
+        errno = ETIMEDOUT;
+        result = -1;
+      } else if (result > 0) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        errno = error;
+        result = error == 0 ? 0 : -1;
+      }
+    }
+    if (result < 0) {
+      std::cerr << "Cannot connect to " << address << ": " << std::strerror(errno) << std::endl;
+      ::close(fd);
+      return false;
+    }
+    fcntl(fd, F_SETFL, flags);
+    return this->attach(fd);
+  }
+
+  bool TelinkAttClient::attach(int fd) {
+    this->close();
+    if (fd < 0) return false;
+    // bounds the wait for buffer space in write_commands
+    struct timeval send_timeout = {this->timeout / 1000, (this->timeout % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    this->fd = fd;
+    this->mtu = ATT_DEFAULT_MTU;
+    this->running = true;
+    uint64_t link;
+    {
+      std::lock_guard<std::mutex> lock(this->notification_mutex);
+      link = ++this->generation;
+    }
+    this->dispatcher = std::thread(&TelinkAttClient::dispatch_loop, this, link);
+    this->reader = std::thread(&TelinkAttClient::read_loop, this);
+    return true;
+  }
+
+  void TelinkAttClient::close() {
+    if (this->fd < 0) return;
+    this->running = false; // link is closed on purpose: no disconnection event
+    shutdown(this->fd, SHUT_RDWR);
+    if (this->reader.joinable()) {
+      if (this->reader.get_id() == std::this_thread::get_id())
+        this->reader.detach(); // closed from a handler
+      else
+        this->reader.join();
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->notification_mutex);
+      this->generation++;
+      this->notifications.clear();
+      this->notification_ready.notify_all();
+    }
+    if (this->dispatcher.joinable()) {
+      if (this->dispatcher.get_id() == std::this_thread::get_id())
+        this->dispatcher.detach(); // closed from the notification handler
+      else
+        this->dispatcher.join();
+    }
+    ::close(this->fd);
+    this->fd = -1;
+    std::lock_guard<std::mutex> lock(this->response_mutex);
+    this->response_ready.notify_all();
+  }
+
+  void TelinkAttClient::set_notification_handler(const std::function<void(uint16_t, const unsigned char *, std::size_t)> & handler) {
+    this->notification_handler = handler;
+  }
+
+  void TelinkAttClient::set_disconnection_handler(const std::function<void()> & handler) {
+    this->disconnection_handler = handler;
+  }
+
+  void TelinkAttClient::read_loop() {
+    std::vector<unsigned char> buffers(ATT_RECEIVE_BATCH * ATT_MAX_MTU);
+    struct iovec iov[ATT_RECEIVE_BATCH];
+    struct mmsghdr messages[ATT_RECEIVE_BATCH];
+    while (this->running) {
+      for (int i=0; i<ATT_RECEIVE_BATCH; i++) {
+        iov[i].iov_base = &buffers[i * ATT_MAX_MTU];
+        iov[i].iov_len = ATT_MAX_MTU;
+        std::memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+      }
+      // waits for one PDU, then takes all those already queued
+      int n = recvmmsg(this->fd, messages, ATT_RECEIVE_BATCH, MSG_WAITFORONE, nullptr);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0 || messages[0].msg_len == 0) break; // error or end of stream
+      for (int i=0; i<n; i++)
+        this->handle_pdu(&buffers[i * ATT_MAX_MTU], messages[i].msg_len);
+    }
+
+    bool lost = this->running.exchange(false);
+    {
+      std::lock_guard<std::mutex> lock(this->response_mutex);
+      this->response_ready.notify_all();
+    }
+    if (lost && this->disconnection_handler)
+      this->disconnection_handler();
+  }
+
+  void TelinkAttClient::dispatch_loop(uint64_t link) {
+    std::deque<std::pair<uint16_t, std::vector<unsigned char>>> batch;
+    std::unique_lock<std::mutex> lock(this->notification_mutex);
+    while (true) {
+      this->notification_ready.wait(lock, [this, link]() {
+        return this->generation != link || !this->notifications.empty();
+      });
+      if (this->generation != link) break;
+      batch.swap(this->notifications);
+      lock.unlock();
+      for (auto & notification : batch) {
+        if (this->generation != link) break; // closed by the handler
+        this->notification_handler(notification.first, notification.second.data(), notification.second.size());
+      }
+      batch.clear();
+      lock.lock();
+    }
+  }
+
+  void TelinkAttClient::handle_pdu(const unsigned char * pdu, std::size_t size) {
+    if (size == 0) return;
+    unsigned char opcode = pdu[0];
+    if (opcode == ATT_NOTIFICATION || opcode == ATT_INDICATION) {
+      if (opcode == ATT_INDICATION)
+        this->send_pdu({ATT_CONFIRMATION});
+      if (size >= 3 && this->notification_handler) {
+        // handled on the dispatcher thread: the handler may wait for responses read here
+        std::lock_guard<std::mutex> lock(this->notification_mutex);
+        if (this->notifications.size() < ATT_MAX_PENDING) {
+          this->notifications.emplace_back(get_le16(pdu + 1), std::vector<unsigned char>(pdu + 3, pdu + size));
+          this->notification_ready.notify_one();
+        }
+      }
+      return;
+    }
+    if (opcode == ATT_MTU_REQ && size >= 3) {
+      // the server may start the exchange too
+      std::vector<unsigned char> reply = {ATT_MTU_RSP};
+      put_le16(reply, ATT_MAX_MTU);
+      this->send_pdu(reply);
+      this->mtu = std::max<uint16_t>(ATT_DEFAULT_MTU, std::min<uint16_t>(get_le16(pdu + 1), ATT_MAX_MTU));
+      return;
+    }
+    if (!(opcode & 0x01) && !(opcode & 0x40)) {
+      // other requests would target a local GATT server, which there is none of
+      this->send_pdu({ATT_ERROR_RSP, opcode, 0, 0, ATT_ERROR_NOT_SUPPORTED});
+      return;
+    }
+    if (opcode & 0x40) return; // commands need no reply
+
+    std::lock_guard<std::mutex> lock(this->response_mutex);
+    if (this->waiting) {
+      this->response.assign(pdu, pdu + size);
+      this->response_ready.notify_all();
+    }
+  }
+
+  bool TelinkAttClient::send_pdu(const std::vector<unsigned char> & pdu) {
+    if (!this->running) return false;
+    return send(this->fd, pdu.data(), pdu.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(pdu.size());
+  }
+
+  bool TelinkAttClient::request(const std::vector<unsigned char> & pdu, std::vector<unsigned char> & result) {
+    std::lock_guard<std::mutex> request_lock(this->request_mutex);
+    this->error = 0;
+    std::unique_lock<std::mutex> lock(this->response_mutex);
+    this->response.clear();
+    this->waiting = true;
+    lock.unlock();
+    bool sent = this->send_pdu(pdu);
+    lock.lock();
+    bool received = sent && this->response_ready.wait_for(lock, std::chrono::milliseconds(this->timeout),
+      [this]() { return !this->response.empty() || !this->running; });
+    this->waiting = false;
+    if (sent && !received && this->running) {
+      // the protocol has no way to recover from a lost response: drop the link
+      std::cerr << "ATT request 0x" << std::hex << static_cast<int>(pdu[0]) << std::dec << " timed out" << std::endl;
+      shutdown(this->fd, SHUT_RDWR);
+    }
+    if (this->response.empty()) return false;
+    result.swap(this->response);
+    this->response.clear();
+    if (result[0] == ATT_ERROR_RSP && result.size() >= 5 && result[1] == pdu[0]) {
+      this->error = result[4];
+      return false;
+    }
+    return result[0] == pdu[0] + 1;
+  }
+
+  bool TelinkAttClient::exchange_mtu(uint16_t mtu) {
+    std::vector<unsigned char> pdu = {ATT_MTU_REQ}, result;
+    put_le16(pdu, mtu);
+    if (!this->request(pdu, result) || result.size() < 3)
+      return false;
+    this->mtu = std::max<uint16_t>(ATT_DEFAULT_MTU, std::min<uint16_t>(get_le16(&result[1]), mtu));
+    return true;
+  }
+
+  bool TelinkAttClient::find_service(const std::string & uuid, uint16_t & start, uint16_t & end) {
+    std::string target = uuid;
+    std::transform(target.begin(), target.end(), target.begin(), ::tolower);
+    uint32_t handle = 1;
+    while (handle <= 0xffff) {
+      std::vector<unsigned char> pdu = {ATT_READ_BY_GROUP_REQ}, result;
+      put_le16(pdu, handle);
+      put_le16(pdu, 0xffff);
+      put_le16(pdu, GATT_PRIMARY_SERVICE);
+      if (!this->request(pdu, result) || result.size() < 2 || result[1] < 6)
+        return false; // attribute not found once all services were listed
+      std::size_t length = result[1];
+      uint16_t last = 0;
+      for (std::size_t offset=2; offset+length<=result.size(); offset+=length) {
+        last = get_le16(&result[offset+2]);
+        if (format_uuid(&result[offset+4], length-4) == target) {
+          start = get_le16(&result[offset]);
+          end = last;
+          return true;
+        }
+      }
+      if (last < handle) return false;
+      handle = last + 1;
+    }
+    return false;
+  }
+
+  bool TelinkAttClient::find_characteristics(uint16_t start, uint16_t end, std::vector<TelinkAttCharacteristic> & characteristics) {
+    characteristics.clear();
+    uint32_t handle = start;
+    while (handle <= end) {
+      std::vector<unsigned char> pdu = {ATT_READ_BY_TYPE_REQ}, result;
+      put_le16(pdu, handle);
+      put_le16(pdu, end);
+      put_le16(pdu, GATT_CHARACTERISTIC);
+      if (!this->request(pdu, result))
+        break;
+      std::size_t length = result.size() >= 2 ? result[1] : 0;
+      if (length < 7) return false;
+      uint16_t declaration = 0;
+      for (std::size_t offset=2; offset+length<=result.size(); offset+=length) {
+        declaration = get_le16(&result[offset]);
+        if (!characteristics.empty())
+          characteristics.back().end = declaration - 1;
+        TelinkAttCharacteristic characteristic;
+        characteristic.properties = result[offset+2];
+        characteristic.value = get_le16(&result[offset+3]);
+        characteristic.uuid = format_uuid(&result[offset+5], length-5);
+        characteristic.end = end;
+        characteristics.push_back(characteristic);
+      }
+      if (declaration < handle) return false;
+      handle = declaration + 1;
+    }
+    // listing ends with "attribute not found"
+    return this->error == ATT_ERROR_NOT_FOUND || handle > end;
+  }
+
+  uint16_t TelinkAttClient::find_descriptor(const TelinkAttCharacteristic & characteristic, uint16_t type) {
+    uint32_t handle = characteristic.value + 1;
+    while (handle <= characteristic.end) {
+      std::vector<unsigned char> pdu = {ATT_FIND_INFO_REQ}, result;
+      put_le16(pdu, handle);
+      put_le16(pdu, characteristic.end);
+      if (!this->request(pdu, result) || result.size() < 2)
+        return 0;
+      std::size_t length = result[1] == 1 ? 4 : 18; // 16-bit or 128-bit types
+      uint16_t last = 0;
+      for (std::size_t offset=2; offset+length<=result.size(); offset+=length) {
+        last = get_le16(&result[offset]);
+        if (length == 4 && get_le16(&result[offset+2]) == type)
+          return last;
+      }
+      if (last < handle) return 0;
+      handle = last + 1;
+    }
+    return 0;
+  }
+
+  bool TelinkAttClient::read(uint16_t handle, std::vector<unsigned char> & value) {
+    std::vector<unsigned char> pdu = {ATT_READ_REQ}, result;
+    put_le16(pdu, handle);
+    if (!this->request(pdu, result))
+      return false;
+    value.assign(result.begin() + 1, result.end());
+    return true;
+  }
+
+  bool TelinkAttClient::write(uint16_t handle, const unsigned char * data, std::size_t size) {
+    std::vector<unsigned char> pdu = {ATT_WRITE_REQ}, result;
+    put_le16(pdu, handle);
+    pdu.insert(pdu.end(), data, data + size);
+    return this->request(pdu, result);
+  }
+
+  std::size_t TelinkAttClient::write_commands(uint16_t handle, const unsigned char * values, std::size_t size, std::size_t count) {
+    if (!this->running || count == 0) return 0;
+    if (size + 3 > this->mtu) {
+      std::cerr << "Value size " << size << " exceeds ATT MTU " << this->mtu << std::endl;
+      return 0;
+    }
+    std::size_t pdu_size = size + 3;
+    std::vector<unsigned char> pdus(count * pdu_size);
+    std::vector<struct iovec> iov(count);
+    std::vector<struct mmsghdr> messages(count);
+    for (std::size_t i=0; i<count; i++) {
+      unsigned char * pdu = &pdus[i * pdu_size];
+      pdu[0] = ATT_WRITE_CMD;
+      pdu[1] = handle & 0xff;
+      pdu[2] = handle >> 8;
+      std::memcpy(pdu + 3, values + i*size, size);
+      iov[i].iov_base = pdu;
+      iov[i].iov_len = pdu_size;
+      std::memset(&messages[i], 0, sizeof(messages[i]));
+      messages[i].msg_hdr.msg_iov = &iov[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* the socket blocks while the controller has no free buffer, up to the send timeout */
+    std::size_t written = 0;
+    while (written < count) {
+      int n = sendmmsg(this->fd, &messages[written], count - written, MSG_NOSIGNAL);
+      if (n > 0) {
+        written += n;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          std::cerr << "ATT link stalled, " << count - written << " writes not sent" << std::endl;
+        else
+          std::cerr << "ATT write failed: " << std::strerror(errno) << std::endl;
+        break;
+      }
+    }
+    return written;
+  }
+
+}
@@ -0,0 +1,370 @@
+/** \file telink_att.h
+ *  Minimal ATT client over an L2CAP socket, bypassing D-Bus and bluetoothd.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_ATT_H__
+#define __TELINK_ATT_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+namespace telink {
+
+  /** \brief L2CAP channel of the attribute protocol. */
+  #define ATT_CID 4
+  /** \brief Default ATT MTU of LE links. */
+  #define ATT_DEFAULT_MTU 23
+  /** \brief Largest ATT MTU requested. */
+  #define ATT_MAX_MTU 247
+  /** \brief Default time to wait for a response or for buffer space, in milliseconds. */
+  #define ATT_TIMEOUT 5000
+  /** \brief Maximum number of notifications waiting for the notification handler. */
+  #define ATT_MAX_PENDING 1024
+
+  // ATT opcodes (Bluetooth Core Specification, Vol 3, Part F)
+  #define ATT_ERROR_RSP         0x01
+  #define ATT_MTU_REQ           0x02
+  #define ATT_MTU_RSP           0x03
+  #define ATT_FIND_INFO_REQ     0x04
+  #define ATT_FIND_INFO_RSP     0x05
+  #define ATT_READ_BY_TYPE_REQ  0x08
+  #define ATT_READ_BY_TYPE_RSP  0x09
+  #define ATT_READ_REQ          0x0a
+  #define ATT_READ_RSP          0x0b
+  #define ATT_READ_BY_GROUP_REQ 0x10
+  #define ATT_READ_BY_GROUP_RSP 0x11
+  #define ATT_WRITE_REQ         0x12
+  #define ATT_WRITE_RSP         0x13
+  #define ATT_NOTIFICATION      0x1b
+  #define ATT_INDICATION        0x1d
+  #define ATT_CONFIRMATION      0x1e
+  #define ATT_WRITE_CMD         0x52
+
+  // ATT error codes
+  #define ATT_ERROR_NOT_SUPPORTED 0x06 // request not supported
+  #define ATT_ERROR_NOT_FOUND     0x0a // attribute not found
+
+  // GATT attribute types
+  #define GATT_PRIMARY_SERVICE 0x2800
+  #define GATT_CHARACTERISTIC  0x2803
+  #define GATT_CLIENT_CONFIG   0x2902
+
+  /** \class TelinkAttCharacteristic
+   *  \brief GATT characteristic found by discovery.
+   */
+  class TelinkAttCharacteristic {
+  public:
+    /** \property std::string uuid
+     *  \brief Characteristic UUID, in lower case 128-bit string form.
+     */
+    std::string uuid;
+
+    /** \property uint16_t value
+     *  \brief Handle of the characteristic value.
+     */
+    uint16_t value = 0;
+
+    /** \property uint16_t end
+     *  \brief Last handle of the characteristic (value and descriptors).
+     */
+    uint16_t end = 0;
+
+    /** \property uint8_t properties
+     *  \brief Characteristic properties (read, write, notify...).
+     */
+    uint8_t properties = 0;
+  };
+
+  /** \class TelinkAttClient
+   *  \brief Attribute protocol client on a connected L2CAP socket.
+   *
+   *  Requests are serialized and wait for their response, as the protocol requires. A reader
+   *  thread receives responses, notifications and indications, several per system call.
+   *  Notifications are handed to a dispatcher thread, so that their handler may issue requests.
+   *  Write commands are also handed to the kernel in batches, and wait for buffer space when
+   *  the controller has no free packet slots.
+   */
+  class TelinkAttClient {
+  private:
+    /** \property int fd
+     *  \brief Socket descriptor, or -1 if closed.
+     */
+    int fd = -1;
+
+    /** \property std::atomic<uint16_t> mtu
+     *  \brief Negotiated ATT MTU.
+     */
+    std::atomic<uint16_t> mtu;
+
+    /** \property int timeout
+     *  \brief Time to wait for a response, in milliseconds.
+     */
+    int timeout = ATT_TIMEOUT;
+
+    /** \property std::thread reader
+     *  \brief Thread receiving PDUs from the socket.
+     */
+    std::thread reader;
+
+    /** \property std::atomic<bool> running
+     *  \brief true while the link is up.
+     */
+    std::atomic<bool> running;
+
+    /** \property std::thread dispatcher
+     *  \brief Thread calling the notification handler.
+     */
+    std::thread dispatcher;
+
+    /** \property std::mutex notification_mutex
+     *  \brief Protects notifications and generation.
+     */
+    std::mutex notification_mutex;
+
+    /** \property std::condition_variable notification_ready
+     *  \brief Signals a queued notification, or link closing.
+     */
+    std::condition_variable notification_ready;
+
+    /** \property std::deque<std::pair<uint16_t, std::vector<unsigned char>>> notifications
+     *  \brief Notifications waiting for the handler, with attribute handle, oldest first.
+     */
+    std::deque<std::pair<uint16_t, std::vector<unsigned char>>> notifications;
+
+    /** \property std::atomic<uint64_t> generation
+     *  \brief Link number, changed under notification_mutex; a dispatcher stops once the link
+     *  it was started for is closed.
+     */
+    std::atomic<uint64_t> generation;
+
+    /** \property std::mutex request_mutex
+     *  \brief Serializes requests.
+     */
+    std::mutex request_mutex;
+
+    /** \property std::mutex response_mutex
+     *  \brief Protects response and waiting.
+     */
+    std::mutex response_mutex;
+
+    /** \property std::condition_variable response_ready
+     *  \brief Signals a received response, or link loss.
+     */
+    std::condition_variable response_ready;
+
+    /** \property std::vector<unsigned char> response
+     *  \brief Last response PDU, empty while waiting.
+     */
+    std::vector<unsigned char> response;
+
+    /** \property bool waiting
+     *  \brief true while a request waits for its response.
+     */
+    bool waiting = false;
+
+    /** \property uint8_t error
+     *  \brief Error code of last failed request, or 0 if it failed without ATT error.
+     */
+    uint8_t error = 0;
+
+    /** \property std::function<void(uint16_t, const unsigned char *, std::size_t)> notification_handler
+     *  \brief Called from dispatcher thread for each notification or indication.
+     */
+    std::function<void(uint16_t, const unsigned char *, std::size_t)> notification_handler;
+
+    /** \property std::function<void()> disconnection_handler
+     *  \brief Called from reader thread when the link is lost.
+     */
+    std::function<void()> disconnection_handler;
+
+    /** \fn void read_loop()
+     *  \brief Receives and dispatches PDUs until the link is closed.
+     */
+    void read_loop();
+
+    /** \fn void dispatch_loop(uint64_t link)
+     *  \brief Calls the notification handler for queued notifications until the link is closed.
+     *  \param link : generation of the link.
+     */
+    void dispatch_loop(uint64_t link);
+
+    /** \fn void handle_pdu(const unsigned char * pdu, std::size_t size)
+     *  \brief Dispatches a received PDU.
+     *  \param pdu : received PDU.
+     *  \param size : PDU size.
+     */
+    void handle_pdu(const unsigned char * pdu, std::size_t size);
+
+    /** \fn bool send_pdu(const std::vector<unsigned char> & pdu)
+     *  \brief Sends a PDU.
+     *  \param pdu : PDU to send.
+     *  \returns true on success.
+     */
+    bool send_pdu(const std::vector<unsigned char> & pdu);
+
+    /** \fn bool request(const std::vector<unsigned char> & pdu, std::vector<unsigned char> & result)
+     *  \brief Sends a request and waits for its response.
+     *  \param pdu : request PDU.
+     *  \param result : response PDU.
+     *  \returns true if the expected response was received; on ATT error, the error code is
+     *  available with get_error().
+     */
+    bool request(const std::vector<unsigned char> & pdu, std::vector<unsigned char> & result);
+
+  public:
+    TelinkAttClient();
+    TelinkAttClient(const TelinkAttClient &) = delete;
+    TelinkAttClient & operator=(const TelinkAttClient &) = delete;
+    ~TelinkAttClient();
+
+    /** \fn bool open(const std::string & address, bool random_address = false, const std::string & adapter = "")
+     *  \brief Connects to the ATT channel of an LE device.
+     *  \param address : device MAC address.
+     *  \param random_address : true if the device uses a random address.
+     *  \param adapter : MAC address of the local adapter, or empty for any.
+     *  \returns true on success.
+     */
+    bool open(const std::string & address, bool random_address = false, const std::string & adapter = "");
+
+    /** \fn bool attach(int fd)
+     *  \brief Uses an already connected socket (any SOCK_SEQPACKET, e.g. to test against a
+     *  local responder). The client takes ownership of the descriptor.
+     *  \param fd : socket descriptor.
+     *  \returns true on success.
+     */
+    bool attach(int fd);
+
+    /** \fn void close()
+     *  \brief Closes the link. The disconnection handler is not called.
+     */
+    void close();
+
+    /** \fn bool is_open() const
+     *  \brief Tells if the link is up.
+     *  \returns true if connected.
+     */
+    bool is_open() const { return this->running; }
+
+    /** \fn void set_notification_handler(const std::function<void(uint16_t, const unsigned char *, std::size_t)> & handler)
+     *  \brief Sets the function called for each notification or indication, with attribute
+     *  handle and value. Must be set before the link is opened. The function runs on a
+     *  dispatcher thread, in order of reception: it may issue requests, which then delay the
+     *  following notifications (up to ATT_MAX_PENDING are queued, further ones are dropped).
+     *  \param handler : function to call.
+     */
+    void set_notification_handler(const std::function<void(uint16_t, const unsigned char *, std::size_t)> & handler);
+
+    /** \fn void set_disconnection_handler(const std::function<void()> & handler)
+     *  \brief Sets the function called when the link is lost. Must be set before the link is opened.
+     *  The function runs on the reader thread and must not issue requests.
+     *  \param handler : function to call.
+     */
+    void set_disconnection_handler(const std::function<void()> & handler);
+
+    /** \fn void set_timeout(int timeout)
+     *  \brief Sets the time to wait for a response or for buffer space.
+     *  \param timeout : time in milliseconds.
+     */
+    void set_timeout(int timeout) { this->timeout = timeout; }
+
+    /** \fn uint8_t get_error() const
+     *  \brief Returns the ATT error code of the last failed request.
+     *  \returns the error code, or 0 if the request failed without response.
+     */
+    uint8_t get_error() const { return this->error; }
+
+    /** \fn uint16_t get_mtu() const
+     *  \brief Returns the negotiated ATT MTU.
+     *  \returns the MTU in bytes.
+     */
+    uint16_t get_mtu() const { return this->mtu; }
+
+    /** \fn bool exchange_mtu(uint16_t mtu = ATT_MAX_MTU)
+     *  \brief Negotiates the ATT MTU.
+     *  \param mtu : largest MTU accepted by the client.
+     *  \returns true on success.
+     */
+    bool exchange_mtu(uint16_t mtu = ATT_MAX_MTU);
+
+    /** \fn bool find_service(const std::string & uuid, uint16_t & start, uint16_t & end)
+     *  \brief Looks up the handle range of a primary service.
+     *  \param uuid : service UUID, in 128-bit string form.
+     *  \param start : first handle of service.
+     *  \param end : last handle of service.
+     *  \returns true if the service was found.
+     */
+    bool find_service(const std::string & uuid, uint16_t & start, uint16_t & end);
+
+    /** \fn bool find_characteristics(uint16_t start, uint16_t end, std::vector<TelinkAttCharacteristic> & characteristics)
+     *  \brief Lists the characteristics in a handle range.
+     *  \param start : first handle.
+     *  \param end : last handle.
+     *  \param characteristics : found characteristics.
+     *  \returns true on success.
+     */
+    bool find_characteristics(uint16_t start, uint16_t end, std::vector<TelinkAttCharacteristic> & characteristics);
+
+    /** \fn uint16_t find_descriptor(const TelinkAttCharacteristic & characteristic, uint16_t type)
+     *  \brief Looks up a descriptor of a characteristic.
+     *  \param characteristic : characteristic.
+     *  \param type : 16-bit descriptor type, e.g. GATT_CLIENT_CONFIG.
+     *  \returns the descriptor handle, or 0 if not found.
+     */
+    uint16_t find_descriptor(const TelinkAttCharacteristic & characteristic, uint16_t type);
+
+    /** \fn bool read(uint16_t handle, std::vector<unsigned char> & value)
+     *  \brief Reads an attribute value (up to MTU-1 bytes).
+     *  \param handle : attribute handle.
+     *  \param value : read value.
+     *  \returns true on success.
+     */
+    bool read(uint16_t handle, std::vector<unsigned char> & value);
+
+    /** \fn bool write(uint16_t handle, const unsigned char * data, std::size_t size)
+     *  \brief Writes an attribute value and waits for acknowledgement.
+     *  \param handle : attribute handle.
+     *  \param data : value to write.
+     *  \param size : value size (up to MTU-3 bytes).
+     *  \returns true on success.
+     */
+    bool write(uint16_t handle, const unsigned char * data, std::size_t size);
+
+    /** \fn std::size_t write_commands(uint16_t handle, const unsigned char * values, std::size_t size, std::size_t count)
+     *  \brief Writes values without acknowledgement, in as few system calls as possible.
+     *  \param handle : attribute handle.
+     *  \param values : count x size bytes.
+     *  \param size : size of a value (up to MTU-3 bytes).
+     *  \param count : number of values.
+     *  \returns the number of values written.
+     */
+    std::size_t write_commands(uint16_t handle, const unsigned char * values, std::size_t size, std::size_t count);
+  };
+
+  /** \fn bool parse_uuid(const std::string & uuid, unsigned char * bytes)
+   *  \brief Converts a 128-bit UUID string to its little-endian ATT form.
+   *  \param uuid : UUID string (xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx).
+   *  \param bytes : 16-byte output.
+   *  \returns true if the string is valid.
+   */
+  bool parse_uuid(const std::string & uuid, unsigned char * bytes);
+
+  /** \fn std::string format_uuid(const unsigned char * bytes, std::size_t size)
+   *  \brief Converts a UUID in ATT form to a 128-bit string.
+   *  \param bytes : little-endian UUID.
+   *  \param size : 2 (16-bit UUID, extended with the Bluetooth base UUID) or 16.
+   *  \returns the lower case UUID string.
+   */
+  std::string format_uuid(const unsigned char * bytes, std::size_t size);
+
+}
+
+#endif // __TELINK_ATT_H__
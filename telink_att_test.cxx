@@ -0,0 +1,436 @@
+/** \file telink_att_test.cxx
+ *  Self-contained check of the L2CAP transport: a TelinkLight talks to a local ATT responder
+ *  emulating a Telink device over a socketpair, through discovery, pairing, write requests,
+ *  write commands, notifications and reconnection with kept handles.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "telink_light.h"
+#include "telink_att.h"
+#include "telink_credentials.h"
+
+using namespace telink;
+
+// attribute handles of the emulated device
+#define HANDLE_SERVICE      1
+#define HANDLE_NOTIFICATION 3
+#define HANDLE_CONFIG       4
+#define HANDLE_COMMAND      6
+#define HANDLE_OTA          8
+#define HANDLE_PAIR         10
+
+/** \class TelinkAttCommand
+ *  \brief Command packet received by the responder, once decrypted.
+ */
+class TelinkAttCommand {
+public:
+  bool request;           // sent as a write request rather than a write command
+  bool authentic;         // MAC matches the session key
+  int opcode;
+  uint16_t destination;
+  std::string payload;    // bytes 10-19
+};
+
+/** \class TelinkAttResponder
+ *  \brief Minimal ATT server with the Telink service, answering on one end of a socketpair.
+ *  Pairing always succeeds; notifications are encrypted with the resulting session key.
+ */
+class TelinkAttResponder {
+private:
+  /** \property int fd
+   *  \brief Server end of the socketpair.
+   */
+  int fd;
+
+  /** \property std::string reverse_address
+   *  \brief Device MAC address, least significant byte first.
+   */
+  std::string reverse_address;
+
+  /** \property std::shared_ptr<const TelinkCredentials> credentials
+   *  \brief Mesh name and password.
+   */
+  std::shared_ptr<const TelinkCredentials> credentials;
+
+  /** \property std::string client_random
+   *  \brief Random part of the pairing request.
+   */
+  std::string client_random;
+
+  /** \property TelinkAes session
+   *  \brief Session key schedule, set once paired.
+   */
+  TelinkAes session;
+
+  /** \property std::thread thread
+   *  \brief Thread answering requests.
+   */
+  std::thread thread;
+
+  /** \property std::mutex mutex
+   *  \brief Protects counters.
+   */
+  std::mutex mutex;
+
+  /** \property std::condition_variable changed
+   *  \brief Signals a counter change.
+   */
+  std::condition_variable changed;
+
+  /** \property std::vector<TelinkAttCommand> commands
+   *  \brief Decrypted command packets, in order of reception.
+   */
+  std::vector<TelinkAttCommand> commands;
+
+  /** \fn std::string encrypt_block(std::string block) const
+   *  \brief Encrypts a 16-byte block with the session key, in Telink byte order.
+   *  \param block : block to encrypt.
+   *  \returns the encrypted block.
+   */
+  std::string encrypt_block(std::string block) const {
+    std::reverse(block.begin(), block.end());
+    unsigned char * pointer = reinterpret_cast<unsigned char*>(&block[0]);
+    this->session.encrypt(pointer, pointer);
+    std::reverse(block.begin(), block.end());
+    return block;
+  }
+
+  /** \fn void receive_command(const unsigned char * value, std::size_t size, bool request)
+   *  \brief Decrypts a command packet written by the client and records it.
+   *  \param value : written value.
+   *  \param size : value size.
+   *  \param request : true for a write request, false for a write command.
+   */
+  void receive_command(const unsigned char * value, std::size_t size, bool request) {
+    TelinkAttCommand command = {request, false, -1, 0, ""};
+    if (size == 20) {
+      std::string packet(reinterpret_cast<const char*>(value), size);
+      // bytes 5-19 are XORed with the encrypted nonce, made of address and packet counter
+      std::string iv = '\0' + this->reverse_address.substr(0,4) + '\1' + packet.substr(0,3);
+      iv.append(7, 0);
+      std::string buffer = this->encrypt_block(iv);
+      for (int i=0; i<15; i++)
+        packet[i+5] ^= buffer[i];
+      // bytes 3-4 carry the MAC of the plain packet
+      std::string authenticator = this->reverse_address.substr(0,4) + '\1' + packet.substr(0,3) + '\x0f';
+      authenticator.append(7, 0);
+      authenticator = this->encrypt_block(authenticator);
+      for (int i=0; i<15; i++)
+        authenticator[i] ^= packet[i+5];
+      std::string mac = this->encrypt_block(authenticator);
+      command.authentic = mac[0] == packet[3] && mac[1] == packet[4];
+      command.opcode = static_cast<unsigned char>(packet[7]);
+      command.destination = static_cast<unsigned char>(packet[5]) | (static_cast<unsigned char>(packet[6]) << 8);
+      command.payload = packet.substr(10);
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->commands.push_back(command);
+    }
+    this->count(request ? this->write_requests : this->write_commands);
+  }
+
+  /** \fn void send_pdu(const std::vector<unsigned char> & pdu)
+   *  \brief Sends a PDU to the client.
+   *  \param pdu : PDU to send.
+   */
+  void send_pdu(const std::vector<unsigned char> & pdu) {
+    send(this->fd, pdu.data(), pdu.size(), MSG_NOSIGNAL);
+  }
+
+  /** \fn void send_error(unsigned char opcode, uint16_t handle, unsigned char error)
+   *  \brief Answers a request with an error.
+   *  \param opcode : request opcode.
+   *  \param handle : attribute handle in error.
+   *  \param error : ATT error code.
+   */
+  void send_error(unsigned char opcode, uint16_t handle, unsigned char error) {
+    this->send_pdu({ATT_ERROR_RSP, opcode, static_cast<unsigned char>(handle & 0xff), static_cast<unsigned char>(handle >> 8), error});
+  }
+
+  /** \fn void handle_request(const unsigned char * pdu, std::size_t size)
+   *  \brief Answers a request or records a command.
+   *  \param pdu : received PDU.
+   *  \param size : PDU size.
+   */
+  void handle_request(const unsigned char * pdu, std::size_t size) {
+    unsigned char opcode = pdu[0];
+    uint16_t start = size >= 3 ? pdu[1] | (pdu[2] << 8) : 0;
+    uint16_t end = size >= 5 ? pdu[3] | (pdu[4] << 8) : 0;
+
+    if (opcode == ATT_MTU_REQ) {
+      this->send_pdu({ATT_MTU_RSP, ATT_MAX_MTU & 0xff, ATT_MAX_MTU >> 8});
+
+    } else if (opcode == ATT_READ_BY_GROUP_REQ) {
+      this->count(this->discovery_requests);
+      if (start > HANDLE_SERVICE) {
+        this->send_error(opcode, start, ATT_ERROR_NOT_FOUND);
+        return;
+      }
+      std::vector<unsigned char> rsp = {ATT_READ_BY_GROUP_RSP, 20, HANDLE_SERVICE, 0, HANDLE_PAIR, 0};
+      unsigned char uuid[16];
+      parse_uuid(uuid_info_service, uuid);
+      rsp.insert(rsp.end(), uuid, uuid + 16);
+      this->send_pdu(rsp);
+
+    } else if (opcode == ATT_READ_BY_TYPE_REQ) {
+      this->count(this->discovery_requests);
+      const char * uuids[] = {uuid_notification_char, uuid_command_char, uuid_ota_char, uuid_pair_char};
+      const uint16_t values[] = {HANDLE_NOTIFICATION, HANDLE_COMMAND, HANDLE_OTA, HANDLE_PAIR};
+      const unsigned char properties[] = {0x12, 0x0e, 0x0e, 0x0a};
+      std::vector<unsigned char> rsp = {ATT_READ_BY_TYPE_RSP, 21};
+      for (int i=0; i<4; i++) {
+        uint16_t declaration = values[i] - 1;
+        if (declaration < start || declaration > end) continue;
+        unsigned char uuid[16];
+        parse_uuid(uuids[i], uuid);
+        rsp.insert(rsp.end(), {static_cast<unsigned char>(declaration), 0, properties[i], static_cast<unsigned char>(values[i]), 0});
+        rsp.insert(rsp.end(), uuid, uuid + 16);
+      }
+      if (rsp.size() == 2)
+        this->send_error(opcode, start, ATT_ERROR_NOT_FOUND);
+      else
+        this->send_pdu(rsp);
+
+    } else if (opcode == ATT_FIND_INFO_REQ) {
+      this->count(this->discovery_requests);
+      if (start <= HANDLE_CONFIG && end >= HANDLE_CONFIG)
+        this->send_pdu({ATT_FIND_INFO_RSP, 1, HANDLE_CONFIG, 0, GATT_CLIENT_CONFIG & 0xff, GATT_CLIENT_CONFIG >> 8});
+      else
+        this->send_error(opcode, start, ATT_ERROR_NOT_FOUND);
+
+    } else if (opcode == ATT_WRITE_REQ && size >= 3) {
+      if (start == HANDLE_PAIR && size >= 12 && pdu[3] == 0x0c) {
+        this->client_random.assign(reinterpret_cast<const char*>(pdu + 4), 8);
+      } else if (start == HANDLE_CONFIG || start == HANDLE_NOTIFICATION) {
+        this->count(this->notification_enables);
+      } else if (start == HANDLE_COMMAND) {
+        this->receive_command(pdu + 3, size - 3, true);
+      }
+      this->send_pdu({ATT_WRITE_RSP});
+
+    } else if (opcode == ATT_READ_REQ && start == HANDLE_PAIR) {
+      // any proof is accepted by the client: only the random part matters for the session key
+      std::string device_random = "\x11\x22\x33\x44\x55\x66\x77\x88";
+      std::string key = this->credentials->encrypt(this->client_random + device_random);
+      std::reverse(key.begin(), key.end());
+      this->session.set_key(reinterpret_cast<const unsigned char*>(key.data()));
+      std::vector<unsigned char> rsp = {ATT_READ_RSP, 0x0d};
+      rsp.insert(rsp.end(), device_random.begin(), device_random.end());
+      rsp.insert(rsp.end(), 8, 0);
+      this->count(this->pairings);
+      this->send_pdu(rsp);
+
+    } else if (opcode == ATT_READ_REQ) {
+      this->send_pdu({ATT_READ_RSP});
+
+    } else if (opcode == ATT_WRITE_CMD && start == HANDLE_COMMAND && size >= 3) {
+      this->receive_command(pdu + 3, size - 3, false);
+
+    } else if (!(opcode & 0x40)) {
+      this->send_error(opcode, start, ATT_ERROR_NOT_SUPPORTED);
+    }
+  }
+
+  /** \fn void count(int & counter)
+   *  \brief Increments a counter and wakes up waiters.
+   *  \param counter : counter to increment.
+   */
+  void count(int & counter) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    counter++;
+    this->changed.notify_all();
+  }
+
+  /** \fn void run()
+   *  \brief Answers requests until the client closes its end.
+   */
+  void run() {
+    unsigned char pdu[ATT_MAX_MTU];
+    while (true) {
+      ssize_t size = recv(this->fd, pdu, sizeof(pdu), 0);
+      if (size <= 0) break;
+      this->handle_request(pdu, size);
+    }
+  }
+
+public:
+  // requests seen, by kind; read them once the client got the matching response
+  int discovery_requests = 0;
+  int pairings = 0;
+  int notification_enables = 0;
+  int write_requests = 0;
+  int write_commands = 0;
+
+  /** \fn TelinkAttResponder(int fd, const std::string & address, const std::string & name, const std::string & password)
+   *  \brief Starts answering on a socket.
+   *  \param fd : server end of the socketpair; closed on destruction.
+   *  \param address : emulated device MAC address.
+   *  \param name : mesh name.
+   *  \param password : mesh password.
+   */
+  TelinkAttResponder(int fd, const std::string & address, const std::string & name, const std::string & password) : fd(fd) {
+    uint8_t mac[6];
+    parse_mac_address(address, mac);
+    this->reverse_address.assign(mac, mac + 6);
+    std::reverse(this->reverse_address.begin(), this->reverse_address.end());
+    this->credentials = TelinkCredentials::get(name, password);
+    this->thread = std::thread(&TelinkAttResponder::run, this);
+  }
+
+  ~TelinkAttResponder() {
+    shutdown(this->fd, SHUT_RDWR);
+    this->thread.join();
+    close(this->fd);
+  }
+
+  /** \fn bool wait_for(int & counter, int value, int timeout_ms)
+   *  \brief Waits until a counter reaches a value.
+   *  \param counter : counter to watch.
+   *  \param value : value to reach.
+   *  \param timeout_ms : time to wait, in milliseconds.
+   *  \returns true if the value was reached in time.
+   */
+  bool wait_for(int & counter, int value, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->changed.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&counter, value]() { return counter >= value; });
+  }
+
+  /** \fn TelinkAttCommand command(std::size_t index)
+   *  \brief Returns a received command.
+   *  \param index : rank of the command, counting write requests and write commands together.
+   *  \returns the decrypted command; opcode is -1 if there is no such command.
+   */
+  TelinkAttCommand command(std::size_t index) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (index >= this->commands.size())
+      return {false, false, -1, 0, ""};
+    return this->commands[index];
+  }
+
+  /** \fn void notify(const std::string & plain)
+   *  \brief Sends an encrypted report to the client, as the device would.
+   *  \param plain : 20-byte plaintext report.
+   */
+  void notify(std::string plain) {
+    // bytes 7-19 are XORed with the encrypted nonce, made of address and packet header
+    std::string iv = '\0' + this->reverse_address.substr(0,3) + plain.substr(0,5);
+    iv.append(7, 0);
+    std::string block = this->encrypt_block(iv);
+    for (std::size_t i=0; i+7<plain.size(); i++)
+      plain[i+7] ^= block[i];
+    std::vector<unsigned char> pdu = {ATT_NOTIFICATION, HANDLE_NOTIFICATION, 0};
+    pdu.insert(pdu.end(), plain.begin(), plain.end());
+    this->send_pdu(pdu);
+  }
+};
+
+/** \fn static bool check(bool condition, const char * description)
+ *  \brief Prints out the outcome of a check.
+ *  \param condition : check result.
+ *  \param description : what was checked.
+ *  \returns the check result.
+ */
+static bool check(bool condition, const char * description) {
+  std::cout << (condition ? "ok     " : "FAILED ") << description << std::endl;
+  return condition;
+}
+
+/** \fn static bool is_command(const TelinkAttCommand & command, bool request, int opcode, int destination, const std::string & payload)
+ *  \brief Compares a received command with the expected one.
+ *  \param command : decrypted command.
+ *  \param request : true if a write request is expected, false for a write command.
+ *  \param opcode : expected command code.
+ *  \param destination : expected mesh ID.
+ *  \param payload : expected first bytes of the payload; the remaining bytes must be 0.
+ *  \returns true if the command is authentic and matches.
+ */
+static bool is_command(const TelinkAttCommand & command, bool request, int opcode, int destination, const std::string & payload) {
+  std::string expected = payload;
+  expected.resize(command.payload.size(), 0);
+  return command.authentic && command.request == request && command.opcode == opcode
+    && command.destination == destination && command.payload == expected;
+}
+
+int main() {
+  const std::string address = "A4:C1:38:00:00:01", name = "telink_mesh1", password = "123";
+  bool ok = true;
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+    std::cerr << "Cannot create socketpair" << std::endl;
+    return 1;
+  }
+  std::unique_ptr<TelinkAttResponder> device(new TelinkAttResponder(fds[1], address, name, password));
+  TelinkLight light(address, name, password);
+
+  /* first connection: discovery and pairing */
+  ok &= check(light.connect_socket(fds[0]), "connection over socketpair");
+  ok &= check(device->discovery_requests > 0, "service discovery");
+  ok &= check(device->pairings == 1, "pairing");
+  ok &= check(device->notification_enables > 0, "notifications enabled");
+
+  /* acknowledged writes */
+  light.set_state(true);
+  ok &= check(device->wait_for(device->write_requests, 1, 1000), "write request");
+  ok &= check(is_command(device->command(0), true, COMMAND_LIGHT_ON_OFF, 0, std::string("\x01\x00\x00", 3)), "write request content");
+
+  /* a report listener issuing a request from the notification handler */
+  std::atomic<bool> answered(false);
+  light.add_report_listener([&light, &answered](const std::string & packet) {
+    if (static_cast<unsigned char>(packet[7]) != COMMAND_ONLINE_STATUS_REPORT || answered) return;
+    answered = true;
+    light.set_brightness(50);
+  });
+  std::string report(20, 0);
+  report[0] = 1;      // packet counter
+  report[3] = 1;      // source mesh ID
+  report[7] = static_cast<char>(COMMAND_ONLINE_STATUS_REPORT);
+  report[8] = 0x11;   // vendor code
+  report[9] = 0x02;
+  report[10] = 1;     // mesh ID
+  report[12] = 80;    // brightness
+  report[13] = 0x40;  // light on
+  device->notify(report);
+  ok &= check(device->wait_for(device->write_requests, 2, 1000) && answered, "request from report listener");
+  ok &= check(is_command(device->command(1), true, COMMAND_LIGHT_ATTRIBUTES_SET, 0, std::string("\x32\0\0\0\0\0\0\x01", 8)), "request from report listener content");
+
+  /* unacknowledged writes, in one batch */
+  light.set_write_mode(WRITE_COMMAND);
+  uint16_t destinations[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  unsigned char data[8] = {0};
+  std::size_t sent = light.send_packets(COMMAND_LIGHT_ON_OFF, destinations, data, 1, 8);
+  ok &= check(sent == 8 && device->wait_for(device->write_commands, 8, 1000), "batched write commands");
+  bool batch = true;
+  for (int i=0; i<8; i++)
+    batch &= is_command(device->command(2+i), false, COMMAND_LIGHT_ON_OFF, destinations[i], std::string(1, 0));
+  ok &= check(batch, "batched write commands content");
+
+  /* reconnection: handles kept from the first connection are validated by pairing */
+  light.disconnect();
+  device.reset();
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+    std::cerr << "Cannot create socketpair" << std::endl;
+    return 1;
+  }
+  device.reset(new TelinkAttResponder(fds[1], address, name, password));
+  ok &= check(light.connect_socket(fds[0]), "reconnection over socketpair");
+  ok &= check(device->discovery_requests == 0 && device->pairings == 1, "reconnection without discovery");
+  light.disconnect();
+
+  return ok ? 0 : 1;
+}
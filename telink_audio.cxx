@@ -0,0 +1,126 @@
+/** \file telink_audio.cxx
+ *  Streaming audio analysis for driving lights in music mode.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "telink_audio.h"
+#include "telink_color_batch.h"
+
+namespace telink {
+
+  TelinkAudioAnalyzer::TelinkAudioAnalyzer(int sample_rate, int fft_size, int hop_size) : sample_rate(sample_rate) {
+    this->fft_size = 4;
+    while (this->fft_size < fft_size)
+      this->fft_size <<= 1;
+    this->hop_size = std::max(1, std::min(hop_size, this->fft_size));
+
+    const float pi = 3.14159265358979f;
+    int n = this->fft_size, half = n/2;
+    this->history.assign(n, 0);
+    this->window.resize(n);
+    for (int i=0; i<n; i++)
+      this->window[i] = 0.5f - 0.5f*std::cos(2*pi*i/n);
+    this->twiddles.resize(half);
+    for (int k=0; k<half; k++)
+      this->twiddles[k] = std::polar(1.0f, -2*pi*k/n);
+    this->bit_reverse.resize(half);
+    int bits = 0;
+    while ((1 << bits) < half) bits++;
+    for (int i=0; i<half; i++) {
+      int r = 0;
+      for (int b=0; b<bits; b++)
+        r |= ((i >> b) & 1) << (bits-1-b);
+      this->bit_reverse[i] = r;
+    }
+    this->buffer.resize(half);
+    this->magnitude.assign(half+1, 0);
+    this->previous_magnitude.assign(half+1, 0);
+  }
+
+  double TelinkAudioAnalyzer::get_window_delay() const {
+    return 1000.0 * (this->fft_size/2 + this->hop_size) / this->sample_rate;
+  }
+
+  void TelinkAudioAnalyzer::transform() {
+    /* A real signal of length N is packed as N/2 complex values z[n] = x[2n] + i x[2n+1],
+       transformed with an in-place radix-2 FFT, then split into the N/2+1 bins of the
+       real spectrum.
+    */
+    int n = this->fft_size, half = n/2;
+    for (int i=0; i<half; i++) {
+      int j = this->bit_reverse[i];
+      this->buffer[j] = std::complex<float>(this->history[2*i]*this->window[2*i], this->history[2*i+1]*this->window[2*i+1]);
+    }
+    for (int len=2; len<=half; len<<=1) {
+      int step = n/len; // twiddle stride in full-size table
+      for (int start=0; start<half; start+=len) {
+        for (int k=0; k<len/2; k++) {
+          std::complex<float> t = this->twiddles[k*step] * this->buffer[start+k+len/2];
+          this->buffer[start+k+len/2] = this->buffer[start+k] - t;
+          this->buffer[start+k] += t;
+        }
+      }
+    }
+    for (int k=0; k<=half; k++) {
+      std::complex<float> a = this->buffer[k % half], b = std::conj(this->buffer[(half-k) % half]);
+      std::complex<float> even = 0.5f*(a + b), odd = std::complex<float>(0, -0.5f)*(a - b);
+      std::complex<float> w = k < half ? this->twiddles[k] : std::complex<float>(-1, 0);
+      this->magnitude[k] = std::abs(even + w*odd);
+    }
+  }
+
+  TelinkAudioFrame TelinkAudioAnalyzer::analyze(const float * samples) {
+    std::copy(this->history.begin() + this->hop_size, this->history.end(), this->history.begin());
+    std::copy(samples, samples + this->hop_size, this->history.end() - this->hop_size);
+    this->magnitude.swap(this->previous_magnitude);
+    this->transform();
+
+    TelinkAudioFrame frame;
+    float bin_width = static_cast<float>(this->sample_rate) / this->fft_size;
+    float norm = 2.0f / this->fft_size;
+    for (std::size_t k=1; k<this->magnitude.size(); k++) {
+      float f = k * bin_width;
+      float m = this->magnitude[k] * norm;
+      if (f < 250) frame.bass += m*m;
+      else if (f < 2000) frame.mid += m*m;
+      else if (f < 8000) frame.treble += m*m;
+      float d = this->magnitude[k] - this->previous_magnitude[k];
+      if (d > 0) frame.flux += d * norm;
+    }
+
+    // adaptive threshold with a refractory period of ~100 ms
+    int refractory = std::max(1, this->sample_rate / (10 * this->hop_size));
+    this->hops_since_onset++;
+    frame.onset = frame.flux > 1.5f*this->flux_average + 1e-3f && this->hops_since_onset > refractory;
+    if (frame.onset)
+      this->hops_since_onset = 0;
+    this->flux_average = 0.9f*this->flux_average + 0.1f*frame.flux;
+    return frame;
+  }
+
+  std::string TelinkAudioMapper::map(const TelinkAudioFrame & frame) {
+    float energy = frame.bass + frame.mid + frame.treble;
+    this->peak = std::max(energy, this->peak * 0.995f);
+    float level = std::sqrt(energy / this->peak);
+
+    // bass pulls the hue towards red, treble towards blue
+    float balance = (frame.treble - frame.bass) / (energy + 1e-9f);
+    float target = 120.0f + 120.0f*balance;
+    this->hue += 0.2f * (target - this->hue);
+    if (frame.onset) {
+      this->flash = 1.0f;
+      this->hue += 60.0f;
+    }
+    this->hue = std::fmod(this->hue + 360.0f, 360.0f);
+
+    float H = this->hue, S = 1.0f - 0.5f*this->flash, V = std::max(level, this->flash);
+    this->flash *= 0.8f;
+    unsigned char payload[COLOR_PAYLOAD_SIZE];
+    batch_from_hsv(&H, &S, &V, 1, payload);
+    return std::string(reinterpret_cast<char*>(payload), COLOR_PAYLOAD_SIZE);
+  }
+
+}
@@ -0,0 +1,181 @@
+/** \file telink_audio.h
+ *  Streaming audio analysis for driving lights in music mode.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_AUDIO_H__
+#define __TELINK_AUDIO_H__
+
+#include <string>
+#include <vector>
+#include <complex>
+
+namespace telink {
+
+  /** \class TelinkAudioFrame
+   *  \brief Features extracted from one analysis hop.
+   */
+  class TelinkAudioFrame {
+  public:
+    /** \property float bass
+     *  \brief Energy in the 20-250 Hz band.
+     */
+    float bass = 0;
+
+    /** \property float mid
+     *  \brief Energy in the 250-2000 Hz band.
+     */
+    float mid = 0;
+
+    /** \property float treble
+     *  \brief Energy in the 2000-8000 Hz band.
+     */
+    float treble = 0;
+
+    /** \property float flux
+     *  \brief Spectral flux (sum of positive magnitude changes since previous hop).
+     */
+    float flux = 0;
+
+    /** \property bool onset
+     *  \brief true if an onset (beat) was detected in this hop.
+     */
+    bool onset = false;
+  };
+
+
+  /** \class TelinkAudioAnalyzer
+   *  \brief Streaming FFT analyzer computing band energies and onsets from mono PCM.
+   *  Samples are fed hop by hop; each hop triggers an FFT over the last fft_size samples.
+   */
+  class TelinkAudioAnalyzer {
+  private:
+    /** \property int sample_rate
+     *  \brief Sampling rate in Hz.
+     */
+    int sample_rate;
+
+    /** \property int fft_size
+     *  \brief Analysis window length (power of 2).
+     */
+    int fft_size;
+
+    /** \property int hop_size
+     *  \brief Number of new samples between two analyses.
+     */
+    int hop_size;
+
+    /** \property std::vector<float> history
+     *  \brief Last fft_size samples.
+     */
+    std::vector<float> history;
+
+    /** \property std::vector<float> window
+     *  \brief Hann window coefficients.
+     */
+    std::vector<float> window;
+
+    /** \property std::vector<std::complex<float>> buffer
+     *  \brief Work buffer for half-size complex FFT.
+     */
+    std::vector<std::complex<float>> buffer;
+
+    /** \property std::vector<std::complex<float>> twiddles
+     *  \brief Precomputed twiddle factors exp(-2 pi i k / fft_size).
+     */
+    std::vector<std::complex<float>> twiddles;
+
+    /** \property std::vector<int> bit_reverse
+     *  \brief Precomputed bit reversal permutation for half-size FFT.
+     */
+    std::vector<int> bit_reverse;
+
+    /** \property std::vector<float> magnitude
+     *  \brief Magnitude spectrum of current hop.
+     */
+    std::vector<float> magnitude;
+
+    /** \property std::vector<float> previous_magnitude
+     *  \brief Magnitude spectrum of previous hop.
+     */
+    std::vector<float> previous_magnitude;
+
+    /** \property float flux_average
+     *  \brief Running average of spectral flux, used as adaptive onset threshold.
+     */
+    float flux_average = 0;
+
+    /** \property int hops_since_onset
+     *  \brief Number of hops since last detected onset (refractory period).
+     */
+    int hops_since_onset = 0;
+
+    /** \fn void transform()
+     *  \brief Computes the magnitude spectrum of the windowed history with a real FFT.
+     */
+    void transform();
+
+  public:
+    /** \fn TelinkAudioAnalyzer(int sample_rate, int fft_size, int hop_size)
+     *  \brief Object instantiation.
+     *  \param sample_rate : sampling rate in Hz
+     *  \param fft_size : analysis window length; rounded up to a power of 2
+     *  \param hop_size : number of samples per hop; at most fft_size
+     */
+    TelinkAudioAnalyzer(int sample_rate, int fft_size = 1024, int hop_size = 256);
+
+    /** \fn int get_hop_size() const
+     *  \brief Returns the number of samples expected by analyze().
+     *  \returns the hop size.
+     */
+    int get_hop_size() const { return this->hop_size; }
+
+    /** \fn double get_window_delay() const
+     *  \brief Returns the delay added by analysis buffering (half window plus one hop).
+     *  \returns the delay in milliseconds.
+     */
+    double get_window_delay() const;
+
+    /** \fn TelinkAudioFrame analyze(const float * samples)
+     *  \brief Analyzes one hop of mono samples.
+     *  \param samples : hop_size samples, in [-1, 1]
+     *  \returns the extracted features.
+     */
+    TelinkAudioFrame analyze(const float * samples);
+  };
+
+
+  /** \class TelinkAudioMapper
+   *  \brief Maps audio features to a light attribute payload.
+   *  Hue follows the spectral balance, brightness follows loudness with automatic gain,
+   *  onsets flash to full brightness and decay.
+   */
+  class TelinkAudioMapper {
+  private:
+    /** \property float peak
+     *  \brief Slowly decaying loudness peak (automatic gain control).
+     */
+    float peak = 1e-6f;
+
+    /** \property float hue
+     *  \brief Current hue in degrees.
+     */
+    float hue = 0;
+
+    /** \property float flash
+     *  \brief Onset flash level, from 0 to 1.
+     */
+    float flash = 0;
+
+  public:
+    /** \fn std::string map(const TelinkAudioFrame & frame)
+     *  \brief Computes the light attribute payload for given features.
+     *  \param frame : audio features
+     *  \returns an 8-byte payload, as produced by TelinkColor::get_bytes().
+     */
+    std::string map(const TelinkAudioFrame & frame);
+  };
+
+}
+
+#endif // __TELINK_AUDIO_H__
@@ -0,0 +1,201 @@
+/** \file telink_cache.cxx
+ *  Persistent cache of Telink mesh device metadata.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "telink_cache.h"
+
+namespace telink {
+
+  /* Cache file layout (host byte order):
+       bytes 0-7   : magic "TLKCACHE"
+       bytes 8-11  : format version
+       bytes 12-15 : entry size
+       bytes 16-19 : number of entries
+       bytes 20-23 : reserved
+       bytes 24-   : entries
+  */
+  #define CACHE_HEADER_SIZE 24
+
+  #define CACHE_V1_ENTRY_SIZE 56 // version 1 entries end after the flags field
+
+  static_assert(sizeof(TelinkCacheEntry) == 64, "unexpected cache entry size");
+
+  bool parse_mac_address(const std::string & address, uint8_t * mac) {
+    unsigned int b[6];
+    char extra;
+    if (std::sscanf(address.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &extra) != 6)
+      return false;
+    for (int i=0; i<6; i++)
+      mac[i] = b[i];
+    return true;
+  }
+
+  std::string format_mac_address(const uint8_t * mac) {
+    char buffer[18];
+    std::snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return buffer;
+  }
+
+  std::string TelinkCacheEntry::get_address() const {
+    return format_mac_address(this->mac);
+  }
+
+  std::string TelinkCacheEntry::get_proxy() const {
+    return format_mac_address(this->proxy);
+  }
+
+  TelinkCache::TelinkCache(const std::string & path) : path(path) {
+    this->load();
+  }
+
+  TelinkCache::~TelinkCache() {
+    if (this->dirty)
+      this->save();
+  }
+
+  bool TelinkCache::load() {
+    int fd = open(this->path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    std::vector<char> data;
+    if (fstat(fd, &st) == 0 && st.st_size >= CACHE_HEADER_SIZE) {
+      data.resize(st.st_size);
+      if (read(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size()))
+        data.clear();
+    }
+    close(fd);
+
+    uint32_t version, entry_size, count;
+    if (data.size() < CACHE_HEADER_SIZE || std::memcmp(data.data(), CACHE_MAGIC, 8) != 0) {
+      std::cerr << "Invalid cache file " << this->path << std::endl;
+      return false;
+    }
+    std::memcpy(&version, data.data() + 8, 4);
+    std::memcpy(&entry_size, data.data() + 12, 4);
+    std::memcpy(&count, data.data() + 16, 4);
+    bool upgrade = version == 1 && entry_size == CACHE_V1_ENTRY_SIZE;
+    if ((!upgrade && (version != CACHE_VERSION || entry_size != sizeof(TelinkCacheEntry)))
+        || CACHE_HEADER_SIZE + static_cast<uint64_t>(count)*entry_size > data.size()) {
+      std::cerr << "Unsupported or truncated cache file " << this->path << std::endl;
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.resize(count);
+    if (upgrade) {
+      // version 1 entries are a prefix of current ones; new fields start empty
+      std::memset(this->entries.data(), 0, count*sizeof(TelinkCacheEntry));
+      for (uint32_t i=0; i<count; i++)
+        std::memcpy(&this->entries[i], data.data() + CACHE_HEADER_SIZE + i*entry_size, entry_size);
+    } else if (count > 0) {
+      std::memcpy(this->entries.data(), data.data() + CACHE_HEADER_SIZE, count*entry_size);
+    }
+    this->dirty = upgrade;
+    return true;
+  }
+
+  bool TelinkCache::save() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    char header[CACHE_HEADER_SIZE];
+    uint32_t version = CACHE_VERSION, entry_size = sizeof(TelinkCacheEntry), count = this->entries.size();
+    std::memset(header, 0, sizeof(header));
+    std::memcpy(header, CACHE_MAGIC, 8);
+    std::memcpy(header + 8, &version, 4);
+    std::memcpy(header + 12, &entry_size, 4);
+    std::memcpy(header + 16, &count, 4);
+
+    std::string tmp_path = this->path + ".tmp";
+    FILE * f = std::fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr) {
+      std::cerr << "Cannot write cache file " << tmp_path << std::endl;
+      return false;
+    }
+    bool ok = std::fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    if (count > 0)
+      ok = ok && std::fwrite(this->entries.data(), entry_size, count, f) == count;
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp_path.c_str(), this->path.c_str()) != 0) {
+      std::cerr << "Cannot write cache file " << this->path << std::endl;
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+    this->dirty = false;
+    return true;
+  }
+
+  bool TelinkCache::get(const std::string & address, TelinkCacheEntry & entry) const {
+    uint8_t mac[6];
+    if (!parse_mac_address(address, mac)) return false;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & e : this->entries) {
+      if (std::memcmp(e.mac, mac, 6) == 0) {
+        entry = e;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void TelinkCache::update(const std::string & address, const std::function<void(TelinkCacheEntry &)> & modifier) {
+    uint8_t mac[6];
+    if (!parse_mac_address(address, mac)) return;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = std::find_if(this->entries.begin(), this->entries.end(), [&mac](const TelinkCacheEntry & e) {
+      return std::memcmp(e.mac, mac, 6) == 0;
+    });
+    if (it == this->entries.end()) {
+      TelinkCacheEntry entry;
+      std::memset(&entry, 0, sizeof(entry));
+      std::memcpy(entry.mac, mac, 6);
+      this->entries.push_back(entry);
+      it = this->entries.end() - 1;
+    }
+    modifier(*it);
+    it->updated = std::time(nullptr);
+    this->dirty = true;
+  }
+
+  void TelinkCache::set_proxy(int mesh_id, const std::string & proxy) {
+    uint8_t mac[6];
+    if (!parse_mac_address(proxy, mac)) return;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & entry : this->entries) {
+      if (!(entry.flags & CACHE_MESH_ID) || entry.mesh_id != mesh_id) continue;
+      if ((entry.flags & CACHE_PROXY) && std::memcmp(entry.proxy, mac, 6) == 0) continue;
+      std::memcpy(entry.proxy, mac, 6);
+      entry.flags |= CACHE_PROXY;
+      entry.updated = std::time(nullptr);
+      this->dirty = true;
+    }
+  }
+
+  void TelinkCache::remove(const std::string & address) {
+    uint8_t mac[6];
+    if (!parse_mac_address(address, mac)) return;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = std::remove_if(this->entries.begin(), this->entries.end(), [&mac](const TelinkCacheEntry & e) {
+      return std::memcmp(e.mac, mac, 6) == 0;
+    });
+    if (it != this->entries.end()) {
+      this->entries.erase(it, this->entries.end());
+      this->dirty = true;
+    }
+  }
+
+  std::vector<TelinkCacheEntry> TelinkCache::get_entries() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->entries;
+  }
+
+}
@@ -0,0 +1,219 @@
+/** \file telink_cache.h
+ *  Persistent cache of Telink mesh device metadata.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_CACHE_H__
+#define __TELINK_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+namespace telink {
+
+  /** \brief Magic bytes at the beginning of a cache file. */
+  #define CACHE_MAGIC "TLKCACHE"
+  /** \brief Cache file format version. */
+  #define CACHE_VERSION 2
+
+  // Cache entry validity flags
+  #define CACHE_MESH_ID   0x01
+  #define CACHE_GROUPS    0x02
+  #define CACHE_FIRMWARE  0x04
+  #define CACHE_STATE     0x08
+  #define CACHE_COLOR     0x10
+  #define CACHE_PROXY     0x20
+  #define CACHE_HANDLES   0x40
+
+  /** \class TelinkCacheEntry
+   *  \brief Cached metadata of a mesh device. Entries are stored as-is in cache files (64 bytes, host byte order).
+   */
+  class TelinkCacheEntry {
+  public:
+    /** \property uint64_t updated
+     *  \brief Time of last update of any field (seconds since epoch).
+     */
+    uint64_t updated;
+
+    /** \property uint8_t mac[6]
+     *  \brief Device MAC address, most significant byte first.
+     */
+    uint8_t mac[6];
+
+    /** \property uint8_t proxy[6]
+     *  \brief MAC address of the connected node that last relayed a report of the device.
+     */
+    uint8_t proxy[6];
+
+    /** \property uint16_t mesh_id
+     *  \brief Device mesh ID.
+     */
+    uint16_t mesh_id;
+
+    /** \property uint8_t groups[10]
+     *  \brief Group IDs, as given by a group ID report.
+     */
+    uint8_t groups[10];
+
+    /** \property uint8_t version[10]
+     *  \brief Firmware version data, as given by a device version report.
+     */
+    uint8_t version[10];
+
+    /** \property uint8_t state
+     *  \brief Last known power state (1 = on, 0 = off).
+     */
+    uint8_t state;
+
+    /** \property uint8_t brightness
+     *  \brief Last known brightness, from 0 to 100.
+     */
+    uint8_t brightness;
+
+    /** \property uint8_t color[5]
+     *  \brief Last known R, G, B, Y and W values.
+     */
+    uint8_t color[5];
+
+    /** \property uint8_t flags
+     *  \brief Combination of CACHE_* flags telling which fields are valid.
+     */
+    uint8_t flags;
+
+    /** \property uint16_t handles[5]
+     *  \brief ATT handles of notification, notification configuration, command, pairing and
+     *  OTA characteristics, as resolved by the last service discovery.
+     */
+    uint16_t handles[5];
+
+    /** \property uint32_t checked
+     *  \brief Time mesh ID, groups or firmware version were last reported by the device
+     *  (seconds since epoch); 0 if never.
+     */
+    uint32_t checked;
+
+    /** \fn std::string get_address() const
+     *  \brief Returns the device MAC address.
+     *  \returns the MAC address in the form AA:BB:CC:DD:EE:FF.
+     */
+    std::string get_address() const;
+
+    /** \fn std::string get_proxy() const
+     *  \brief Returns the MAC address of the last good proxy.
+     *  \returns the MAC address in the form AA:BB:CC:DD:EE:FF.
+     */
+    std::string get_proxy() const;
+  };
+
+  /** \class TelinkCache
+   *  \brief Set of device metadata, loaded from and saved to a compact binary file.
+   *  All methods are thread-safe.
+   */
+  class TelinkCache {
+  private:
+    /** \property std::string path
+     *  \brief Cache file path.
+     */
+    std::string path;
+
+    /** \property std::vector<TelinkCacheEntry> entries
+     *  \brief Cached entries.
+     */
+    std::vector<TelinkCacheEntry> entries;
+
+    /** \property bool dirty
+     *  \brief true if entries changed since last load or save.
+     */
+    bool dirty = false;
+
+    /** \property std::mutex mutex
+     *  \brief Protects entries.
+     */
+    mutable std::mutex mutex;
+
+  public:
+    /** \fn TelinkCache(const std::string & path)
+     *  \brief Object instantiation. Loads the cache file if it exists.
+     *  \param path : cache file path.
+     */
+    TelinkCache(const std::string & path);
+
+    TelinkCache(const TelinkCache &) = delete;
+    TelinkCache & operator=(const TelinkCache &) = delete;
+
+    /** \fn ~TelinkCache()
+     *  \brief Saves the cache if it changed.
+     */
+    ~TelinkCache();
+
+    /** \fn bool load()
+     *  \brief Replaces entries with the content of the cache file.
+     *  Files written by version 1 are converted.
+     *  \returns true if the file was read, false if it is missing or invalid.
+     */
+    bool load();
+
+    /** \fn bool save()
+     *  \brief Writes entries to the cache file (atomically replaced).
+     *  \returns true on success, false otherwise.
+     */
+    bool save();
+
+    /** \fn bool get(const std::string & address, TelinkCacheEntry & entry) const
+     *  \brief Gets the entry of a device.
+     *  \param address : device MAC address.
+     *  \param entry : copy of the entry (output).
+     *  \returns true if the device is cached, false otherwise.
+     */
+    bool get(const std::string & address, TelinkCacheEntry & entry) const;
+
+    /** \fn void update(const std::string & address, const std::function<void(TelinkCacheEntry &)> & modifier)
+     *  \brief Modifies the entry of a device, creating it if needed, and sets its update time.
+     *  \param address : device MAC address.
+     *  \param modifier : function changing the entry.
+     */
+    void update(const std::string & address, const std::function<void(TelinkCacheEntry &)> & modifier);
+
+    /** \fn void remove(const std::string & address)
+     *  \brief Removes the entry of a device.
+     *  \param address : device MAC address.
+     */
+    void remove(const std::string & address);
+
+    /** \fn void set_proxy(int mesh_id, const std::string & proxy)
+     *  \brief Records the connected node through which reports of a device arrived. The device
+     *  is found by mesh ID, so entries without CACHE_MESH_ID are left alone; mesh IDs are only
+     *  unique within a mesh, so a cache should not hold devices of several meshes.
+     *  \param mesh_id : mesh ID of the reporting device.
+     *  \param proxy : MAC address of the connected node.
+     */
+    void set_proxy(int mesh_id, const std::string & proxy);
+
+    /** \fn std::vector<TelinkCacheEntry> get_entries() const
+     *  \brief Returns a copy of all entries.
+     *  \returns the cached entries.
+     */
+    std::vector<TelinkCacheEntry> get_entries() const;
+  };
+
+  /** \fn bool parse_mac_address(const std::string & address, uint8_t * mac)
+   *  \brief Converts a MAC address string into bytes.
+   *  \param address : MAC address in the form AA:BB:CC:DD:EE:FF.
+   *  \param mac : 6-byte output, most significant byte first.
+   *  \returns true if the address is valid, false otherwise.
+   */
+  bool parse_mac_address(const std::string & address, uint8_t * mac);
+
+  /** \fn std::string format_mac_address(const uint8_t * mac)
+   *  \brief Converts MAC address bytes into a string.
+   *  \param mac : 6 bytes, most significant byte first.
+   *  \returns the MAC address in the form AA:BB:CC:DD:EE:FF.
+   */
+  std::string format_mac_address(const uint8_t * mac);
+
+}
+
+#endif // __TELINK_CACHE_H__
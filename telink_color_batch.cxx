@@ -0,0 +1,290 @@
+/** \file telink_color_batch.cxx
+ *  Batch conversion of color arrays into Telink light attribute payloads.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "telink_color_batch.h"
+
+#if !defined(TELINK_NO_SIMD) && defined(__SSE2__)
+  #include <emmintrin.h>
+  #define TELINK_SIMD_SSE2
+#elif !defined(TELINK_NO_SIMD) && defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define TELINK_SIMD_NEON
+#endif
+
+namespace telink {
+
+  /* Lookup tables.
+     The Kelvin table holds the ramp d * 255 / 1900 for d = 0..1900, which is used
+     for Y above 4600 K (d = 6500 - T) and for W below 4600 K (d = T - 2700).
+     It is generated at compile time to match TelinkColor::set_temperature exactly.
+  */
+  template <unsigned... I> struct index_sequence {};
+
+  template <class A, class B> struct concat_sequence;
+  template <unsigned... A, unsigned... B> struct concat_sequence<index_sequence<A...>, index_sequence<B...>> {
+    typedef index_sequence<A..., (sizeof...(A) + B)...> type;
+  };
+
+  template <unsigned N> struct make_index_sequence {
+    typedef typename concat_sequence<typename make_index_sequence<N/2>::type, typename make_index_sequence<N - N/2>::type>::type type;
+  };
+  template <> struct make_index_sequence<0> { typedef index_sequence<> type; };
+  template <> struct make_index_sequence<1> { typedef index_sequence<0> type; };
+
+  constexpr unsigned char kelvin_ramp(unsigned d) {
+    return static_cast<unsigned char>(d * 255 / 1900);
+  }
+
+  template <class S> struct kelvin_table;
+  template <unsigned... I> struct kelvin_table<index_sequence<I...>> {
+    static constexpr unsigned char values[sizeof...(I)] = { kelvin_ramp(I)... };
+  };
+  template <unsigned... I> constexpr unsigned char kelvin_table<index_sequence<I...>>::values[sizeof...(I)];
+
+  typedef kelvin_table<make_index_sequence<1901>::type> kelvin_lut;
+
+  // round(255 * (i / 255)^2.2)
+  static constexpr unsigned char gamma_lut[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+  };
+
+  // linear sRGB primaries from CIE XYZ (D65)
+  static const float xyz_to_rgb[9] = {
+     3.2404542f, -1.5371385f, -0.4985314f,
+    -0.9692660f,  1.8760108f,  0.0415560f,
+     0.0556434f, -0.2040259f,  1.0572252f
+  };
+
+  void kelvin_to_yw(int temperature, unsigned char & Y, unsigned char & W) {
+    temperature = std::max(std::min(6500, temperature), 2700);
+    Y = kelvin_lut::values[std::min(1900, 6500 - temperature)];
+    W = kelvin_lut::values[std::min(1900, temperature - 2700)];
+  }
+
+  unsigned char gamma_correct(unsigned char value) {
+    return gamma_lut[value];
+  }
+
+  /** \fn static void write_payload(unsigned char * payload, int brightness, int R, int G, int B, int Y, int W, bool gamma)
+   *  \brief Writes a single light attribute payload.
+   *  \param payload : output buffer of COLOR_PAYLOAD_SIZE bytes
+   *  \param brightness : brightness, from 0 to 100%
+   *  \param R : red component, from 0 to 255
+   *  \param G : green component, from 0 to 255
+   *  \param B : blue component, from 0 to 255
+   *  \param Y : CCT Y value
+   *  \param W : CCT W value
+   *  \param gamma : if true, RGB components are gamma corrected
+   */
+  static inline void write_payload(unsigned char * payload, int brightness, int R, int G, int B, int Y, int W, bool gamma) {
+    payload[0] = static_cast<unsigned char>(brightness);
+    payload[1] = gamma ? gamma_lut[R & 0xff] : static_cast<unsigned char>(R);
+    payload[2] = gamma ? gamma_lut[G & 0xff] : static_cast<unsigned char>(G);
+    payload[3] = gamma ? gamma_lut[B & 0xff] : static_cast<unsigned char>(B);
+    payload[4] = static_cast<unsigned char>(Y);
+    payload[5] = static_cast<unsigned char>(W);
+    payload[6] = 0;
+    payload[7] = 0;
+  }
+
+  /** \fn static inline float clamp_unit(float value)
+   *  \brief Clamps a value to [0, 1]; NaN gives 0.
+   *  \param value : value to clamp
+   *  \returns the clamped value.
+   */
+  static inline float clamp_unit(float value) {
+    return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+  }
+
+  /** \fn static inline float hsv_channel(float h6, float S, float n)
+   *  \brief Computes one RGB channel of a fully bright HSV color.
+   *  \param h6 : hue divided by 60 degrees, in [0, 6]
+   *  \param S : saturation, from 0 to 1
+   *  \param n : channel offset (5 for R, 3 for G, 1 for B)
+   *  \returns the channel value, from 0 to 1.
+   */
+  static inline float hsv_channel(float h6, float S, float n) {
+    float k = n + h6;
+    k -= 6.0f * std::floor(k * (1.0f/6.0f));
+    return 1.0f - S * std::max(0.0f, std::min(std::min(k, 4.0f - k), 1.0f));
+  }
+
+  static void hsv_scalar(const float * H, const float * S, const float * V, std::size_t start, std::size_t count, unsigned char * payloads, bool gamma) {
+    for (std::size_t i=start; i<count; i++) {
+      float h6 = H[i] * (1.0f/60.0f);
+      h6 -= 6.0f * std::floor(h6 * (1.0f/6.0f));
+      h6 = h6 > 0.0f ? (h6 < 6.0f ? h6 : 6.0f) : 0.0f; // also catches NaN or infinite hue
+      float s = clamp_unit(S[i]);
+      int R = std::lrint(hsv_channel(h6, s, 5.0f) * 255.0f);
+      int G = std::lrint(hsv_channel(h6, s, 3.0f) * 255.0f);
+      int B = std::lrint(hsv_channel(h6, s, 1.0f) * 255.0f);
+      write_payload(payloads + i*COLOR_PAYLOAD_SIZE, std::lrint(clamp_unit(V[i]) * 100.0f), R, G, B, 0, 0, gamma);
+    }
+  }
+
+  static void xy_scalar(const float * x, const float * y, const unsigned char * brightness, std::size_t start, std::size_t count, unsigned char * payloads, bool gamma) {
+    for (std::size_t i=start; i<count; i++) {
+      float yy = std::max(y[i], 1e-6f);
+      float X = x[i] / yy, Z = (1.0f - x[i] - y[i]) / yy;
+      float rgb[3];
+      for (int c=0; c<3; c++)
+        rgb[c] = std::max(0.0f, xyz_to_rgb[3*c]*X + xyz_to_rgb[3*c+1] + xyz_to_rgb[3*c+2]*Z);
+      float scale = 255.0f / std::max(std::max(std::max(rgb[0], rgb[1]), rgb[2]), 1e-6f);
+      write_payload(payloads + i*COLOR_PAYLOAD_SIZE, brightness[i] % 101, std::lrint(rgb[0]*scale), std::lrint(rgb[1]*scale), std::lrint(rgb[2]*scale), 0, 0, gamma);
+    }
+  }
+
+  #if defined(TELINK_SIMD_SSE2) || defined(TELINK_SIMD_NEON)
+  /* Thin wrappers over 4-lane float vectors, so that the kernels below are written once
+     for every instruction set.
+  */
+  #if defined(TELINK_SIMD_SSE2)
+  typedef __m128 vf;
+  static inline vf vf_load(const float * p) { return _mm_loadu_ps(p); }
+  static inline vf vf_set(float v) { return _mm_set1_ps(v); }
+  static inline vf vf_add(vf a, vf b) { return _mm_add_ps(a, b); }
+  static inline vf vf_sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+  static inline vf vf_mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+  static inline vf vf_div(vf a, vf b) { return _mm_div_ps(a, b); }
+  static inline vf vf_min(vf a, vf b) { return _mm_min_ps(a, b); }
+  static inline vf vf_max(vf a, vf b) { return _mm_max_ps(a, b); }
+  static inline vf vf_floor(vf a) {
+    vf t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+  }
+  static inline void vf_round_store(int * p, vf a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_cvtps_epi32(a)); }
+  #else
+  typedef float32x4_t vf;
+  static inline vf vf_load(const float * p) { return vld1q_f32(p); }
+  static inline vf vf_set(float v) { return vdupq_n_f32(v); }
+  static inline vf vf_add(vf a, vf b) { return vaddq_f32(a, b); }
+  static inline vf vf_sub(vf a, vf b) { return vsubq_f32(a, b); }
+  static inline vf vf_mul(vf a, vf b) { return vmulq_f32(a, b); }
+  static inline vf vf_min(vf a, vf b) { return vminq_f32(a, b); }
+  static inline vf vf_max(vf a, vf b) { return vmaxq_f32(a, b); }
+  #if defined(__aarch64__)
+  static inline vf vf_div(vf a, vf b) { return vdivq_f32(a, b); }
+  static inline vf vf_floor(vf a) { return vrndmq_f32(a); }
+  static inline void vf_round_store(int * p, vf a) { vst1q_s32(p, vcvtnq_s32_f32(a)); }
+  #else
+  static inline vf vf_div(vf a, vf b) {
+    vf r = vrecpeq_f32(b);
+    r = vmulq_f32(vrecpsq_f32(b, r), r);
+    r = vmulq_f32(vrecpsq_f32(b, r), r);
+    return vmulq_f32(a, r);
+  }
+  static inline vf vf_floor(vf a) {
+    vf t = vcvtq_f32_s32(vcvtq_s32_f32(a));
+    return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(t, a), vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))));
+  }
+  static inline void vf_round_store(int * p, vf a) { vst1q_s32(p, vcvtq_s32_f32(vaddq_f32(a, vdupq_n_f32(0.5f)))); }
+  #endif
+  #endif
+
+  static inline vf vf_clamp_unit(vf a) {
+    return vf_min(vf_max(a, vf_set(0.0f)), vf_set(1.0f));
+  }
+
+  static inline vf vf_hsv_channel(vf h6, vf S, float n) {
+    vf k = vf_add(vf_set(n), h6);
+    k = vf_sub(k, vf_mul(vf_set(6.0f), vf_floor(vf_mul(k, vf_set(1.0f/6.0f)))));
+    vf f = vf_min(vf_min(k, vf_sub(vf_set(4.0f), k)), vf_set(1.0f));
+    f = vf_max(f, vf_set(0.0f));
+    return vf_sub(vf_set(1.0f), vf_mul(S, f));
+  }
+
+  static std::size_t hsv_simd(const float * H, const float * S, const float * V, std::size_t count, unsigned char * payloads, bool gamma) {
+    int R[4], G[4], B[4], L[4];
+    std::size_t i = 0;
+    for (; i+4<=count; i+=4) {
+      vf h6 = vf_mul(vf_load(H+i), vf_set(1.0f/60.0f));
+      h6 = vf_sub(h6, vf_mul(vf_set(6.0f), vf_floor(vf_mul(h6, vf_set(1.0f/6.0f)))));
+      h6 = vf_min(vf_max(h6, vf_set(0.0f)), vf_set(6.0f));
+      vf s = vf_clamp_unit(vf_load(S+i));
+      vf_round_store(R, vf_mul(vf_hsv_channel(h6, s, 5.0f), vf_set(255.0f)));
+      vf_round_store(G, vf_mul(vf_hsv_channel(h6, s, 3.0f), vf_set(255.0f)));
+      vf_round_store(B, vf_mul(vf_hsv_channel(h6, s, 1.0f), vf_set(255.0f)));
+      vf_round_store(L, vf_mul(vf_clamp_unit(vf_load(V+i)), vf_set(100.0f)));
+      for (int j=0; j<4; j++)
+        write_payload(payloads + (i+j)*COLOR_PAYLOAD_SIZE, L[j], R[j], G[j], B[j], 0, 0, gamma);
+    }
+    return i;
+  }
+
+  static std::size_t xy_simd(const float * x, const float * y, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma) {
+    int rgb[3][4];
+    std::size_t i = 0;
+    for (; i+4<=count; i+=4) {
+      vf vx = vf_load(x+i), vy = vf_load(y+i);
+      vf yy = vf_max(vy, vf_set(1e-6f));
+      vf X = vf_div(vx, yy);
+      vf Z = vf_div(vf_sub(vf_sub(vf_set(1.0f), vx), vy), yy);
+      vf c[3];
+      for (int k=0; k<3; k++) {
+        c[k] = vf_add(vf_mul(vf_set(xyz_to_rgb[3*k]), X), vf_set(xyz_to_rgb[3*k+1]));
+        c[k] = vf_max(vf_add(c[k], vf_mul(vf_set(xyz_to_rgb[3*k+2]), Z)), vf_set(0.0f));
+      }
+      vf m = vf_max(vf_max(vf_max(c[0], c[1]), c[2]), vf_set(1e-6f));
+      vf scale = vf_div(vf_set(255.0f), m);
+      for (int k=0; k<3; k++)
+        vf_round_store(rgb[k], vf_mul(c[k], scale));
+      for (int j=0; j<4; j++)
+        write_payload(payloads + (i+j)*COLOR_PAYLOAD_SIZE, brightness[i+j] % 101, rgb[0][j], rgb[1][j], rgb[2][j], 0, 0, gamma);
+    }
+    return i;
+  }
+  #endif
+
+  void batch_from_rgb(const unsigned char * R, const unsigned char * G, const unsigned char * B, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma) {
+    for (std::size_t i=0; i<count; i++)
+      write_payload(payloads + i*COLOR_PAYLOAD_SIZE, brightness[i] % 101, R[i], G[i], B[i], 0, 0, gamma);
+  }
+
+  void batch_from_hsv(const float * H, const float * S, const float * V, std::size_t count, unsigned char * payloads, bool gamma) {
+    std::size_t done = 0;
+    #if defined(TELINK_SIMD_SSE2) || defined(TELINK_SIMD_NEON)
+    done = hsv_simd(H, S, V, count, payloads, gamma);
+    #endif
+    hsv_scalar(H, S, V, done, count, payloads, gamma);
+  }
+
+  void batch_from_xy(const float * x, const float * y, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma) {
+    std::size_t done = 0;
+    #if defined(TELINK_SIMD_SSE2) || defined(TELINK_SIMD_NEON)
+    done = xy_simd(x, y, brightness, count, payloads, gamma);
+    #endif
+    xy_scalar(x, y, brightness, done, count, payloads, gamma);
+  }
+
+  void batch_from_kelvin(const int * temperature, const unsigned char * brightness, std::size_t count, unsigned char * payloads) {
+    for (std::size_t i=0; i<count; i++) {
+      unsigned char Y, W;
+      kelvin_to_yw(temperature[i], Y, W);
+      int level = brightness[i] % 101;
+      if (level == 0) level = 3; // same as TelinkColor::set_temperature
+      write_payload(payloads + i*COLOR_PAYLOAD_SIZE, level, 0, 0, 0, Y, W, false);
+    }
+  }
+
+}
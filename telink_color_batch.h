@@ -0,0 +1,89 @@
+/** \file telink_color_batch.h
+ *  Batch conversion of color arrays into Telink light attribute payloads.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_COLOR_BATCH_H__
+#define __TELINK_COLOR_BATCH_H__
+
+#include <cstddef>
+
+namespace telink {
+
+  /** \brief Size of a light attribute payload, as returned by TelinkColor::get_bytes(). */
+  #define COLOR_PAYLOAD_SIZE 8
+
+  /* Payloads produced by the functions below are packed back to back in the output
+     buffer, COLOR_PAYLOAD_SIZE bytes per color, with the layout of TelinkColor::get_bytes():
+       byte 0 : brightness (0-100)
+       bytes 1-3 : R, G, B
+       bytes 4-5 : Y, W
+       byte 6 : music mode flag (always 0 here)
+       byte 7 : 0
+     Input arrays are in struct-of-arrays form and must all hold at least count elements.
+  */
+
+  /** \fn void kelvin_to_yw(int temperature, unsigned char & Y, unsigned char & W)
+   *  \brief Converts a black body temperature into CCT Y and W parameters using a lookup table.
+   *  \param temperature : equivalent temperature, from 2700 to 6500 K (clamped)
+   *  \param Y : CCT Y value (output)
+   *  \param W : CCT W value (output)
+   */
+  void kelvin_to_yw(int temperature, unsigned char & Y, unsigned char & W);
+
+  /** \fn unsigned char gamma_correct(unsigned char value)
+   *  \brief Applies a 2.2 gamma correction to a color component using a lookup table.
+   *  \param value : color component, from 0 to 255
+   *  \returns the corrected color component.
+   */
+  unsigned char gamma_correct(unsigned char value);
+
+  /** \fn void batch_from_rgb(const unsigned char * R, const unsigned char * G, const unsigned char * B, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma)
+   *  \brief Converts arrays of RGB colors into light attribute payloads.
+   *  \param R : red components, from 0 to 255
+   *  \param G : green components, from 0 to 255
+   *  \param B : blue components, from 0 to 255
+   *  \param brightness : brightness values, from 0 to 100%
+   *  \param count : number of colors to convert
+   *  \param payloads : output buffer of count x COLOR_PAYLOAD_SIZE bytes
+   *  \param gamma : if true, RGB components are gamma corrected
+   */
+  void batch_from_rgb(const unsigned char * R, const unsigned char * G, const unsigned char * B, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma = false);
+
+  /** \fn void batch_from_hsv(const float * H, const float * S, const float * V, std::size_t count, unsigned char * payloads, bool gamma)
+   *  \brief Converts arrays of HSV colors into light attribute payloads.
+   *  Hue and saturation set the RGB components at full scale; value sets the brightness.
+   *  \param H : hue in degrees (wrapped to [0, 360))
+   *  \param S : saturation, from 0 to 1
+   *  \param V : value, from 0 to 1
+   *  \param count : number of colors to convert
+   *  \param payloads : output buffer of count x COLOR_PAYLOAD_SIZE bytes
+   *  \param gamma : if true, RGB components are gamma corrected
+   */
+  void batch_from_hsv(const float * H, const float * S, const float * V, std::size_t count, unsigned char * payloads, bool gamma = false);
+
+  /** \fn void batch_from_xy(const float * x, const float * y, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma)
+   *  \brief Converts arrays of CIE 1931 xy chromaticities into light attribute payloads.
+   *  Chromaticities are mapped to linear sRGB primaries and normalized to full scale.
+   *  \param x : CIE x coordinates
+   *  \param y : CIE y coordinates
+   *  \param brightness : brightness values, from 0 to 100%
+   *  \param count : number of colors to convert
+   *  \param payloads : output buffer of count x COLOR_PAYLOAD_SIZE bytes
+   *  \param gamma : if true, RGB components are gamma corrected
+   */
+  void batch_from_xy(const float * x, const float * y, const unsigned char * brightness, std::size_t count, unsigned char * payloads, bool gamma = false);
+
+  /** \fn void batch_from_kelvin(const int * temperature, const unsigned char * brightness, std::size_t count, unsigned char * payloads)
+   *  \brief Converts arrays of black body temperatures into light attribute payloads.
+   *  Gives the same result as TelinkColor(temperature, brightness).get_bytes().
+   *  \param temperature : equivalent temperatures, from 2700 to 6500 K (clamped)
+   *  \param brightness : brightness values, from 0 to 100%
+   *  \param count : number of colors to convert
+   *  \param payloads : output buffer of count x COLOR_PAYLOAD_SIZE bytes
+   */
+  void batch_from_kelvin(const int * temperature, const unsigned char * brightness, std::size_t count, unsigned char * payloads);
+
+}
+
+#endif // __TELINK_COLOR_BATCH_H__
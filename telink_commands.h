@@ -0,0 +1,253 @@
+/** \file telink_commands.h
+ *  Compile-time table of Telink mesh commands: opcodes, payload layouts and expected reports.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_COMMANDS_H__
+#define __TELINK_COMMANDS_H__
+
+#include <array>
+#include <string>
+#include <cstddef>
+
+namespace telink {
+
+  // Command codes
+  constexpr unsigned char COMMAND_OTA_UPDATE            = 0xC6;
+  constexpr unsigned char COMMAND_QUERY_OTA_STATE       = 0xC7;
+  constexpr unsigned char COMMAND_OTA_STATUS_REPORT     = 0xC8;
+  constexpr unsigned char COMMAND_GROUP_ID_QUERY        = 0xDD;
+  constexpr unsigned char COMMAND_GROUP_ID_REPORT       = 0xD4;
+  constexpr unsigned char COMMAND_GROUP_EDIT            = 0xD7;
+  constexpr unsigned char COMMAND_ONLINE_STATUS_REPORT  = 0xDC;
+  constexpr unsigned char COMMAND_ADDRESS_EDIT          = 0xE0;
+  constexpr unsigned char COMMAND_ADDRESS_REPORT        = 0xE1;
+  constexpr unsigned char COMMAND_RESET                 = 0xE3;
+  constexpr unsigned char COMMAND_TIME_QUERY            = 0xE8;
+  constexpr unsigned char COMMAND_TIME_REPORT           = 0xE9;
+  constexpr unsigned char COMMAND_TIME_SET              = 0xE4;
+  constexpr unsigned char COMMAND_DEVICE_INFO_QUERY     = 0xEA;
+  constexpr unsigned char COMMAND_DEVICE_INFO_REPORT    = 0xEB;
+  constexpr unsigned char COMMAND_SCENARIO_QUERY        = 0xC0;
+  constexpr unsigned char COMMAND_SCENARIO_REPORT       = 0xC1;
+  constexpr unsigned char COMMAND_SCENARIO_LOAD         = 0xF2;
+  constexpr unsigned char COMMAND_SCENARIO_EDIT         = 0xF3;
+  constexpr unsigned char COMMAND_STATUS_QUERY          = 0xDA;
+  constexpr unsigned char COMMAND_STATUS_REPORT         = 0xDB;
+  constexpr unsigned char COMMAND_ALARM_QUERY           = 0xE6;
+  constexpr unsigned char COMMAND_ALARM_REPORT          = 0xE7;
+  constexpr unsigned char COMMAND_ALARM_EDIT            = 0xE5;
+  constexpr unsigned char COMMAND_LIGHT_ON_OFF          = 0xF0;
+  constexpr unsigned char COMMAND_LIGHT_ATTRIBUTES_SET  = 0xF1;
+
+  /** \brief Maximum size of command parameters in a packet. */
+  #define COMMAND_PAYLOAD_MAX 10
+  /** \brief Offset of command parameters in a decrypted packet. */
+  #define COMMAND_PAYLOAD_OFFSET 10
+  /** \brief Report value of commands the device does not reply to. */
+  #define COMMAND_NO_REPORT -1
+
+  /** \class TelinkField
+   *  \brief Little-endian field of a command payload, given by its offset and width in bytes.
+   *  Used to encode command arguments and to decode report fields.
+   */
+  template <std::size_t Offset, std::size_t Width = 1>
+  struct TelinkField {
+    static_assert(Width >= 1 && Width <= 4, "fields are 1 to 4 bytes wide");
+    static constexpr std::size_t end = Offset + Width;
+    static constexpr std::size_t arguments = 1;
+
+    /** \fn static void store(unsigned char * payload, unsigned int value)
+     *  \brief Stores a value in a payload.
+     *  \param payload : payload buffer.
+     *  \param value : field value.
+     */
+    static void store(unsigned char * payload, unsigned int value) {
+      for (std::size_t i=0; i<Width; i++)
+        payload[Offset + i] = (value >> (8*i)) & 0xff;
+    }
+
+    /** \fn static unsigned int load(const std::string & packet, std::size_t base)
+     *  \brief Reads the field from a decrypted packet.
+     *  \param packet : decrypted 20-byte packet.
+     *  \param base : offset of the record holding the field, within the payload.
+     *  \returns the field value.
+     */
+    static unsigned int load(const std::string & packet, std::size_t base = 0) {
+      unsigned int value = 0;
+      for (std::size_t i=0; i<Width; i++)
+        value |= static_cast<unsigned int>(static_cast<unsigned char>(packet[COMMAND_PAYLOAD_OFFSET + base + Offset + i])) << (8*i);
+      return value;
+    }
+  };
+
+  /** \class TelinkConst
+   *  \brief Payload byte with a fixed value, consuming no argument.
+   */
+  template <std::size_t Offset, unsigned char Value>
+  struct TelinkConst {
+    static constexpr std::size_t end = Offset + 1;
+    static constexpr std::size_t arguments = 0;
+
+    static void store(unsigned char * payload) {
+      payload[Offset] = Value;
+    }
+  };
+
+  /** \class TelinkLayout
+   *  \brief Sequence of fields making a payload; arguments fill fields in order.
+   */
+  template <class... Fields>
+  struct TelinkLayout;
+
+  template <>
+  struct TelinkLayout<> {
+    static constexpr std::size_t size = 0;
+    static constexpr std::size_t arguments = 0;
+
+    static void store(unsigned char *) {}
+  };
+
+  template <std::size_t Offset, std::size_t Width, class... Rest>
+  struct TelinkLayout<TelinkField<Offset, Width>, Rest...> {
+    typedef TelinkLayout<Rest...> rest;
+    static constexpr std::size_t size = TelinkField<Offset, Width>::end > rest::size ? TelinkField<Offset, Width>::end : rest::size;
+    static constexpr std::size_t arguments = 1 + rest::arguments;
+
+    template <class Value, class... Values>
+    static void store(unsigned char * payload, Value value, Values... values) {
+      TelinkField<Offset, Width>::store(payload, static_cast<unsigned int>(value));
+      rest::store(payload, values...);
+    }
+  };
+
+  template <std::size_t Offset, unsigned char Value, class... Rest>
+  struct TelinkLayout<TelinkConst<Offset, Value>, Rest...> {
+    typedef TelinkLayout<Rest...> rest;
+    static constexpr std::size_t size = TelinkConst<Offset, Value>::end > rest::size ? TelinkConst<Offset, Value>::end : rest::size;
+    static constexpr std::size_t arguments = rest::arguments;
+
+    template <class... Values>
+    static void store(unsigned char * payload, Values... values) {
+      TelinkConst<Offset, Value>::store(payload);
+      rest::store(payload, values...);
+    }
+  };
+
+  /** \class TelinkCommand
+   *  \brief Descriptor of a command: opcode, payload layout and opcode of the expected report.
+   */
+  template <unsigned char Opcode, int Report, class... Fields>
+  struct TelinkCommand {
+    typedef TelinkLayout<Fields...> layout;
+    static constexpr unsigned char opcode = Opcode;
+    static constexpr int report = Report;
+    static constexpr std::size_t size = layout::size;
+    static constexpr std::size_t arguments = layout::arguments;
+    static_assert(layout::size <= COMMAND_PAYLOAD_MAX, "payload exceeds packet capacity");
+
+    /** \brief Fixed-size payload buffer. */
+    typedef std::array<unsigned char, layout::size> payload;
+
+    /** \fn static payload encode(Values... values)
+     *  \brief Builds the payload from arguments, one per non-constant field.
+     *  \param values : field values.
+     *  \returns the payload.
+     */
+    template <class... Values>
+    static payload encode(Values... values) {
+      static_assert(sizeof...(Values) == layout::arguments, "wrong number of command arguments");
+      payload result = {};
+      layout::store(result.data(), values...);
+      return result;
+    }
+  };
+
+  /** \class TelinkCommandTable
+   *  \brief Set of commands, mapping opcodes to expected reports at compile time.
+   */
+  template <class... Commands>
+  struct TelinkCommandTable;
+
+  template <>
+  struct TelinkCommandTable<> {
+    static constexpr int report(int) { return COMMAND_NO_REPORT; }
+  };
+
+  template <class Command, class... Rest>
+  struct TelinkCommandTable<Command, Rest...> {
+    /** \fn static constexpr int report(int opcode)
+     *  \brief Returns the opcode of the report answering a command.
+     *  \param opcode : command opcode.
+     *  \returns the report opcode, or COMMAND_NO_REPORT.
+     */
+    static constexpr int report(int opcode) {
+      return opcode == Command::opcode && Command::report != COMMAND_NO_REPORT ? Command::report : TelinkCommandTable<Rest...>::report(opcode);
+    }
+  };
+
+  // Mesh commands
+  typedef TelinkCommand<COMMAND_QUERY_OTA_STATE, COMMAND_OTA_STATUS_REPORT, TelinkConst<0, 0x10>> TelinkOtaStateQuery;
+  typedef TelinkCommand<COMMAND_GROUP_ID_QUERY, COMMAND_GROUP_ID_REPORT, TelinkConst<0, 0x0A>, TelinkConst<1, 0x01>> TelinkGroupQuery;
+  typedef TelinkCommand<COMMAND_GROUP_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x01>, TelinkField<1>, TelinkConst<2, 0x80>> TelinkGroupAdd; // group ID
+  typedef TelinkCommand<COMMAND_GROUP_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x00>, TelinkField<1>, TelinkConst<2, 0x80>> TelinkGroupDelete; // group ID
+  typedef TelinkCommand<COMMAND_ADDRESS_EDIT, COMMAND_ADDRESS_REPORT, TelinkConst<0, 0xff>, TelinkConst<1, 0xff>> TelinkAddressQuery;
+  typedef TelinkCommand<COMMAND_ADDRESS_EDIT, COMMAND_ADDRESS_REPORT, TelinkField<0, 2>> TelinkAddressSet; // mesh ID
+  typedef TelinkCommand<COMMAND_TIME_QUERY, COMMAND_TIME_REPORT, TelinkConst<0, 0x10>> TelinkTimeQuery;
+  // year, month, day, hour, minute, second
+  typedef TelinkCommand<COMMAND_TIME_SET, COMMAND_NO_REPORT, TelinkField<0, 2>, TelinkField<2>, TelinkField<3>, TelinkField<4>, TelinkField<5>, TelinkField<6>> TelinkTimeSet;
+  typedef TelinkCommand<COMMAND_DEVICE_INFO_QUERY, COMMAND_DEVICE_INFO_REPORT, TelinkConst<0, 0x10>> TelinkDeviceInfoQuery;
+  typedef TelinkCommand<COMMAND_DEVICE_INFO_QUERY, COMMAND_DEVICE_INFO_REPORT, TelinkConst<0, 0x10>, TelinkConst<1, 0x02>> TelinkDeviceVersionQuery;
+
+  // Light commands
+  typedef TelinkCommand<COMMAND_STATUS_QUERY, COMMAND_STATUS_REPORT, TelinkConst<0, 0x10>> TelinkStatusQuery;
+  typedef TelinkCommand<COMMAND_ALARM_QUERY, COMMAND_ALARM_REPORT, TelinkConst<0, 0x10>> TelinkAlarmQuery;
+  typedef TelinkCommand<COMMAND_SCENARIO_QUERY, COMMAND_SCENARIO_REPORT, TelinkConst<0, 0>, TelinkConst<1, 0>, TelinkField<2>, TelinkConst<3, 0xff>> TelinkScenarioQuery; // scenario ID
+  typedef TelinkCommand<COMMAND_SCENARIO_LOAD, COMMAND_NO_REPORT, TelinkField<0>, TelinkField<1>, TelinkField<2>> TelinkScenarioLoad; // scenario ID, speed, brightness
+  typedef TelinkCommand<COMMAND_SCENARIO_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x01>, TelinkField<1>> TelinkScenarioAdd; // scenario ID
+  typedef TelinkCommand<COMMAND_SCENARIO_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x00>, TelinkField<1>> TelinkScenarioDelete; // scenario ID
+  typedef TelinkCommand<COMMAND_LIGHT_ON_OFF, COMMAND_NO_REPORT, TelinkField<0>, TelinkConst<1, 0>, TelinkConst<2, 0>> TelinkLightOnOff; // state
+  // brightness, R, G, B, Y, W, music mode, brightness only
+  typedef TelinkCommand<COMMAND_LIGHT_ATTRIBUTES_SET, COMMAND_NO_REPORT, TelinkField<0>, TelinkField<1>, TelinkField<2>, TelinkField<3>, TelinkField<4>, TelinkField<5>, TelinkField<6>, TelinkField<7>> TelinkLightAttributesSet;
+  // alarm ID, action code, weekdays, hour, minute, second, scenario ID
+  typedef TelinkCommand<COMMAND_ALARM_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x02>, TelinkField<1>, TelinkField<2>, TelinkConst<3, 0>, TelinkField<4>, TelinkField<5>, TelinkField<6>, TelinkField<7>, TelinkField<8>, TelinkConst<9, 0>> TelinkAlarmSet;
+  typedef TelinkCommand<COMMAND_ALARM_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x01>, TelinkField<1>> TelinkAlarmDelete; // alarm ID
+  typedef TelinkCommand<COMMAND_ALARM_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x03>, TelinkField<1>> TelinkAlarmEnable; // alarm ID
+  typedef TelinkCommand<COMMAND_ALARM_EDIT, COMMAND_NO_REPORT, TelinkConst<0, 0x04>, TelinkField<1>> TelinkAlarmDisable; // alarm ID
+
+  /** \brief All commands with an expected report. */
+  typedef TelinkCommandTable<TelinkOtaStateQuery, TelinkGroupQuery, TelinkAddressQuery, TelinkTimeQuery, TelinkDeviceInfoQuery,
+    TelinkStatusQuery, TelinkAlarmQuery, TelinkScenarioQuery> TelinkCommands;
+
+  // Report fields, relative to the payload (packet byte 10)
+  struct TelinkStatusReport {
+    static constexpr unsigned char opcode = COMMAND_STATUS_REPORT;
+    typedef TelinkField<0> brightness;
+    typedef TelinkField<1> red;
+    typedef TelinkField<2> green;
+    typedef TelinkField<3> blue;
+    typedef TelinkField<4> yellow;
+    typedef TelinkField<5> white;
+  };
+
+  struct TelinkOnlineStatusReport {
+    static constexpr unsigned char opcode = COMMAND_ONLINE_STATUS_REPORT;
+    static constexpr std::size_t entry_size = 4;
+    static constexpr std::size_t entry_count = 2;
+    typedef TelinkField<0> address;
+    typedef TelinkField<1> sequence; // 0 if node is offline
+    typedef TelinkField<2> brightness;
+    typedef TelinkField<3> status;   // bit 0 set if light is off
+  };
+
+  struct TelinkAddressReport {
+    static constexpr unsigned char opcode = COMMAND_ADDRESS_REPORT;
+    typedef TelinkField<0, 2> mesh_id;
+  };
+
+  static_assert(TelinkCommands::report(COMMAND_STATUS_QUERY) == COMMAND_STATUS_REPORT, "inconsistent command table");
+  static_assert(TelinkLightAttributesSet::size == 8, "light attributes payload is 8 bytes");
+
+}
+
+#endif // __TELINK_COMMANDS_H__
@@ -0,0 +1,75 @@
+/** \file telink_credentials.cxx
+ *  Pairing material derived from mesh name and password, shared by all connections to a mesh.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+
+#include "telink_credentials.h"
+
+namespace telink {
+
+  TelinkCredentials::TelinkCredentials(const std::string & name, const std::string & password) {
+    for (std::size_t i=0; i<16; i++) {
+      unsigned char n = i < name.size() ? name[i] : 0;
+      unsigned char p = i < password.size() ? password[i] : 0;
+      this->key[i] = n ^ p;
+    }
+    unsigned char reversed[16];
+    std::reverse_copy(this->key, this->key + 16, reversed);
+    this->cipher.set_key(reversed);
+    secure_zero(reversed, 16);
+  }
+
+  TelinkCredentials::~TelinkCredentials() {
+    // the cipher zeroes its own schedule
+    secure_zero(this->key, 16);
+  }
+
+  std::shared_ptr<const TelinkCredentials> TelinkCredentials::get(const std::string & name, const std::string & password) {
+    // credentials are matched by key, so that no copy of name or password is kept
+    static std::mutex mutex;
+    static std::vector<std::weak_ptr<const TelinkCredentials>> registry;
+    unsigned char key[16];
+    for (std::size_t i=0; i<16; i++)
+      key[i] = (i < name.size() ? name[i] : 0) ^ (i < password.size() ? password[i] : 0);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const TelinkCredentials> credentials;
+    registry.erase(std::remove_if(registry.begin(), registry.end(), [&](const std::weak_ptr<const TelinkCredentials> & entry) {
+      std::shared_ptr<const TelinkCredentials> shared = entry.lock();
+      if (shared != nullptr && credentials == nullptr && secure_equal(shared->key, key, 16))
+        credentials = shared;
+      return shared == nullptr;
+    }), registry.end());
+    secure_zero(key, 16);
+    if (credentials == nullptr) {
+      credentials = std::make_shared<const TelinkCredentials>(name, password);
+      registry.push_back(credentials);
+    }
+    return credentials;
+  }
+
+  std::string TelinkCredentials::get_key() const {
+    return std::string(reinterpret_cast<const char*>(this->key), 16);
+  }
+
+  std::string TelinkCredentials::encrypt(const std::string & data) const {
+    if (data.size() != 16)
+      throw std::runtime_error("AES encryption expects a 16-byte block.");
+    unsigned char block[16];
+    std::reverse_copy(data.begin(), data.end(), block);
+    this->cipher.encrypt(block, block);
+    std::string result(block, block + 16);
+    std::reverse(result.begin(), result.end());
+    secure_zero(block, 16);
+    return result;
+  }
+
+  bool TelinkCredentials::matches(const TelinkCredentials & other) const {
+    return secure_equal(this->key, other.key, 16);
+  }
+
+}
@@ -0,0 +1,80 @@
+/** \file telink_credentials.h
+ *  Pairing material derived from mesh name and password, shared by all connections to a mesh.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_CREDENTIALS_H__
+#define __TELINK_CREDENTIALS_H__
+
+#include <string>
+#include <memory>
+
+#include "telink_aes.h"
+
+namespace telink {
+
+  /** \class TelinkCredentials
+   *  \brief Mesh name and password combined into the pairing key, with its expanded AES schedule.
+   *
+   *  All nodes of a mesh share name and password, so the pairing key and its AES key schedule
+   *  are derived once and shared by all connections; pairing then only does per-session work.
+   *  Key material is zeroed on destruction. Instances are immutable and thread-safe.
+   */
+  class TelinkCredentials {
+  private:
+    /** \property unsigned char key[16]
+     *  \brief Name XORed with password, each padded with zeros to 16 bytes.
+     */
+    unsigned char key[16];
+
+    /** \property TelinkAes cipher
+     *  \brief Expanded key schedule.
+     */
+    TelinkAes cipher;
+
+  public:
+    /** \fn TelinkCredentials(const std::string & name, const std::string & password)
+     *  \brief Object instantiation. Prefer get(), which shares instances.
+     *  \param name : mesh name (up to 16 characters).
+     *  \param password : mesh password (up to 16 characters).
+     */
+    TelinkCredentials(const std::string & name, const std::string & password);
+
+    TelinkCredentials(const TelinkCredentials &) = delete;
+    TelinkCredentials & operator=(const TelinkCredentials &) = delete;
+
+    ~TelinkCredentials();
+
+    /** \fn static std::shared_ptr<const TelinkCredentials> get(const std::string & name, const std::string & password)
+     *  \brief Returns the credentials of a mesh, shared with other connections using them.
+     *  \param name : mesh name (up to 16 characters).
+     *  \param password : mesh password (up to 16 characters).
+     *  \returns the shared credentials.
+     */
+    static std::shared_ptr<const TelinkCredentials> get(const std::string & name, const std::string & password);
+
+    /** \fn std::string get_key() const
+     *  \brief Returns the pairing key (name XORed with password).
+     *  \returns the 16-byte key.
+     */
+    std::string get_key() const;
+
+    /** \fn std::string encrypt(const std::string & data) const
+     *  \brief Encrypts data with the pairing key, using the precomputed schedule. Byte order
+     *  follows the Telink convention (key and data reversed).
+     *  \param data : 16-byte data string.
+     *  \returns the encrypted data.
+     */
+    std::string encrypt(const std::string & data) const;
+
+    /** \fn bool matches(const TelinkCredentials & other) const
+     *  \brief Tells if other credentials derive the same key.
+     *  \param other : credentials to compare.
+     *  \returns true if both keys are identical.
+     */
+    bool matches(const TelinkCredentials & other) const;
+  };
+
+}
+
+#endif // __TELINK_CREDENTIALS_H__
@@ -0,0 +1,55 @@
+/** \file telink_daemon.cxx
+ *  Daemon owning the connection to a Telink mesh and sharing it with local clients over a
+ *  Unix domain socket (see TelinkServer for the frame format).
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <csignal>
+
+#include "telink_mesh.h"
+#include "telink_server.h"
+
+static volatile std::sig_atomic_t running = 1;
+
+static void stop(int) {
+  running = 0;
+}
+
+int main(int argc, char **argv) {
+
+  if (argc < 5) {
+    std::cerr << "Run as: " << argv[0] << " <device_MAC_address> <device_name> <device_password> <socket_path> [adapter]" << std::endl;
+    exit(1);
+  }
+
+  using namespace telink;
+
+  TelinkMesh mesh(argv[1], argv[2], argv[3]);
+  if (argc > 5)
+    mesh.set_adapter(argv[5]);
+  TelinkServer server(mesh, argv[4]);
+  if (!server.start()) return 1;
+  if (!mesh.connect())
+    std::cerr << "Initial connection failed; retrying when a command arrives." << std::endl;
+
+  std::signal(SIGINT, stop);
+  std::signal(SIGTERM, stop);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::size_t clients = 0;
+  while (running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if (server.get_client_count() != clients) {
+      clients = server.get_client_count();
+      std::cout << clients << " client(s) connected" << std::endl;
+    }
+  }
+
+  // joins the threads that may still send through or reconnect the mesh
+  server.stop();
+  mesh.disconnect();
+  return 0;
+}
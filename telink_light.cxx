@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include "telink_light.h"
+#include "telink_color_batch.h"
 
 namespace telink {
   
@@ -22,16 +23,8 @@ namespace telink {
   }
   
   void TelinkColor::set_temperature(int temperature) {
-    unsigned char W = 0xff, Y = 0xff;
-    this->R = 0;
-    this->G = 0;
-    this->B = 0;
-    temperature = std::max(std::min(6500, temperature), 2700);
-    if (temperature > 4600) {
-      Y = static_cast<unsigned char>((((float) (6500 - temperature)) * 255.0f) / 1900.0f);
-    } else {
-      W = static_cast<unsigned char>((((float) (temperature - 2700)) * 255.0f) / 1900.0f);
-    }
+    unsigned char W, Y;
+    kelvin_to_yw(temperature, Y, W);
     this->set_temperature(Y, W);
   }
   
@@ -45,8 +38,13 @@ namespace telink {
     this->B = 0;
   }
   
+  TelinkLightAttributesSet::payload TelinkColor::get_payload(unsigned char mode) const {
+    return TelinkLightAttributesSet::encode(this->brightness, this->R, this->G, this->B, this->Y, this->W, mode, 0);
+  }
+  
   std::string TelinkColor::get_bytes() const {
-    return {schar(this->brightness), schar(this->R), schar(this->G), schar(this->B), schar(this->Y), schar(this->W), 0, 0};
+    TelinkLightAttributesSet::payload payload = this->get_payload(0);
+    return std::string(payload.begin(), payload.end());
   }
   
   
@@ -79,47 +77,60 @@ namespace telink {
   }
   
   void TelinkLight::query_alarm() {
-    this->send_packet(COMMAND_ALARM_QUERY, {0x10});
+    this->send_command<TelinkAlarmQuery>();
   }
   
   void TelinkLight::query_scenario(unsigned char scenario_id) {
-    this->send_packet(COMMAND_SCENARIO_QUERY, {0, 0, schar(scenario_id), schar(0xff)});
+    this->send_command<TelinkScenarioQuery>(scenario_id);
   }
   
   void TelinkLight::query_status() {
-    this->send_packet(COMMAND_STATUS_QUERY, {0x10});
+    this->send_command<TelinkStatusQuery>();
   }
   
   void TelinkLight::set_temperature(int temperature) {
     TelinkColor color(temperature, this->brightness);
-    std::string packet = color.get_bytes();
-    packet[6] = this->music_mode;
-    this->send_packet(COMMAND_LIGHT_ATTRIBUTES_SET, packet);
+    TelinkLightAttributesSet::payload payload = color.get_payload(this->music_mode);
+    this->send_payload(TelinkLightAttributesSet::opcode, payload.data(), payload.size());
   }
 
   void TelinkLight::set_state(bool on_off) {
     this->state = on_off;
-    this->send_packet(COMMAND_LIGHT_ON_OFF, {on_off, 0, 0});
+    this->send_command<TelinkLightOnOff>(on_off);
   }
   
   void TelinkLight::add_scenario(unsigned char scenario_id) {
-    this->send_packet(COMMAND_SCENARIO_EDIT, {0x01, schar(scenario_id)});
+    this->send_command<TelinkScenarioAdd>(scenario_id);
   }
   
   void TelinkLight::delete_scenario(unsigned char scenario_id) {
-    this->send_packet(COMMAND_SCENARIO_EDIT, {0x00, schar(scenario_id)});
+    this->send_command<TelinkScenarioDelete>(scenario_id);
   }
   
   void TelinkLight::set_brightness(int brightness) {
     this->brightness = std::min(100, std::max(brightness, 0));
-    this->send_packet(COMMAND_LIGHT_ATTRIBUTES_SET, {schar(this->brightness), 0, 0, 0, 0, 0, 0, 1});
+    this->send_command<TelinkLightAttributesSet>(this->brightness, 0, 0, 0, 0, 0, 0, 1);
   }
 
   void TelinkLight::set_color(unsigned char R, unsigned char G, unsigned char B) {
     TelinkColor color(R, G, B, this->brightness);
-    std::string packet = color.get_bytes();
+    TelinkLightAttributesSet::payload payload = color.get_payload(this->music_mode);
+    this->send_payload(TelinkLightAttributesSet::opcode, payload.data(), payload.size());
+  }
+  
+  void TelinkLight::set_attributes(const std::string & payload) {
+    std::string packet = payload;
+    packet.resize(8, 0);
     packet[6] = this->music_mode;
-    this->send_packet(COMMAND_LIGHT_ATTRIBUTES_SET, packet);
+    this->send_packet(TelinkLightAttributesSet::opcode, packet);
+  }
+  
+  std::size_t TelinkLight::set_frame(const uint16_t * addresses, const unsigned char * R, const unsigned char * G, const unsigned char * B, const unsigned char * brightness, std::size_t count) {
+    std::vector<unsigned char> payloads(count * COLOR_PAYLOAD_SIZE);
+    batch_from_rgb(R, G, B, brightness, count, payloads.data());
+    for (std::size_t i=0; i<count; i++)
+      payloads[i*COLOR_PAYLOAD_SIZE + 6] = this->music_mode;
+    return this->send_packets(TelinkLightAttributesSet::opcode, addresses, payloads.data(), COLOR_PAYLOAD_SIZE, count);
   }
   
   void TelinkLight::set_music_mode(bool music_mode) {
@@ -127,31 +138,30 @@ namespace telink {
   }
   
   void TelinkLight::load_scenario(unsigned char scenario_id, unsigned char speed) {
-    this->send_packet(COMMAND_SCENARIO_LOAD, {schar(scenario_id), schar(speed), schar(this->brightness)});
+    this->send_command<TelinkScenarioLoad>(scenario_id, speed, this->brightness);
   }
   
   void TelinkLight::set_alarm(unsigned char alarm_id, const std::vector<bool> & weekdays, unsigned char hour, unsigned char minute, unsigned char second, unsigned char action) {
-    unsigned char action_code;
-    std::string data = {2, schar(alarm_id), 0, 0, 0, schar(hour), schar(minute), schar(second), 0, 0};
-    if (action == 0 || action == 1) {
-      data[2] = 0x90 + action;
-    } else {
-      data[2] = 0x92;
-      data[8] = action;
-    }
+    // actions 0 and 1 switch light off and on, others load scenario with ID = action
+    unsigned char action_code = action < 2 ? 0x90 + action : 0x92;
+    unsigned char scenario_id = action < 2 ? 0 : action;
     // compile byte for days
+    unsigned char days = 0;
     for (int i=0; i<weekdays.size(); i++)
-      data[4] |= weekdays[i] << i;
+      days |= weekdays[i] << i;
     
-    this->send_packet(COMMAND_ALARM_EDIT, data);
+    this->send_command<TelinkAlarmSet>(alarm_id, action_code, days, hour, minute, second, scenario_id);
   }
   
   void TelinkLight::set_alarm(unsigned char alarm_id, bool state) {
-    this->send_packet(COMMAND_ALARM_EDIT, {state ? '\3' : '\4', schar(alarm_id)});
+    if (state)
+      this->send_command<TelinkAlarmEnable>(alarm_id);
+    else
+      this->send_command<TelinkAlarmDisable>(alarm_id);
   }
   
   void TelinkLight::delete_alarm(unsigned char alarm_id) {
-    this->send_packet(COMMAND_ALARM_EDIT, {1, schar(alarm_id)});
+    this->send_command<TelinkAlarmDelete>(alarm_id);
   }
   
   void TelinkLight::edit_scenario(unsigned char scenario_id, TelinkScenario & scenario) {
@@ -166,15 +176,44 @@ namespace telink {
   
   void TelinkLight::parse_online_status_report(const std::string & packet) {
     this->brightness = packet[12];
-    this->state = ~(packet[13] & 1); // 0x40 = light on, 0x41 = light off
+    this->state = !(packet[13] & 1); // 0x40 = light on, 0x41 = light off
+    unsigned char brightness = packet[12];
+    bool state = !(packet[13] & 1);
+    this->update_cache([brightness, state](TelinkCacheEntry & entry) {
+      entry.brightness = brightness;
+      entry.state = state;
+      entry.flags |= CACHE_STATE;
+    });
   }
   
   void TelinkLight::parse_status_report(const std::string & packet) {
-    this->brightness = packet[10];
-    unsigned char R = packet[11];
-    unsigned char G = packet[12];
-    unsigned char B = packet[13];
-    unsigned char W = packet[15];
+    this->brightness = TelinkStatusReport::brightness::load(packet);
+    unsigned char R = TelinkStatusReport::red::load(packet);
+    unsigned char G = TelinkStatusReport::green::load(packet);
+    unsigned char B = TelinkStatusReport::blue::load(packet);
+    unsigned char W = TelinkStatusReport::white::load(packet);
+    unsigned char Y = TelinkStatusReport::yellow::load(packet);
+    unsigned char brightness = this->brightness;
+    this->update_cache([brightness, R, G, B, Y, W](TelinkCacheEntry & entry) {
+      entry.brightness = brightness;
+      entry.color[0] = R;
+      entry.color[1] = G;
+      entry.color[2] = B;
+      entry.color[3] = Y;
+      entry.color[4] = W;
+      entry.flags |= CACHE_COLOR;
+    });
+    const unsigned char color[5] = {R, G, B, Y, W};
+    this->update_node_color(static_cast<unsigned char>(packet[3]), brightness, color);
+    this->update_shared_state(static_cast<unsigned char>(packet[3]), [brightness, R, G, B, Y, W](TelinkNodeState & node) {
+      node.brightness = brightness;
+      node.color[0] = R;
+      node.color[1] = G;
+      node.color[2] = B;
+      node.color[3] = Y;
+      node.color[4] = W;
+      node.flags |= NODE_COLOR | NODE_ONLINE;
+    });
   }
   
   void TelinkLight::parse_alarm_report(const std::string & packet) {
@@ -10,20 +10,6 @@
 
 namespace telink {
   
-  // Command codes
-  #define COMMAND_SCENARIO_QUERY        0xC0
-  #define COMMAND_SCENARIO_REPORT       0xC1
-  #define COMMAND_SCENARIO_LOAD         0xF2
-  #define COMMAND_SCENARIO_EDIT         0xF3
-  #define COMMAND_STATUS_QUERY          0xDA
-  #define COMMAND_STATUS_REPORT         0xDB
-  #define COMMAND_ALARM_QUERY           0xE6
-  #define COMMAND_ALARM_REPORT          0xE7
-  #define COMMAND_ALARM_EDIT            0xE5
-  #define COMMAND_LIGHT_ON_OFF          0xF0
-  #define COMMAND_LIGHT_ATTRIBUTES_SET  0xF1
-
-
   // scenario ID definitions
   #define SCENARIO_CUSTOM_1 0x00
   #define SCENARIO_CUSTOM_2 0x01
@@ -153,6 +139,13 @@ namespace telink {
      */
     void set_temperature(unsigned char Y, unsigned char W);
     
+    /** \fn TelinkLightAttributesSet::payload get_payload(unsigned char mode) const
+     *  \brief Gets the light attribute payload of the color.
+     *  \param mode : value of the mode byte (1 for music mode, 0 otherwise).
+     *  \returns the 8-byte payload.
+     */
+    TelinkLightAttributesSet::payload get_payload(unsigned char mode) const;
+    
     /** \fn std::string get_bytes() const
      *  \brief Compiles a byte string to be sent as data to the device.
      *  \returns a byte string with color definitions.
@@ -320,6 +313,24 @@ namespace telink {
      */
     void set_color(unsigned char R, unsigned char G, unsigned char B);
     
+    /** \fn void set_attributes(const std::string & payload)
+     *  \brief Sets light brightness and color from a precomputed payload.
+     *  \param payload : 8-byte payload, as produced by TelinkColor::get_bytes() or batch conversion functions.
+     */
+    void set_attributes(const std::string & payload);
+    
+    /** \fn std::size_t set_frame(const uint16_t * addresses, const unsigned char * R, const unsigned char * G, const unsigned char * B, const unsigned char * brightness, std::size_t count)
+     *  \brief Sets color and brightness of several mesh nodes through this connection.
+     *  \param addresses : mesh IDs of target nodes or groups.
+     *  \param R : red components, from 0 to 255.
+     *  \param G : green components, from 0 to 255.
+     *  \param B : blue components, from 0 to 255.
+     *  \param brightness : brightness values, from 0 to 100.
+     *  \param count : number of nodes.
+     *  \returns the number of packets sent.
+     */
+    std::size_t set_frame(const uint16_t * addresses, const unsigned char * R, const unsigned char * G, const unsigned char * B, const unsigned char * brightness, std::size_t count);
+    
     /** \fn void set_music_mode(bool music_mode)
      *  \brief Sets device music mode: color/brightness changes are faster, but aren't acknowledged by replies.
      *  \param music_mode : state of music mode to set.
@@ -0,0 +1,212 @@
+/** \file telink_manager.cxx
+ *  Several independent meshes driven by a pool of worker threads.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include "telink_manager.h"
+
+namespace telink {
+
+  TelinkMeshManager::TelinkMeshManager(std::size_t workers) : running(false) {
+    if (workers == 0)
+      workers = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    for (std::size_t i=0; i<workers; i++)
+      this->workers.emplace_back(new Worker());
+  }
+
+  TelinkMeshManager::~TelinkMeshManager() {
+    this->stop();
+  }
+
+  void TelinkMeshManager::set_adapter_manager(TelinkAdapterManager * adapters) {
+    this->adapters = adapters;
+  }
+
+  int TelinkMeshManager::add_mesh(const std::vector<std::string> & proxies, const std::string & name, const std::string & password, std::size_t size, double weight) {
+    if (this->running) {
+      std::cerr << "Meshes can only be added before the manager is started." << std::endl;
+      return -1;
+    }
+    int index = this->meshes.size();
+    std::unique_ptr<Mesh> mesh(new Mesh());
+    mesh->pool.reset(new TelinkProxyPool(proxies, name, password, size));
+    mesh->pool->set_adapter_manager(this->adapters);
+    mesh->pool->add_report_listener([this, index](const std::string & packet) {
+      this->post_report(index, packet);
+    });
+    mesh->weight = weight;
+
+    // least loaded worker; ties go to the one with fewer meshes
+    auto worker = std::min_element(this->workers.begin(), this->workers.end(),
+      [](const std::unique_ptr<Worker> & a, const std::unique_ptr<Worker> & b) {
+        if (a->status.weight != b->status.weight)
+          return a->status.weight < b->status.weight;
+        return a->meshes.size() < b->meshes.size();
+      });
+    mesh->worker = worker - this->workers.begin();
+    (*worker)->meshes.push_back(index);
+    (*worker)->status.meshes++;
+    (*worker)->status.weight += weight;
+    this->meshes.push_back(std::move(mesh));
+    return index;
+  }
+
+  void TelinkMeshManager::add_report_listener(const std::function<void(int, const std::string &)> & listener) {
+    this->listeners.push_back(listener);
+  }
+
+  bool TelinkMeshManager::start() {
+    if (this->running) return false;
+    this->running = true;
+    for (auto & worker : this->workers)
+      worker->thread = std::thread(&TelinkMeshManager::run, this, std::ref(*worker));
+    return true;
+  }
+
+  void TelinkMeshManager::stop() {
+    if (!this->running) return;
+    this->running = false;
+    for (auto & worker : this->workers) {
+      // taking the lock ensures that the worker either waits or sees the flag
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->wakeup.notify_all();
+    }
+    for (auto & worker : this->workers) {
+      worker->thread.join();
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->commands.clear();
+      worker->reports.clear();
+    }
+    for (auto & mesh : this->meshes) {
+      if (mesh->started)
+        mesh->pool->stop();
+      mesh->started = false;
+    }
+  }
+
+  void TelinkMeshManager::post_report(int mesh, const std::string & packet) {
+    Worker & worker = *this->workers[this->meshes[mesh]->worker];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!this->running || worker.reports.size() >= MANAGER_MAX_PENDING)
+      return;
+    worker.reports.emplace_back(mesh, packet);
+    worker.wakeup.notify_one();
+  }
+
+  bool TelinkMeshManager::send_packet(int mesh, int destination, int command, const std::string & data) {
+    uint16_t target = destination;
+    return this->send_packets(mesh, command, &target, reinterpret_cast<const unsigned char*>(data.data()), data.size(), 1) == 1;
+  }
+
+  std::size_t TelinkMeshManager::send_packets(int mesh, int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count) {
+    if (mesh < 0 || mesh >= static_cast<int>(this->meshes.size()) || count == 0) return 0;
+    Worker & worker = *this->workers[this->meshes[mesh]->worker];
+    std::size_t size = std::min<std::size_t>(data_size, 10);
+    std::size_t queued = 0;
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (!this->running) return 0;
+      if (worker.commands.size() < MANAGER_MAX_PENDING)
+        queued = std::min<std::size_t>(count, MANAGER_MAX_PENDING - worker.commands.size());
+      for (std::size_t i=0; i<queued; i++) {
+        Command entry;
+        entry.mesh = mesh;
+        entry.destination = destinations[i];
+        entry.command = command;
+        entry.size = size;
+        std::memcpy(entry.data, data + i*data_size, size);
+        worker.commands.push_back(entry);
+      }
+      worker.status.failed += count - queued;
+    }
+    if (queued > 0)
+      worker.wakeup.notify_one();
+    return queued;
+  }
+
+  void TelinkMeshManager::run(Worker & worker) {
+    // connecting takes seconds per proxy: each worker connects its own meshes, in parallel with others
+    for (int index : worker.meshes) {
+      if (!this->running) return;
+      Mesh & mesh = *this->meshes[index];
+      if (!mesh.pool->start())
+        std::cerr << "No proxy of mesh " << index << " connected yet" << std::endl;
+      mesh.started = true;
+    }
+
+    std::vector<Command> commands;
+    std::vector<std::pair<int, std::string>> reports;
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    while (true) {
+      worker.wakeup.wait(lock, [this, &worker]() {
+        return !this->running || !worker.commands.empty() || !worker.reports.empty();
+      });
+      if (!this->running) break;
+      commands.swap(worker.commands);
+      reports.swap(worker.reports);
+      lock.unlock();
+
+      for (auto & report : reports) {
+        for (auto & listener : this->listeners)
+          listener(report.first, report.second);
+      }
+
+      // group commands by mesh, keeping their order within a mesh, then send runs with the
+      // same code and parameter size in one call
+      std::stable_sort(commands.begin(), commands.end(), [](const Command & a, const Command & b) {
+        return a.mesh < b.mesh;
+      });
+      for (std::size_t first=0, last; first<commands.size(); first=last) {
+        last = first + 1;
+        while (last < commands.size() && last - first < MANAGER_BATCH_SIZE && commands[last].mesh == commands[first].mesh
+               && commands[last].command == commands[first].command && commands[last].size == commands[first].size)
+          last++;
+        this->send_batch(worker, &commands[first], last - first);
+      }
+
+      lock.lock();
+      worker.status.reports += reports.size();
+      commands.clear();
+      reports.clear();
+    }
+  }
+
+  void TelinkMeshManager::send_batch(Worker & worker, const Command * commands, std::size_t count) {
+    uint16_t destinations[MANAGER_BATCH_SIZE];
+    unsigned char data[MANAGER_BATCH_SIZE * 10];
+    std::size_t size = commands[0].size;
+    for (std::size_t i=0; i<count; i++) {
+      destinations[i] = commands[i].destination;
+      std::memcpy(data + i*size, commands[i].data, size);
+    }
+    std::size_t sent = this->meshes[commands[0].mesh]->pool->send_packets(commands[0].command, destinations, data, size, count);
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.status.sent += sent;
+    worker.status.failed += count - sent;
+  }
+
+  int TelinkMeshManager::get_worker(int mesh) const {
+    if (mesh < 0 || mesh >= static_cast<int>(this->meshes.size())) return -1;
+    return this->meshes[mesh]->worker;
+  }
+
+  std::vector<TelinkWorkerStatus> TelinkMeshManager::get_status() {
+    std::vector<TelinkWorkerStatus> statuses;
+    for (auto & worker : this->workers) {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      statuses.push_back(worker->status);
+      statuses.back().pending = worker->commands.size();
+    }
+    return statuses;
+  }
+
+  std::vector<TelinkProxyStatus> TelinkMeshManager::get_proxy_status(int mesh) {
+    if (mesh < 0 || mesh >= static_cast<int>(this->meshes.size())) return {};
+    return this->meshes[mesh]->pool->get_status();
+  }
+
+}
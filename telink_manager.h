@@ -0,0 +1,328 @@
+/** \file telink_manager.h
+ *  Several independent meshes driven by a pool of worker threads.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_MANAGER_H__
+#define __TELINK_MANAGER_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "telink_proxy_pool.h"
+#include "telink_adapter.h"
+
+namespace telink {
+
+  /** \brief Maximum number of commands waiting per worker. */
+  #define MANAGER_MAX_PENDING 4096
+  /** \brief Maximum number of packets handed to a mesh in one call. */
+  #define MANAGER_BATCH_SIZE 32
+
+  /** \class TelinkWorkerStatus
+   *  \brief Load and counters of a worker thread.
+   */
+  class TelinkWorkerStatus {
+  public:
+    /** \property std::size_t meshes
+     *  \brief Number of meshes assigned to the worker.
+     */
+    std::size_t meshes = 0;
+
+    /** \property double weight
+     *  \brief Total weight of assigned meshes.
+     */
+    double weight = 0;
+
+    /** \property std::size_t pending
+     *  \brief Number of commands waiting to be sent.
+     */
+    std::size_t pending = 0;
+
+    /** \property uint64_t sent
+     *  \brief Number of packets sent.
+     */
+    uint64_t sent = 0;
+
+    /** \property uint64_t failed
+     *  \brief Number of packets that could not be sent, or were rejected because the queue was full.
+     */
+    uint64_t failed = 0;
+
+    /** \property uint64_t reports
+     *  \brief Number of reports handled.
+     */
+    uint64_t reports = 0;
+  };
+
+  /** \class TelinkMeshManager
+   *  \brief Owns several meshes, each with its own name, password and proxy pool, and shards
+   *  them over worker threads.
+   *
+   *  Each mesh is assigned to the least loaded worker when added. A worker is an event loop
+   *  with its own command queue: it connects its meshes, sends their commands in batches, and
+   *  calls report listeners for them, so that meshes on different workers never wait for each
+   *  other and the work of one mesh stays on one thread. Nodes are addressed by mesh index and
+   *  mesh address. With an adapter manager, proxy connections of all meshes are spread over
+   *  the Bluetooth adapters.
+   */
+  class TelinkMeshManager {
+  private:
+    /** \class Command
+     *  \brief Command waiting to be sent.
+     */
+    class Command {
+    public:
+      /** \property int mesh
+       *  \brief Mesh index.
+       */
+      int mesh;
+
+      /** \property uint16_t destination
+       *  \brief Mesh ID of target node or group.
+       */
+      uint16_t destination;
+
+      /** \property uint8_t command
+       *  \brief Command code.
+       */
+      uint8_t command;
+
+      /** \property uint8_t size
+       *  \brief Size of parameters.
+       */
+      uint8_t size;
+
+      /** \property unsigned char data[10]
+       *  \brief Command parameters.
+       */
+      unsigned char data[10];
+    };
+
+    /** \class Mesh
+     *  \brief A managed mesh.
+     */
+    class Mesh {
+    public:
+      /** \property std::unique_ptr<TelinkProxyPool> pool
+       *  \brief Connections to the mesh.
+       */
+      std::unique_ptr<TelinkProxyPool> pool;
+
+      /** \property std::size_t worker
+       *  \brief Index of the worker driving the mesh.
+       */
+      std::size_t worker = 0;
+
+      /** \property double weight
+       *  \brief Expected load of the mesh, relative to other meshes.
+       */
+      double weight = 1;
+
+      /** \property std::atomic<bool> started
+       *  \brief true once the worker started the proxy pool.
+       */
+      std::atomic<bool> started;
+
+      Mesh() : started(false) {}
+    };
+
+    /** \class Worker
+     *  \brief A worker thread and its queues.
+     */
+    class Worker {
+    public:
+      /** \property std::thread thread
+       *  \brief Event loop thread.
+       */
+      std::thread thread;
+
+      /** \property std::vector<int> meshes
+       *  \brief Indices of assigned meshes.
+       */
+      std::vector<int> meshes;
+
+      /** \property std::vector<Command> commands
+       *  \brief Commands waiting to be sent, oldest first; taken all at once by the worker.
+       */
+      std::vector<Command> commands;
+
+      /** \property std::vector<std::pair<int, std::string>> reports
+       *  \brief Reports waiting to be handled, with their mesh index, oldest first.
+       */
+      std::vector<std::pair<int, std::string>> reports;
+
+      /** \property std::mutex mutex
+       *  \brief Protects queues and status.
+       */
+      std::mutex mutex;
+
+      /** \property std::condition_variable wakeup
+       *  \brief Signals queued work or stop.
+       */
+      std::condition_variable wakeup;
+
+      /** \property TelinkWorkerStatus status
+       *  \brief Load and counters.
+       */
+      TelinkWorkerStatus status;
+    };
+
+    /** \property std::vector<std::unique_ptr<Mesh>> meshes
+     *  \brief Managed meshes, by index; fixed once started.
+     */
+    std::vector<std::unique_ptr<Mesh>> meshes;
+
+    /** \property std::vector<std::unique_ptr<Worker>> workers
+     *  \brief Worker threads.
+     */
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /** \property std::atomic<bool> running
+     *  \brief true while workers run.
+     */
+    std::atomic<bool> running;
+
+    /** \property TelinkAdapterManager * adapters
+     *  \brief Adapter manager shared by all meshes, or nullptr.
+     */
+    TelinkAdapterManager * adapters = nullptr;
+
+    /** \property std::vector<std::function<void(int, const std::string &)>> listeners
+     *  \brief Functions receiving reports, with mesh index.
+     */
+    std::vector<std::function<void(int, const std::string &)>> listeners;
+
+    /** \fn void run(Worker & worker)
+     *  \brief Event loop of a worker: starts its meshes, then sends commands and dispatches
+     *  reports until stopped.
+     *  \param worker : worker to run.
+     */
+    void run(Worker & worker);
+
+    /** \fn void send_batch(Worker & worker, const Command * commands, std::size_t count)
+     *  \brief Sends commands of one mesh, with the same code and parameter size, in one call.
+     *  \param worker : worker sending the commands.
+     *  \param commands : commands to send.
+     *  \param count : number of commands (up to MANAGER_BATCH_SIZE).
+     */
+    void send_batch(Worker & worker, const Command * commands, std::size_t count);
+
+    /** \fn void post_report(int mesh, const std::string & packet)
+     *  \brief Queues a report for the worker of its mesh.
+     *  \param mesh : mesh index.
+     *  \param packet : decrypted report.
+     */
+    void post_report(int mesh, const std::string & packet);
+
+  public:
+    /** \fn TelinkMeshManager(std::size_t workers)
+     *  \brief Object instantiation.
+     *  \param workers : number of worker threads; 0 for one per hardware thread.
+     */
+    TelinkMeshManager(std::size_t workers = 0);
+
+    TelinkMeshManager(const TelinkMeshManager &) = delete;
+    TelinkMeshManager & operator=(const TelinkMeshManager &) = delete;
+
+    /** \fn ~TelinkMeshManager()
+     *  \brief Stops workers and disconnects all meshes.
+     */
+    ~TelinkMeshManager();
+
+    /** \fn void set_adapter_manager(TelinkAdapterManager * adapters)
+     *  \brief Spreads proxy connections of all meshes over several Bluetooth adapters. Must be
+     *  called before meshes are added.
+     *  \param adapters : adapter manager; nullptr to use the default adapter.
+     */
+    void set_adapter_manager(TelinkAdapterManager * adapters);
+
+    /** \fn int add_mesh(const std::vector<std::string> & proxies, const std::string & name, const std::string & password, std::size_t size = 2, double weight = 1)
+     *  \brief Adds a mesh and assigns it to the worker with least total weight. Must be called
+     *  before start().
+     *  \param proxies : MAC addresses of candidate proxy nodes of the mesh.
+     *  \param name : mesh name.
+     *  \param password : mesh password.
+     *  \param size : number of proxies to keep connected.
+     *  \param weight : expected load of the mesh, e.g. its number of nodes.
+     *  \returns the mesh index, or -1 if the manager is running.
+     */
+    int add_mesh(const std::vector<std::string> & proxies, const std::string & name, const std::string & password, std::size_t size = 2, double weight = 1);
+
+    /** \fn void add_report_listener(const std::function<void(int, const std::string &)> & listener)
+     *  \brief Adds a function receiving reports from all meshes, called on the worker of the
+     *  mesh. Must be called before start().
+     *  \param listener : function taking the mesh index and the decrypted 20-byte packet.
+     */
+    void add_report_listener(const std::function<void(int, const std::string &)> & listener);
+
+    /** \fn bool start()
+     *  \brief Starts workers; each one connects its meshes in the background.
+     *  \returns true if workers were started, false if already running.
+     */
+    bool start();
+
+    /** \fn void stop()
+     *  \brief Stops workers, dropping queued commands, and disconnects all meshes.
+     */
+    void stop();
+
+    /** \fn bool send_packet(int mesh, int destination, int command, const std::string & data)
+     *  \brief Queues a command for a node or group of a mesh.
+     *  \param mesh : mesh index.
+     *  \param destination : mesh ID of target node or group.
+     *  \param command : command code.
+     *  \param data : command parameters (up to 10 byte).
+     *  \returns true if the command was queued, false if the mesh is unknown or its worker queue is full.
+     */
+    bool send_packet(int mesh, int destination, int command, const std::string & data);
+
+    /** \fn std::size_t send_packets(int mesh, int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count)
+     *  \brief Queues the same command for several nodes of a mesh; they are sent in batches.
+     *  \param mesh : mesh index.
+     *  \param command : command code.
+     *  \param destinations : mesh IDs of target nodes or groups.
+     *  \param data : command parameters, count x data_size bytes.
+     *  \param data_size : size of parameters of one packet (up to 10 byte).
+     *  \param count : number of packets.
+     *  \returns the number of commands queued.
+     */
+    std::size_t send_packets(int mesh, int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count);
+
+    /** \fn int get_worker(int mesh) const
+     *  \brief Returns the worker a mesh is assigned to.
+     *  \param mesh : mesh index.
+     *  \returns the worker index, or -1 if the mesh is unknown.
+     */
+    int get_worker(int mesh) const;
+
+    /** \fn std::size_t get_mesh_count() const
+     *  \brief Returns the number of managed meshes.
+     *  \returns the number of meshes.
+     */
+    std::size_t get_mesh_count() const { return this->meshes.size(); }
+
+    /** \fn std::vector<TelinkWorkerStatus> get_status()
+     *  \brief Returns load and counters of all workers.
+     *  \returns the statuses, by worker index.
+     */
+    std::vector<TelinkWorkerStatus> get_status();
+
+    /** \fn std::vector<TelinkProxyStatus> get_proxy_status(int mesh)
+     *  \brief Returns the health of the proxies of a mesh.
+     *  \param mesh : mesh index.
+     *  \returns the statuses, in candidate order; empty if the mesh is unknown.
+     */
+    std::vector<TelinkProxyStatus> get_proxy_status(int mesh);
+  };
+
+}
+
+#endif // __TELINK_MANAGER_H__
@@ -9,11 +9,11 @@
 #include <iomanip>
 #include <sstream>
 #include <exception>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
 
-#include <openssl/evp.h>
-#include <openssl/err.h>
-#include <openssl/ssl.h>
-#include <openssl/rand.h>
+#include <unistd.h>
 
 #include <boost/algorithm/string.hpp>
 
@@ -21,6 +21,21 @@
 
 namespace telink {
   
+  /** \fn static std::string encrypt(const TelinkAes & aes, std::string data)
+   *  \brief Encrypts a n x 16-byte data string with an expanded key, using AES encryption.
+   *  Telink byte order is reversed with respect to AES.
+   *  \param aes : expanded encryption key.
+   *  \param data : n x 16-byte data string
+   *  \returns the encrypted data string.
+   */
+  static std::string encrypt(const TelinkAes & aes, std::string data) {
+    std::reverse(data.begin(), data.end());
+    unsigned char * pointer = reinterpret_cast<unsigned char*>(&data[0]);
+    aes.encrypt_blocks(pointer, pointer, data.size() / AES_BLOCK_SIZE);
+    std::reverse(data.begin(), data.end());
+    return data;
+  }
+
   /** \fn static std::string encrypt(std::string key, std::string data)
    *  \brief Encrypts a n x 16-byte data string with a 16-byte key, using AES encryption.
    *  \param key : 16-byte encryption key.
@@ -29,23 +44,9 @@ namespace telink {
    */
   static std::string encrypt(std::string key, std::string data) {
     std::reverse(key.begin(), key.end());
-    std::reverse(data.begin(), data.end());
-  
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    EVP_EncryptInit_ex (ctx, EVP_aes_128_ecb(), NULL, (const unsigned char*)key.c_str(), NULL);
-    EVP_CIPHER_CTX_set_padding(ctx, false);
-    unsigned char buffer[1024], *pointer = buffer;
-    int outlen;
-    if (!EVP_EncryptUpdate(ctx, pointer, &outlen, (const unsigned char*)data.c_str(), data.length()))
-      throw std::runtime_error("AES encryption failed in encryption stage.");
-    pointer += outlen;
-    if (!EVP_EncryptFinal_ex(ctx, pointer, &outlen))
-      throw std::runtime_error("AES encryption failed in final stage.");
-    pointer += outlen;
-    std::string result = std::string((char*)buffer, pointer-buffer);
-    std::reverse(result.begin(), result.end());
-    EVP_CIPHER_CTX_free(ctx);
-    return result;
+    TelinkAes aes(reinterpret_cast<const unsigned char*>(key.data()));
+    secure_zero(&key[0], key.size());
+    return encrypt(aes, data);
   }
 
    /** \fn static std::vector<unsigned char> to_vector(const std::string & str)
@@ -72,6 +73,15 @@ namespace telink {
     return out;
   }
 
+   /** \fn static uint16_t packet_counter(const unsigned char * packet)
+    *  \brief Reads the counter of a packet, which is not encrypted.
+    *  \param packet : packet of at least 2 bytes.
+    *  \returns the packet counter.
+    */
+  static uint16_t packet_counter(const unsigned char * packet) {
+    return packet[0] | (packet[1] << 8);
+  }
+
    /** \fn static void print_hex_string(const std::string desc, const std::string & str)
     *  \brief Prints out a string with characters represented in hexadecimal format.
     *  \param desc : description text.
@@ -85,25 +95,76 @@ namespace telink {
     std::cout << stream.str().substr(0,stream.tellp()-1LL) << std::endl;
   }
 
+  void TelinkMesh::connection_callback(BluetoothDevice &, bool connected) {
+    // the link coming up is published by connect(), once pairing succeeded
+    if (!connected)
+      this->connected = false;
+  }
+
   void TelinkMesh::notification_callback(BluetoothGattCharacteristic & c, std::vector<unsigned char> & data) {
+    this->receive_notification(data);
+  }
+
+  void TelinkMesh::receive_notification(const std::vector<unsigned char> & data) {
     std::string data_string = from_vector(data);
-    std::string decoded_string = this->decrypt_packet(data_string);
+    std::string decoded_string;
+    {
+      TelinkTimelineScope span(this->timeline, SPAN_DECRYPT, data.size() >= 2 ? packet_counter(data.data()) : 0);
+      decoded_string = this->decrypt_packet(data_string);
+    }
     
     #ifdef DEBUG
     print_hex_string("Received data", decoded_string);
     #endif
     
+    if (this->trace != nullptr)
+      this->trace->record(TRACE_RX, decoded_string, from_vector(data));
+    
+    TelinkTimelineScope span(this->timeline, SPAN_REPORT);
+    if (decoded_string.size() >= 8) {
+      // reports carry the source mesh ID in bytes 3-4
+      const unsigned char * report = reinterpret_cast<const unsigned char*>(decoded_string.data());
+      span.packet = packet_counter(report);
+      span.node = report[3] | (report[4] << 8);
+      span.opcode = report[7];
+      this->record_proxy(span.node);
+    }
+    this->receive_packet(decoded_string);
+  }
+  
+  void TelinkMesh::receive_packet(const std::string & packet) {
     // check that targetted vendor is correct
-    if ((decoded_string[8] == (this->vendor & 0xff)) && (decoded_string[9] == (this->vendor >> 8)))
-      this->parse_command(decoded_string);
+    if (packet.size() >= 10 && (packet[8] == (this->vendor & 0xff)) && (packet[9] == (this->vendor >> 8))) {
+      {
+        std::lock_guard<std::mutex> lock(this->listener_mutex);
+        for (auto & listener : this->report_listeners)
+          listener.second(packet);
+      }
+      if (static_cast<unsigned char>(packet[7]) == COMMAND_ONLINE_STATUS_REPORT)
+        this->parse_presence_report(packet);
+      this->parse_command(packet);
+    }
+  }
+  
+  int TelinkMesh::add_report_listener(const std::function<void(const std::string &)> & listener) {
+    std::lock_guard<std::mutex> lock(this->listener_mutex);
+    this->report_listeners.emplace_back(++this->listener_id, listener);
+    return this->listener_id;
+  }
+  
+  void TelinkMesh::remove_report_listener(int id) {
+    std::lock_guard<std::mutex> lock(this->listener_mutex);
+    this->report_listeners.erase(std::remove_if(this->report_listeners.begin(), this->report_listeners.end(),
+      [id](const std::pair<int, std::function<void(const std::string &)>> & listener) { return listener.first == id; }),
+      this->report_listeners.end());
   }
 
 
-  TelinkMesh::TelinkMesh(const std::string address) {
+  TelinkMesh::TelinkMesh(const std::string address) : packets_sent(0), connected(false), ota_state(-1), ota_block(-1) {
     this->set_address(address);
   }
 
-  TelinkMesh::TelinkMesh(const std::string address, const std::string name, const std::string password) {
+  TelinkMesh::TelinkMesh(const std::string address, const std::string name, const std::string password) : packets_sent(0), connected(false), ota_state(-1), ota_block(-1) {
     this->set_address(address);
     this->set_name(name);
     this->set_password(password);
@@ -114,11 +175,13 @@ namespace telink {
   }
 
   void TelinkMesh::set_address(const std::string address) {
-    if (this->ble_mesh != nullptr) {
+    if (this->is_connected()) {
       std::cerr << "Address change can only occur when disconnected." << std::endl;
       return;
     }
     
+    if (address != this->address)
+      this->drop_device();
     this->address = address;
     this->reverse_address = "";
     std::vector<std::string> mac;
@@ -129,34 +192,146 @@ namespace telink {
   }
 
   void TelinkMesh::set_name(const std::string name) {
-    if (this->ble_mesh != nullptr)
+    if (this->is_connected())
       std::cerr << "Connection already established. Name change will apply only after reconnection." << std::endl;
     this->name = name;
     this->name.append(16-name.size(), 0);
+    this->credentials = nullptr; // derived again at next connection
   }
 
   void TelinkMesh::set_password(const std::string password) {
-    if (this->ble_mesh != nullptr)
+    if (this->is_connected())
       std::cerr << "Connection already established. Password change will apply only after reconnection." << std::endl;
     this->password = password;
     this->password.append(16 - password.size(), 0);
+    this->credentials = nullptr; // derived again at next connection
+  }
+
+  void TelinkMesh::set_credentials(const std::shared_ptr<const TelinkCredentials> & credentials) {
+    if (this->is_connected())
+      std::cerr << "Connection already established. Credential change will apply only after reconnection." << std::endl;
+    this->credentials = credentials;
   }
 
   void TelinkMesh::set_vendor(int vendor) {
     this->vendor = vendor & 0xffff;
   }
 
+  void TelinkMesh::set_adapter(const std::string & adapter) {
+    if (this->is_connected())
+      std::cerr << "Connection already established. Adapter change will apply only after reconnection." << std::endl;
+    else if (adapter != this->adapter)
+      this->drop_device(); // device objects belong to the previous adapter
+    this->adapter = adapter;
+  }
+
+  void TelinkMesh::set_auto_reconnect(bool auto_reconnect) {
+    this->auto_reconnect = auto_reconnect;
+  }
+
+  void TelinkMesh::set_transport(int transport) {
+    if (this->is_connected()) {
+      std::cerr << "Transport change can only occur when disconnected." << std::endl;
+      return;
+    }
+    this->transport = transport;
+  }
+
+  void TelinkMesh::set_write_mode(int mode) {
+    this->write_mode = mode;
+    if (this->is_connected())
+      this->open_write_channel();
+  }
+
+  int TelinkMesh::get_rssi() {
+    if (this->ble_mesh == nullptr || !this->is_connected()) return 0;
+    try {
+      return this->ble_mesh->get_rssi();
+    } catch (std::exception & e) {
+      return 0;
+    }
+  }
+
+  void TelinkMesh::set_trace(TelinkTrace * trace) {
+    this->trace = trace;
+  }
+
+  void TelinkMesh::set_timeline(TelinkTimeline * timeline) {
+    this->timeline = timeline;
+  }
+
+  void TelinkMesh::set_cache(TelinkCache * cache, int max_age) {
+    this->cache = cache;
+    this->cache_max_age = max_age;
+  }
+  
+  void TelinkMesh::update_cache(const std::function<void(TelinkCacheEntry &)> & modifier) {
+    if (this->cache != nullptr)
+      this->cache->update(this->address, modifier);
+  }
+
+  void TelinkMesh::record_proxy(int mesh_id) {
+    if (this->cache == nullptr || mesh_id == 0) return;
+    {
+      std::lock_guard<std::mutex> lock(this->relayed_mutex);
+      if (!this->relayed.insert(mesh_id).second) return;
+    }
+    this->cache->set_proxy(mesh_id, this->address);
+  }
+
+  void TelinkMesh::set_shared_state(TelinkSharedState * shared_state) {
+    this->shared_state = shared_state;
+  }
+  
+  void TelinkMesh::set_presence(TelinkPresence * presence) {
+    this->presence = presence;
+  }
+  
+  void TelinkMesh::set_registry(TelinkNodeRegistry * registry) {
+    this->registry = registry;
+  }
+  
+  void TelinkMesh::parse_presence_report(const std::string & packet) {
+    if (this->presence != nullptr)
+      this->presence->parse_report(packet);
+    if (this->shared_state == nullptr && this->registry == nullptr)
+      return;
+    // same entry layout as in TelinkPresence::parse_report
+    for (std::size_t offset=10; offset+4<=packet.size() && offset<=14; offset+=4) {
+      unsigned char address = packet[offset];
+      if (address == 0) continue;
+      bool online = packet[offset+1] != 0;
+      bool state = !(packet[offset+3] & 1);
+      unsigned char brightness = packet[offset+2];
+      if (this->registry != nullptr)
+        this->registry->update_power(address, online, state, brightness);
+      this->update_shared_state(address, [online, state, brightness](TelinkNodeState & node) {
+        node.brightness = brightness;
+        node.flags = (node.flags & ~(NODE_ONLINE | NODE_ON)) | NODE_POWER | (online ? NODE_ONLINE : 0) | (state ? NODE_ON : 0);
+      });
+    }
+  }
+  
+  void TelinkMesh::update_shared_state(int address, const std::function<void(TelinkNodeState &)> & modifier) {
+    if (this->shared_state != nullptr)
+      this->shared_state->update(address, modifier);
+  }
+
+  void TelinkMesh::update_node_color(int address, unsigned char brightness, const unsigned char * color) {
+    if (this->registry != nullptr)
+      this->registry->update_color(address, brightness, color);
+  }
+
   std::string TelinkMesh::combine_name_and_password() const {
-    std::string data;
-    for (int i=0; i<16; i++)
-      data.push_back(this->name[i] ^ this->password[i]);
-    return data;
+    return this->credentials->get_key();
   }
 
   void TelinkMesh::generate_shared_key(const std::string & data1, const std::string & data2) {
-    std::string key = this->combine_name_and_password();
     try {
-      this->shared_key = encrypt(key, data1.substr(0,8) + data2.substr(0,8));
+      this->shared_key = this->credentials->encrypt(data1.substr(0,8) + data2.substr(0,8));
+      std::string key(this->shared_key.rbegin(), this->shared_key.rend());
+      this->shared_cipher.set_key(reinterpret_cast<const unsigned char*>(key.data()));
+      secure_zero(&key[0], key.size());
     } catch (std::runtime_error & e) {
       std::cerr << "Shared key generation failed. Error: " << e.what() << std::endl;
     }
@@ -176,51 +351,72 @@ namespace telink {
   std::string TelinkMesh::encrypt_packet(std::string & packet) const {
     std::string auth_nonce = this->reverse_address.substr(0,4) + '\1' + packet.substr(0,3) + '\x0f';
     auth_nonce.append(7,0);
-    std::string authenticator;
-    try {
-      authenticator = encrypt(this->shared_key, auth_nonce);
-    } catch (std::runtime_error & e) {
-      std::cerr << "Packet authenticator generation failed. Error: " << e.what() << std::endl;
-    }
+    std::string authenticator = encrypt(this->shared_cipher, auth_nonce);
     for (int i=0; i<15; i++)
       authenticator[i] ^= packet[i+5];
     
-    std::string mac;
-    try {
-      mac = encrypt(this->shared_key, authenticator);
-    } catch (std::runtime_error & e) {
-      std::cerr << "MAC encryption for packet failed. Error: " << e.what() << std::endl;
-    }
-  
+    std::string mac = encrypt(this->shared_cipher, authenticator);
     for (int i=0; i<2; i++)
       packet[i+3] = mac[i];
   
     std::string iv = '\0' + this->reverse_address.substr(0,4) + '\1' + packet.substr(0,3);
     iv.append(7,0);
-    std::string buffer;
-    try {
-      buffer = encrypt(this->shared_key, iv);
-    } catch (std::runtime_error & e) {
-      std::cerr << "Packet encryption failed. Error: " << e.what() << std::endl;
-    }
-  
+    std::string buffer = encrypt(this->shared_cipher, iv);
     for (int i=0; i<15; i++)
       packet[i+5] ^= buffer[i];
   
     return packet;
   }
 
+  void TelinkMesh::encrypt_packets(unsigned char * packets, std::size_t count) const {
+    /* Nonce and IV of a packet only depend on its header, so they are encrypted for all
+       packets in a first pass. The MAC needs the encrypted nonce and takes a second pass.
+       Blocks are byte-reversed, as done by encrypt(). */
+    std::vector<unsigned char> nonces(2*count*AES_BLOCK_SIZE, 0);
+    std::vector<unsigned char> macs(count*AES_BLOCK_SIZE);
+    for (std::size_t n=0; n<count; n++) {
+      const unsigned char * packet = packets + n*PACKET_SIZE;
+      unsigned char * auth_nonce = &nonces[2*n*AES_BLOCK_SIZE];
+      unsigned char * iv = auth_nonce + AES_BLOCK_SIZE;
+      for (int i=0; i<4; i++) {
+        auth_nonce[15-i] = this->reverse_address[i];
+        iv[14-i] = this->reverse_address[i];
+      }
+      auth_nonce[11] = 1;
+      iv[10] = 1;
+      for (int i=0; i<3; i++) {
+        auth_nonce[10-i] = packet[i];
+        iv[9-i] = packet[i];
+      }
+      auth_nonce[7] = 0x0f;
+    }
+    this->shared_cipher.encrypt_blocks(nonces.data(), nonces.data(), 2*count);
+  
+    for (std::size_t n=0; n<count; n++) {
+      const unsigned char * packet = packets + n*PACKET_SIZE;
+      const unsigned char * authenticator = &nonces[2*n*AES_BLOCK_SIZE];
+      unsigned char * mac = &macs[n*AES_BLOCK_SIZE];
+      mac[0] = authenticator[0];
+      for (int i=0; i<15; i++)
+        mac[15-i] = authenticator[15-i] ^ packet[i+5];
+    }
+    this->shared_cipher.encrypt_blocks(macs.data(), macs.data(), count);
+  
+    for (std::size_t n=0; n<count; n++) {
+      unsigned char * packet = packets + n*PACKET_SIZE;
+      const unsigned char * mac = &macs[n*AES_BLOCK_SIZE];
+      const unsigned char * buffer = &nonces[(2*n+1)*AES_BLOCK_SIZE];
+      packet[3] = mac[15];
+      packet[4] = mac[14];
+      for (int i=0; i<15; i++)
+        packet[i+5] ^= buffer[15-i];
+    }
+  }
+
   std::string TelinkMesh::decrypt_packet(std::string & packet) const {
     std::string iv = '\0' + this->reverse_address.substr(0,3) + packet.substr(0,5);
     iv.append(7,0);
-    
-    std::string result;
-    
-    try {
-      result = encrypt(this->shared_key, iv);
-    } catch (std::runtime_error & e) {
-      std::cerr << "Packet decryption failed. Error: " << e.what() << std::endl;
-    }
+    std::string result = encrypt(this->shared_cipher, iv);
     for (int i=0; i<packet.size()-7; i++)
       packet[i+7] ^= result[i];
   
@@ -228,6 +424,37 @@ namespace telink {
   }
 
   std::string TelinkMesh::build_packet(int command, const std::string & data) {
+    return this->build_packet(command, data, this->mesh_id);
+  }
+
+  std::string TelinkMesh::build_packet(int command, const std::string & data, int destination) {
+    return this->build_packet(command, reinterpret_cast<const unsigned char*>(data.data()), data.size(), destination);
+  }
+
+  std::string TelinkMesh::build_packet(int command, const unsigned char * data, std::size_t size, int destination) {
+    std::string packet(PACKET_SIZE, 0);
+    this->fill_packet(reinterpret_cast<unsigned char*>(&packet[0]), command, data, size, destination);
+  
+    std::string plain_packet;
+    if (this->trace != nullptr)
+      plain_packet = packet;
+  
+    std::string enc_packet;
+    {
+      TelinkTimelineScope span(this->timeline, SPAN_ENCRYPT, packet_counter(reinterpret_cast<const unsigned char*>(packet.data())), destination, command);
+      enc_packet = this->encrypt_packet(packet);
+    }
+  
+    if (this->trace != nullptr) {
+      plain_packet[3] = enc_packet[3]; // MAC bytes are sent unencrypted
+      plain_packet[4] = enc_packet[4];
+      this->trace->record(TRACE_TX, plain_packet, enc_packet);
+    }
+  
+    return enc_packet;
+  }
+
+  void TelinkMesh::fill_packet(unsigned char * packet, int command, const unsigned char * data, std::size_t size, int destination) {
     /* Telink mesh packets take the following form:
        bytes 0-1   : packet counter
        bytes 2-4   : not used (=0)
@@ -239,78 +466,81 @@ namespace telink {
       All multi-byte elements are in little-endian form.
       Packet counter runs between 1 and 0xffff.
     */
-    std::string packet;
-    packet.resize(20, 0);
+    std::memset(packet, 0, PACKET_SIZE);
     packet[0] = this->packet_count & 0xff;
     packet[1] = (this->packet_count++ >> 8) & 0xff;
-    packet[5] = this->mesh_id & 0xff;
-    packet[6] = (this->mesh_id >> 8) & 0xff;
+    packet[5] = destination & 0xff;
+    packet[6] = (destination >> 8) & 0xff;
     packet[7] = command & 0xff;
     packet[8] = this->vendor & 0xff;
     packet[9] = (this->vendor >> 8) & 0xff;
-    for (int i=0; i<data.size(); i++)
+    for (std::size_t i=0; i<size && i<10; i++)
       packet[i+10] = data[i];
   
-    std::string enc_packet = this->encrypt_packet(packet);
-  
     if (this->packet_count > 0xffff)
       this->packet_count = 1;
-  
-    return enc_packet;
   }
 
   bool TelinkMesh::connect() {
-    if (this->ble_mesh != nullptr){
+    if (this->is_connected() || this->att.is_open()){
       std::cerr << "Error: mesh node with address " << this->address << " is already connected" << std::endl;
       return false;
     }
-  
-    /* access local Bluetooth peripheral */
-    BluetoothManager * manager = nullptr;
-    try {
-        manager = BluetoothManager::get_bluetooth_manager();
-    } catch(const std::runtime_error& e) {
-        std::cerr << "Error while initializing libtinyb: " << e.what() << std::endl;
-        manager = nullptr;
-        return false;
+    {
+      // proxies are recorded again for this connection
+      std::lock_guard<std::mutex> lock(this->relayed_mutex);
+      this->relayed.clear();
     }
-
-    /* start discovery of devices and search for target device */
-    bool ret = manager->start_discovery();
-    this->ble_mesh = manager->find<BluetoothDevice>(nullptr, &(this->address), nullptr, std::chrono::seconds(10));
-    if (this->ble_mesh == nullptr) {
-        std::cerr << "Device not found" << std::endl;
-        ret = manager->stop_discovery();
+  
+    TelinkCacheEntry cached;
+    bool is_cached = this->cache != nullptr && this->cache->get(this->address, cached);
+    bool reused = false;
+    if (this->transport == TRANSPORT_L2CAP) {
+      /* handles resolved by an earlier process are trusted until pairing fails */
+      if (this->handles.command == 0 && is_cached && (cached.flags & CACHE_HANDLES)) {
+        this->handles.notification = cached.handles[0];
+        this->handles.notification_config = cached.handles[1];
+        this->handles.command = cached.handles[2];
+        this->handles.pair = cached.handles[3];
+        this->handles.ota = cached.handles[4];
+      }
+      if (!this->connect_att(reused))
         return false;
+    } else if (!this->connect_gatt(is_cached, reused)) {
+      return false;
     }
   
-    /* connect to device and get info service */
-    this->ble_mesh->connect();
-    std::unique_ptr<BluetoothGattService> info_service = this->ble_mesh->find(&uuid_info_service);
-    ret = manager->stop_discovery(); // stop discovery (device found or timed out)
-  
-    /* get characteristics */
-    this->notification_char = info_service->find(&uuid_notification_char);
-    this->command_char = info_service->find(&uuid_command_char);
-    this->pair_char = info_service->find(&uuid_pair_char);
+    /* derive pairing key once for all connections to the mesh */
+    if (this->credentials == nullptr)
+      this->credentials = TelinkCredentials::get(this->name, this->password);
   
     /* create public key */
     unsigned char buffer[8];
-    int rc = RAND_bytes(buffer, 8);
-    if(rc != 1) {
-      unsigned long err = ERR_get_error();
-      std::cerr << "Cannot generate random key. Error " << err << std::endl;
+    if (!random_bytes(buffer, 8)) {
+      std::cerr << "Cannot generate random key. Error " << errno << std::endl;
+      this->disconnect();
       return false;
     }
-    std::string data = std::string((char*)buffer).substr(0,8);
+    std::string data = std::string((char*)buffer, 8);
     // 2nd part of key is encrypted with mesh name and password
     data.append(8,0);
     std::string enc_data = this->key_encrypt(data);
     std::string packet = '\x0c' + data.substr(0,8) + enc_data.substr(0,8);
   
-    /* send public key to device and get response */
-    this->pair_char->write_value(to_vector(packet));
-    std::vector<unsigned char> response = this->pair_char->read_value();
+    /* send public key to device and get response; characteristics known from an earlier
+       connection are validated by this exchange, and looked up again if it fails */
+    std::vector<unsigned char> response;
+    bool paired = this->exchange_pairing(packet, response);
+    if (!paired && reused)
+      paired = this->discover_characteristics() && this->exchange_pairing(packet, response);
+    if (!paired || response[0] != 0x0d) {
+      if (paired)
+        std::cerr << "Device " << this->address << " rejected mesh name or password" << std::endl;
+      else
+        std::cerr << "Pairing with device " << this->address << " failed" << std::endl;
+      this->disconnect();
+      return false;
+    }
     std::string response_string = from_vector(response);
   
     /* generate shared key */
@@ -318,75 +548,490 @@ namespace telink {
     this->generate_shared_key(data1, data2);
   
     /* set notification callback and enable notifications from device */
-    using namespace std::placeholders;
-    this->notification_char->enable_value_notifications(std::bind(&TelinkMesh::notification_callback, this, _1, _2), nullptr);
-    this->notification_char->write_value({0x01});
+    if (this->transport == TRANSPORT_L2CAP) {
+      const unsigned char enable[2] = {0x01, 0x00};
+      if (this->handles.notification_config != 0)
+        this->att.write(this->handles.notification_config, enable, 2);
+      this->att.write(this->handles.notification, enable, 1);
+    } else {
+      using namespace std::placeholders;
+      this->notification_char->enable_value_notifications(std::bind(&TelinkMesh::notification_callback, this, _1, _2), nullptr);
+      this->notification_char->write_value({0x01});
+      this->open_write_channel();
+    }
+  
+    /* the connection is usable only now that packets can be encrypted; the link is checked
+       after publishing the flag, since a loss during pairing could not clear it */
+    this->connected = true;
+    bool link = this->att.is_open();
+    if (this->transport != TRANSPORT_L2CAP) {
+      try {
+        link = this->ble_mesh->get_connected();
+      } catch (std::exception & e) {
+        link = false;
+      }
+    }
+    if (!link) {
+      std::cerr << "Connection to device " << this->address << " was lost while pairing" << std::endl;
+      this->disconnect();
+      return false;
+    }
+  
+    /* trust cached metadata, and revalidate it asynchronously if too old */
+    if (is_cached) {
+      if (this->mesh_id == 0 && (cached.flags & CACHE_MESH_ID))
+        this->mesh_id = cached.mesh_id;
+      if (std::time(nullptr) - static_cast<time_t>(cached.checked) > this->cache_max_age) {
+        this->query_mesh_id();
+        this->query_groups();
+        this->query_device_version();
+      }
+    }
+    this->update_cache([this](TelinkCacheEntry & entry) {
+      // handles are worth keeping only once pairing proved them right
+      if (this->transport == TRANSPORT_L2CAP) {
+        entry.handles[0] = this->handles.notification;
+        entry.handles[1] = this->handles.notification_config;
+        entry.handles[2] = this->handles.command;
+        entry.handles[3] = this->handles.pair;
+        entry.handles[4] = this->handles.ota;
+        entry.flags |= CACHE_HANDLES;
+      }
+    });
   
     return true;
   }
 
+  bool TelinkMesh::exchange_pairing(const std::string & packet, std::vector<unsigned char> & response) {
+    response.clear();
+    if (this->transport == TRANSPORT_L2CAP) {
+      if (!this->att.write(this->handles.pair, reinterpret_cast<const unsigned char*>(packet.data()), packet.size())
+          || !this->att.read(this->handles.pair, response))
+        return false;
+    } else {
+      try {
+        this->pair_char->write_value(to_vector(packet));
+        response = this->pair_char->read_value();
+      } catch (std::exception & e) {
+        return false;
+      }
+    }
+    // 0x0d acknowledges the key, 0x0e rejects mesh name or password
+    return response.size() >= 9 && (response[0] == 0x0d || response[0] == 0x0e);
+  }
+
+  bool TelinkMesh::connect_socket(int fd) {
+    if (this->is_connected() || this->att.is_open()) {
+      std::cerr << "Error: mesh node with address " << this->address << " is already connected" << std::endl;
+      ::close(fd);
+      return false;
+    }
+    this->transport = TRANSPORT_L2CAP;
+    this->att_socket = fd; // taken over by connect_att()
+    return this->connect();
+  }
+
+  bool TelinkMesh::find_device(bool is_cached) {
+    /* access local Bluetooth peripheral */
+    BluetoothManager * manager = nullptr;
+    try {
+        manager = BluetoothManager::get_bluetooth_manager();
+    } catch(const std::runtime_error& e) {
+        std::cerr << "Error while initializing libtinyb: " << e.what() << std::endl;
+        manager = nullptr;
+        return false;
+    }
+
+    /* look up the adapter the connection is pinned to */
+    std::unique_ptr<BluetoothAdapter> adapter;
+    if (!this->adapter.empty()) {
+      for (auto & candidate : manager->get_adapters()) {
+        if (candidate->get_address() == this->adapter || candidate->get_name() == this->adapter) {
+          adapter = std::move(candidate);
+          break;
+        }
+      }
+      if (adapter == nullptr) {
+        std::cerr << "Bluetooth adapter " << this->adapter << " not found" << std::endl;
+        return false;
+      }
+    }
+  
+    /* a cached device is likely still known to the Bluetooth stack: look it up without discovery first */
+    if (is_cached)
+      this->ble_mesh = manager->find<BluetoothDevice>(nullptr, &(this->address), adapter.get(), std::chrono::seconds(1));
+  
+    /* start discovery of devices and search for target device */
+    bool ret;
+    if (this->ble_mesh == nullptr) {
+      ret = adapter != nullptr ? adapter->start_discovery() : manager->start_discovery();
+      this->ble_mesh = manager->find<BluetoothDevice>(nullptr, &(this->address), adapter.get(), std::chrono::seconds(10));
+      ret = adapter != nullptr ? adapter->stop_discovery() : manager->stop_discovery(); // stop discovery (device found or timed out)
+      if (this->ble_mesh == nullptr) {
+          std::cerr << "Device not found" << std::endl;
+          return false;
+      }
+    }
+    this->device_adapter = this->adapter;
+    return true;
+  }
+
+  bool TelinkMesh::connect_gatt(bool is_cached, bool & reused) {
+    /* track connection state from notifications, then connect to device */
+    auto attach = [this]() {
+      using namespace std::placeholders;
+      this->ble_mesh->enable_connected_notifications(std::bind(&TelinkMesh::connection_callback, this, _1, _2), nullptr);
+      this->ble_mesh->connect();
+    };
+  
+    /* a device object kept from an earlier connection is connected to directly, but BlueZ
+       may have removed the device meanwhile: look it up again if the object is stale */
+    reused = false;
+    if (this->ble_mesh != nullptr) {
+      try {
+        attach();
+        reused = this->pair_char != nullptr;
+      } catch (std::exception & e) {
+        std::cerr << "Device object of " << this->address << " is stale (" << e.what() << "); looking it up again" << std::endl;
+        this->drop_device();
+      }
+    }
+    if (this->ble_mesh == nullptr) {
+      if (!this->find_device(is_cached))
+        return false;
+      try {
+        attach();
+      } catch (std::exception & e) {
+        std::cerr << "Cannot connect to device with address " << this->address << ": " << e.what() << std::endl;
+        this->drop_device();
+        this->connected = false;
+        return false;
+      }
+    }
+    if (!reused && !this->discover_characteristics()) {
+      this->disconnect();
+      return false;
+    }
+    return true;
+  }
+
+  bool TelinkMesh::connect_att(bool & reused) {
+    /* notifications are handled on the dispatcher thread of the ATT client, disconnection on its reader thread */
+    this->att.set_notification_handler([this](uint16_t handle, const unsigned char * data, std::size_t size) {
+      if (handle == this->handles.notification)
+        this->receive_notification(std::vector<unsigned char>(data, data + size));
+    });
+    this->att.set_disconnection_handler([this]() {
+      this->connected = false;
+    });
+    // adapters can only be selected by address on this transport
+    int fd = this->att_socket;
+    this->att_socket = -1;
+    if (fd >= 0 ? !this->att.attach(fd) : !this->att.open(this->address, false, this->adapter))
+      return false;
+  
+    /* handles from an earlier connection or from the cache are validated by pairing */
+    reused = this->handles.command != 0;
+    if (!reused && !this->discover_characteristics()) {
+      this->att.close();
+      return false;
+    }
+    return true;
+  }
+
+  bool TelinkMesh::discover_characteristics() {
+    if (this->transport != TRANSPORT_L2CAP) {
+      // TinyB looks objects up by identifier string
+      std::string service_uuid = uuid_info_service, notification_uuid = uuid_notification_char;
+      std::string command_uuid = uuid_command_char, pair_uuid = uuid_pair_char;
+      this->ota_char = nullptr;
+      this->info_service = this->ble_mesh->find(&service_uuid);
+      if (this->info_service == nullptr) {
+        std::cerr << "Device with address " << this->address << " has no Telink service" << std::endl;
+        return false;
+      }
+      this->notification_char = this->info_service->find(&notification_uuid);
+      this->command_char = this->info_service->find(&command_uuid);
+      this->pair_char = this->info_service->find(&pair_uuid);
+      if (this->notification_char == nullptr || this->command_char == nullptr || this->pair_char == nullptr) {
+        std::cerr << "Device with address " << this->address << " lacks Telink characteristics" << std::endl;
+        this->pair_char = nullptr;
+        return false;
+      }
+      return true;
+    }
+  
+    /* resolve handles of info service */
+    this->att.exchange_mtu();
+    uint16_t start, end;
+    std::vector<TelinkAttCharacteristic> characteristics;
+    this->handles = TelinkServiceHandles();
+    if (!this->att.find_service(uuid_info_service, start, end) || !this->att.find_characteristics(start, end, characteristics)) {
+      std::cerr << "Device with address " << this->address << " has no Telink service" << std::endl;
+      return false;
+    }
+    for (auto & characteristic : characteristics) {
+      if (characteristic.uuid == uuid_notification_char) {
+        this->handles.notification = characteristic.value;
+        this->handles.notification_config = this->att.find_descriptor(characteristic, GATT_CLIENT_CONFIG);
+      } else if (characteristic.uuid == uuid_command_char) {
+        this->handles.command = characteristic.value;
+      } else if (characteristic.uuid == uuid_pair_char) {
+        this->handles.pair = characteristic.value;
+      } else if (characteristic.uuid == uuid_ota_char) {
+        this->handles.ota = characteristic.value;
+      }
+    }
+    if (this->handles.notification == 0 || this->handles.command == 0 || this->handles.pair == 0) {
+      std::cerr << "Device with address " << this->address << " lacks Telink characteristics" << std::endl;
+      this->handles = TelinkServiceHandles();
+      return false;
+    }
+    return true;
+  }
+
   void TelinkMesh::disconnect() {
-    if (this->ble_mesh != nullptr)
+    this->write_channel.release();
+    this->att.close();
+    if (this->ble_mesh != nullptr) {
+      try {
+        // notifications are enabled again on next connection
+        if (this->notification_char != nullptr)
+          this->notification_char->disable_value_notifications();
+        this->ble_mesh->disable_connected_notifications();
         this->ble_mesh->disconnect();
+      } catch (std::exception & e) {
+        // link already lost
+      }
+    }
+    this->connected = false;
+    // device objects and handles are kept to reconnect without discovery, unless they belong
+    // to an adapter that was changed while connected
+    if (this->ble_mesh != nullptr && this->device_adapter != this->adapter)
+      this->drop_device();
+  }
+
+  void TelinkMesh::drop_device() {
+    this->notification_char = nullptr;
+    this->command_char = nullptr;
+    this->pair_char = nullptr;
+    this->ota_char = nullptr;
+    this->info_service = nullptr;
     this->ble_mesh = nullptr;
+    this->handles = TelinkServiceHandles();
+  }
+
+  void TelinkMesh::forget_device() {
+    if (this->is_connected()) {
+      std::cerr << "Device can only be forgotten when disconnected." << std::endl;
+      return;
+    }
+    this->drop_device();
+    TelinkCacheEntry cached;
+    if (this->cache != nullptr && this->cache->get(this->address, cached) && (cached.flags & CACHE_HANDLES)) {
+      this->update_cache([](TelinkCacheEntry & entry) {
+        entry.flags &= ~CACHE_HANDLES;
+      });
+    }
   }
 
   bool TelinkMesh::is_connected() {
-    if (this->ble_mesh == nullptr) return false;
-    return this->ble_mesh->get_connected();
+    return this->connected.load(std::memory_order_acquire);
   }
   
-  void TelinkMesh::send_packet(int command, const std::string & data) {
+  bool TelinkMesh::ensure_connected() {
+    if (this->is_connected()) return true;
+    if (!this->auto_reconnect) return false;
+    TelinkTimelineScope span(this->timeline, SPAN_CONNECT);
+    this->disconnect();
+    this->connect();
     if (!this->is_connected()) {
-      this->disconnect();
-      this->connect();
-      if (!this->is_connected()) {
-        std::cerr << "Device with address " << this->address << " is disconnected and reconnection failed." << std::endl;
+      std::cerr << "Device with address " << this->address << " is disconnected and reconnection failed." << std::endl;
+      return false;
+    }
+    return true;
+  }
+  
+  void TelinkMesh::send_packet(int command, const std::string & data) {
+    this->send_payload(command, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+  }
+  
+  void TelinkMesh::send_payload(int command, const unsigned char * data, std::size_t size) {
+    // a failed write means the link is lost even if not notified yet: reconnect and retry once
+    for (int attempt=0; attempt<2; attempt++) {
+      if (!this->ensure_connected()) return;
+      // packet is built again after reconnection, as the session key changed
+      std::string enc_packet = this->build_packet(command, data, size, this->mesh_id);
+      if (this->write_packets(reinterpret_cast<const unsigned char*>(enc_packet.data()), 1) == 1)
         return;
+    }
+  }
+  
+  std::size_t TelinkMesh::send_packets(int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count) {
+    if (count == 0 || !this->ensure_connected()) return 0;
+    // encode all packets first, so that writes follow each other closely
+    std::vector<unsigned char> packets(count*PACKET_SIZE);
+    {
+      TelinkTimelineScope span(this->timeline, SPAN_BUILD, 0, destinations[0], command, count);
+      for (std::size_t i=0; i<count; i++)
+        this->fill_packet(&packets[i*PACKET_SIZE], command, data + i*data_size, data_size, destinations[i]);
+      span.packet = packet_counter(packets.data());
+    }
+    std::vector<unsigned char> plain_packets;
+    if (this->trace != nullptr)
+      plain_packets = packets;
+  
+    {
+      TelinkTimelineScope span(this->timeline, SPAN_ENCRYPT, packet_counter(packets.data()), destinations[0], command, count);
+      this->encrypt_packets(packets.data(), count);
+    }
+  
+    if (this->trace != nullptr) {
+      for (std::size_t i=0; i<count; i++) {
+        unsigned char * plain_packet = &plain_packets[i*PACKET_SIZE];
+        const unsigned char * enc_packet = &packets[i*PACKET_SIZE];
+        plain_packet[3] = enc_packet[3]; // MAC bytes are sent unencrypted
+        plain_packet[4] = enc_packet[4];
+        this->trace->record(TRACE_TX, std::string(plain_packet, plain_packet + PACKET_SIZE), std::string(enc_packet, enc_packet + PACKET_SIZE));
+      }
+    }
+  
+    // on failure, connection is recovered on next send
+    return this->write_packets(packets.data(), count);
+  }
+  
+  std::size_t TelinkMesh::write_packets(const unsigned char * packets, std::size_t count) {
+    TelinkTimelineScope span(this->timeline, SPAN_WRITE, packet_counter(packets), 0, 0, count);
+    std::size_t written = 0;
+    if (this->att.is_open()) {
+      if (this->write_mode == WRITE_COMMAND) {
+        written = this->att.write_commands(this->handles.command, packets, PACKET_SIZE, count);
+      } else {
+        while (written < count && this->att.write(this->handles.command, packets + written*PACKET_SIZE, PACKET_SIZE))
+          written++;
       }
+      if (written < count && !this->att.is_open())
+        this->connected = false;
+    } else if (this->write_channel.is_open()) {
+      written = this->write_channel.write(packets, PACKET_SIZE, count);
+      if (!this->write_channel.is_open())
+        this->connected = false;
+    } else {
+      try {
+        for (; written<count; written++)
+          this->command_char->write_value(std::vector<unsigned char>(packets + written*PACKET_SIZE, packets + (written+1)*PACKET_SIZE));
+      } catch (std::exception & e) {
+        std::cerr << "Error while sending packets to " << this->address << ": " << e.what() << std::endl;
+        this->connected = false;
+      }
+    }
+    this->packets_sent += written;
+    return written;
+  }
+  
+  void TelinkMesh::open_write_channel() {
+    if (this->write_mode != WRITE_COMMAND || this->command_char == nullptr) {
+      this->write_channel.release();
+      return;
     }
-    std::string enc_packet = this->build_packet(command, data);
-    this->command_char->write_value(to_vector(enc_packet));
+    if (!this->write_channel.is_open() && !this->write_channel.acquire(this->command_char->get_object_path()))
+      std::cerr << "Falling back to write requests for device " << this->address << std::endl;
   }
   
   void TelinkMesh::query_mesh_id() {
-    this->send_packet(COMMAND_ADDRESS_EDIT, {schar(0xff), schar(0xff)});
+    this->send_command<TelinkAddressQuery>();
+  }
+  
+  void TelinkMesh::query_ota_state() {
+    this->send_command<TelinkOtaStateQuery>();
+  }
+  
+  bool TelinkMesh::write_ota_packet(const std::string & packet) {
+    if (this->att.is_open()) {
+      if (this->handles.ota == 0) {
+        std::cerr << "Device with address " << this->address << " has no OTA characteristic." << std::endl;
+        return false;
+      }
+      return this->att.write(this->handles.ota, reinterpret_cast<const unsigned char*>(packet.data()), packet.size());
+    }
+    if (this->info_service == nullptr || !this->is_connected())
+      return false;
+    try {
+      if (this->ota_char == nullptr) {
+        std::string ota_uuid = uuid_ota_char;
+        this->ota_char = this->info_service->find(&ota_uuid, std::chrono::seconds(2));
+      }
+      if (this->ota_char == nullptr) {
+        std::cerr << "Device with address " << this->address << " has no OTA characteristic." << std::endl;
+        return false;
+      }
+      return this->ota_char->write_value(to_vector(packet));
+    } catch (std::exception & e) {
+      std::cerr << "OTA write failed. Error: " << e.what() << std::endl;
+      return false;
+    }
+  }
+  
+  bool TelinkMesh::sync_ota() {
+    if (this->att.is_open()) {
+      std::vector<unsigned char> value;
+      return this->handles.ota != 0 && this->att.read(this->handles.ota, value);
+    }
+    if (this->ota_char == nullptr)
+      return false;
+    try {
+      this->ota_char->read_value();
+      return true;
+    } catch (std::exception & e) {
+      std::cerr << "OTA read failed. Error: " << e.what() << std::endl;
+      return false;
+    }
   }
   
   void TelinkMesh::query_groups() {
-    this->send_packet(COMMAND_GROUP_ID_QUERY, {0x0A, 0x01});
+    this->send_command<TelinkGroupQuery>();
   }
   
   void TelinkMesh::query_time() {
-    this->send_packet(COMMAND_TIME_QUERY, {0x10});
+    this->send_command<TelinkTimeQuery>();
   }
   
   void TelinkMesh::query_device_info() {
-    this->send_packet(COMMAND_DEVICE_INFO_QUERY, {0x10});
+    this->send_command<TelinkDeviceInfoQuery>();
   }
   
   void TelinkMesh::query_device_version() {
-    this->send_packet(COMMAND_DEVICE_INFO_QUERY, {0x10, 0x02});
+    this->send_command<TelinkDeviceVersionQuery>();
   }
   
   void TelinkMesh::set_time() {
     time_t now = std::time( 0 );
     tm *ltm = std::localtime( &now );
     int year = 1900 + ltm->tm_year;
-    this->send_packet(COMMAND_TIME_SET, {schar(year & 0xff), schar(year >> 8), schar(ltm->tm_mon + 1), schar(ltm->tm_mday), schar(ltm->tm_hour), schar(ltm->tm_min), schar(ltm->tm_sec)});
+    this->send_command<TelinkTimeSet>(year, ltm->tm_mon + 1, ltm->tm_mday, ltm->tm_hour, ltm->tm_min, ltm->tm_sec);
   }
   
   void TelinkMesh::set_mesh_id(int mesh_id) {
     this->mesh_id = mesh_id & 0xffff;
-    this->send_packet(COMMAND_ADDRESS_EDIT, {schar(mesh_id & 0xff), schar((mesh_id >> 8) & 0xff)});
+    this->update_cache([mesh_id](TelinkCacheEntry & entry) {
+      entry.mesh_id = mesh_id & 0xffff;
+      entry.flags |= CACHE_MESH_ID;
+    });
+    this->send_command<TelinkAddressSet>(mesh_id);
   }
   
   void TelinkMesh::add_group(unsigned char group_id) {
-    this->send_packet(COMMAND_GROUP_EDIT, {0x01, schar(group_id), schar(0x80)});
+    this->update_cache([](TelinkCacheEntry & entry) {
+      entry.flags &= ~CACHE_GROUPS; // group list must be queried again
+    });
+    this->send_command<TelinkGroupAdd>(group_id);
   }
   
   void TelinkMesh::delete_group(unsigned char group_id) {
-    this->send_packet(COMMAND_GROUP_EDIT, {0x00, schar(group_id), schar(0x80)});
+    this->update_cache([](TelinkCacheEntry & entry) {
+      entry.flags &= ~CACHE_GROUPS; // group list must be queried again
+    });
+    this->send_command<TelinkGroupDelete>(group_id);
   }
   
   bool TelinkMesh::check_packet_validity(const std::string & packet) {
@@ -396,8 +1041,13 @@ namespace telink {
     unsigned int received_id;
     if (static_cast<unsigned char>(packet[7]) == COMMAND_ONLINE_STATUS_REPORT) {
       received_id = packet[10];
-      if (this->mesh_id == 0)
+      if (this->mesh_id == 0) {
         this->mesh_id = received_id;
+        this->update_cache([received_id](TelinkCacheEntry & entry) {
+          entry.mesh_id = received_id;
+          entry.flags |= CACHE_MESH_ID;
+        });
+      }
     } else {
       received_id = packet[3];
     }
@@ -425,6 +1075,11 @@ namespace telink {
     std::vector<unsigned char> mac_address(6);
     for (int i=0; i<6; i++)
       mac_address[i] = packet[12+i];
+    this->update_cache([mesh_id](TelinkCacheEntry & entry) {
+      entry.mesh_id = mesh_id;
+      entry.flags |= CACHE_MESH_ID;
+      entry.checked = std::time(nullptr);
+    });
   }
   
   void TelinkMesh::parse_device_info_report(const std::string & packet) {
@@ -432,6 +1087,11 @@ namespace telink {
     // the content of these packets, except for the 2 conditions below
     if (packet[19] == 0) { // packet contains device info
     } else if (packet[19] == 2) { // packet contains device version
+      this->update_cache([&packet](TelinkCacheEntry & entry) {
+        std::copy(packet.begin()+10, packet.begin()+20, entry.version);
+        entry.flags |= CACHE_FIRMWARE;
+        entry.checked = std::time(nullptr);
+      });
     }
   }
   
@@ -439,6 +1099,17 @@ namespace telink {
     std::vector<unsigned char> groups(10);
     for (int i=0; i<10; i++)
       groups[i] = packet[10+i];
+    this->update_cache([&groups](TelinkCacheEntry & entry) {
+      std::copy(groups.begin(), groups.end(), entry.groups);
+      entry.flags |= CACHE_GROUPS;
+      entry.checked = std::time(nullptr);
+    });
+  }
+  
+  void TelinkMesh::parse_ota_status_report(const std::string & packet) {
+    // byte 10: OTA state; bytes 11-12: number of blocks received by device
+    this->ota_block = static_cast<unsigned char>(packet[11]) | (static_cast<unsigned char>(packet[12]) << 8);
+    this->ota_state = static_cast<unsigned char>(packet[10]);
   }
   
   void TelinkMesh::parse_command(const std::string & packet) {
@@ -455,6 +1126,9 @@ namespace telink {
       } else if (static_cast<unsigned char>(packet[7]) == COMMAND_GROUP_ID_REPORT) {
         this->parse_group_id_report(packet);
         
+      } else if (static_cast<unsigned char>(packet[7]) == COMMAND_OTA_STATUS_REPORT) {
+        this->parse_ota_status_report(packet);
+        
       }
     }
   }
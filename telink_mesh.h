@@ -9,37 +9,49 @@
 #include <string>
 #include <vector>
 #include <exception>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
 #include <tinyb.hpp>
 
+#include "telink_trace.h"
+#include "telink_timeline.h"
+#include "telink_cache.h"
+#include "telink_shared_state.h"
+#include "telink_presence.h"
+#include "telink_registry.h"
+#include "telink_credentials.h"
+#include "telink_aes.h"
+#include "telink_commands.h"
+#include "telink_write_channel.h"
+#include "telink_att.h"
+
 namespace telink {
   
   #define schar(x) static_cast<char>(x)
   
+  /** \brief Size of a mesh packet, in bytes. */
+  #define PACKET_SIZE 20
+  
+  // Command write modes
+  #define WRITE_REQUEST 0 // acknowledged writes
+  #define WRITE_COMMAND 1 // unacknowledged writes
+  
+  // Transports to device
+  #define TRANSPORT_DBUS  0 // GATT through TinyB, D-Bus and bluetoothd
+  #define TRANSPORT_L2CAP 1 // ATT on an L2CAP socket, without bluetoothd
+  
   /** \brief UUID for Bluetooth GATT information service */
-  static std::string uuid_info_service = "00010203-0405-0607-0809-0a0b0c0d1910";
+  constexpr char uuid_info_service[] = "00010203-0405-0607-0809-0a0b0c0d1910";
   /** \brief UUID for Bluetooth GATT notification characteristic */
-  static std::string uuid_notification_char = "00010203-0405-0607-0809-0a0b0c0d1911";
+  constexpr char uuid_notification_char[] = "00010203-0405-0607-0809-0a0b0c0d1911";
   /** \brief UUID for Bluetooth GATT command characteristic */
-  static std::string uuid_command_char = "00010203-0405-0607-0809-0a0b0c0d1912";
+  constexpr char uuid_command_char[] = "00010203-0405-0607-0809-0a0b0c0d1912";
+  /** \brief UUID for Bluetooth GATT OTA characteristic */
+  constexpr char uuid_ota_char[] = "00010203-0405-0607-0809-0a0b0c0d1913";
   /** \brief UUID for Bluetooth GATT pairing characteristic */
-  static std::string uuid_pair_char = "00010203-0405-0607-0809-0a0b0c0d1914";
-  
-  // Command codes
-  #define COMMAND_OTA_UPDATE            0xC6
-  #define COMMAND_QUERY_OTA_STATE       0xC7
-  #define COMMAND_OTA_STATUS_REPORT     0xC8
-  #define COMMAND_GROUP_ID_QUERY        0xDD
-  #define COMMAND_GROUP_ID_REPORT       0xD4
-  #define COMMAND_GROUP_EDIT            0xD7
-  #define COMMAND_ONLINE_STATUS_REPORT  0xDC
-  #define COMMAND_ADDRESS_EDIT          0xE0
-  #define COMMAND_ADDRESS_REPORT        0xE1
-  #define COMMAND_RESET                 0xE3
-  #define COMMAND_TIME_QUERY            0xE8
-  #define COMMAND_TIME_REPORT           0xE9
-  #define COMMAND_TIME_SET              0xE4
-  #define COMMAND_DEVICE_INFO_QUERY     0xEA
-  #define COMMAND_DEVICE_INFO_REPORT    0xEB
+  constexpr char uuid_pair_char[] = "00010203-0405-0607-0809-0a0b0c0d1914";
   
   /** \class TelinkMeshException
    *  \brief Exception possibly generated by TelinkMesh and derived classes.
@@ -67,6 +79,38 @@ namespace telink {
     }
   };
   
+  /** \class TelinkServiceHandles
+   *  \brief Attribute handles of the Telink service, for the L2CAP transport. They are kept
+   *  across connections and stored in the metadata cache, so that reconnecting skips discovery.
+   */
+  class TelinkServiceHandles {
+  public:
+    /** \property uint16_t notification
+     *  \brief Value handle of notification characteristic.
+     */
+    uint16_t notification = 0;
+    
+    /** \property uint16_t notification_config
+     *  \brief Handle of client configuration descriptor of notification characteristic, or 0.
+     */
+    uint16_t notification_config = 0;
+    
+    /** \property uint16_t command
+     *  \brief Value handle of command characteristic.
+     */
+    uint16_t command = 0;
+    
+    /** \property uint16_t pair
+     *  \brief Value handle of pairing characteristic.
+     */
+    uint16_t pair = 0;
+    
+    /** \property uint16_t ota
+     *  \brief Value handle of OTA characteristic, or 0.
+     */
+    uint16_t ota = 0;
+  };
+  
   /** \class TelinkMesh
    *  \brief Class handling connection with a Bluetooth LE device with Telink mesh protocol.
    */
@@ -92,11 +136,21 @@ namespace telink {
      */
     std::string password;
     
+    /** \property std::shared_ptr<const TelinkCredentials> credentials
+     *  \brief Pairing key derived from name and password, shared with other connections to the same mesh.
+     */
+    std::shared_ptr<const TelinkCredentials> credentials;
+    
     /** \property std::string shared_key
      *  \brief Shared key used to encrypt communication with device.
      */
     std::string shared_key;
     
+    /** \property TelinkAes shared_cipher
+     *  \brief Expanded shared key, used to encrypt and decrypt packets.
+     */
+    TelinkAes shared_cipher;
+    
     /** \property int vendor
      *  \brief Bluetooth vendor code.
      */
@@ -112,10 +166,68 @@ namespace telink {
      */
     int packet_count = 1;
   
+    /** \property bool auto_reconnect
+     *  \brief true if sending reconnects a lost connection.
+     */
+    bool auto_reconnect = true;
+  
+    /** \property int write_mode
+     *  \brief How command packets are written (WRITE_REQUEST or WRITE_COMMAND).
+     */
+    int write_mode = WRITE_REQUEST;
+  
+    /** \property TelinkWriteChannel write_channel
+     *  \brief Channel to command characteristic, open in WRITE_COMMAND mode.
+     */
+    TelinkWriteChannel write_channel;
+  
+    /** \property int transport
+     *  \brief How the device is reached (TRANSPORT_DBUS or TRANSPORT_L2CAP).
+     */
+    int transport = TRANSPORT_DBUS;
+  
+    /** \property TelinkAttClient att
+     *  \brief ATT link to device, with the L2CAP transport.
+     */
+    TelinkAttClient att;
+  
+    /** \property TelinkServiceHandles handles
+     *  \brief Attribute handles resolved on the ATT link.
+     */
+    TelinkServiceHandles handles;
+  
+    /** \property int att_socket
+     *  \brief Connected socket given to connect_socket(), used by the next connection instead
+     *  of opening an L2CAP link; -1 if none.
+     */
+    int att_socket = -1;
+  
+    /** \property std::string adapter
+     *  \brief Address or name of the Bluetooth adapter to connect through; empty for any adapter.
+     */
+    std::string adapter;
+  
+    /** \property std::atomic<uint64_t> packets_sent
+     *  \brief Number of command packets written.
+     */
+    std::atomic<uint64_t> packets_sent;
+  
+    /** \property std::atomic<bool> connected
+     *  \brief Connection state, set once pairing succeeded and cleared by notifications from
+     *  the Bluetooth stack and by failed writes.
+     */
+    std::atomic<bool> connected;
+  
     /** \property std::unique_ptr<BluetoothDevice> ble_mesh
-     *  \brief TinyB Bluetooth device object.
+     *  \brief TinyB Bluetooth device object; kept after disconnection, with the service and
+     *  characteristic objects, to reconnect without lookup.
      */
     std::unique_ptr<BluetoothDevice> ble_mesh;
+
+    /** \property std::string device_adapter
+     *  \brief Adapter setting the device object was looked up with.
+     */
+    std::string device_adapter;
     
     /** \property std::unique_ptr<BluetoothGattCharacteristic> notification_char
      *  \brief TinyB object for notification Bluetooth GATT characteristic.
@@ -131,6 +243,87 @@ namespace telink {
      *  \brief TinyB object for pairing Bluetooth GATT characteristic.
      */
     std::unique_ptr<BluetoothGattCharacteristic> pair_char;
+    
+    /** \property std::unique_ptr<BluetoothGattService> info_service
+     *  \brief TinyB object for information Bluetooth GATT service.
+     */
+    std::unique_ptr<BluetoothGattService> info_service;
+    
+    /** \property std::unique_ptr<BluetoothGattCharacteristic> ota_char
+     *  \brief TinyB object for OTA Bluetooth GATT characteristic; looked up on first use.
+     */
+    std::unique_ptr<BluetoothGattCharacteristic> ota_char;
+    
+    /** \property std::atomic<int> ota_state
+     *  \brief OTA state from last OTA status report; -1 if none was received.
+     */
+    std::atomic<int> ota_state;
+    
+    /** \property std::atomic<int> ota_block
+     *  \brief Number of OTA blocks received by device, from last OTA status report; -1 if none was received.
+     */
+    std::atomic<int> ota_block;
+    
+    /** \property TelinkTrace * trace
+     *  \brief Packet trace recorder; nullptr if tracing is disabled.
+     */
+    TelinkTrace * trace = nullptr;
+    
+    /** \property TelinkTimeline * timeline
+     *  \brief Packet stage timeline; nullptr if stage timing is disabled.
+     */
+    TelinkTimeline * timeline = nullptr;
+    
+    /** \property TelinkCache * cache
+     *  \brief Device metadata cache; nullptr if caching is disabled.
+     */
+    TelinkCache * cache = nullptr;
+    
+    /** \property int cache_max_age
+     *  \brief Age in seconds after which cached metadata is revalidated on connection.
+     */
+    int cache_max_age = 3600;
+    
+    /** \property TelinkSharedState * shared_state
+     *  \brief Shared memory node state table; nullptr if publishing is disabled.
+     */
+    TelinkSharedState * shared_state = nullptr;
+    
+    /** \property TelinkPresence * presence
+     *  \brief Mesh-wide presence table; nullptr if disabled.
+     */
+    TelinkPresence * presence = nullptr;
+    
+    /** \property TelinkNodeRegistry * registry
+     *  \brief Node state registry; nullptr if disabled.
+     */
+    TelinkNodeRegistry * registry = nullptr;
+    
+    /** \property std::vector<std::pair<int, std::function<void(const std::string &)>>> report_listeners
+     *  \brief Functions receiving every decrypted report from the mesh, with their IDs.
+     */
+    std::vector<std::pair<int, std::function<void(const std::string &)>>> report_listeners;
+    
+    /** \property int listener_id
+     *  \brief Last report listener ID.
+     */
+    int listener_id = 0;
+    
+    /** \property std::mutex listener_mutex
+     *  \brief Protects report listeners.
+     */
+    std::mutex listener_mutex;
+  
+    /** \property std::unordered_set<int> relayed
+     *  \brief Mesh IDs of nodes whose reports came through this connection since it was
+     *  established, already recorded in the cache.
+     */
+    std::unordered_set<int> relayed;
+  
+    /** \property std::mutex relayed_mutex
+     *  \brief Protects relayed.
+     */
+    std::mutex relayed_mutex;
   
     /** \fn std::string combine_name_and_password()
      *  \brief Combines the device name and password for use with shared key generation.
@@ -159,6 +352,16 @@ namespace telink {
      */
     std::string encrypt_packet(std::string & packet) const;
     
+    /** \fn void encrypt_packets(unsigned char * packets, std::size_t count) const
+     *  \brief Encrypts several packets in place with stored shared key. The result is the same
+     *  as encrypt_packet on each of them, but AES blocks of all packets are encrypted together,
+     *  stage by stage, so that the cipher works on independent blocks instead of waiting on the
+     *  chain of each packet.
+     *  \param packets : count x PACKET_SIZE bytes to encrypt.
+     *  \param count : number of packets.
+     */
+    void encrypt_packets(unsigned char * packets, std::size_t count) const;
+    
     /** \fn std::string decrypt_packet(std::string & packet) const
      *  \brief Decrypts given packet with stored shared key.
      *  \param packet : 20-byte packet to decrypt.
@@ -173,6 +376,113 @@ namespace telink {
      *  \returns the encrypted generated packet.
      */
     std::string build_packet(int command, const std::string & data);
+    
+    /** \fn std::string build_packet(int command, const std::string & data, int destination)
+     *  \brief Builds a command packet addressed to a given mesh node.
+     *  \param command : command code.
+     *  \param data : command parameters (up to 10 byte).
+     *  \param destination : mesh ID of the target node or group.
+     *  \returns the encrypted generated packet.
+     */
+    std::string build_packet(int command, const std::string & data, int destination);
+    
+    /** \fn std::string build_packet(int command, const unsigned char * data, std::size_t size, int destination)
+     *  \brief Builds a command packet from a raw payload.
+     *  \param command : command code.
+     *  \param data : command parameters.
+     *  \param size : size of parameters (up to 10 byte).
+     *  \param destination : mesh ID of the target node or group.
+     *  \returns the encrypted generated packet.
+     */
+    std::string build_packet(int command, const unsigned char * data, std::size_t size, int destination);
+    
+    /** \fn void fill_packet(unsigned char * packet, int command, const unsigned char * data, std::size_t size, int destination)
+     *  \brief Writes an unencrypted command packet and advances the packet counter.
+     *  \param packet : PACKET_SIZE-byte buffer to fill.
+     *  \param command : command code.
+     *  \param data : command parameters.
+     *  \param size : size of parameters (up to 10 byte).
+     *  \param destination : mesh ID of the target node or group.
+     */
+    void fill_packet(unsigned char * packet, int command, const unsigned char * data, std::size_t size, int destination);
+  
+    /** \fn void connection_callback(BluetoothDevice & device, bool connected)
+     *  \brief Callback for connection state changes of Bluetooth device.
+     *  \param device : Bluetooth device.
+     *  \param connected : new connection state.
+     */
+    void connection_callback(BluetoothDevice & device, bool connected);
+  
+    /** \fn bool ensure_connected()
+     *  \brief Reconnects a lost connection, if auto-reconnection is enabled.
+     *  \returns true if the device is connected.
+     */
+    bool ensure_connected();
+  
+    /** \fn void open_write_channel()
+     *  \brief Opens or closes the write channel according to write mode.
+     */
+    void open_write_channel();
+  
+    /** \fn void drop_device()
+     *  \brief Releases the device object, characteristics and handles kept from previous
+     *  connections.
+     */
+    void drop_device();
+  
+    /** \fn bool find_device(bool is_cached)
+     *  \brief Looks up the TinyB device object, with discovery if needed.
+     *  \param is_cached : true if the device is in the metadata cache.
+     *  \returns true if the device was found.
+     */
+    bool find_device(bool is_cached);
+  
+    /** \fn bool connect_gatt(bool is_cached, bool & reused)
+     *  \brief Connects through TinyB and looks up the Telink characteristics, unless they
+     *  are known from a previous connection. A kept device object that fails to connect is
+     *  dropped and the device looked up again.
+     *  \param is_cached : true if the device is in the metadata cache.
+     *  \param reused : set to true if characteristics from a previous connection are used.
+     *  \returns true on success.
+     */
+    bool connect_gatt(bool is_cached, bool & reused);
+  
+    /** \fn bool connect_att(bool & reused)
+     *  \brief Opens an ATT link and resolves the handles of the Telink characteristics, unless
+     *  they are known from a previous connection or from the cache.
+     *  \param reused : set to true if known handles are used.
+     *  \returns true on success.
+     */
+    bool connect_att(bool & reused);
+  
+    /** \fn bool discover_characteristics()
+     *  \brief Looks up the Telink characteristics on the connected device.
+     *  \returns true if all required characteristics were found.
+     */
+    bool discover_characteristics();
+  
+    /** \fn bool exchange_pairing(const std::string & packet, std::vector<unsigned char> & response)
+     *  \brief Writes a pairing request and reads the device response.
+     *  \param packet : pairing request.
+     *  \param response : device response.
+     *  \returns true if a valid response was read.
+     */
+    bool exchange_pairing(const std::string & packet, std::vector<unsigned char> & response);
+  
+    /** \fn void receive_notification(const std::vector<unsigned char> & data)
+     *  \brief Decrypts and handles a notification from the device.
+     *  \param data : encrypted notification value.
+     */
+    void receive_notification(const std::vector<unsigned char> & data);
+  
+    /** \fn std::size_t write_packets(const unsigned char * packets, std::size_t count)
+     *  \brief Writes encrypted packets to command characteristic, with current write mode.
+     *  A failed write marks the connection as lost.
+     *  \param packets : count x PACKET_SIZE bytes.
+     *  \param count : number of packets.
+     *  \returns the number of packets written.
+     */
+    std::size_t write_packets(const unsigned char * packets, std::size_t count);
   
     /** \fn void notification_callback(BluetoothGattCharacteristic & c, std::vector<unsigned char> & data, void * userdata)
      *  \brief Callback for notification Bluetooth GATT characteristic.
@@ -188,6 +498,41 @@ namespace telink {
      */
     virtual void parse_command(const std::string & packet);
     
+    /** \fn void update_cache(const std::function<void(TelinkCacheEntry &)> & modifier)
+     *  \brief Modifies the cache entry of the device, if a cache is set.
+     *  \param modifier : function changing the entry.
+     */
+    void update_cache(const std::function<void(TelinkCacheEntry &)> & modifier);
+    
+    /** \fn void record_proxy(int mesh_id)
+     *  \brief Records this connection as proxy of a reporting node in the cache, once per
+     *  node and connection.
+     *  \param mesh_id : mesh ID of the reporting node.
+     */
+    void record_proxy(int mesh_id);
+    
+    /** \fn void update_shared_state(int address, const std::function<void(TelinkNodeState &)> & modifier)
+     *  \brief Modifies the published state of a node, if a shared state table is set.
+     *  \param address : node mesh address.
+     *  \param modifier : function changing the state.
+     */
+    void update_shared_state(int address, const std::function<void(TelinkNodeState &)> & modifier);
+    
+    /** \fn void update_node_color(int address, unsigned char brightness, const unsigned char * color)
+     *  \brief Records the color of a node in the registry, if one is set.
+     *  \param address : node mesh address.
+     *  \param brightness : brightness, from 0 to 100.
+     *  \param color : R, G, B, Y and W values.
+     */
+    void update_node_color(int address, unsigned char brightness, const unsigned char * color);
+    
+    /** \fn void parse_presence_report(const std::string & packet)
+     *  \brief Feeds all node entries of an online status report, from any node, to the presence
+     *  table, the shared state table and the node registry.
+     *  \param packet : decrypted online status report.
+     */
+    void parse_presence_report(const std::string & packet);
+    
   public:
     /** \fn TelinkMesh(const std::string address)
      *  \brief Object instantiation.
@@ -222,32 +567,228 @@ namespace telink {
      */
     void set_password(const std::string password);
     
+    /** \fn void set_credentials(const std::shared_ptr<const TelinkCredentials> & credentials)
+     *  \brief Sets the pairing key directly, replacing name and password. Applies at next connection.
+     *  \param credentials : mesh credentials.
+     */
+    void set_credentials(const std::shared_ptr<const TelinkCredentials> & credentials);
+    
+    /** \fn std::shared_ptr<const TelinkCredentials> get_credentials() const
+     *  \brief Returns the pairing key used by the connection.
+     *  \returns the mesh credentials; nullptr if name or password changed since last connection.
+     */
+    std::shared_ptr<const TelinkCredentials> get_credentials() const { return this->credentials; }
+    
     /** \fn void set_vendor(int vendor)
      *  \brief Sets the Bluetooth vendor code (0x0211 for Telink).
      *  \param vendor : vendor code.
      */
     void set_vendor(int vendor);
     
+    /** \fn const std::string & get_address() const
+     *  \brief Returns the MAC address to connect to.
+     *  \returns the MAC address.
+     */
+    const std::string & get_address() const { return this->address; }
+    
+    /** \fn void set_adapter(const std::string & adapter)
+     *  \brief Pins the connection to a Bluetooth adapter. Applies at next connection.
+     *  \param adapter : adapter MAC address or name; empty to use any adapter.
+     */
+    void set_adapter(const std::string & adapter);
+    
+    /** \fn const std::string & get_adapter() const
+     *  \brief Returns the adapter the connection is pinned to.
+     *  \returns the adapter address or name; empty if not pinned.
+     */
+    const std::string & get_adapter() const { return this->adapter; }
+    
+    /** \fn uint64_t get_packets_sent() const
+     *  \brief Returns the number of command packets written since object creation.
+     *  \returns the packet count.
+     */
+    uint64_t get_packets_sent() const { return this->packets_sent; }
+    
+    /** \fn void set_auto_reconnect(bool auto_reconnect)
+     *  \brief Sets whether sending reconnects a lost connection (default) or fails immediately.
+     *  \param auto_reconnect : true to reconnect.
+     */
+    void set_auto_reconnect(bool auto_reconnect);
+    
+    /** \fn void set_write_mode(int mode)
+     *  \brief Selects how command packets are written. With WRITE_COMMAND, packets are not
+     *  acknowledged and several can be sent per connection event; throughput is then limited
+     *  by buffer space in the Bluetooth stack. Falls back to WRITE_REQUEST if BlueZ cannot
+     *  provide a write channel.
+     *  \param mode : WRITE_REQUEST (default) or WRITE_COMMAND.
+     */
+    void set_write_mode(int mode);
+    
+    /** \fn int get_write_mode() const
+     *  \brief Returns the selected write mode.
+     *  \returns WRITE_REQUEST or WRITE_COMMAND.
+     */
+    int get_write_mode() const { return this->write_mode; }
+    
+    /** \fn void set_transport(int transport)
+     *  \brief Selects how the device is reached; takes effect on next connection. The L2CAP
+     *  transport talks ATT directly on a socket: writes and notifications skip D-Bus and
+     *  bluetoothd. It may need root privileges, addresses adapters by MAC address only,
+     *  and does not report RSSI.
+     *  \param transport : TRANSPORT_DBUS (default) or TRANSPORT_L2CAP.
+     */
+    void set_transport(int transport);
+    
+    /** \fn int get_transport() const
+     *  \brief Returns the selected transport.
+     *  \returns TRANSPORT_DBUS or TRANSPORT_L2CAP.
+     */
+    int get_transport() const { return this->transport; }
+    
+    /** \fn int get_rssi()
+     *  \brief Returns the signal strength of the connected device.
+     *  \returns the RSSI in dBm, or 0 if not connected.
+     */
+    int get_rssi();
+    
     /** \fn void send_packet(int command, const std::string & data)
      *  \brief Sends a command packet to the device.
      *  \param command : command code.
      *  \param data : command parameters (up to 10 byte).
      */
     void send_packet(int command, const std::string & data);
+    
+    /** \fn void send_payload(int command, const unsigned char * data, std::size_t size)
+     *  \brief Sends a command packet with a raw payload to the device.
+     *  \param command : command code.
+     *  \param data : command parameters.
+     *  \param size : size of parameters (up to 10 byte).
+     */
+    void send_payload(int command, const unsigned char * data, std::size_t size);
+    
+    /** \fn void send_command(Values... values)
+     *  \brief Sends a command described in telink_commands.h; the payload is laid out at compile time.
+     *  \param values : command arguments, one per non-constant field.
+     */
+    template <class Command, class... Values>
+    void send_command(Values... values) {
+      typename Command::payload payload = Command::encode(values...);
+      this->send_payload(Command::opcode, payload.data(), payload.size());
+    }
+    
+    /** \fn std::size_t send_packets(int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count)
+     *  \brief Sends the same command to several mesh nodes, each with its own parameters.
+     *  Connection is checked once for the whole batch, and packets are encrypted together
+     *  before being written.
+     *  \param command : command code.
+     *  \param destinations : mesh IDs of target nodes or groups, count elements.
+     *  \param data : command parameters, count x data_size bytes.
+     *  \param data_size : size of parameters of one packet (up to 10 byte).
+     *  \param count : number of packets.
+     *  \returns the number of packets sent.
+     */
+    std::size_t send_packets(int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count);
+    
+    /** \fn void receive_packet(const std::string & packet)
+     *  \brief Handles a decrypted packet as if it had been received from the device.
+     *  \param packet : decrypted 20-byte packet.
+     */
+    void receive_packet(const std::string & packet);
+    
+    /** \fn int add_report_listener(const std::function<void(const std::string &)> & listener)
+     *  \brief Adds a function receiving every decrypted report with the right vendor code, from
+     *  any mesh node, before it is parsed. It is called from the Bluetooth thread, and must not
+     *  add or remove listeners.
+     *  \param listener : function taking the decrypted 20-byte packet.
+     *  \returns an ID to remove the listener with.
+     */
+    int add_report_listener(const std::function<void(const std::string &)> & listener);
+    
+    /** \fn void remove_report_listener(int id)
+     *  \brief Removes a report listener. When this returns, the listener is not running.
+     *  \param id : ID returned by add_report_listener.
+     */
+    void remove_report_listener(int id);
+    
+    /** \fn void set_trace(TelinkTrace * trace)
+     *  \brief Records all sent and received packets into given trace. The trace must outlive the connection.
+     *  \param trace : trace recorder, or nullptr to disable tracing.
+     */
+    void set_trace(TelinkTrace * trace);
+    
+    /** \fn void set_timeline(TelinkTimeline * timeline)
+     *  \brief Records the time packets spend in each stage (build, encryption, write, report
+     *  handling) into given timeline. The timeline must outlive the connection.
+     *  \param timeline : timeline, or nullptr to disable stage timing.
+     */
+    void set_timeline(TelinkTimeline * timeline);
+    
+    /** \fn TelinkTimeline * get_timeline() const
+     *  \brief Returns the timeline packet stages are recorded into.
+     *  \returns the timeline, or nullptr if stage timing is disabled.
+     */
+    TelinkTimeline * get_timeline() const { return this->timeline; }
+    
+    /** \fn void set_cache(TelinkCache * cache, int max_age)
+     *  \brief Uses given cache to persist device metadata (mesh ID, groups, firmware version, state).
+     *  On connection, cached metadata is trusted and the device is looked up without discovery;
+     *  metadata older than max_age is then revalidated with asynchronous queries.
+     *  The cache must outlive the connection.
+     *  \param cache : device metadata cache, or nullptr to disable caching.
+     *  \param max_age : age in seconds after which cached metadata is revalidated.
+     */
+    void set_cache(TelinkCache * cache, int max_age = 3600);
+    
+    /** \fn void set_shared_state(TelinkSharedState * shared_state)
+     *  \brief Publishes decoded node states into given shared memory table. The table must
+     *  have been created, and must outlive the connection.
+     *  \param shared_state : node state table, or nullptr to disable publishing.
+     */
+    void set_shared_state(TelinkSharedState * shared_state);
+    
+    /** \fn void set_presence(TelinkPresence * presence)
+     *  \brief Tracks presence of all mesh nodes from online status reports into given table.
+     *  The table must outlive the connection.
+     *  \param presence : presence table, or nullptr to disable tracking.
+     */
+    void set_presence(TelinkPresence * presence);
+    
+    /** \fn void set_registry(TelinkNodeRegistry * registry)
+     *  \brief Records decoded node states into given registry, for fleet-wide queries. The
+     *  registry can be shared by several connections, and must outlive them.
+     *  \param registry : node registry, or nullptr to disable recording.
+     */
+    void set_registry(TelinkNodeRegistry * registry);
   
     /** \fn bool connect()
      *  \brief Connects to Bluetooth device.
      *  \returns true if connection succeeded, false otherwise.
      */
     bool connect();
+  
+    /** \fn bool connect_socket(int fd)
+     *  \brief Connects with the L2CAP transport over an already connected socket, e.g. one end
+     *  of a socketpair served by a local ATT responder. Reconnections open L2CAP links as usual.
+     *  \param fd : connected SOCK_SEQPACKET socket; the mesh takes ownership of it.
+     *  \returns true if connection succeeded, false otherwise.
+     */
+    bool connect_socket(int fd);
     
     /** \fn void disconnect()
      *  \brief Disconnects from Bluetooth device.
      */
     void disconnect();
     
+    /** \fn void forget_device()
+     *  \brief Drops the device object and the characteristics kept from previous connections,
+     *  including cached handles, so that next connection looks them up again. Only applies
+     *  when disconnected.
+     */
+    void forget_device();
+    
     /** \fn bool is_connected()
-     *  \brief Probes whether the connection with the device is established.
+     *  \brief Tells whether the connection with the device is established. The state is
+     *  tracked from connection notifications, so this does not query the Bluetooth stack.
      *  \returns true if connected, false otherwise.
      */
     bool is_connected();
@@ -262,6 +803,42 @@ namespace telink {
      */
     void query_groups();
    
+    /** \fn void query_ota_state()
+     *  \brief Queries OTA update state from device.
+     */
+    void query_ota_state();
+    
+    /** \fn bool write_ota_packet(const std::string & packet)
+     *  \brief Writes a raw packet to the OTA characteristic.
+     *  \param packet : OTA packet (up to 20 bytes).
+     *  \returns true if the write succeeded, false otherwise.
+     */
+    bool write_ota_packet(const std::string & packet);
+    
+    /** \fn bool sync_ota()
+     *  \brief Reads the OTA characteristic, which returns once the device processed previous OTA writes.
+     *  \returns true if the read succeeded, false otherwise.
+     */
+    bool sync_ota();
+    
+    /** \fn int get_ota_state() const
+     *  \brief Returns the OTA state from the last OTA status report.
+     *  \returns the OTA state, or -1 if no report was received.
+     */
+    int get_ota_state() const { return this->ota_state; }
+    
+    /** \fn int get_ota_block() const
+     *  \brief Returns the number of OTA blocks received by device, from the last OTA status report.
+     *  \returns the number of blocks, or -1 if no report was received.
+     */
+    int get_ota_block() const { return this->ota_block; }
+
+    /** \fn void reset_ota_state()
+     *  \brief Forgets the last OTA status report, so that get_ota_state() and get_ota_block()
+     *  return -1 until the device reports again.
+     */
+    void reset_ota_state() { this->ota_state = -1; this->ota_block = -1; }
+   
     /** \fn void set_time()
      *  \brief Sets device date and time.
      */
@@ -330,6 +907,12 @@ namespace telink {
      *  \param packet : decrypted packet to be parsed.
      */
     virtual void parse_group_id_report(const std::string & packet);
+    
+    /** \fn virtual void parse_ota_status_report(const std::string & packet)
+     *  \brief Parses a command packet from an OTA status report.
+     *  \param packet : decrypted packet to be parsed.
+     */
+    virtual void parse_ota_status_report(const std::string & packet);
   };
   
 }
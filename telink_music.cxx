@@ -0,0 +1,159 @@
+/** \file telink_music.cxx
+ *  Command line example driving a Telink light in music mode from a PCM stream.
+ *  Input is raw signed 16-bit little-endian PCM, read from a file, a pipe or stdin, e.g.
+ *    arecord -f S16_LE -r 44100 -c 1 -t raw | telink_music <MAC> <name> <password> -
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#include "telink_light.h"
+#include "telink_audio.h"
+
+static volatile std::sig_atomic_t running = 1;
+
+static void stop(int) {
+  running = 0;
+}
+
+/** \fn static bool read_full(int fd, char * buffer, size_t size)
+ *  \brief Reads exactly size bytes from a file descriptor.
+ *  \param fd : file descriptor
+ *  \param buffer : output buffer
+ *  \param size : number of bytes to read
+ *  \returns true if all bytes were read, false on end of stream or error.
+ */
+static bool read_full(int fd, char * buffer, size_t size) {
+  size_t done = 0;
+  while (done < size && running) {
+    ssize_t n = read(fd, buffer + done, size - done);
+    if (n <= 0) return false;
+    done += n;
+  }
+  return done == size;
+}
+
+/** \fn static void report(std::vector<double> & latencies, double window_delay, long sent, long dropped)
+ *  \brief Prints audio-to-packet latency statistics and clears collected samples.
+ *  \param latencies : measured read-to-write latencies in milliseconds
+ *  \param window_delay : fixed analysis buffering delay in milliseconds
+ *  \param sent : number of frames sent
+ *  \param dropped : number of frames dropped to stay in sync
+ */
+static void report(std::vector<double> & latencies, double window_delay, long sent, long dropped) {
+  if (latencies.empty()) return;
+  std::sort(latencies.begin(), latencies.end());
+  double p50 = latencies[latencies.size()/2];
+  double p95 = latencies[latencies.size()*95/100];
+  double max = latencies.back();
+  std::cout << std::fixed << std::setprecision(2)
+            << "latency (ms): buffering " << window_delay
+            << " + processing/send p50 " << p50 << " p95 " << p95 << " max " << max
+            << " => total p95 " << window_delay + p95
+            << " | frames sent " << sent << ", dropped " << dropped << std::endl;
+  latencies.clear();
+}
+
+int main(int argc, char **argv) {
+
+  if (argc < 4) {
+    std::cerr << "Run as: " << argv[0] << " <device_MAC_address> <device_name> <device_password> [<pcm_file>|-] [<sample_rate>] [<channels>]" << std::endl;
+    exit(1);
+  }
+
+  using namespace telink;
+  using clock = std::chrono::steady_clock;
+
+  std::string source = argc > 4 ? argv[4] : "-";
+  int sample_rate = argc > 5 ? std::atoi(argv[5]) : 44100;
+  int channels = argc > 6 ? std::max(1, std::atoi(argv[6])) : 1;
+
+  int fd = source == "-" ? STDIN_FILENO : open(source.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << source << std::endl;
+    return 1;
+  }
+  // regular files are paced at the sampling rate; pipes deliver data in real time
+  struct stat st;
+  bool pace = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+  TelinkLight ble_light(argv[1], argv[2], argv[3]);
+  if (!ble_light.connect()) return 1;
+  ble_light.set_state(true);
+  ble_light.set_music_mode(true);
+
+  std::signal(SIGINT, stop);
+  std::signal(SIGTERM, stop);
+
+  TelinkAudioAnalyzer analyzer(sample_rate);
+  TelinkAudioMapper mapper;
+  int hop = analyzer.get_hop_size();
+  size_t hop_bytes = hop * channels * 2;
+  std::vector<char> raw(hop_bytes);
+  std::vector<float> samples(hop);
+  std::vector<double> latencies;
+  long sent = 0, dropped = 0;
+
+  auto hop_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(static_cast<double>(hop) / sample_rate));
+  auto start = clock::now(), last_report = start;
+  long hop_index = 0;
+
+  while (running && read_full(fd, raw.data(), hop_bytes)) {
+    clock::time_point arrival = clock::now();
+    if (pace) {
+      arrival = start + hop_index * hop_duration;
+      std::this_thread::sleep_until(arrival);
+    }
+    hop_index++;
+
+    // downmix to mono
+    const unsigned char * p = reinterpret_cast<const unsigned char*>(raw.data());
+    for (int i=0; i<hop; i++) {
+      int sum = 0;
+      for (int c=0; c<channels; c++, p+=2)
+        sum += static_cast<short>(p[0] | (p[1] << 8));
+      samples[i] = sum / (32768.0f * channels);
+    }
+
+    TelinkAudioFrame frame = analyzer.analyze(samples.data());
+    std::string payload = mapper.map(frame);
+
+    // if the next hop is already waiting, we are behind: keep analyzing, skip the radio
+    bool late;
+    if (pace) {
+      late = clock::now() > start + hop_index * hop_duration;
+    } else {
+      int available = 0;
+      late = ioctl(fd, FIONREAD, &available) == 0 && available >= static_cast<int>(hop_bytes);
+    }
+    if (late) {
+      dropped++;
+    } else {
+      ble_light.set_attributes(payload);
+      latencies.push_back(std::chrono::duration<double, std::milli>(clock::now() - arrival).count());
+      sent++;
+    }
+
+    if (clock::now() - last_report > std::chrono::seconds(5)) {
+      report(latencies, analyzer.get_window_delay(), sent, dropped);
+      last_report = clock::now();
+    }
+  }
+  report(latencies, analyzer.get_window_delay(), sent, dropped);
+
+  if (fd != STDIN_FILENO)
+    close(fd);
+  return 0;
+}
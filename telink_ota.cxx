@@ -0,0 +1,185 @@
+/** \file telink_ota.cxx
+ *  Firmware update of a Telink mesh device over an established connection.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "telink_ota.h"
+
+namespace telink {
+
+  /** \fn static uint16_t crc16(const std::string & data)
+   *  \brief Computes the CRC-16/MODBUS checksum used by Telink OTA packets.
+   *  \param data : data to checksum.
+   *  \returns the checksum.
+   */
+  static uint16_t crc16(const std::string & data) {
+    uint16_t crc = 0xffff;
+    for (auto & chr : data) {
+      crc ^= static_cast<unsigned char>(chr);
+      for (int i=0; i<8; i++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc;
+  }
+
+  TelinkOta::~TelinkOta() {
+    this->close();
+  }
+
+  bool TelinkOta::open(const std::string & path) {
+    this->close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Cannot open firmware file " << path << std::endl;
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      std::cerr << "Firmware file " << path << " is empty" << std::endl;
+      ::close(fd);
+      return false;
+    }
+    void * region = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (region == MAP_FAILED) {
+      std::cerr << "Cannot map firmware file " << path << std::endl;
+      return false;
+    }
+    madvise(region, st.st_size, MADV_SEQUENTIAL);
+    this->image = static_cast<const unsigned char*>(region);
+    this->image_size = st.st_size;
+    this->acknowledged = 0;
+    return true;
+  }
+
+  void TelinkOta::close() {
+    if (this->image != nullptr)
+      munmap(const_cast<unsigned char*>(this->image), this->image_size);
+    this->image = nullptr;
+    this->image_size = 0;
+  }
+
+  void TelinkOta::set_window(int window) {
+    this->window = std::max(1, window);
+  }
+
+  void TelinkOta::set_progress_callback(const std::function<void(int, int, double)> & callback) {
+    this->progress = callback;
+  }
+
+  std::string TelinkOta::build_block(int index) const {
+    std::string packet = {schar(index & 0xff), schar((index >> 8) & 0xff)};
+    std::size_t offset = static_cast<std::size_t>(index) * OTA_BLOCK_SIZE;
+    std::size_t length = std::min<std::size_t>(OTA_BLOCK_SIZE, this->image_size - offset);
+    packet.append(reinterpret_cast<const char*>(this->image + offset), length);
+    packet.append(OTA_BLOCK_SIZE - length, schar(0xff)); // pad last block
+    uint16_t crc = crc16(packet);
+    packet.push_back(schar(crc & 0xff));
+    packet.push_back(schar(crc >> 8));
+    return packet;
+  }
+
+  int TelinkOta::wait_acknowledgement(int target, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+      int reported = this->mesh.get_ota_block();
+      if (reported >= target)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    this->acknowledged = std::max(this->acknowledged, this->mesh.get_ota_block());
+    return this->acknowledged;
+  }
+
+  int TelinkOta::resume_point() {
+    // a report from an earlier run or connection may not match what the device has now
+    this->mesh.reset_ota_state();
+    this->mesh.query_ota_state();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1000);
+    while (this->mesh.get_ota_block() < 0 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    int reported = this->mesh.get_ota_block();
+    if (reported >= 0)
+      this->acknowledged = reported;
+    return std::min(this->acknowledged, this->get_block_count());
+  }
+
+  bool TelinkOta::run(int first_block) {
+    if (this->image == nullptr) {
+      std::cerr << "No firmware image loaded." << std::endl;
+      return false;
+    }
+    int total = this->get_block_count();
+    if (total > 0x10000) {
+      std::cerr << "Firmware image is too large for OTA." << std::endl;
+      return false;
+    }
+
+    this->acknowledged = 0; // nothing is known of a previous run
+    int reported = this->resume_point();
+    int block = first_block >= 0 ? std::min(first_block, total) : reported;
+    this->acknowledged = block;
+    if (block == 0 && !this->mesh.write_ota_packet({0x00, schar(0xff)})) // OTA start
+      return false;
+
+    auto start = std::chrono::steady_clock::now();
+    int first = block, retries = 0;
+    bool reports = this->mesh.get_ota_block() >= 0; // device sends OTA status reports
+    while (block < total) {
+      // do not get more than two windows ahead of the device
+      if (reports && block - this->acknowledged >= 2*this->window &&
+          this->wait_acknowledgement(block - this->window, 2000) <= block - 2*this->window)
+        reports = false; // reports stopped: fall back to read-back synchronization
+
+      if (!this->mesh.write_ota_packet(this->build_block(block))) {
+        if (++retries > 3) {
+          std::cerr << "OTA aborted at block " << block << " of " << total << std::endl;
+          return false;
+        }
+        this->mesh.disconnect();
+        if (this->mesh.connect())
+          block = std::min(block, this->resume_point());
+        continue;
+      }
+      block++;
+
+      if (block % this->window == 0 || block == total) {
+        if (reports) {
+          this->mesh.query_ota_state();
+          this->acknowledged = std::max(this->acknowledged, this->mesh.get_ota_block());
+        } else if (this->mesh.sync_ota()) {
+          this->acknowledged = block;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->throughput = elapsed > 0 ? (block - first) * OTA_BLOCK_SIZE / elapsed : 0;
+        if (this->progress)
+          this->progress(this->acknowledged, total, this->throughput);
+        retries = 0;
+      }
+    }
+
+    // OTA end: last block index and its complement
+    int last = total - 1;
+    std::string end_packet = {0x02, schar(0xff), schar(last & 0xff), schar(last >> 8), schar(~last & 0xff), schar((~last >> 8) & 0xff)};
+    if (!this->mesh.write_ota_packet(end_packet))
+      return false;
+    if (reports)
+      this->wait_acknowledgement(total, 2000);
+    else
+      this->acknowledged = total;
+    if (this->progress)
+      this->progress(this->acknowledged, total, this->throughput);
+    return true;
+  }
+
+}
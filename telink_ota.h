@@ -0,0 +1,153 @@
+/** \file telink_ota.h
+ *  Firmware update of a Telink mesh device over an established connection.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_OTA_H__
+#define __TELINK_OTA_H__
+
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include "telink_mesh.h"
+
+namespace telink {
+
+  /** \brief Number of firmware bytes carried by an OTA packet. */
+  #define OTA_BLOCK_SIZE 16
+
+  /** \class TelinkOta
+   *  \brief Streams a memory-mapped firmware image to a device.
+   *
+   *  Each OTA packet holds a little-endian block index, 16 bytes of firmware and a
+   *  CRC-16/MODBUS of the preceding 18 bytes. Packets are written in windows: OTA state is
+   *  queried at the end of each window, and writing pauses when the device lags more than
+   *  two windows behind. Devices that do not send OTA status reports are synchronized by
+   *  reading back the OTA characteristic instead. After a failed write, the device is
+   *  reconnected and the transfer resumes from the last acknowledged block.
+   */
+  class TelinkOta {
+  private:
+    /** \property TelinkMesh & mesh
+     *  \brief Device to update.
+     */
+    TelinkMesh & mesh;
+
+    /** \property const unsigned char * image
+     *  \brief Memory-mapped firmware image.
+     */
+    const unsigned char * image = nullptr;
+
+    /** \property std::size_t image_size
+     *  \brief Firmware image size in bytes.
+     */
+    std::size_t image_size = 0;
+
+    /** \property int window
+     *  \brief Number of packets per window.
+     */
+    int window = 8;
+
+    /** \property int acknowledged
+     *  \brief Number of blocks acknowledged by device.
+     */
+    int acknowledged = 0;
+
+    /** \property double throughput
+     *  \brief Firmware throughput of last run in bytes per second.
+     */
+    double throughput = 0;
+
+    /** \property std::function<void(int, int, double)> progress
+     *  \brief Progress callback.
+     */
+    std::function<void(int, int, double)> progress;
+
+    /** \fn std::string build_block(int index) const
+     *  \brief Builds the OTA packet of a firmware block.
+     *  \param index : block index.
+     *  \returns the 20-byte OTA packet.
+     */
+    std::string build_block(int index) const;
+
+    /** \fn int wait_acknowledgement(int target, int timeout_ms)
+     *  \brief Waits until device reports at least target received blocks.
+     *  \param target : number of blocks to wait for.
+     *  \param timeout_ms : timeout in milliseconds.
+     *  \returns the number of blocks acknowledged when returning.
+     */
+    int wait_acknowledgement(int target, int timeout_ms);
+
+    /** \fn int resume_point()
+     *  \brief Queries device OTA state to find where to resume. If the device reports, its block
+     *  count replaces the acknowledged one, which may go back, e.g. when the device restarted OTA.
+     *  \returns the index of the first block to send.
+     */
+    int resume_point();
+
+  public:
+    /** \fn TelinkOta(TelinkMesh & mesh)
+     *  \brief Object instantiation.
+     *  \param mesh : connected device to update.
+     */
+    TelinkOta(TelinkMesh & mesh) : mesh(mesh) {}
+
+    TelinkOta(const TelinkOta &) = delete;
+    TelinkOta & operator=(const TelinkOta &) = delete;
+
+    ~TelinkOta();
+
+    /** \fn bool open(const std::string & path)
+     *  \brief Maps a firmware image file in memory.
+     *  \param path : firmware file path.
+     *  \returns true on success, false otherwise.
+     */
+    bool open(const std::string & path);
+
+    /** \fn void close()
+     *  \brief Unmaps the firmware image.
+     */
+    void close();
+
+    /** \fn int get_block_count() const
+     *  \brief Returns the number of blocks in the firmware image.
+     *  \returns the number of blocks.
+     */
+    int get_block_count() const { return (this->image_size + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE; }
+
+    /** \fn int get_acknowledged_block() const
+     *  \brief Returns the number of blocks acknowledged by device.
+     *  \returns the number of acknowledged blocks.
+     */
+    int get_acknowledged_block() const { return this->acknowledged; }
+
+    /** \fn double get_throughput() const
+     *  \brief Returns the firmware throughput of the last run.
+     *  \returns the throughput in bytes per second.
+     */
+    double get_throughput() const { return this->throughput; }
+
+    /** \fn void set_window(int window)
+     *  \brief Sets the number of packets per window.
+     *  \param window : number of packets, at least 1.
+     */
+    void set_window(int window);
+
+    /** \fn void set_progress_callback(const std::function<void(int, int, double)> & callback)
+     *  \brief Sets a function called at the end of each window.
+     *  \param callback : function taking acknowledged blocks, total blocks and throughput in bytes per second.
+     */
+    void set_progress_callback(const std::function<void(int, int, double)> & callback);
+
+    /** \fn bool run(int first_block)
+     *  \brief Streams the firmware image to the device.
+     *  \param first_block : index of the first block to send; -1 to resume from the state reported by the device.
+     *  \returns true if the whole image was sent, false otherwise.
+     */
+    bool run(int first_block = -1);
+  };
+
+}
+
+#endif // __TELINK_OTA_H__
@@ -0,0 +1,53 @@
+/** \file telink_ota_update.cxx
+ *  Command line tool updating the firmware of a Telink mesh device.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+
+#include "telink_mesh.h"
+#include "telink_ota.h"
+
+int main(int argc, char **argv) {
+
+  if (argc < 5) {
+    std::cerr << "Run as: " << argv[0] << " <device_MAC_address> <device_name> <device_password> <firmware_file> [--resume <block>] [--window <packets>]" << std::endl;
+    exit(1);
+  }
+
+  using namespace telink;
+
+  int first_block = -1, window = 8;
+  for (int i=5; i+1<argc; i+=2) {
+    if (std::strcmp(argv[i], "--resume") == 0) {
+      first_block = std::atoi(argv[i+1]);
+    } else if (std::strcmp(argv[i], "--window") == 0) {
+      window = std::atoi(argv[i+1]);
+    } else {
+      std::cerr << "Unknown argument " << argv[i] << std::endl;
+      exit(1);
+    }
+  }
+
+  TelinkMesh mesh(argv[1], argv[2], argv[3]);
+  TelinkOta ota(mesh);
+  if (!ota.open(argv[4])) return 1;
+  ota.set_window(window);
+  ota.set_progress_callback([](int acknowledged, int total, double throughput) {
+    std::cout << "\rblock " << acknowledged << "/" << total << " (" << std::fixed << std::setprecision(1)
+              << 100.0*acknowledged/total << "%), " << throughput/1024 << " kB/s" << std::flush;
+  });
+
+  if (!mesh.connect()) return 1;
+  bool ok = ota.run(first_block);
+  std::cout << std::endl;
+  if (!ok) {
+    std::cerr << "Update failed; resume with --resume " << ota.get_acknowledged_block() << std::endl;
+    return 1;
+  }
+  std::cout << "Update sent: " << ota.get_block_count() << " blocks at " << ota.get_throughput()/1024 << " kB/s" << std::endl;
+  return 0;
+}
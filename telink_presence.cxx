@@ -0,0 +1,108 @@
+/** \file telink_presence.cxx
+ *  Mesh-wide table of node presence, built from online status reports.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <string>
+#include <chrono>
+
+#include "telink_presence.h"
+
+namespace telink {
+
+  /** \fn static uint64_t now_ns()
+   *  \brief Returns monotonic time.
+   *  \returns time in nanoseconds.
+   */
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void TelinkPresence::set_change_callback(const std::function<void(const TelinkPresenceEntry &, int)> & callback) {
+    this->callback = callback;
+  }
+
+  void TelinkPresence::parse_report(const std::string & packet) {
+    /* Online status reports carry two node entries of 4 bytes, at bytes 10 and 14:
+         byte 0 : node address (0 = empty entry)
+         byte 1 : sequence number, 0 if the node is offline
+         byte 2 : brightness
+         byte 3 : status; bit 0 set = light off
+    */
+    typedef TelinkOnlineStatusReport report;
+    for (std::size_t base=0; base<report::entry_count*report::entry_size; base+=report::entry_size) {
+      if (COMMAND_PAYLOAD_OFFSET + base + report::entry_size > packet.size()) break;
+      unsigned char address = report::address::load(packet, base);
+      if (address == 0) continue;
+      this->update(address, report::sequence::load(packet, base) != 0, !(report::status::load(packet, base) & 1), report::brightness::load(packet, base));
+    }
+  }
+
+  void TelinkPresence::update(int address, bool online, bool state, unsigned char brightness) {
+    if (address < 0 || address >= PRESENCE_SIZE) return;
+    TelinkPresenceEntry copy;
+    int events = 0;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      TelinkPresenceEntry & entry = this->entries[address];
+      if (!entry.known || online != entry.online)
+        events |= online ? PRESENCE_APPEARED : PRESENCE_LEFT;
+      else if (online && (state != entry.state || brightness != entry.brightness))
+        events |= PRESENCE_CHANGED;
+      entry.address = address;
+      entry.known = true;
+      entry.online = online;
+      entry.state = state;
+      entry.brightness = brightness;
+      entry.last_seen = now_ns();
+      entry.reports++;
+      copy = entry;
+    }
+    if (events && this->callback)
+      this->callback(copy, events);
+  }
+
+  void TelinkPresence::expire(int timeout_ms) {
+    uint64_t limit = now_ns() - static_cast<uint64_t>(timeout_ms) * 1000000;
+    std::vector<TelinkPresenceEntry> expired;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      for (auto & entry : this->entries) {
+        if (entry.online && entry.last_seen < limit) {
+          entry.online = false;
+          expired.push_back(entry);
+        }
+      }
+    }
+    if (this->callback) {
+      for (auto & entry : expired)
+        this->callback(entry, PRESENCE_LEFT);
+    }
+  }
+
+  bool TelinkPresence::get(int address, TelinkPresenceEntry & entry) const {
+    if (address < 0 || address >= PRESENCE_SIZE) return false;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    entry = this->entries[address];
+    return entry.known;
+  }
+
+  std::vector<TelinkPresenceEntry> TelinkPresence::get_entries() const {
+    std::vector<TelinkPresenceEntry> known;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & entry : this->entries) {
+      if (entry.known)
+        known.push_back(entry);
+    }
+    return known;
+  }
+
+  int TelinkPresence::get_online_count() const {
+    int count = 0;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & entry : this->entries)
+      count += entry.online;
+    return count;
+  }
+
+}
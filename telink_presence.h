@@ -0,0 +1,146 @@
+/** \file telink_presence.h
+ *  Mesh-wide table of node presence, built from online status reports.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_PRESENCE_H__
+#define __TELINK_PRESENCE_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#include "telink_commands.h"
+
+namespace telink {
+
+  /** \brief Number of node addresses carried by online status reports (addresses are one byte). */
+  #define PRESENCE_SIZE 256
+
+  // Presence change events
+  #define PRESENCE_APPEARED  0x01 // node was seen for the first time, or came back online
+  #define PRESENCE_LEFT      0x02 // node reported offline, or not seen before expiry
+  #define PRESENCE_CHANGED   0x04 // brightness or power state changed
+
+  /** \class TelinkPresenceEntry
+   *  \brief Presence of a mesh node.
+   */
+  class TelinkPresenceEntry {
+  public:
+    /** \property uint8_t address
+     *  \brief Node mesh address.
+     */
+    uint8_t address = 0;
+
+    /** \property bool known
+     *  \brief true if the node was seen at least once.
+     */
+    bool known = false;
+
+    /** \property bool online
+     *  \brief true if the node is reachable in mesh.
+     */
+    bool online = false;
+
+    /** \property bool state
+     *  \brief Power state (true = on).
+     */
+    bool state = false;
+
+    /** \property uint8_t brightness
+     *  \brief Brightness, from 0 to 100.
+     */
+    uint8_t brightness = 0;
+
+    /** \property uint64_t last_seen
+     *  \brief Monotonic time of last report, in nanoseconds.
+     */
+    uint64_t last_seen = 0;
+
+    /** \property uint32_t reports
+     *  \brief Number of reports received about the node.
+     */
+    uint32_t reports = 0;
+  };
+
+  /** \class TelinkPresence
+   *  \brief Presence table of all nodes of a mesh, fed passively by online status reports.
+   *  All methods are thread-safe; the change callback is called without the table locked.
+   */
+  class TelinkPresence {
+  private:
+    /** \property std::vector<TelinkPresenceEntry> entries
+     *  \brief Entries, indexed by mesh address.
+     */
+    std::vector<TelinkPresenceEntry> entries;
+
+    /** \property std::function<void(const TelinkPresenceEntry &, int)> callback
+     *  \brief Function called on presence changes.
+     */
+    std::function<void(const TelinkPresenceEntry &, int)> callback;
+
+    /** \property std::mutex mutex
+     *  \brief Protects entries.
+     */
+    mutable std::mutex mutex;
+
+  public:
+    TelinkPresence() : entries(PRESENCE_SIZE) {}
+
+    TelinkPresence(const TelinkPresence &) = delete;
+    TelinkPresence & operator=(const TelinkPresence &) = delete;
+
+    /** \fn void set_change_callback(const std::function<void(const TelinkPresenceEntry &, int)> & callback)
+     *  \brief Sets a function called when a node appears, leaves or changes state. Must be set
+     *  before the table is fed.
+     *  \param callback : function taking the new entry and a combination of PRESENCE_* events.
+     */
+    void set_change_callback(const std::function<void(const TelinkPresenceEntry &, int)> & callback);
+
+    /** \fn void parse_report(const std::string & packet)
+     *  \brief Updates the table with all node entries of an online status report.
+     *  \param packet : decrypted online status report.
+     */
+    void parse_report(const std::string & packet);
+
+    /** \fn void update(int address, bool online, bool state, unsigned char brightness)
+     *  \brief Updates a node entry.
+     *  \param address : node mesh address.
+     *  \param online : true if the node is reachable.
+     *  \param state : power state.
+     *  \param brightness : brightness, from 0 to 100.
+     */
+    void update(int address, bool online, bool state, unsigned char brightness);
+
+    /** \fn void expire(int timeout_ms)
+     *  \brief Marks online nodes not seen for some time as offline.
+     *  \param timeout_ms : time without reports after which a node is considered offline, in milliseconds.
+     */
+    void expire(int timeout_ms);
+
+    /** \fn bool get(int address, TelinkPresenceEntry & entry) const
+     *  \brief Gets the entry of a node.
+     *  \param address : node mesh address.
+     *  \param entry : copy of the entry (output).
+     *  \returns true if the node was seen, false otherwise.
+     */
+    bool get(int address, TelinkPresenceEntry & entry) const;
+
+    /** \fn std::vector<TelinkPresenceEntry> get_entries() const
+     *  \brief Returns entries of all nodes seen so far.
+     *  \returns the entries, by increasing address.
+     */
+    std::vector<TelinkPresenceEntry> get_entries() const;
+
+    /** \fn int get_online_count() const
+     *  \brief Returns the number of nodes currently online.
+     *  \returns the number of online nodes.
+     */
+    int get_online_count() const;
+  };
+
+}
+
+#endif // __TELINK_PRESENCE_H__
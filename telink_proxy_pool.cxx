@@ -0,0 +1,279 @@
+/** \file telink_proxy_pool.cxx
+ *  Pool of connections to several nodes of one mesh, with health scoring and failover.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+#include "telink_proxy_pool.h"
+
+namespace telink {
+
+  typedef std::chrono::steady_clock clock;
+
+  // weight of the last write in moving averages
+  static const double ewma_weight = 0.2;
+
+  static double proxy_cost(const TelinkProxyStatus & status) {
+    double cost = std::max(status.latency, 1.0) * (1 + 10 * status.error_rate);
+    // signal weaker than -60 dBm adds cost; 0 means unknown
+    if (status.rssi < -60)
+      cost += (-60 - status.rssi) * 0.5;
+    return cost;
+  }
+
+  TelinkProxyPool::TelinkProxyPool(const std::vector<std::string> & addresses, const std::string & name, const std::string & password, std::size_t size) : size(std::max<std::size_t>(1, size)), running(false) {
+    std::shared_ptr<const TelinkCredentials> credentials = TelinkCredentials::get(name, password);
+    for (auto & address : addresses) {
+      std::unique_ptr<Proxy> proxy(new Proxy());
+      proxy->mesh.reset(new TelinkMesh(address, name, password));
+      proxy->mesh->set_credentials(credentials);
+      proxy->mesh->set_auto_reconnect(false);
+      proxy->status.address = address;
+      proxy->status.cost = proxy_cost(proxy->status);
+      this->proxies.push_back(std::move(proxy));
+    }
+    std::fill(this->recent, this->recent + PROXY_DEDUP_SIZE, 0);
+  }
+
+  TelinkProxyPool::~TelinkProxyPool() {
+    this->stop();
+  }
+
+  bool TelinkProxyPool::start() {
+    if (this->running) return false;
+    for (auto & proxy : this->proxies) {
+      proxy->listener_id = proxy->mesh->add_report_listener([this](const std::string & packet) {
+        this->dispatch_report(packet);
+      });
+    }
+    this->connect_proxies();
+    this->running = true;
+    this->maintenance = std::thread(&TelinkProxyPool::maintain, this);
+    return !this->ranked().empty();
+  }
+
+  void TelinkProxyPool::stop() {
+    if (this->running) {
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->running = false;
+      }
+      this->wakeup.notify_all();
+      this->maintenance.join();
+    }
+    for (auto & proxy : this->proxies) {
+      std::lock_guard<std::mutex> send_lock(proxy->send_mutex);
+      if (proxy->listener_id != 0) {
+        proxy->mesh->remove_report_listener(proxy->listener_id);
+        proxy->listener_id = 0;
+      }
+      proxy->mesh->disconnect();
+      if (this->adapters != nullptr)
+        this->adapters->release(*proxy->mesh);
+      std::lock_guard<std::mutex> lock(this->mutex);
+      proxy->status.connected = false;
+    }
+  }
+
+  void TelinkProxyPool::set_adapter_manager(TelinkAdapterManager * adapters) {
+    this->adapters = adapters;
+  }
+
+  void TelinkProxyPool::set_interval(int interval) {
+    this->interval = std::max(100, interval);
+  }
+
+  void TelinkProxyPool::maintain() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->running) {
+      this->wakeup.wait_for(lock, std::chrono::milliseconds(this->interval));
+      if (!this->running) break;
+      lock.unlock();
+      this->connect_proxies();
+      if (this->adapters != nullptr)
+        this->adapters->update();
+      lock.lock();
+    }
+  }
+
+  void TelinkProxyPool::connect_proxies() {
+    std::size_t connected = 0;
+    for (auto & proxy : this->proxies) {
+      std::lock_guard<std::mutex> send_lock(proxy->send_mutex);
+      bool is_connected = proxy->mesh->is_connected();
+      if (!is_connected && connected < this->size) {
+        // drop stale objects before reconnecting, through the least loaded adapter
+        proxy->mesh->disconnect();
+        if (this->adapters != nullptr)
+          this->adapters->assign(*proxy->mesh);
+        is_connected = proxy->mesh->connect() && proxy->mesh->is_connected();
+        if (is_connected) {
+          // a fresh connection gets a fresh score
+          std::lock_guard<std::mutex> lock(this->mutex);
+          proxy->status.latency = 0;
+          proxy->status.error_rate = 0;
+        }
+      }
+      if (!is_connected && this->adapters != nullptr)
+        this->adapters->release(*proxy->mesh);
+      int rssi = is_connected ? proxy->mesh->get_rssi() : 0;
+      if (is_connected) connected++;
+      std::lock_guard<std::mutex> lock(this->mutex);
+      proxy->status.connected = is_connected;
+      proxy->status.rssi = rssi;
+      proxy->status.cost = proxy_cost(proxy->status);
+    }
+  }
+
+  void TelinkProxyPool::record(Proxy & proxy, bool success, bool connected, double latency) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    TelinkProxyStatus & status = proxy.status;
+    if (success) {
+      status.sent++;
+      status.latency = status.latency == 0 ? latency : (1 - ewma_weight) * status.latency + ewma_weight * latency;
+      status.error_rate = (1 - ewma_weight) * status.error_rate;
+    } else {
+      status.failed++;
+      status.error_rate = (1 - ewma_weight) * status.error_rate + ewma_weight;
+      status.connected = connected;
+    }
+    status.cost = proxy_cost(status);
+  }
+
+  std::vector<TelinkProxyPool::Proxy*> TelinkProxyPool::ranked() {
+    std::vector<Proxy*> result;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & proxy : this->proxies)
+      if (proxy->status.connected)
+        result.push_back(proxy.get());
+    std::stable_sort(result.begin(), result.end(), [](const Proxy * a, const Proxy * b) {
+      return a->status.cost < b->status.cost;
+    });
+    return result;
+  }
+
+  std::size_t TelinkProxyPool::send_through(Proxy & proxy, int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count) {
+    std::size_t sent = 0;
+    bool connected = true;
+    clock::time_point start = clock::now();
+    {
+      std::lock_guard<std::mutex> send_lock(proxy.send_mutex);
+      sent = proxy.mesh->send_packets(command, destinations, data, data_size, count);
+      if (sent < count)
+        connected = proxy.mesh->is_connected();
+    }
+    double latency = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    this->record(proxy, sent == count, connected, sent > 0 ? latency / sent : latency);
+    return sent;
+  }
+
+  bool TelinkProxyPool::send_packet(int destination, int command, const std::string & data) {
+    uint16_t address = destination & 0xffff;
+    const unsigned char * parameters = reinterpret_cast<const unsigned char*>(data.data());
+    for (auto proxy : this->ranked()) {
+      if (this->send_through(*proxy, command, &address, parameters, data.size(), 1) == 1)
+        return true;
+    }
+    std::cerr << "No proxy could send packet to " << destination << "." << std::endl;
+    this->wakeup.notify_all();
+    return false;
+  }
+
+  std::size_t TelinkProxyPool::send_packets(int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count, bool spread) {
+    if (count == 0) return 0;
+    std::vector<Proxy*> candidates = this->ranked();
+    if (candidates.empty()) {
+      this->wakeup.notify_all();
+      return 0;
+    }
+
+    std::vector<std::size_t> shares(candidates.size(), 0);
+    if (spread && candidates.size() > 1) {
+      // split in proportion to 1/cost; leftovers go to the best proxy
+      std::vector<double> weights;
+      double total = 0;
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (auto proxy : candidates) {
+          weights.push_back(1.0 / proxy->status.cost);
+          total += weights.back();
+        }
+      }
+      std::size_t assigned = 0;
+      for (std::size_t i=0; i<candidates.size(); i++) {
+        shares[i] = static_cast<std::size_t>(count * weights[i] / total);
+        assigned += shares[i];
+      }
+      shares[0] += count - assigned;
+    } else {
+      shares[0] = count;
+    }
+
+    // each proxy sends its share; a proxy failing hands the rest of its share to the next one
+    std::vector<std::size_t> offsets(candidates.size(), 0);
+    for (std::size_t i=1; i<candidates.size(); i++)
+      offsets[i] = offsets[i-1] + shares[i-1];
+    std::vector<std::size_t> sent(candidates.size(), 0);
+    auto send_share = [&](std::size_t index) {
+      std::size_t offset = offsets[index];
+      std::size_t remaining = shares[index];
+      for (std::size_t k=0; k<candidates.size() && remaining > 0; k++) {
+        Proxy & proxy = *candidates[(index + k) % candidates.size()];
+        std::size_t n = this->send_through(proxy, command, destinations + offset, data + offset * data_size, data_size, remaining);
+        sent[index] += n;
+        offset += n;
+        remaining -= n;
+      }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t i=1; i<candidates.size(); i++)
+      if (shares[i] > 0)
+        threads.push_back(std::thread(send_share, i));
+    send_share(0);
+    for (auto & thread : threads)
+      thread.join();
+
+    std::size_t total_sent = 0;
+    for (auto n : sent)
+      total_sent += n;
+    if (total_sent < count)
+      this->wakeup.notify_all();
+    return total_sent;
+  }
+
+  void TelinkProxyPool::add_report_listener(const std::function<void(const std::string &)> & listener) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->listeners.push_back(listener);
+  }
+
+  void TelinkProxyPool::dispatch_report(const std::string & packet) {
+    if (packet.size() < 8) return;
+    // sequence number, source and opcode identify a mesh packet whichever proxy relays it
+    uint64_t key = 1;
+    for (int i : {0, 1, 2, 3, 4, 7})
+      key = (key << 8) | static_cast<unsigned char>(packet[i]);
+    std::vector<std::function<void(const std::string &)>> targets;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (std::find(this->recent, this->recent + PROXY_DEDUP_SIZE, key) != this->recent + PROXY_DEDUP_SIZE)
+        return;
+      this->recent[this->recent_index] = key;
+      this->recent_index = (this->recent_index + 1) % PROXY_DEDUP_SIZE;
+      targets = this->listeners;
+    }
+    for (auto & listener : targets)
+      listener(packet);
+  }
+
+  std::vector<TelinkProxyStatus> TelinkProxyPool::get_status() {
+    std::vector<TelinkProxyStatus> result;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & proxy : this->proxies)
+      result.push_back(proxy->status);
+    return result;
+  }
+
+}
@@ -0,0 +1,277 @@
+/** \file telink_proxy_pool.h
+ *  Pool of connections to several nodes of one mesh, with health scoring and failover.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_PROXY_POOL_H__
+#define __TELINK_PROXY_POOL_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "telink_mesh.h"
+#include "telink_adapter.h"
+
+namespace telink {
+
+  /** \brief Number of recent report keys remembered to drop duplicates relayed by several proxies. */
+  #define PROXY_DEDUP_SIZE 64
+
+  /** \class TelinkProxyStatus
+   *  \brief Health of a proxy node.
+   */
+  class TelinkProxyStatus {
+  public:
+    /** \property std::string address
+     *  \brief Proxy MAC address.
+     */
+    std::string address;
+
+    /** \property bool connected
+     *  \brief true if the proxy is connected.
+     */
+    bool connected = false;
+
+    /** \property int rssi
+     *  \brief Last signal strength, in dBm; 0 if unknown.
+     */
+    int rssi = 0;
+
+    /** \property double latency
+     *  \brief Moving average of write latency, in milliseconds.
+     */
+    double latency = 0;
+
+    /** \property double error_rate
+     *  \brief Moving average of write failures, from 0 to 1.
+     */
+    double error_rate = 0;
+
+    /** \property double cost
+     *  \brief Routing cost derived from the above; lower is better.
+     */
+    double cost = 0;
+
+    /** \property uint64_t sent
+     *  \brief Number of packets sent through the proxy.
+     */
+    uint64_t sent = 0;
+
+    /** \property uint64_t failed
+     *  \brief Number of failed writes.
+     */
+    uint64_t failed = 0;
+  };
+
+  /** \class TelinkProxyPool
+   *  \brief Keeps connections to several nodes of the same mesh and routes packets through the healthiest.
+   *
+   *  Each proxy gets a routing cost: write latency, inflated by the error rate and by a weak
+   *  signal. Packets go through the connected proxy with the lowest cost; when a write fails,
+   *  the proxy is penalized and the packet is sent through the next one. A maintenance thread
+   *  reconnects lost proxies and refreshes signal strengths. Batches can be spread across all
+   *  connected proxies, each sending its share in parallel.
+   */
+  class TelinkProxyPool {
+  private:
+    /** \class Proxy
+     *  \brief Connection to a proxy node and its health.
+     */
+    class Proxy {
+    public:
+      /** \property std::unique_ptr<TelinkMesh> mesh
+       *  \brief Connection.
+       */
+      std::unique_ptr<TelinkMesh> mesh;
+
+      /** \property TelinkProxyStatus status
+       *  \brief Health; protected by the pool mutex.
+       */
+      TelinkProxyStatus status;
+
+      /** \property int listener_id
+       *  \brief ID of the report listener added to the connection.
+       */
+      int listener_id = 0;
+
+      /** \property std::mutex send_mutex
+       *  \brief Serializes use of the connection.
+       */
+      std::mutex send_mutex;
+    };
+
+    /** \property std::vector<std::unique_ptr<Proxy>> proxies
+     *  \brief Candidate proxies.
+     */
+    std::vector<std::unique_ptr<Proxy>> proxies;
+
+    /** \property std::size_t size
+     *  \brief Number of proxies to keep connected.
+     */
+    std::size_t size;
+
+    /** \property std::mutex mutex
+     *  \brief Protects proxy statuses and report listeners.
+     */
+    std::mutex mutex;
+
+    /** \property std::atomic<bool> running
+     *  \brief true while the maintenance thread runs.
+     */
+    std::atomic<bool> running;
+
+    /** \property std::condition_variable wakeup
+     *  \brief Wakes the maintenance thread.
+     */
+    std::condition_variable wakeup;
+
+    /** \property std::thread maintenance
+     *  \brief Thread reconnecting proxies.
+     */
+    std::thread maintenance;
+
+    /** \property TelinkAdapterManager * adapters
+     *  \brief Manager spreading proxy connections over Bluetooth adapters; nullptr to use the default adapter.
+     */
+    TelinkAdapterManager * adapters = nullptr;
+
+    /** \property int interval
+     *  \brief Maintenance period, in milliseconds.
+     */
+    int interval = 2000;
+
+    /** \property std::vector<std::function<void(const std::string &)>> listeners
+     *  \brief Functions receiving deduplicated reports.
+     */
+    std::vector<std::function<void(const std::string &)>> listeners;
+
+    /** \property uint64_t recent[PROXY_DEDUP_SIZE]
+     *  \brief Keys of recent reports.
+     */
+    uint64_t recent[PROXY_DEDUP_SIZE];
+
+    /** \property std::size_t recent_index
+     *  \brief Next slot in recent.
+     */
+    std::size_t recent_index = 0;
+
+    /** \fn void maintain()
+     *  \brief Maintenance thread loop.
+     */
+    void maintain();
+
+    /** \fn void connect_proxies()
+     *  \brief Connects proxies until the pool size is reached, and refreshes signal strengths.
+     */
+    void connect_proxies();
+
+    /** \fn void dispatch_report(const std::string & packet)
+     *  \brief Passes a report to listeners, unless another proxy already relayed it.
+     *  \param packet : decrypted report.
+     */
+    void dispatch_report(const std::string & packet);
+
+    /** \fn void record(Proxy & proxy, bool success, bool connected, double latency)
+     *  \brief Updates the health of a proxy after a write.
+     *  \param proxy : proxy used.
+     *  \param success : true if the write succeeded.
+     *  \param connected : true if the proxy is still connected.
+     *  \param latency : write duration per packet, in milliseconds.
+     */
+    void record(Proxy & proxy, bool success, bool connected, double latency);
+
+    /** \fn std::vector<Proxy*> ranked()
+     *  \brief Returns connected proxies by increasing cost.
+     *  \returns the proxies.
+     */
+    std::vector<Proxy*> ranked();
+
+    /** \fn std::size_t send_through(Proxy & proxy, int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count)
+     *  \brief Sends packets through a proxy and records its health.
+     *  \returns the number of packets sent.
+     */
+    std::size_t send_through(Proxy & proxy, int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count);
+
+  public:
+    /** \fn TelinkProxyPool(const std::vector<std::string> & addresses, const std::string & name, const std::string & password, std::size_t size)
+     *  \brief Object instantiation.
+     *  \param addresses : MAC addresses of candidate proxy nodes, all in the same mesh.
+     *  \param name : mesh name.
+     *  \param password : mesh password.
+     *  \param size : number of proxies to keep connected.
+     */
+    TelinkProxyPool(const std::vector<std::string> & addresses, const std::string & name, const std::string & password, std::size_t size = 2);
+
+    TelinkProxyPool(const TelinkProxyPool &) = delete;
+    TelinkProxyPool & operator=(const TelinkProxyPool &) = delete;
+
+    ~TelinkProxyPool();
+
+    /** \fn bool start()
+     *  \brief Connects proxies and starts the maintenance thread.
+     *  \returns true if at least one proxy is connected.
+     */
+    bool start();
+
+    /** \fn void stop()
+     *  \brief Stops the maintenance thread and disconnects all proxies.
+     */
+    void stop();
+
+    /** \fn void set_adapter_manager(TelinkAdapterManager * adapters)
+     *  \brief Spreads proxy connections over several Bluetooth adapters. Must be called before start().
+     *  The manager rates are updated by the maintenance thread.
+     *  \param adapters : adapter manager; nullptr to use the default adapter.
+     */
+    void set_adapter_manager(TelinkAdapterManager * adapters);
+
+    /** \fn void set_interval(int interval)
+     *  \brief Sets the maintenance period.
+     *  \param interval : period in milliseconds.
+     */
+    void set_interval(int interval);
+
+    /** \fn bool send_packet(int destination, int command, const std::string & data)
+     *  \brief Sends a command through the healthiest proxy, failing over to the others.
+     *  \param destination : mesh ID of target node or group.
+     *  \param command : command code.
+     *  \param data : command parameters (up to 10 byte).
+     *  \returns true if the packet was sent.
+     */
+    bool send_packet(int destination, int command, const std::string & data);
+
+    /** \fn std::size_t send_packets(int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count, bool spread)
+     *  \brief Sends the same command to several nodes.
+     *  \param command : command code.
+     *  \param destinations : mesh IDs of target nodes or groups.
+     *  \param data : command parameters, count x data_size bytes.
+     *  \param data_size : size of parameters of one packet (up to 10 byte).
+     *  \param count : number of packets.
+     *  \param spread : true to split the batch across all connected proxies in proportion to their health, sending in parallel.
+     *  \returns the number of packets sent.
+     */
+    std::size_t send_packets(int command, const uint16_t * destinations, const unsigned char * data, std::size_t data_size, std::size_t count, bool spread = false);
+
+    /** \fn void add_report_listener(const std::function<void(const std::string &)> & listener)
+     *  \brief Adds a function receiving reports from all proxies, without duplicates. Must be called before start().
+     *  \param listener : function taking the decrypted 20-byte packet.
+     */
+    void add_report_listener(const std::function<void(const std::string &)> & listener);
+
+    /** \fn std::vector<TelinkProxyStatus> get_status()
+     *  \brief Returns the health of all candidate proxies.
+     *  \returns the statuses, in candidate order.
+     */
+    std::vector<TelinkProxyStatus> get_status();
+  };
+
+}
+
+#endif // __TELINK_PROXY_POOL_H__
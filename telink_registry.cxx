@@ -0,0 +1,176 @@
+/** \file telink_registry.cxx
+ *  Compact in-memory table of mesh node states, for fleet-wide queries.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include "telink_registry.h"
+
+namespace telink {
+
+  /** \brief Number of color channels (R, G, B, Y, W). */
+  #define REGISTRY_CHANNELS 5
+
+  /** \fn static uint64_t now_ns()
+   *  \brief Returns wall-clock time.
+   *  \returns time in nanoseconds since epoch.
+   */
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  /** \fn static uint64_t brightness_mask(const uint8_t * brightness, uint64_t bits, int min_brightness, int max_brightness)
+   *  \brief Keeps the bits of a bitmap word whose brightness is in range.
+   *  \param brightness : brightness of the 64 nodes of the word.
+   *  \param bits : selected nodes of the word.
+   *  \param min_brightness : lowest brightness.
+   *  \param max_brightness : highest brightness.
+   *  \returns the bits of selected nodes in range.
+   */
+  static uint64_t brightness_mask(const uint8_t * brightness, uint64_t bits, int min_brightness, int max_brightness) {
+    if (min_brightness <= 0 && max_brightness >= 255)
+      return bits;
+    if (min_brightness > max_brightness)
+      return 0;
+    // compare all 64 bytes without branches (vectorized by the compiler), then gather one
+    // flag byte per bit, 8 at a time: multiplying moves the low bit of byte i to bit 56+i
+    unsigned char in_range[64];
+    unsigned int span = max_brightness - min_brightness;
+    for (int i=0; i<64; i++)
+      in_range[i] = static_cast<unsigned int>(brightness[i] - min_brightness) <= span;
+    uint64_t kept = 0;
+    for (int i=0; i<8; i++) {
+      uint64_t chunk;
+      std::memcpy(&chunk, in_range + 8*i, 8);
+      kept |= ((chunk * 0x0102040810204080ULL) >> 56) << (8*i);
+    }
+    return bits & kept;
+  }
+
+  TelinkNodeRegistry::TelinkNodeRegistry(std::size_t capacity) {
+    // whole bitmap words, so that scans never handle partial words
+    this->capacity = std::min<std::size_t>(std::max<std::size_t>(capacity, 1), REGISTRY_MAX_SIZE);
+    std::size_t words = (this->capacity + 63) / 64;
+    this->known.resize(words, 0);
+    this->online.resize(words, 0);
+    this->on.resize(words, 0);
+    this->power.resize(words, 0);
+    this->color.resize(words, 0);
+    this->brightness.resize(words * 64, 0);
+    this->channels.resize(REGISTRY_CHANNELS * this->capacity, 0);
+    this->updated.resize(this->capacity, 0);
+  }
+
+  void TelinkNodeRegistry::set_flag(std::vector<uint64_t> & bitmap, int address, bool value) {
+    uint64_t bit = uint64_t(1) << (address % 64);
+    if (value)
+      bitmap[address / 64] |= bit;
+    else
+      bitmap[address / 64] &= ~bit;
+  }
+
+  uint64_t TelinkNodeRegistry::match(std::size_t word, int flags, int mask) const {
+    uint64_t bits = this->known[word];
+    if (mask & NODE_ONLINE)
+      bits &= (flags & NODE_ONLINE) ? this->online[word] : ~this->online[word];
+    if (mask & NODE_ON)
+      bits &= (flags & NODE_ON) ? this->on[word] : ~this->on[word];
+    if (mask & NODE_POWER)
+      bits &= (flags & NODE_POWER) ? this->power[word] : ~this->power[word];
+    if (mask & NODE_COLOR)
+      bits &= (flags & NODE_COLOR) ? this->color[word] : ~this->color[word];
+    return bits;
+  }
+
+  void TelinkNodeRegistry::update_power(int address, bool online, bool state, unsigned char brightness) {
+    if (address < 0 || address >= static_cast<int>(this->capacity)) return;
+    uint64_t time = now_ns();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->set_flag(this->known, address, true);
+    this->set_flag(this->online, address, online);
+    this->set_flag(this->on, address, state);
+    this->set_flag(this->power, address, true);
+    this->brightness[address] = brightness;
+    this->updated[address] = time;
+  }
+
+  void TelinkNodeRegistry::update_color(int address, unsigned char brightness, const unsigned char * color) {
+    if (address < 0 || address >= static_cast<int>(this->capacity)) return;
+    uint64_t time = now_ns();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->set_flag(this->known, address, true);
+    this->set_flag(this->online, address, true);
+    this->set_flag(this->color, address, true);
+    this->brightness[address] = brightness;
+    for (int i=0; i<REGISTRY_CHANNELS; i++)
+      this->channels[i*this->capacity + address] = color[i];
+    this->updated[address] = time;
+  }
+
+  void TelinkNodeRegistry::remove(int address) {
+    if (address < 0 || address >= static_cast<int>(this->capacity)) return;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto bitmap : {&this->known, &this->online, &this->on, &this->power, &this->color})
+      this->set_flag(*bitmap, address, false);
+  }
+
+  bool TelinkNodeRegistry::get(int address, TelinkNodeState & state) const {
+    if (address < 0 || address >= static_cast<int>(this->capacity)) return false;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    uint64_t bit = uint64_t(1) << (address % 64);
+    std::size_t word = address / 64;
+    if (!(this->known[word] & bit)) return false;
+    state.address = address;
+    state.flags = NODE_KNOWN;
+    if (this->online[word] & bit) state.flags |= NODE_ONLINE;
+    if (this->on[word] & bit) state.flags |= NODE_ON;
+    if (this->power[word] & bit) state.flags |= NODE_POWER;
+    if (this->color[word] & bit) state.flags |= NODE_COLOR;
+    state.brightness = this->brightness[address];
+    for (int i=0; i<REGISTRY_CHANNELS; i++)
+      state.color[i] = this->channels[i*this->capacity + address];
+    state.updated = this->updated[address];
+    return true;
+  }
+
+  std::vector<uint16_t> TelinkNodeRegistry::select(int flags, int mask, int min_brightness, int max_brightness) const {
+    std::vector<uint16_t> addresses;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::size_t word=0; word<this->known.size(); word++) {
+      uint64_t bits = this->match(word, flags, mask);
+      if (bits == 0) continue;
+      bits = brightness_mask(&this->brightness[word*64], bits, min_brightness, max_brightness);
+      while (bits) {
+        addresses.push_back(word*64 + __builtin_ctzll(bits));
+        bits &= bits - 1;
+      }
+    }
+    return addresses;
+  }
+
+  std::size_t TelinkNodeRegistry::count(int flags, int mask, int min_brightness, int max_brightness) const {
+    std::size_t total = 0;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::size_t word=0; word<this->known.size(); word++) {
+      uint64_t bits = this->match(word, flags, mask);
+      if (bits != 0)
+        total += __builtin_popcountll(brightness_mask(&this->brightness[word*64], bits, min_brightness, max_brightness));
+    }
+    return total;
+  }
+
+  std::vector<TelinkNodeState> TelinkNodeRegistry::get_states(const std::vector<uint16_t> & addresses) const {
+    std::vector<TelinkNodeState> states;
+    states.reserve(addresses.size());
+    TelinkNodeState state;
+    for (auto address : addresses) {
+      if (this->get(address, state))
+        states.push_back(state);
+    }
+    return states;
+  }
+
+}
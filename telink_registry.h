@@ -0,0 +1,180 @@
+/** \file telink_registry.h
+ *  Compact in-memory table of mesh node states, for fleet-wide queries.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_REGISTRY_H__
+#define __TELINK_REGISTRY_H__
+
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+#include "telink_shared_state.h"
+
+namespace telink {
+
+  /** \brief Largest registry capacity: unicast mesh addresses are below 0x8000. */
+  #define REGISTRY_MAX_SIZE 0x8000
+
+  /** \class TelinkNodeRegistry
+   *  \brief States of mesh nodes indexed by mesh address, stored field by field.
+   *
+   *  Each NODE_* flag is a bitmap with one bit per address, and brightness is a byte array, so
+   *  that selecting nodes by state scans a few bytes per node, 64 nodes per word for flags.
+   *  Colors and update times live in their own arrays and are only read for the nodes asked
+   *  for. The registry is independent of connections: any number of TelinkMesh objects can
+   *  feed the same one. All methods are thread-safe.
+   */
+  class TelinkNodeRegistry {
+  private:
+    /** \property std::size_t capacity
+     *  \brief Number of addresses; addresses from 0 to capacity-1 can be stored.
+     */
+    std::size_t capacity;
+
+    /** \property std::vector<uint64_t> known
+     *  \brief Bitmap of nodes seen (NODE_KNOWN).
+     */
+    std::vector<uint64_t> known;
+
+    /** \property std::vector<uint64_t> online
+     *  \brief Bitmap of nodes reachable in mesh (NODE_ONLINE).
+     */
+    std::vector<uint64_t> online;
+
+    /** \property std::vector<uint64_t> on
+     *  \brief Bitmap of lights on (NODE_ON).
+     */
+    std::vector<uint64_t> on;
+
+    /** \property std::vector<uint64_t> power
+     *  \brief Bitmap of nodes with known power state (NODE_POWER).
+     */
+    std::vector<uint64_t> power;
+
+    /** \property std::vector<uint64_t> color
+     *  \brief Bitmap of nodes with known color (NODE_COLOR).
+     */
+    std::vector<uint64_t> color;
+
+    /** \property std::vector<uint8_t> brightness
+     *  \brief Brightness of each node, from 0 to 100.
+     */
+    std::vector<uint8_t> brightness;
+
+    /** \property std::vector<uint8_t> channels
+     *  \brief R, G, B, Y and W values; one array of capacity bytes per channel, back to back.
+     */
+    std::vector<uint8_t> channels;
+
+    /** \property std::vector<uint64_t> updated
+     *  \brief Time of last update of each node, in nanoseconds since epoch.
+     */
+    std::vector<uint64_t> updated;
+
+    /** \property std::mutex mutex
+     *  \brief Protects all arrays.
+     */
+    mutable std::mutex mutex;
+
+    /** \fn uint64_t match(std::size_t word, int flags, int mask) const
+     *  \brief Selects nodes of a bitmap word by flags.
+     *  \param word : bitmap word index.
+     *  \param flags : required values of masked NODE_* flags.
+     *  \param mask : NODE_* flags to check.
+     *  \returns the bits of known nodes matching flags.
+     */
+    uint64_t match(std::size_t word, int flags, int mask) const;
+
+    /** \fn void set_flag(std::vector<uint64_t> & bitmap, int address, bool value)
+     *  \brief Sets or clears the bit of an address.
+     *  \param bitmap : flag bitmap.
+     *  \param address : node mesh address.
+     *  \param value : bit value.
+     */
+    void set_flag(std::vector<uint64_t> & bitmap, int address, bool value);
+
+  public:
+    /** \fn TelinkNodeRegistry(std::size_t capacity)
+     *  \brief Object instantiation.
+     *  \param capacity : number of addresses, up to REGISTRY_MAX_SIZE; node addresses must
+     *  be below this value.
+     */
+    TelinkNodeRegistry(std::size_t capacity = 256);
+
+    TelinkNodeRegistry(const TelinkNodeRegistry &) = delete;
+    TelinkNodeRegistry & operator=(const TelinkNodeRegistry &) = delete;
+
+    /** \fn std::size_t get_capacity() const
+     *  \brief Returns the number of addresses.
+     *  \returns the capacity.
+     */
+    std::size_t get_capacity() const { return this->capacity; }
+
+    /** \fn void update_power(int address, bool online, bool state, unsigned char brightness)
+     *  \brief Records the power state of a node, as given by an online status report.
+     *  Ignored if the address is out of range.
+     *  \param address : node mesh address.
+     *  \param online : true if the node is reachable.
+     *  \param state : power state (true = on).
+     *  \param brightness : brightness, from 0 to 100.
+     */
+    void update_power(int address, bool online, bool state, unsigned char brightness);
+
+    /** \fn void update_color(int address, unsigned char brightness, const unsigned char * color)
+     *  \brief Records the color of a node, as given by a status report; the node is marked
+     *  online. Ignored if the address is out of range.
+     *  \param address : node mesh address.
+     *  \param brightness : brightness, from 0 to 100.
+     *  \param color : R, G, B, Y and W values.
+     */
+    void update_color(int address, unsigned char brightness, const unsigned char * color);
+
+    /** \fn void remove(int address)
+     *  \brief Forgets a node.
+     *  \param address : node mesh address.
+     */
+    void remove(int address);
+
+    /** \fn bool get(int address, TelinkNodeState & state) const
+     *  \brief Gets the state of a node.
+     *  \param address : node mesh address.
+     *  \param state : node state (output).
+     *  \returns true if the node is known, false otherwise.
+     */
+    bool get(int address, TelinkNodeState & state) const;
+
+    /** \fn std::vector<uint16_t> select(int flags, int mask = 0, int min_brightness = 0, int max_brightness = 255) const
+     *  \brief Lists known nodes by state, e.g. select(NODE_ON | NODE_POWER, NODE_ON | NODE_POWER, 51)
+     *  for lights on above 50%.
+     *  \param flags : required values of masked NODE_* flags.
+     *  \param mask : NODE_* flags to check.
+     *  \param min_brightness : lowest brightness.
+     *  \param max_brightness : highest brightness.
+     *  \returns the node addresses, in increasing order.
+     */
+    std::vector<uint16_t> select(int flags, int mask = 0, int min_brightness = 0, int max_brightness = 255) const;
+
+    /** \fn std::size_t count(int flags, int mask = 0, int min_brightness = 0, int max_brightness = 255) const
+     *  \brief Counts known nodes by state, with the same criteria as select().
+     *  \param flags : required values of masked NODE_* flags.
+     *  \param mask : NODE_* flags to check.
+     *  \param min_brightness : lowest brightness.
+     *  \param max_brightness : highest brightness.
+     *  \returns the number of matching nodes.
+     */
+    std::size_t count(int flags, int mask = 0, int min_brightness = 0, int max_brightness = 255) const;
+
+    /** \fn std::vector<TelinkNodeState> get_states(const std::vector<uint16_t> & addresses) const
+     *  \brief Gets the states of several nodes, e.g. from select().
+     *  \param addresses : node mesh addresses.
+     *  \returns the states of known nodes among them, in the same order.
+     */
+    std::vector<TelinkNodeState> get_states(const std::vector<uint16_t> & addresses) const;
+  };
+
+}
+
+#endif // __TELINK_REGISTRY_H__
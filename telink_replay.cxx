@@ -0,0 +1,98 @@
+/** \file telink_replay.cxx
+ *  Command line tool replaying a binary packet trace, either into the packet decoder or
+ *  into the send path of a connected device.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+
+#include "telink_light.h"
+#include "telink_trace.h"
+
+/** \fn static void print_record(const telink::TelinkTraceRecord & rec, uint64_t origin)
+ *  \brief Prints out a trace record.
+ *  \param rec : trace record.
+ *  \param origin : timestamp of first record, in ns.
+ */
+static void print_record(const telink::TelinkTraceRecord & rec, uint64_t origin) {
+  std::cout << std::fixed << std::setprecision(3) << std::setw(12) << (rec.timestamp - origin) / 1e6 << " ms "
+            << (rec.direction == TRACE_TX ? "TX" : "RX") << " opcode " << std::hex << std::setfill('0')
+            << std::setw(2) << (unsigned int)rec.opcode << " plain";
+  for (int i=0; i<rec.length; i++)
+    std::cout << " " << std::setw(2) << (unsigned int)rec.plain[i];
+  std::cout << " cipher";
+  for (int i=0; i<rec.length; i++)
+    std::cout << " " << std::setw(2) << (unsigned int)rec.cipher[i];
+  std::cout << std::dec << std::setfill(' ') << std::endl;
+}
+
+int main(int argc, char **argv) {
+
+  if (argc < 2) {
+    std::cerr << "Run as: " << argv[0] << " <trace_file> [--dump] [--max-speed] [--send <device_MAC_address> <device_name> <device_password>]" << std::endl;
+    exit(1);
+  }
+
+  using namespace telink;
+  using clock = std::chrono::steady_clock;
+
+  bool dump = false, max_speed = false;
+  const char * send_args[3] = {nullptr, nullptr, nullptr};
+  for (int i=2; i<argc; i++) {
+    if (std::strcmp(argv[i], "--dump") == 0) {
+      dump = true;
+    } else if (std::strcmp(argv[i], "--max-speed") == 0) {
+      max_speed = true;
+    } else if (std::strcmp(argv[i], "--send") == 0 && i+3 < argc) {
+      for (int j=0; j<3; j++)
+        send_args[j] = argv[++i];
+    } else {
+      std::cerr << "Unknown argument " << argv[i] << std::endl;
+      exit(1);
+    }
+  }
+
+  std::vector<TelinkTraceRecord> records = TelinkTrace::load(argv[1]);
+  if (records.empty()) return 1;
+  uint64_t origin = records.front().timestamp;
+
+  if (dump)
+    for (auto & rec : records)
+      print_record(rec, origin);
+
+  // replay into the send path of a connected device, or into the decoder
+  bool sending = send_args[0] != nullptr;
+  TelinkLight light(sending ? send_args[0] : "00:00:00:00:00:00", sending ? send_args[1] : "", sending ? send_args[2] : "");
+  if (sending && !light.connect()) return 1;
+  uint8_t direction = sending ? TRACE_TX : TRACE_RX;
+
+  long count = 0;
+  clock::duration busy = clock::duration::zero();
+  clock::time_point start = clock::now();
+  for (auto & rec : records) {
+    if (rec.direction != direction || rec.length < 10) continue;
+    if (!max_speed)
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds(rec.timestamp - origin));
+    std::string plain(reinterpret_cast<const char*>(rec.plain), rec.length);
+    clock::time_point t0 = clock::now();
+    if (sending) {
+      // keep the recorded target node or group (bytes 5-6)
+      uint16_t destination = rec.plain[5] | (rec.plain[6] << 8);
+      light.send_packets(rec.opcode, &destination, rec.plain + 10, rec.length - 10, 1);
+    } else
+      light.receive_packet(plain);
+    busy += clock::now() - t0;
+    count++;
+  }
+  double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  double per_packet = count > 0 ? std::chrono::duration<double, std::micro>(busy).count() / count : 0;
+
+  std::cout << "Replayed " << count << (sending ? " sent" : " received") << " packets in " << elapsed << " s ("
+            << (elapsed > 0 ? count / elapsed : 0) << " packets/s), " << per_packet << " us per packet in "
+            << (sending ? "send_packets" : "receive_packet") << std::endl;
+  return 0;
+}
@@ -0,0 +1,367 @@
+/** \file telink_server.cxx
+ *  Local server sharing one Telink mesh connection between several client processes.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "telink_server.h"
+
+namespace telink {
+
+  /** \fn static std::string build_frame(unsigned char type, const std::string & payload)
+   *  \brief Builds a frame.
+   *  \param type : frame type.
+   *  \param payload : frame payload (up to 255 bytes).
+   *  \returns the frame.
+   */
+  static std::string build_frame(unsigned char type, const std::string & payload) {
+    std::string frame = {schar(type), schar(payload.size())};
+    return frame + payload;
+  }
+
+  /** \fn static bool fill_address(const std::string & path, struct sockaddr_un & addr)
+   *  \brief Fills a Unix domain socket address.
+   *  \param path : socket path.
+   *  \param addr : socket address (output).
+   *  \returns false if the path is too long.
+   */
+  static bool fill_address(const std::string & path, struct sockaddr_un & addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Socket path " << path << " is too long." << std::endl;
+      return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+  }
+
+  TelinkServer::~TelinkServer() {
+    this->stop();
+  }
+
+  bool TelinkServer::start() {
+    if (this->running) return true;
+    struct sockaddr_un addr;
+    if (!fill_address(this->path, addr)) return false;
+
+    this->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(this->path.c_str()); // remove socket left by a previous instance
+    if (this->listen_fd < 0 || bind(this->listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(this->listen_fd, 16) != 0) {
+      std::cerr << "Cannot listen on " << this->path << ": " << std::strerror(errno) << std::endl;
+      if (this->listen_fd >= 0) close(this->listen_fd);
+      this->listen_fd = -1;
+      return false;
+    }
+    this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    this->listener_id = this->mesh.add_report_listener([this](const std::string & packet) {
+      {
+        std::lock_guard<std::mutex> lock(this->report_mutex);
+        this->reports.push_back(packet);
+      }
+      this->wake();
+    });
+
+    this->running = true;
+    this->io_thread = std::thread(&TelinkServer::serve, this);
+    this->send_thread = std::thread(&TelinkServer::send_commands, this);
+    return true;
+  }
+
+  void TelinkServer::stop() {
+    if (!this->running) return;
+    {
+      std::lock_guard<std::mutex> lock(this->send_mutex);
+      this->running = false;
+      this->send_wakeup.notify_one();
+    }
+    this->wake();
+    this->io_thread.join();
+    this->send_thread.join();
+    this->mesh.remove_report_listener(this->listener_id);
+
+    for (auto & client : this->clients)
+      close(client.first);
+    this->clients.clear();
+    this->queues.clear();
+    this->client_count = 0;
+    close(this->listen_fd);
+    close(this->wake_fd);
+    this->listen_fd = this->wake_fd = -1;
+    unlink(this->path.c_str());
+  }
+
+  void TelinkServer::wake() {
+    uint64_t one = 1;
+    if (write(this->wake_fd, &one, sizeof(one)) < 0) {}
+  }
+
+  void TelinkServer::drop_client(int fd) {
+    {
+      std::lock_guard<std::mutex> lock(this->send_mutex);
+      this->queues.erase(fd);
+    }
+    this->clients.erase(fd);
+    this->client_count = this->clients.size();
+    close(fd);
+  }
+
+  bool TelinkServer::handle_frame(int fd, Client & client, unsigned char type, const std::string & payload) {
+    if (type == FRAME_SEND) {
+      if (payload.size() < 3 || payload.size() > 13)
+        return false;
+      std::lock_guard<std::mutex> lock(this->send_mutex);
+      auto & queue = this->queues[fd];
+      if (queue.size() >= SERVER_MAX_PENDING) {
+        client.output += build_frame(FRAME_ERROR, {FRAME_ERROR_QUEUE_FULL});
+      } else {
+        TelinkTimeline * timeline = this->mesh.get_timeline();
+        queue.emplace_back(timeline != nullptr && timeline->is_enabled() ? TelinkTimeline::now() : 0, payload);
+        this->send_wakeup.notify_one();
+      }
+    } else if (type == FRAME_SUBSCRIBE) {
+      if (payload.empty())
+        client.opcodes.set();
+      for (auto & opcode : payload)
+        client.opcodes.set(static_cast<unsigned char>(opcode));
+    } else if (type == FRAME_UNSUBSCRIBE) {
+      client.opcodes.reset();
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void TelinkServer::serve() {
+    std::vector<struct pollfd> fds;
+    std::vector<std::string> received;
+    std::vector<int> failed, closed;
+    char buffer[4096];
+
+    while (this->running) {
+      fds.clear();
+      fds.push_back({this->wake_fd, POLLIN, 0});
+      fds.push_back({this->listen_fd, POLLIN, 0});
+      for (auto & client : this->clients)
+        fds.push_back({client.first, short(client.second.output.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+      if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+        std::cerr << "Server poll failed: " << std::strerror(errno) << std::endl;
+        break;
+      }
+
+      // reports and send errors
+      if (fds[0].revents & POLLIN) {
+        uint64_t count;
+        if (read(this->wake_fd, &count, sizeof(count)) < 0) {}
+        {
+          std::lock_guard<std::mutex> lock(this->report_mutex);
+          received.swap(this->reports);
+        }
+        {
+          std::lock_guard<std::mutex> lock(this->send_mutex);
+          failed.swap(this->send_errors);
+        }
+        for (auto & packet : received) {
+          std::string frame = build_frame(FRAME_REPORT, packet);
+          for (auto & client : this->clients) {
+            // slow clients lose reports rather than holding memory
+            if (client.second.opcodes.test(static_cast<unsigned char>(packet[7])) && client.second.output.size() < SERVER_MAX_OUTPUT)
+              client.second.output += frame;
+          }
+        }
+        for (auto & fd : failed) {
+          auto it = this->clients.find(fd);
+          if (it != this->clients.end())
+            it->second.output += build_frame(FRAME_ERROR, {FRAME_ERROR_SEND_FAILED});
+        }
+        received.clear();
+        failed.clear();
+      }
+
+      // new clients
+      if (fds[1].revents & POLLIN) {
+        int fd;
+        while ((fd = accept4(this->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+          this->clients[fd];
+        this->client_count = this->clients.size();
+      }
+
+      // client traffic
+      for (std::size_t i=2; i<fds.size(); i++) {
+        auto it = this->clients.find(fds[i].fd);
+        if (it == this->clients.end()) continue;
+        Client & client = it->second;
+        bool keep = true;
+        if (fds[i].revents & POLLIN) {
+          ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+          if (n > 0) {
+            client.input.append(buffer, n);
+            std::size_t offset = 0;
+            while (keep && client.input.size() - offset >= FRAME_HEADER_SIZE) {
+              std::size_t length = static_cast<unsigned char>(client.input[offset+1]);
+              if (client.input.size() - offset < FRAME_HEADER_SIZE + length) break;
+              keep = this->handle_frame(fds[i].fd, client, client.input[offset], client.input.substr(offset + FRAME_HEADER_SIZE, length));
+              offset += FRAME_HEADER_SIZE + length;
+            }
+            client.input.erase(0, offset);
+            if (!keep) {
+              // framing is lost: report and close
+              std::string frame = build_frame(FRAME_ERROR, {FRAME_ERROR_INVALID});
+              if (write(fds[i].fd, frame.data(), frame.size()) < 0) {}
+            }
+          } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            keep = false;
+          }
+        } else if (fds[i].revents & (POLLHUP | POLLERR)) {
+          keep = false;
+        }
+        if (keep && !client.output.empty()) {
+          ssize_t n = send(fds[i].fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+          if (n > 0)
+            client.output.erase(0, n);
+          else if (n < 0 && errno != EAGAIN && errno != EINTR)
+            keep = false;
+        }
+        if (!keep)
+          closed.push_back(fds[i].fd);
+      }
+      for (auto & fd : closed)
+        this->drop_client(fd);
+      closed.clear();
+    }
+  }
+
+  void TelinkServer::send_commands() {
+    int last_fd = -1;
+    std::unique_lock<std::mutex> lock(this->send_mutex);
+    while (true) {
+      this->send_wakeup.wait(lock, [this]() {
+        if (!this->running) return true;
+        for (auto & queue : this->queues)
+          if (!queue.second.empty()) return true;
+        return false;
+      });
+      if (!this->running) break;
+
+      // round-robin over clients with pending commands
+      auto it = this->queues.upper_bound(last_fd);
+      for (std::size_t i=0; i<this->queues.size(); i++, it++) {
+        if (it == this->queues.end()) it = this->queues.begin();
+        if (!it->second.empty()) break;
+      }
+      last_fd = it->first;
+      uint64_t queued = it->second.front().first;
+      std::string command = it->second.front().second;
+      it->second.pop_front();
+      lock.unlock();
+
+      uint16_t destination = static_cast<unsigned char>(command[0]) | (static_cast<unsigned char>(command[1]) << 8);
+      TelinkTimeline * timeline = this->mesh.get_timeline();
+      if (queued != 0 && timeline != nullptr)
+        timeline->record(SPAN_QUEUE, queued, TelinkTimeline::now(), 0, destination, static_cast<unsigned char>(command[2]));
+      std::size_t sent = this->mesh.send_packets(static_cast<unsigned char>(command[2]), &destination,
+                                                 reinterpret_cast<const unsigned char*>(command.data()) + 3, command.size() - 3, 1);
+
+      lock.lock();
+      if (sent == 0) {
+        this->send_errors.push_back(last_fd);
+        lock.unlock();
+        this->wake();
+        lock.lock();
+      }
+    }
+  }
+
+  TelinkClient::~TelinkClient() {
+    this->disconnect();
+  }
+
+  bool TelinkClient::connect(const std::string & path) {
+    this->disconnect();
+    struct sockaddr_un addr;
+    if (!fill_address(path, addr)) return false;
+    this->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->fd < 0 || ::connect(this->fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+      std::cerr << "Cannot connect to " << path << ": " << std::strerror(errno) << std::endl;
+      this->disconnect();
+      return false;
+    }
+    return true;
+  }
+
+  void TelinkClient::disconnect() {
+    if (this->fd >= 0)
+      close(this->fd);
+    this->fd = -1;
+    this->input.clear();
+  }
+
+  bool TelinkClient::write_frame(unsigned char type, const std::string & payload) {
+    if (this->fd < 0) return false;
+    std::string frame = build_frame(type, payload);
+    std::size_t offset = 0;
+    while (offset < frame.size()) {
+      ssize_t n = send(this->fd, frame.data() + offset, frame.size() - offset, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      offset += n;
+    }
+    return true;
+  }
+
+  bool TelinkClient::send_packet(int destination, int command, const std::string & data) {
+    if (data.size() > 10) return false;
+    std::string payload = {schar(destination & 0xff), schar((destination >> 8) & 0xff), schar(command)};
+    return this->write_frame(FRAME_SEND, payload + data);
+  }
+
+  bool TelinkClient::subscribe(const std::vector<unsigned char> & opcodes) {
+    return this->write_frame(FRAME_SUBSCRIBE, std::string(opcodes.begin(), opcodes.end()));
+  }
+
+  bool TelinkClient::unsubscribe() {
+    return this->write_frame(FRAME_UNSUBSCRIBE, "");
+  }
+
+  int TelinkClient::read_frame(std::string & payload, int timeout_ms) {
+    char buffer[1024];
+    while (true) {
+      if (this->input.size() >= FRAME_HEADER_SIZE) {
+        std::size_t length = static_cast<unsigned char>(this->input[1]);
+        if (this->input.size() >= FRAME_HEADER_SIZE + length) {
+          int type = static_cast<unsigned char>(this->input[0]);
+          payload = this->input.substr(FRAME_HEADER_SIZE, length);
+          this->input.erase(0, FRAME_HEADER_SIZE + length);
+          return type;
+        }
+      }
+      if (this->fd < 0) return -1;
+      struct pollfd pfd = {this->fd, POLLIN, 0};
+      int ready = poll(&pfd, 1, timeout_ms);
+      if (ready == 0) return 0;
+      if (ready < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      ssize_t n = read(this->fd, buffer, sizeof(buffer));
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) continue;
+        this->disconnect();
+        return -1;
+      }
+      this->input.append(buffer, n);
+    }
+  }
+
+}
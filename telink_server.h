@@ -0,0 +1,305 @@
+/** \file telink_server.h
+ *  Local server sharing one Telink mesh connection between several client processes.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_SERVER_H__
+#define __TELINK_SERVER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <bitset>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+
+#include "telink_mesh.h"
+
+namespace telink {
+
+  /* Frames exchanged over the server socket:
+       byte 0  : frame type
+       byte 1  : payload length
+       bytes 2-: payload
+  */
+  // Frame types sent by clients
+  #define FRAME_SEND          0x01 // payload: destination (2 bytes, little-endian), command, data (up to 10 bytes)
+  #define FRAME_SUBSCRIBE     0x02 // payload: report opcodes to receive; empty for all reports
+  #define FRAME_UNSUBSCRIBE   0x03 // payload: none
+  // Frame types sent by server
+  #define FRAME_REPORT        0x81 // payload: decrypted 20-byte report
+  #define FRAME_ERROR         0x82 // payload: error code
+
+  // Error codes
+  #define FRAME_ERROR_INVALID     0x01 // malformed frame
+  #define FRAME_ERROR_QUEUE_FULL  0x02 // too many commands pending; command dropped
+  #define FRAME_ERROR_SEND_FAILED 0x03 // command could not be sent to the mesh
+
+  /** \brief Size of a frame header. */
+  #define FRAME_HEADER_SIZE 2
+  /** \brief Maximum number of commands waiting per client. */
+  #define SERVER_MAX_PENDING 256
+  /** \brief Maximum number of unsent bytes per client before reports are dropped. */
+  #define SERVER_MAX_OUTPUT 65536
+
+  /** \class TelinkServer
+   *  \brief Owns a mesh connection and serves clients over a Unix domain socket.
+   *
+   *  Clients send commands and subscribe to reports with the frames defined above, so that
+   *  only the server talks to the device. Commands from all clients go through a single send
+   *  thread, which takes them round-robin from per-client queues; reports are forwarded to every
+   *  client subscribed to their opcode.
+   */
+  class TelinkServer {
+  private:
+    /** \class Client
+     *  \brief State of a connected client.
+     */
+    class Client {
+    public:
+      /** \property std::string input
+       *  \brief Received bytes not yet forming a complete frame.
+       */
+      std::string input;
+
+      /** \property std::string output
+       *  \brief Frames waiting to be written to the client.
+       */
+      std::string output;
+
+      /** \property std::bitset<256> opcodes
+       *  \brief Report opcodes the client is subscribed to.
+       */
+      std::bitset<256> opcodes;
+    };
+
+    /** \property TelinkMesh & mesh
+     *  \brief Shared mesh connection.
+     */
+    TelinkMesh & mesh;
+
+    /** \property std::string path
+     *  \brief Socket path.
+     */
+    std::string path;
+
+    /** \property int listen_fd
+     *  \brief Listening socket; -1 when stopped.
+     */
+    int listen_fd = -1;
+
+    /** \property int listener_id
+     *  \brief ID of the report listener added to the mesh.
+     */
+    int listener_id = 0;
+
+    /** \property int wake_fd
+     *  \brief eventfd waking the I/O thread.
+     */
+    int wake_fd = -1;
+
+    /** \property std::atomic<bool> running
+     *  \brief true while the server threads run.
+     */
+    std::atomic<bool> running;
+
+    /** \property std::map<int, Client> clients
+     *  \brief Connected clients, by socket; only used by the I/O thread.
+     */
+    std::map<int, Client> clients;
+
+    /** \property std::atomic<std::size_t> client_count
+     *  \brief Number of connected clients.
+     */
+    std::atomic<std::size_t> client_count;
+
+    /** \property std::map<int, std::deque<std::pair<uint64_t, std::string>>> queues
+     *  \brief Command frame payloads waiting to be sent, by client socket, with the time they
+     *  were queued (0 when the mesh has no timeline).
+     */
+    std::map<int, std::deque<std::pair<uint64_t, std::string>>> queues;
+
+    /** \property std::mutex send_mutex
+     *  \brief Protects command queues and send errors.
+     */
+    std::mutex send_mutex;
+
+    /** \property std::condition_variable send_wakeup
+     *  \brief Signals the send thread.
+     */
+    std::condition_variable send_wakeup;
+
+    /** \property std::vector<int> send_errors
+     *  \brief Clients whose commands failed, to be notified by the I/O thread.
+     */
+    std::vector<int> send_errors;
+
+    /** \property std::mutex report_mutex
+     *  \brief Protects reports.
+     */
+    std::mutex report_mutex;
+
+    /** \property std::vector<std::string> reports
+     *  \brief Reports received since the I/O thread last ran.
+     */
+    std::vector<std::string> reports;
+
+    /** \property std::thread io_thread
+     *  \brief Thread serving client sockets.
+     */
+    std::thread io_thread;
+
+    /** \property std::thread send_thread
+     *  \brief Thread sending commands to the mesh.
+     */
+    std::thread send_thread;
+
+    /** \fn void wake()
+     *  \brief Wakes the I/O thread.
+     */
+    void wake();
+
+    /** \fn void serve()
+     *  \brief I/O thread loop.
+     */
+    void serve();
+
+    /** \fn void send_commands()
+     *  \brief Send thread loop.
+     */
+    void send_commands();
+
+    /** \fn bool handle_frame(int fd, Client & client, unsigned char type, const std::string & payload)
+     *  \brief Handles a frame received from a client.
+     *  \param fd : client socket.
+     *  \param client : client state.
+     *  \param type : frame type.
+     *  \param payload : frame payload.
+     *  \returns false if the frame is invalid.
+     */
+    bool handle_frame(int fd, Client & client, unsigned char type, const std::string & payload);
+
+    /** \fn void drop_client(int fd)
+     *  \brief Closes a client connection and forgets its pending commands.
+     *  \param fd : client socket.
+     */
+    void drop_client(int fd);
+
+  public:
+    /** \fn TelinkServer(TelinkMesh & mesh, const std::string & path)
+     *  \brief Object instantiation.
+     *  \param mesh : mesh connection to share; the server connects it when needed.
+     *  \param path : Unix domain socket path.
+     */
+    TelinkServer(TelinkMesh & mesh, const std::string & path) : mesh(mesh), path(path), running(false), client_count(0) {}
+
+    TelinkServer(const TelinkServer &) = delete;
+    TelinkServer & operator=(const TelinkServer &) = delete;
+
+    ~TelinkServer();
+
+    /** \fn bool start()
+     *  \brief Creates the socket and starts serving clients.
+     *  \returns true on success, false otherwise.
+     */
+    bool start();
+
+    /** \fn void stop()
+     *  \brief Stops serving, closes all client connections and removes the socket.
+     */
+    void stop();
+
+    /** \fn std::size_t get_client_count() const
+     *  \brief Returns the number of connected clients.
+     *  \returns the number of clients.
+     */
+    std::size_t get_client_count() const { return this->client_count; }
+  };
+
+  /** \class TelinkClient
+   *  \brief Client of a TelinkServer.
+   */
+  class TelinkClient {
+  private:
+    /** \property int fd
+     *  \brief Socket; -1 when disconnected.
+     */
+    int fd = -1;
+
+    /** \property std::string input
+     *  \brief Received bytes not yet forming a complete frame.
+     */
+    std::string input;
+
+    /** \fn bool write_frame(unsigned char type, const std::string & payload)
+     *  \brief Writes a frame to the server.
+     *  \param type : frame type.
+     *  \param payload : frame payload.
+     *  \returns true on success, false otherwise.
+     */
+    bool write_frame(unsigned char type, const std::string & payload);
+
+  public:
+    TelinkClient() {}
+
+    TelinkClient(const TelinkClient &) = delete;
+    TelinkClient & operator=(const TelinkClient &) = delete;
+
+    ~TelinkClient();
+
+    /** \fn bool connect(const std::string & path)
+     *  \brief Connects to a server.
+     *  \param path : server socket path.
+     *  \returns true on success, false otherwise.
+     */
+    bool connect(const std::string & path);
+
+    /** \fn void disconnect()
+     *  \brief Closes the connection.
+     */
+    void disconnect();
+
+    /** \fn bool send_packet(int destination, int command, const std::string & data)
+     *  \brief Sends a command to a mesh node through the server.
+     *  \param destination : mesh ID of target node or group.
+     *  \param command : command code.
+     *  \param data : command parameters (up to 10 byte).
+     *  \returns true if the command was passed to the server.
+     */
+    bool send_packet(int destination, int command, const std::string & data);
+
+    /** \fn bool subscribe(const std::vector<unsigned char> & opcodes)
+     *  \brief Subscribes to reports.
+     *  \param opcodes : report opcodes to receive; empty for all reports.
+     *  \returns true on success, false otherwise.
+     */
+    bool subscribe(const std::vector<unsigned char> & opcodes);
+
+    /** \fn bool unsubscribe()
+     *  \brief Stops receiving reports.
+     *  \returns true on success, false otherwise.
+     */
+    bool unsubscribe();
+
+    /** \fn int read_frame(std::string & payload, int timeout_ms)
+     *  \brief Waits for a frame from the server.
+     *  \param payload : frame payload (output).
+     *  \param timeout_ms : timeout in milliseconds; -1 to wait indefinitely.
+     *  \returns the frame type, 0 on timeout, or -1 if the connection is closed.
+     */
+    int read_frame(std::string & payload, int timeout_ms);
+
+    /** \fn int get_fd() const
+     *  \brief Returns the socket, e.g. to wait for frames in an event loop.
+     *  \returns the socket, or -1 when disconnected.
+     */
+    int get_fd() const { return this->fd; }
+  };
+
+}
+
+#endif // __TELINK_SERVER_H__
@@ -0,0 +1,220 @@
+/** \file telink_shared_state.cxx
+ *  Snapshot of mesh node states in POSIX shared memory, readable lock-free by other processes.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "telink_shared_state.h"
+
+namespace telink {
+
+  /* Region layout (host byte order):
+       bytes 0-7   : magic "TLKSTATE"
+       bytes 8-11  : format version
+       bytes 12-15 : record size
+       bytes 16-19 : number of records
+       bytes 20-63 : reserved
+       bytes 64-   : records, indexed by mesh address
+  */
+  #define SHARED_STATE_HEADER_SIZE 64
+
+  /** \class SharedRecord
+   *  \brief Node state as stored in the region. All fields are atomics, so that readers racing
+   *  with the writer read stale or torn values (detected with the sequence) but never undefined ones.
+   */
+  class SharedRecord {
+  public:
+    /** \property std::atomic<uint32_t> sequence
+     *  \brief Sequence lock: odd while the record is being written.
+     */
+    std::atomic<uint32_t> sequence;
+
+    /** \property std::atomic<uint32_t> words[3]
+     *  \brief Packed state: address (16 bits), flags, brightness | R, G, B, Y | W.
+     */
+    std::atomic<uint32_t> words[3];
+
+    /** \property std::atomic<uint64_t> updated
+     *  \brief Time of last update, in nanoseconds since epoch.
+     */
+    std::atomic<uint64_t> updated;
+
+    /** \property uint8_t reserved[8]
+     *  \brief Padding.
+     */
+    uint8_t reserved[8];
+  };
+
+  static_assert(sizeof(SharedRecord) == 32, "unexpected shared record size");
+
+  /** \fn static void load_record(const SharedRecord & record, TelinkNodeState & state)
+   *  \brief Unpacks a record.
+   *  \param record : record to unpack.
+   *  \param state : node state (output).
+   */
+  static void load_record(const SharedRecord & record, TelinkNodeState & state) {
+    uint32_t w0 = record.words[0].load(std::memory_order_relaxed);
+    uint32_t w1 = record.words[1].load(std::memory_order_relaxed);
+    uint32_t w2 = record.words[2].load(std::memory_order_relaxed);
+    state.address = w0 & 0xffff;
+    state.flags = (w0 >> 16) & 0xff;
+    state.brightness = w0 >> 24;
+    for (int i=0; i<4; i++)
+      state.color[i] = (w1 >> (8*i)) & 0xff;
+    state.color[4] = w2 & 0xff;
+    state.updated = record.updated.load(std::memory_order_relaxed);
+  }
+
+  TelinkSharedState::~TelinkSharedState() {
+    this->close();
+  }
+
+  bool TelinkSharedState::map(const std::string & name, bool create, std::size_t capacity) {
+    this->close();
+    int fd = shm_open(name.c_str(), create ? O_CREAT | O_RDWR : O_RDONLY, 0644);
+    if (fd < 0) {
+      std::cerr << "Cannot open shared memory object " << name << std::endl;
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) st.st_size = 0;
+    uint32_t header[4] = {0, 0, 0, 0};
+    if (st.st_size >= SHARED_STATE_HEADER_SIZE && pread(fd, header, sizeof(header), 8) != sizeof(header))
+      st.st_size = 0;
+    char magic[8];
+    if (st.st_size >= SHARED_STATE_HEADER_SIZE && pread(fd, magic, 8, 0) != 8)
+      st.st_size = 0;
+    bool valid = st.st_size >= SHARED_STATE_HEADER_SIZE && std::memcmp(magic, SHARED_STATE_MAGIC, 8) == 0 &&
+                 header[0] == SHARED_STATE_VERSION && header[1] == sizeof(SharedRecord) &&
+                 static_cast<std::size_t>(st.st_size) >= SHARED_STATE_HEADER_SIZE + static_cast<std::size_t>(header[2]) * sizeof(SharedRecord);
+
+    std::size_t size = SHARED_STATE_HEADER_SIZE + capacity * sizeof(SharedRecord);
+    bool initialize = false;
+    if (create) {
+      // keep a compatible region, so that readers survive a restart of the writer
+      initialize = !valid || header[2] != capacity;
+      if (initialize && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        std::cerr << "Cannot resize shared memory object " << name << std::endl;
+        ::close(fd);
+        return false;
+      }
+    } else {
+      if (!valid) {
+        std::cerr << "Invalid shared state " << name << std::endl;
+        ::close(fd);
+        return false;
+      }
+      capacity = header[2];
+      size = SHARED_STATE_HEADER_SIZE + capacity * sizeof(SharedRecord);
+    }
+
+    void * region = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (region == MAP_FAILED) {
+      std::cerr << "Cannot map shared memory object " << name << std::endl;
+      return false;
+    }
+    this->region = static_cast<unsigned char*>(region);
+    this->region_size = size;
+    this->capacity = capacity;
+    this->writable = create;
+
+    if (initialize) {
+      uint32_t values[3] = {SHARED_STATE_VERSION, sizeof(SharedRecord), static_cast<uint32_t>(capacity)};
+      std::memcpy(this->region + 8, values, sizeof(values));
+      std::atomic_thread_fence(std::memory_order_release);
+      std::memcpy(this->region, SHARED_STATE_MAGIC, 8);
+    } else if (create) {
+      // a writer that died mid-update leaves an odd sequence: release those records
+      SharedRecord * records = reinterpret_cast<SharedRecord*>(this->region + SHARED_STATE_HEADER_SIZE);
+      for (std::size_t i=0; i<capacity; i++) {
+        uint32_t sequence = records[i].sequence.load(std::memory_order_relaxed);
+        if (sequence & 1)
+          records[i].sequence.store(sequence + 1, std::memory_order_release);
+      }
+    }
+    return true;
+  }
+
+  bool TelinkSharedState::create(const std::string & name, std::size_t capacity) {
+    return this->map(name, true, capacity);
+  }
+
+  bool TelinkSharedState::open(const std::string & name) {
+    return this->map(name, false, 0);
+  }
+
+  void TelinkSharedState::close() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->region != nullptr)
+      munmap(this->region, this->region_size);
+    this->region = nullptr;
+    this->region_size = 0;
+    this->capacity = 0;
+    this->writable = false;
+  }
+
+  bool TelinkSharedState::remove(const std::string & name) {
+    return shm_unlink(name.c_str()) == 0;
+  }
+
+  void TelinkSharedState::update(int address, const std::function<void(TelinkNodeState &)> & modifier) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->writable || address < 0 || static_cast<std::size_t>(address) >= this->capacity)
+      return;
+    SharedRecord & record = reinterpret_cast<SharedRecord*>(this->region + SHARED_STATE_HEADER_SIZE)[address];
+
+    TelinkNodeState state;
+    load_record(record, state); // single writer: no concurrent change
+    if (!(state.flags & NODE_KNOWN))
+      state = TelinkNodeState();
+    modifier(state);
+    state.address = address;
+    state.flags |= NODE_KNOWN;
+    state.updated = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    // odd while writing, even after, whatever the sequence was left at
+    uint32_t sequence = record.sequence.load(std::memory_order_relaxed) | 1;
+    record.sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.words[0].store(state.address | (state.flags << 16) | (static_cast<uint32_t>(state.brightness) << 24), std::memory_order_relaxed);
+    record.words[1].store(state.color[0] | (state.color[1] << 8) | (state.color[2] << 16) | (static_cast<uint32_t>(state.color[3]) << 24), std::memory_order_relaxed);
+    record.words[2].store(state.color[4], std::memory_order_relaxed);
+    record.updated.store(state.updated, std::memory_order_relaxed);
+    record.sequence.store(sequence + 1, std::memory_order_release);
+  }
+
+  bool TelinkSharedState::read(int address, TelinkNodeState & state) const {
+    if (this->region == nullptr || address < 0 || static_cast<std::size_t>(address) >= this->capacity)
+      return false;
+    const SharedRecord & record = reinterpret_cast<const SharedRecord*>(this->region + SHARED_STATE_HEADER_SIZE)[address];
+    for (int attempt=0; attempt<SHARED_STATE_MAX_RETRIES; attempt++) {
+      uint32_t before = record.sequence.load(std::memory_order_acquire);
+      load_record(record, state);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint32_t after = record.sequence.load(std::memory_order_relaxed);
+      if (!(before & 1) && before == after)
+        return state.flags & NODE_KNOWN;
+    }
+    return false;
+  }
+
+  std::vector<TelinkNodeState> TelinkSharedState::snapshot() const {
+    std::vector<TelinkNodeState> states;
+    TelinkNodeState state;
+    for (std::size_t address=0; address<this->capacity; address++) {
+      if (this->read(address, state))
+        states.push_back(state);
+    }
+    return states;
+  }
+
+}
@@ -0,0 +1,174 @@
+/** \file telink_shared_state.h
+ *  Snapshot of mesh node states in POSIX shared memory, readable lock-free by other processes.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_SHARED_STATE_H__
+#define __TELINK_SHARED_STATE_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+namespace telink {
+
+  /** \brief Magic bytes at the beginning of a shared state region. */
+  #define SHARED_STATE_MAGIC "TLKSTATE"
+  /** \brief Shared state region format version. */
+  #define SHARED_STATE_VERSION 1
+  /** \brief Number of attempts of a reader before giving up on a record being written. */
+  #define SHARED_STATE_MAX_RETRIES 10000
+
+  // Node state flags
+  #define NODE_KNOWN    0x01 // node was seen
+  #define NODE_ONLINE   0x02 // node is reachable in mesh
+  #define NODE_ON       0x04 // light is on
+  #define NODE_POWER    0x08 // NODE_ON is valid
+  #define NODE_COLOR    0x10 // color is valid
+
+  /** \class TelinkNodeState
+   *  \brief Decoded state of a mesh node.
+   */
+  class TelinkNodeState {
+  public:
+    /** \property uint16_t address
+     *  \brief Node mesh address.
+     */
+    uint16_t address = 0;
+
+    /** \property uint8_t flags
+     *  \brief Combination of NODE_* flags.
+     */
+    uint8_t flags = 0;
+
+    /** \property uint8_t brightness
+     *  \brief Brightness, from 0 to 100.
+     */
+    uint8_t brightness = 0;
+
+    /** \property uint8_t color[5]
+     *  \brief R, G, B, Y and W values.
+     */
+    uint8_t color[5] = {0, 0, 0, 0, 0};
+
+    /** \property uint64_t updated
+     *  \brief Time of last update, in nanoseconds since epoch.
+     */
+    uint64_t updated = 0;
+  };
+
+  /** \class TelinkSharedState
+   *  \brief Table of node states indexed by mesh address, in a POSIX shared memory region.
+   *
+   *  One process creates the region and publishes states; any number of processes open it
+   *  read-only. Each record is guarded by a sequence lock: the writer makes the sequence odd
+   *  while it updates a record, and readers retry until they copy a record with the same even
+   *  sequence before and after. Readers never block the writer nor each other.
+   */
+  class TelinkSharedState {
+  private:
+    /** \property unsigned char * region
+     *  \brief Mapped region: header followed by records.
+     */
+    unsigned char * region = nullptr;
+
+    /** \property std::size_t region_size
+     *  \brief Size of mapped region in bytes.
+     */
+    std::size_t region_size = 0;
+
+    /** \property std::size_t capacity
+     *  \brief Number of records; addresses from 0 to capacity-1 can be stored.
+     */
+    std::size_t capacity = 0;
+
+    /** \property bool writable
+     *  \brief true if this process publishes states.
+     */
+    bool writable = false;
+
+    /** \property std::mutex mutex
+     *  \brief Serializes writers within this process.
+     */
+    std::mutex mutex;
+
+    /** \fn bool map(const std::string & name, bool create, std::size_t capacity)
+     *  \brief Opens and maps a region.
+     *  \param name : shared memory object name.
+     *  \param create : true to create the region for writing, false to open it read-only.
+     *  \param capacity : number of records, when creating.
+     *  \returns true on success, false otherwise.
+     */
+    bool map(const std::string & name, bool create, std::size_t capacity);
+
+  public:
+    TelinkSharedState() {}
+
+    TelinkSharedState(const TelinkSharedState &) = delete;
+    TelinkSharedState & operator=(const TelinkSharedState &) = delete;
+
+    ~TelinkSharedState();
+
+    /** \fn bool create(const std::string & name, std::size_t capacity)
+     *  \brief Creates (or reuses) a region to publish states into.
+     *  \param name : shared memory object name, e.g. "/telink_state".
+     *  \param capacity : number of records; node addresses must be below this value.
+     *  \returns true on success, false otherwise.
+     */
+    bool create(const std::string & name, std::size_t capacity = 256);
+
+    /** \fn bool open(const std::string & name)
+     *  \brief Opens an existing region read-only.
+     *  \param name : shared memory object name.
+     *  \returns true on success, false otherwise.
+     */
+    bool open(const std::string & name);
+
+    /** \fn void close()
+     *  \brief Unmaps the region. The region itself persists until removed.
+     */
+    void close();
+
+    /** \fn static bool remove(const std::string & name)
+     *  \brief Removes a region; processes having it mapped keep their mapping.
+     *  \param name : shared memory object name.
+     *  \returns true on success, false otherwise.
+     */
+    static bool remove(const std::string & name);
+
+    /** \fn void update(int address, const std::function<void(TelinkNodeState &)> & modifier)
+     *  \brief Modifies the state of a node and sets its update time. Ignored if the region is read-only
+     *  or the address is out of range.
+     *  \param address : node mesh address.
+     *  \param modifier : function changing the state.
+     */
+    void update(int address, const std::function<void(TelinkNodeState &)> & modifier);
+
+    /** \fn bool read(int address, TelinkNodeState & state) const
+     *  \brief Reads a consistent copy of the state of a node, without locking.
+     *  \param address : node mesh address.
+     *  \param state : node state (output).
+     *  \returns true if the node is known, false otherwise or if no consistent copy was obtained
+     *  within SHARED_STATE_MAX_RETRIES attempts.
+     */
+    bool read(int address, TelinkNodeState & state) const;
+
+    /** \fn std::vector<TelinkNodeState> snapshot() const
+     *  \brief Reads states of all known nodes, without locking. Each state is consistent by itself.
+     *  \returns the node states, by increasing address.
+     */
+    std::vector<TelinkNodeState> snapshot() const;
+
+    /** \fn std::size_t get_capacity() const
+     *  \brief Returns the number of records.
+     *  \returns the number of records, 0 if no region is mapped.
+     */
+    std::size_t get_capacity() const { return this->capacity; }
+  };
+
+}
+
+#endif // __TELINK_SHARED_STATE_H__
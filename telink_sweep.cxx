@@ -0,0 +1,159 @@
+/** \file telink_sweep.cxx
+ *  Pipelined status sweep over many mesh nodes.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <map>
+#include <chrono>
+#include <algorithm>
+
+#include "telink_sweep.h"
+
+namespace telink {
+
+  typedef std::chrono::steady_clock clock;
+
+  TelinkSweep::~TelinkSweep() {
+    if (this->late_listener >= 0)
+      this->mesh.remove_report_listener(this->late_listener);
+  }
+
+  void TelinkSweep::add_latency(double latency) {
+    this->history.push_back(latency);
+    if (this->history.size() > SWEEP_HISTORY)
+      this->history.pop_front();
+  }
+
+  void TelinkSweep::collect_late_replies() {
+    if (this->late_listener < 0) return;
+    this->mesh.remove_report_listener(this->late_listener);
+    this->late_listener = -1;
+    for (auto latency : this->late->latencies)
+      this->add_latency(latency);
+    this->late = nullptr;
+  }
+
+  double TelinkSweep::get_window() const {
+    if (this->history.empty())
+      return this->max_window;
+    std::vector<double> latencies(this->history.begin(), this->history.end());
+    std::size_t rank = std::min(latencies.size() - 1, static_cast<std::size_t>(this->percentile * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+    return std::min(this->max_window, std::max(this->min_window, latencies[rank] * this->margin));
+  }
+
+  void TelinkSweep::set_window_bounds(double min_window, double max_window) {
+    this->min_window = min_window;
+    this->max_window = std::max(min_window, max_window);
+  }
+
+  void TelinkSweep::set_percentile(double percentile, double margin) {
+    this->percentile = std::min(1.0, std::max(0.0, percentile));
+    this->margin = std::max(1.0, margin);
+  }
+
+  TelinkSweepResult TelinkSweep::run(const std::vector<int> & addresses) {
+    this->collect_late_replies();
+    TelinkSweepResult result;
+    bool broadcast = addresses.size() == 1 && addresses[0] == MESH_BROADCAST;
+    std::map<int, std::size_t> indices;
+    if (!broadcast) {
+      for (auto & address : addresses) {
+        if (indices.count(address & 0xff)) continue; // reports carry one-byte addresses
+        indices[address & 0xff] = result.entries.size();
+        TelinkSweepEntry entry;
+        entry.address = address;
+        result.entries.push_back(entry);
+      }
+    }
+    if (!broadcast && result.entries.empty())
+      return result;
+    std::size_t remaining = result.entries.size();
+    std::size_t count = broadcast ? 1 : result.entries.size();
+    std::vector<clock::time_point> sent(count, clock::now());
+    // the listener may append to entries while queries are written
+    std::vector<uint16_t> destinations;
+    for (std::size_t i=0; i<count; i++)
+      destinations.push_back(broadcast ? MESH_BROADCAST : result.entries[i].address);
+
+    std::mutex mutex;
+    std::condition_variable done;
+    clock::time_point start = clock::now();
+    int listener = this->mesh.add_report_listener([&](const std::string & packet) {
+      if (static_cast<unsigned char>(packet[7]) != TelinkStatusQuery::report) return;
+      clock::time_point now = clock::now();
+      int address = static_cast<unsigned char>(packet[3]);
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = indices.find(address);
+      if (it == indices.end()) {
+        // broadcast replies and unexpected responders
+        indices[address] = result.entries.size();
+        TelinkSweepEntry entry;
+        entry.address = address;
+        result.entries.push_back(entry);
+        it = indices.find(address);
+        remaining++;
+      }
+      TelinkSweepEntry & entry = result.entries[it->second];
+      if (entry.responded) return;
+      clock::time_point query = it->second < sent.size() ? sent[it->second] : sent[0];
+      entry.responded = true;
+      entry.latency = std::chrono::duration<double, std::milli>(now - query).count();
+      entry.brightness = TelinkStatusReport::brightness::load(packet);
+      entry.color[0] = TelinkStatusReport::red::load(packet);
+      entry.color[1] = TelinkStatusReport::green::load(packet);
+      entry.color[2] = TelinkStatusReport::blue::load(packet);
+      entry.color[3] = TelinkStatusReport::yellow::load(packet);
+      entry.color[4] = TelinkStatusReport::white::load(packet);
+      if (--remaining == 0 && !broadcast)
+        done.notify_one();
+    });
+
+    // write all queries without waiting for replies
+    const TelinkStatusQuery::payload query = TelinkStatusQuery::encode();
+    for (std::size_t i=0; i<count; i++) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        sent[i] = clock::now();
+      }
+      if (this->mesh.send_packets(TelinkStatusQuery::opcode, &destinations[i], query.data(), query.size(), 1) == 0)
+        break;
+    }
+
+    result.window = this->get_window();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(result.window));
+      done.wait_until(lock, deadline, [&]() { return !broadcast && remaining == 0; });
+    }
+    this->mesh.remove_report_listener(listener);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<LateReplies> late(new LateReplies());
+    for (std::size_t i=0; i<result.entries.size(); i++) {
+      TelinkSweepEntry & entry = result.entries[i];
+      if (entry.responded) {
+        result.responded++;
+        this->add_latency(entry.latency);
+      } else if (i < count) {
+        // only a reply after the window tells that it was too short: keep timing the query
+        late->pending[entry.address & 0xff] = sent[i];
+      }
+    }
+    if (!late->pending.empty()) {
+      this->late = late;
+      this->late_listener = this->mesh.add_report_listener([late](const std::string & packet) {
+        if (static_cast<unsigned char>(packet[7]) != TelinkStatusQuery::report) return;
+        clock::time_point now = clock::now();
+        std::lock_guard<std::mutex> lock(late->mutex);
+        auto it = late->pending.find(static_cast<unsigned char>(packet[3]));
+        if (it == late->pending.end()) return;
+        late->latencies.push_back(std::chrono::duration<double, std::milli>(now - it->second).count());
+        late->pending.erase(it);
+      });
+    }
+    result.duration = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    return result;
+  }
+
+}
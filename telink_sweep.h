@@ -0,0 +1,213 @@
+/** \file telink_sweep.h
+ *  Pipelined status sweep over many mesh nodes.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_SWEEP_H__
+#define __TELINK_SWEEP_H__
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "telink_light.h"
+
+namespace telink {
+
+  /** \brief Mesh address targeting all nodes. */
+  #define MESH_BROADCAST 0xffff
+  /** \brief Number of latencies kept to estimate the collection window. */
+  #define SWEEP_HISTORY 256
+
+  /** \class TelinkSweepEntry
+   *  \brief Status of a node collected by a sweep.
+   */
+  class TelinkSweepEntry {
+  public:
+    /** \property int address
+     *  \brief Node mesh address.
+     */
+    int address = 0;
+
+    /** \property bool responded
+     *  \brief true if the node replied within the collection window.
+     */
+    bool responded = false;
+
+    /** \property double latency
+     *  \brief Time between query and reply, in milliseconds.
+     */
+    double latency = 0;
+
+    /** \property unsigned char brightness
+     *  \brief Brightness, from 0 to 100.
+     */
+    unsigned char brightness = 0;
+
+    /** \property unsigned char color[5]
+     *  \brief R, G, B, Y and W values.
+     */
+    unsigned char color[5] = {0, 0, 0, 0, 0};
+  };
+
+  /** \class TelinkSweepResult
+   *  \brief Result of a sweep.
+   */
+  class TelinkSweepResult {
+  public:
+    /** \property std::vector<TelinkSweepEntry> entries
+     *  \brief Queried nodes, in query order, followed by unexpected responders.
+     */
+    std::vector<TelinkSweepEntry> entries;
+
+    /** \property int responded
+     *  \brief Number of nodes that replied.
+     */
+    int responded = 0;
+
+    /** \property double window
+     *  \brief Collection window used after the last query, in milliseconds.
+     */
+    double window = 0;
+
+    /** \property double duration
+     *  \brief Total sweep duration, in milliseconds.
+     */
+    double duration = 0;
+  };
+
+  /** \class TelinkSweep
+   *  \brief Queries the status of many nodes through one connection.
+   *
+   *  All queries are written back to back, and replies are collected while writing. After the
+   *  last query, the sweep waits until all nodes replied or the collection window elapsed. The
+   *  window is derived from a percentile of latencies observed in previous sweeps, so that a
+   *  sweep takes about one round trip plus transmit time instead of one timeout per node.
+   *  Replies arriving after the window closed are still timed until the next sweep, and widen
+   *  the window; nodes that do not reply at all (e.g. switched off) leave it unchanged.
+   */
+  class TelinkSweep {
+  private:
+    /** \class LateReplies
+     *  \brief Queries of the last sweep still waiting for a reply after its window closed.
+     */
+    class LateReplies {
+    public:
+      /** \property std::mutex mutex
+       *  \brief Protects pending and latencies.
+       */
+      std::mutex mutex;
+
+      /** \property std::map<int, std::chrono::steady_clock::time_point> pending
+       *  \brief Time of query, by one-byte node address.
+       */
+      std::map<int, std::chrono::steady_clock::time_point> pending;
+
+      /** \property std::vector<double> latencies
+       *  \brief Latencies of late replies, in milliseconds.
+       */
+      std::vector<double> latencies;
+    };
+
+    /** \property TelinkMesh & mesh
+     *  \brief Connection used to send queries.
+     */
+    TelinkMesh & mesh;
+
+    /** \property std::deque<double> history
+     *  \brief Latencies of recent replies, in milliseconds, including late ones.
+     */
+    std::deque<double> history;
+
+    /** \property std::shared_ptr<LateReplies> late
+     *  \brief Queries of the last sweep not answered within its window.
+     */
+    std::shared_ptr<LateReplies> late;
+
+    /** \property int late_listener
+     *  \brief ID of the report listener timing late replies, or -1.
+     */
+    int late_listener = -1;
+
+    /** \fn void collect_late_replies()
+     *  \brief Stops timing late replies of the last sweep and adds their latencies to history.
+     */
+    void collect_late_replies();
+
+    /** \fn void add_latency(double latency)
+     *  \brief Adds a latency to history, dropping the oldest one if full.
+     *  \param latency : latency in milliseconds.
+     */
+    void add_latency(double latency);
+
+    /** \property double percentile
+     *  \brief Latency percentile used for the collection window, from 0 to 1.
+     */
+    double percentile = 0.95;
+
+    /** \property double margin
+     *  \brief Factor applied to the latency percentile.
+     */
+    double margin = 1.5;
+
+    /** \property double min_window
+     *  \brief Lower bound of the collection window, in milliseconds.
+     */
+    double min_window = 50;
+
+    /** \property double max_window
+     *  \brief Upper bound of the collection window, and window used without history, in milliseconds.
+     */
+    double max_window = 2000;
+
+  public:
+    /** \fn TelinkSweep(TelinkMesh & mesh)
+     *  \brief Object instantiation.
+     *  \param mesh : connection used to send queries.
+     */
+    TelinkSweep(TelinkMesh & mesh) : mesh(mesh) {}
+
+    TelinkSweep(const TelinkSweep &) = delete;
+    TelinkSweep & operator=(const TelinkSweep &) = delete;
+
+    /** \fn ~TelinkSweep()
+     *  \brief Stops timing late replies.
+     */
+    ~TelinkSweep();
+
+    /** \fn TelinkSweepResult run(const std::vector<int> & addresses)
+     *  \brief Queries the status of given nodes.
+     *  \param addresses : node mesh addresses; a single MESH_BROADCAST address collects replies from all nodes until the window elapses.
+     *  \returns the collected statuses.
+     */
+    TelinkSweepResult run(const std::vector<int> & addresses);
+
+    /** \fn double get_window() const
+     *  \brief Returns the collection window the next sweep will use.
+     *  \returns the window in milliseconds.
+     */
+    double get_window() const;
+
+    /** \fn void set_window_bounds(double min_window, double max_window)
+     *  \brief Sets bounds of the collection window.
+     *  \param min_window : lower bound, in milliseconds.
+     *  \param max_window : upper bound, in milliseconds.
+     */
+    void set_window_bounds(double min_window, double max_window);
+
+    /** \fn void set_percentile(double percentile, double margin)
+     *  \brief Sets how the collection window is derived from observed latencies.
+     *  \param percentile : latency percentile, from 0 to 1.
+     *  \param margin : factor applied to the percentile.
+     */
+    void set_percentile(double percentile, double margin);
+  };
+
+}
+
+#endif // __TELINK_SWEEP_H__
@@ -0,0 +1,140 @@
+/** \file telink_timeline.cxx
+ *  Per-packet stage timing, exported as Chrome trace events.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "telink_timeline.h"
+
+namespace telink {
+
+  static_assert(sizeof(TelinkSpan) == 32, "unexpected span size");
+
+  /** \brief Instance IDs; 0 is never used so that empty thread-local slots match nothing. */
+  static std::atomic<uint64_t> next_timeline_id(1);
+
+  /** \brief Names of SPAN_* stages in exported traces. */
+  static const char * stage_names[] = {"queue", "build", "encrypt", "write", "connect", "decrypt", "report"};
+
+  TelinkTimeline::TelinkTimeline(std::size_t capacity) : id(next_timeline_id++), capacity(std::max<std::size_t>(capacity, 1)), enabled(true) {
+  }
+
+  uint64_t TelinkTimeline::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  TelinkTimeline::Ring * TelinkTimeline::get_ring() {
+    // last ring used by this thread, valid while it was for this timeline
+    static thread_local uint64_t ring_owner = 0;
+    static thread_local Ring * ring = nullptr;
+    if (ring_owner == this->id)
+      return ring;
+
+    uint32_t thread = syscall(SYS_gettid);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = std::find_if(this->rings.begin(), this->rings.end(), [thread](const std::unique_ptr<Ring> & r) {
+      return r->thread == thread;
+    });
+    if (it == this->rings.end()) {
+      this->rings.emplace_back(new Ring(thread, this->capacity));
+      it = this->rings.end() - 1;
+      char name[16] = {0};
+      if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+        (*it)->name = name;
+    }
+    ring_owner = this->id;
+    ring = it->get();
+    return ring;
+  }
+
+  void TelinkTimeline::record(uint8_t stage, uint64_t start, uint64_t end, uint16_t packet, uint16_t node, uint8_t opcode, uint16_t count) {
+    if (!this->is_enabled()) return;
+    Ring * ring = this->get_ring();
+    uint64_t index = ring->written.load(std::memory_order_relaxed);
+    TelinkSpan & span = ring->spans[index % this->capacity];
+    span.start = start;
+    span.end = end;
+    span.thread = ring->thread;
+    span.packet = packet;
+    span.node = node;
+    span.stage = stage;
+    span.opcode = opcode;
+    span.count = count;
+    ring->written.store(index + 1, std::memory_order_release);
+  }
+
+  std::vector<TelinkSpan> TelinkTimeline::get_spans() const {
+    std::vector<TelinkSpan> spans;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto & ring : this->rings) {
+      uint64_t written = ring->written.load(std::memory_order_acquire);
+      uint64_t first = written > this->capacity ? written - this->capacity : 0;
+      std::size_t offset = spans.size();
+      for (uint64_t i=first; i<written; i++)
+        spans.push_back(ring->spans[i % this->capacity]);
+      // slots reused by the recording thread meanwhile may be torn: drop them, including the
+      // one it may be writing now (index rewritten)
+      uint64_t rewritten = ring->written.load(std::memory_order_acquire);
+      if (rewritten + 1 > first + this->capacity) {
+        std::size_t stale = std::min<uint64_t>(rewritten + 1 - first - this->capacity, written - first);
+        spans.erase(spans.begin() + offset, spans.begin() + offset + stale);
+      }
+    }
+    std::sort(spans.begin(), spans.end(), [](const TelinkSpan & a, const TelinkSpan & b) { return a.start < b.start; });
+    return spans;
+  }
+
+  bool TelinkTimeline::export_chrome(const std::string & path) const {
+    std::vector<TelinkSpan> spans = this->get_spans();
+    FILE * f = std::fopen(path.c_str(), "w");
+    if (f == nullptr) {
+      std::cerr << "Cannot write timeline file " << path << std::endl;
+      return false;
+    }
+
+    /* complete events ("X") with microsecond times, plus thread name metadata */
+    int pid = getpid();
+    bool first = true;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      for (auto & ring : this->rings) {
+        if (ring->name.empty()) continue;
+        std::string name;
+        for (auto c : ring->name) {
+          if (c == '"' || c == '\\') name.push_back('\\');
+          if (static_cast<unsigned char>(c) >= 0x20) name.push_back(c);
+        }
+        std::fprintf(f, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                     first ? "" : ",", pid, ring->thread, name.c_str());
+        first = false;
+      }
+    }
+    for (auto & span : spans) {
+      const char * name = span.stage < sizeof(stage_names)/sizeof(stage_names[0]) ? stage_names[span.stage] : "unknown";
+      uint64_t duration = span.end > span.start ? span.end - span.start : 0;
+      std::fprintf(f, "%s\n{\"ph\":\"X\",\"cat\":\"telink\",\"name\":\"%s\",\"pid\":%d,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+                   "\"args\":{\"packet\":%u,\"node\":%u,\"opcode\":%u,\"count\":%u}}",
+                   first ? "" : ",", name, pid, span.thread,
+                   static_cast<unsigned long long>(span.start / 1000), static_cast<unsigned>(span.start % 1000),
+                   static_cast<unsigned long long>(duration / 1000), static_cast<unsigned>(duration % 1000),
+                   span.packet, span.node, span.opcode, span.count);
+      first = false;
+    }
+    std::fprintf(f, "\n]}\n");
+    if (std::fclose(f) != 0) {
+      std::cerr << "Cannot write timeline file " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,272 @@
+/** \file telink_timeline.h
+ *  Per-packet stage timing, exported as Chrome trace events.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_TIMELINE_H__
+#define __TELINK_TIMELINE_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace telink {
+
+  // Packet lifecycle stages
+  #define SPAN_QUEUE     0 // waiting in a command queue
+  #define SPAN_BUILD     1 // packet layout
+  #define SPAN_ENCRYPT   2 // packet encryption
+  #define SPAN_WRITE     3 // write to device (D-Bus call, write channel or ATT socket)
+  #define SPAN_CONNECT   4 // reconnection before a write
+  #define SPAN_DECRYPT   5 // notification decryption
+  #define SPAN_REPORT    6 // report handling (listeners and parsers)
+
+  /** \class TelinkSpan
+   *  \brief Time spent by one or several packets in a stage (32 bytes).
+   */
+  class TelinkSpan {
+  public:
+    /** \property uint64_t start
+     *  \brief Monotonic start time in nanoseconds.
+     */
+    uint64_t start;
+
+    /** \property uint64_t end
+     *  \brief Monotonic end time in nanoseconds.
+     */
+    uint64_t end;
+
+    /** \property uint32_t thread
+     *  \brief ID of the thread the stage ran on.
+     */
+    uint32_t thread;
+
+    /** \property uint16_t packet
+     *  \brief Packet counter of the (first) packet, or 0 if not known yet.
+     */
+    uint16_t packet;
+
+    /** \property uint16_t node
+     *  \brief Destination mesh ID of a command, or source mesh ID of a report; 0 if not known.
+     */
+    uint16_t node;
+
+    /** \property uint8_t stage
+     *  \brief One of the SPAN_* stages.
+     */
+    uint8_t stage;
+
+    /** \property uint8_t opcode
+     *  \brief Command code, or 0 if not known.
+     */
+    uint8_t opcode;
+
+    /** \property uint16_t count
+     *  \brief Number of packets handled together.
+     */
+    uint16_t count;
+
+    /** \property uint8_t reserved[4]
+     *  \brief Padding.
+     */
+    uint8_t reserved[4];
+  };
+
+  /** \class TelinkTimeline
+   *  \brief Records packet stage spans into per-thread rings, for latency analysis.
+   *
+   *  Each recording thread gets its own preallocated ring on first use, so recording takes
+   *  no lock and never allocates afterwards; when a ring is full, its oldest spans are
+   *  overwritten. Spans of a command can be followed from queue to write by packet counter,
+   *  and compared to the reports sent back by the same node to see mesh relay time. The
+   *  export is Chrome trace-event JSON, which chrome://tracing and the Perfetto UI open.
+   */
+  class TelinkTimeline {
+  private:
+    /** \class Ring
+     *  \brief Spans recorded by one thread.
+     */
+    class Ring {
+    public:
+      /** \property uint32_t thread
+       *  \brief ID of the recording thread.
+       */
+      uint32_t thread;
+
+      /** \property std::string name
+       *  \brief Name of the recording thread, when it was first seen.
+       */
+      std::string name;
+
+      /** \property std::vector<TelinkSpan> spans
+       *  \brief Span slots.
+       */
+      std::vector<TelinkSpan> spans;
+
+      /** \property std::atomic<uint64_t> written
+       *  \brief Number of spans recorded so far; only the recording thread increments it.
+       */
+      std::atomic<uint64_t> written;
+
+      Ring(uint32_t thread, std::size_t capacity) : thread(thread), spans(capacity), written(0) {}
+    };
+
+    /** \property uint64_t id
+     *  \brief Unique instance ID, to find per-thread rings from thread-local storage.
+     */
+    uint64_t id;
+
+    /** \property std::size_t capacity
+     *  \brief Number of span slots per thread.
+     */
+    std::size_t capacity;
+
+    /** \property std::atomic<bool> enabled
+     *  \brief true while spans are recorded.
+     */
+    std::atomic<bool> enabled;
+
+    /** \property std::vector<std::unique_ptr<Ring>> rings
+     *  \brief Rings of all threads that recorded spans.
+     */
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    /** \property std::mutex mutex
+     *  \brief Protects the ring list.
+     */
+    mutable std::mutex mutex;
+
+    /** \fn Ring * get_ring()
+     *  \brief Returns the ring of the calling thread, creating it on first use.
+     *  \returns the thread ring.
+     */
+    Ring * get_ring();
+
+  public:
+    /** \fn TelinkTimeline(std::size_t capacity)
+     *  \brief Object instantiation.
+     *  \param capacity : number of spans kept per thread.
+     */
+    TelinkTimeline(std::size_t capacity = 16384);
+
+    TelinkTimeline(const TelinkTimeline &) = delete;
+    TelinkTimeline & operator=(const TelinkTimeline &) = delete;
+
+    /** \fn static uint64_t now()
+     *  \brief Returns the monotonic time used for spans.
+     *  \returns the time in nanoseconds.
+     */
+    static uint64_t now();
+
+    /** \fn void set_enabled(bool enabled)
+     *  \brief Pauses or resumes recording.
+     *  \param enabled : true to record spans.
+     */
+    void set_enabled(bool enabled) { this->enabled.store(enabled, std::memory_order_relaxed); }
+
+    /** \fn bool is_enabled() const
+     *  \brief Tells if spans are recorded.
+     *  \returns true if recording.
+     */
+    bool is_enabled() const { return this->enabled.load(std::memory_order_relaxed); }
+
+    /** \fn void record(uint8_t stage, uint64_t start, uint64_t end, uint16_t packet = 0, uint16_t node = 0, uint8_t opcode = 0, uint16_t count = 1)
+     *  \brief Records a span on the ring of the calling thread.
+     *  \param stage : one of the SPAN_* stages.
+     *  \param start : start time, from now().
+     *  \param end : end time, from now().
+     *  \param packet : packet counter of the (first) packet.
+     *  \param node : destination or source mesh ID.
+     *  \param opcode : command code.
+     *  \param count : number of packets.
+     */
+    void record(uint8_t stage, uint64_t start, uint64_t end, uint16_t packet = 0, uint16_t node = 0, uint8_t opcode = 0, uint16_t count = 1);
+
+    /** \fn std::vector<TelinkSpan> get_spans() const
+     *  \brief Collects the spans of all threads. Spans overwritten while collecting are skipped.
+     *  \returns the spans, sorted by start time.
+     */
+    std::vector<TelinkSpan> get_spans() const;
+
+    /** \fn bool export_chrome(const std::string & path) const
+     *  \brief Writes all spans as a Chrome trace-event JSON file, one track per thread.
+     *  \param path : output file path.
+     *  \returns true on success, false otherwise.
+     */
+    bool export_chrome(const std::string & path) const;
+  };
+
+  /** \class TelinkTimelineScope
+   *  \brief Records a span from construction to destruction. Does nothing, not even reading
+   *  the clock, if the timeline is null or paused.
+   */
+  class TelinkTimelineScope {
+  private:
+    /** \property TelinkTimeline * timeline
+     *  \brief Timeline to record into, or nullptr.
+     */
+    TelinkTimeline * timeline;
+
+    /** \property uint64_t start
+     *  \brief Start time of span.
+     */
+    uint64_t start;
+
+    /** \property uint8_t stage
+     *  \brief Recorded stage.
+     */
+    uint8_t stage;
+
+    /** \property uint16_t count
+     *  \brief Number of packets.
+     */
+    uint16_t count;
+
+  public:
+    /** \property uint16_t packet
+     *  \brief Packet counter; may be set once known, before the scope ends.
+     */
+    uint16_t packet;
+
+    /** \property uint16_t node
+     *  \brief Destination or source mesh ID; may be set before the scope ends.
+     */
+    uint16_t node;
+
+    /** \property uint8_t opcode
+     *  \brief Command code; may be set before the scope ends.
+     */
+    uint8_t opcode;
+
+    /** \fn TelinkTimelineScope(TelinkTimeline * timeline, uint8_t stage, uint16_t packet = 0, uint16_t node = 0, uint8_t opcode = 0, uint16_t count = 1)
+     *  \brief Starts a span.
+     *  \param timeline : timeline, or nullptr to record nothing.
+     *  \param stage : one of the SPAN_* stages.
+     *  \param packet : packet counter of the (first) packet.
+     *  \param node : destination or source mesh ID.
+     *  \param opcode : command code.
+     *  \param count : number of packets.
+     */
+    TelinkTimelineScope(TelinkTimeline * timeline, uint8_t stage, uint16_t packet = 0, uint16_t node = 0, uint8_t opcode = 0, uint16_t count = 1)
+      : timeline(timeline != nullptr && timeline->is_enabled() ? timeline : nullptr), start(0), stage(stage), count(count),
+        packet(packet), node(node), opcode(opcode) {
+      if (this->timeline != nullptr)
+        this->start = TelinkTimeline::now();
+    }
+
+    TelinkTimelineScope(const TelinkTimelineScope &) = delete;
+    TelinkTimelineScope & operator=(const TelinkTimelineScope &) = delete;
+
+    ~TelinkTimelineScope() {
+      if (this->timeline != nullptr)
+        this->timeline->record(this->stage, this->start, TelinkTimeline::now(), this->packet, this->node, this->opcode, this->count);
+    }
+  };
+
+}
+
+#endif // __TELINK_TIMELINE_H__
@@ -0,0 +1,151 @@
+/** \file telink_trace.cxx
+ *  Binary packet trace recording for Telink mesh sessions.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "telink_trace.h"
+
+namespace telink {
+
+  /* Trace file layout (host byte order):
+       bytes 0-7   : magic "TLKTRACE"
+       bytes 8-11  : format version
+       bytes 12-15 : record size
+       bytes 16-23 : capacity (number of record slots)
+       bytes 24-31 : reserved
+       bytes 32-   : record slots; chronological order is given by record sequence numbers
+  */
+  #define TRACE_HEADER_SIZE 32
+
+  static_assert(sizeof(TelinkTraceRecord) == 56, "unexpected trace record size");
+
+  /** \fn static void write_header(unsigned char * storage, std::size_t capacity)
+   *  \brief Writes a trace file header.
+   *  \param storage : trace storage.
+   *  \param capacity : number of record slots.
+   */
+  static void write_header(unsigned char * storage, std::size_t capacity) {
+    uint32_t version = TRACE_VERSION, record_size = sizeof(TelinkTraceRecord);
+    uint64_t slots = capacity;
+    std::memset(storage, 0, TRACE_HEADER_SIZE);
+    std::memcpy(storage, TRACE_MAGIC, 8);
+    std::memcpy(storage + 8, &version, 4);
+    std::memcpy(storage + 12, &record_size, 4);
+    std::memcpy(storage + 16, &slots, 8);
+  }
+
+  TelinkTrace::TelinkTrace(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)), sequence(1) {
+    this->storage = static_cast<unsigned char*>(std::calloc(1, this->storage_size()));
+    write_header(this->storage, this->capacity);
+  }
+
+  TelinkTrace::~TelinkTrace() {
+    this->release();
+  }
+
+  std::size_t TelinkTrace::storage_size() const {
+    return TRACE_HEADER_SIZE + this->capacity * sizeof(TelinkTraceRecord);
+  }
+
+  void TelinkTrace::release() {
+    if (this->storage == nullptr) return;
+    if (this->mapped)
+      munmap(this->storage, this->storage_size());
+    else
+      std::free(this->storage);
+    this->storage = nullptr;
+  }
+
+  bool TelinkTrace::map_file(const std::string & path) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      std::cerr << "Cannot open trace file " << path << std::endl;
+      return false;
+    }
+    if (ftruncate(fd, this->storage_size()) != 0) {
+      std::cerr << "Cannot allocate trace file " << path << std::endl;
+      close(fd);
+      return false;
+    }
+    void * region = mmap(nullptr, this->storage_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+      std::cerr << "Cannot map trace file " << path << std::endl;
+      return false;
+    }
+    this->release();
+    this->storage = static_cast<unsigned char*>(region);
+    this->mapped = true;
+    this->sequence = 1;
+    write_header(this->storage, this->capacity);
+    return true;
+  }
+
+  void TelinkTrace::record(uint8_t direction, const std::string & plain, const std::string & cipher) {
+    TelinkTraceRecord rec;
+    std::memset(&rec, 0, sizeof(rec));
+    rec.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    rec.sequence = this->sequence.fetch_add(1, std::memory_order_relaxed);
+    rec.direction = direction;
+    rec.opcode = plain.size() > 7 ? plain[7] : 0;
+    rec.length = std::min<std::size_t>(std::max(plain.size(), cipher.size()), sizeof(rec.plain));
+    std::memcpy(rec.plain, plain.data(), std::min(plain.size(), sizeof(rec.plain)));
+    std::memcpy(rec.cipher, cipher.data(), std::min(cipher.size(), sizeof(rec.cipher)));
+    std::size_t slot = (rec.sequence - 1) % this->capacity;
+    std::memcpy(this->storage + TRACE_HEADER_SIZE + slot*sizeof(TelinkTraceRecord), &rec, sizeof(rec));
+  }
+
+  bool TelinkTrace::save(const std::string & path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      std::cerr << "Cannot write trace file " << path << std::endl;
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(this->storage), this->storage_size());
+    return static_cast<bool>(out);
+  }
+
+  std::vector<TelinkTraceRecord> TelinkTrace::load(const std::string & path) {
+    std::vector<TelinkTraceRecord> records;
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint32_t version, record_size;
+    uint64_t slots;
+    if (data.size() < TRACE_HEADER_SIZE || std::memcmp(data.data(), TRACE_MAGIC, 8) != 0) {
+      std::cerr << "Invalid trace file " << path << std::endl;
+      return records;
+    }
+    std::memcpy(&version, data.data() + 8, 4);
+    std::memcpy(&record_size, data.data() + 12, 4);
+    std::memcpy(&slots, data.data() + 16, 8);
+    if (version != TRACE_VERSION || record_size != sizeof(TelinkTraceRecord)) {
+      std::cerr << "Unsupported trace file version in " << path << std::endl;
+      return records;
+    }
+    slots = std::min<uint64_t>(slots, (data.size() - TRACE_HEADER_SIZE) / record_size);
+    records.reserve(slots);
+    for (uint64_t i=0; i<slots; i++) {
+      TelinkTraceRecord rec;
+      std::memcpy(&rec, data.data() + TRACE_HEADER_SIZE + i*record_size, record_size);
+      if (rec.sequence != 0)
+        records.push_back(rec);
+    }
+    std::sort(records.begin(), records.end(), [](const TelinkTraceRecord & a, const TelinkTraceRecord & b) {
+      return a.sequence < b.sequence;
+    });
+    return records;
+  }
+
+}
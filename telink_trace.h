@@ -0,0 +1,154 @@
+/** \file telink_trace.h
+ *  Binary packet trace recording for Telink mesh sessions.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_TRACE_H__
+#define __TELINK_TRACE_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+namespace telink {
+
+  // Trace record directions
+  #define TRACE_TX 0x01
+  #define TRACE_RX 0x02
+
+  /** \brief Magic bytes at the beginning of a trace file. */
+  #define TRACE_MAGIC "TLKTRACE"
+  /** \brief Trace file format version. */
+  #define TRACE_VERSION 1
+
+  /** \class TelinkTraceRecord
+   *  \brief A traced packet. Records are stored as-is in trace files (56 bytes, little-endian host).
+   */
+  class TelinkTraceRecord {
+  public:
+    /** \property uint64_t timestamp
+     *  \brief Monotonic timestamp in nanoseconds.
+     */
+    uint64_t timestamp;
+
+    /** \property uint32_t sequence
+     *  \brief Record sequence number, starting at 1; 0 marks an empty slot.
+     */
+    uint32_t sequence;
+
+    /** \property uint8_t direction
+     *  \brief TRACE_TX or TRACE_RX.
+     */
+    uint8_t direction;
+
+    /** \property uint8_t opcode
+     *  \brief Command code of the packet (byte 7 of plaintext).
+     */
+    uint8_t opcode;
+
+    /** \property uint8_t length
+     *  \brief Packet length in bytes (at most 20).
+     */
+    uint8_t length;
+
+    /** \property uint8_t reserved
+     *  \brief Padding.
+     */
+    uint8_t reserved;
+
+    /** \property uint8_t plain[20]
+     *  \brief Decrypted packet.
+     */
+    uint8_t plain[20];
+
+    /** \property uint8_t cipher[20]
+     *  \brief Encrypted packet, as on air.
+     */
+    uint8_t cipher[20];
+  };
+
+  /** \class TelinkTrace
+   *  \brief Preallocated ring of packet records, kept in memory or in a memory-mapped file.
+   *  Recording is lock-free and safe from several threads; when the ring is full, oldest
+   *  records are overwritten. A trace kept in a mapped file survives a crash of the process.
+   */
+  class TelinkTrace {
+  private:
+    /** \property unsigned char * storage
+     *  \brief Header followed by record slots.
+     */
+    unsigned char * storage = nullptr;
+
+    /** \property std::size_t capacity
+     *  \brief Number of record slots.
+     */
+    std::size_t capacity;
+
+    /** \property bool mapped
+     *  \brief true if storage is a memory-mapped file.
+     */
+    bool mapped = false;
+
+    /** \property std::atomic<uint32_t> sequence
+     *  \brief Next record sequence number.
+     */
+    std::atomic<uint32_t> sequence;
+
+    /** \fn std::size_t storage_size() const
+     *  \brief Returns the size of header and record slots.
+     *  \returns the storage size in bytes.
+     */
+    std::size_t storage_size() const;
+
+    /** \fn void release()
+     *  \brief Frees or unmaps storage.
+     */
+    void release();
+
+  public:
+    /** \fn TelinkTrace(std::size_t capacity)
+     *  \brief Object instantiation. Allocates an in-memory ring.
+     *  \param capacity : number of records kept.
+     */
+    TelinkTrace(std::size_t capacity = 65536);
+
+    TelinkTrace(const TelinkTrace &) = delete;
+    TelinkTrace & operator=(const TelinkTrace &) = delete;
+
+    ~TelinkTrace();
+
+    /** \fn bool map_file(const std::string & path)
+     *  \brief Moves the ring into a memory-mapped file; subsequent records are written straight to it.
+     *  The file is created or truncated. Records already in memory are discarded.
+     *  \param path : trace file path.
+     *  \returns true on success, false otherwise (the in-memory ring is kept).
+     */
+    bool map_file(const std::string & path);
+
+    /** \fn void record(uint8_t direction, const std::string & plain, const std::string & cipher)
+     *  \brief Records a packet.
+     *  \param direction : TRACE_TX or TRACE_RX.
+     *  \param plain : decrypted packet.
+     *  \param cipher : encrypted packet.
+     */
+    void record(uint8_t direction, const std::string & plain, const std::string & cipher);
+
+    /** \fn bool save(const std::string & path) const
+     *  \brief Writes the ring to a trace file. Should be called while no packet is being recorded.
+     *  \param path : trace file path.
+     *  \returns true on success, false otherwise.
+     */
+    bool save(const std::string & path) const;
+
+    /** \fn static std::vector<TelinkTraceRecord> load(const std::string & path)
+     *  \brief Reads a trace file.
+     *  \param path : trace file path.
+     *  \returns the records in chronological order; empty if the file is invalid.
+     */
+    static std::vector<TelinkTraceRecord> load(const std::string & path);
+  };
+
+}
+
+#endif // __TELINK_TRACE_H__
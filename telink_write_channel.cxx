@@ -0,0 +1,125 @@
+/** \file telink_write_channel.cxx
+ *  Write-without-response channel to a GATT characteristic, acquired from BlueZ.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#include <vector>
+#include <iostream>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+
+#include "telink_write_channel.h"
+
+namespace telink {
+
+  TelinkWriteChannel::~TelinkWriteChannel() {
+    this->release();
+  }
+
+  bool TelinkWriteChannel::acquire(const std::string & object_path) {
+    this->release();
+    GError * error = nullptr;
+    GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &error);
+    if (bus == nullptr) {
+      std::cerr << "Cannot connect to system bus: " << error->message << std::endl;
+      g_error_free(error);
+      return false;
+    }
+
+    /* AcquireWrite(a{sv} options) -> (h fd, q mtu) */
+    GVariantBuilder options;
+    g_variant_builder_init(&options, G_VARIANT_TYPE("a{sv}"));
+    GUnixFDList * fd_list = nullptr;
+    GVariant * reply = g_dbus_connection_call_with_unix_fd_list_sync(bus, "org.bluez", object_path.c_str(),
+      "org.bluez.GattCharacteristic1", "AcquireWrite", g_variant_new("(a{sv})", &options), G_VARIANT_TYPE("(hq)"),
+      G_DBUS_CALL_FLAGS_NONE, -1, nullptr, &fd_list, nullptr, &error);
+    g_object_unref(bus);
+    if (reply == nullptr) {
+      std::cerr << "Cannot acquire write channel for " << object_path << ": " << error->message << std::endl;
+      g_error_free(error);
+      return false;
+    }
+
+    gint32 index = 0;
+    guint16 mtu = 0;
+    g_variant_get(reply, "(hq)", &index, &mtu);
+    g_variant_unref(reply);
+    int fd = fd_list != nullptr ? g_unix_fd_list_get(fd_list, index, &error) : -1;
+    if (fd_list != nullptr)
+      g_object_unref(fd_list);
+    if (fd < 0) {
+      if (error != nullptr) {
+        std::cerr << "Cannot get write channel descriptor: " << error->message << std::endl;
+        g_error_free(error);
+      }
+      return false;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    this->fd = fd;
+    this->mtu = mtu;
+    return true;
+  }
+
+  void TelinkWriteChannel::release() {
+    if (this->fd >= 0)
+      close(this->fd);
+    this->fd = -1;
+    this->mtu = 0;
+  }
+
+  std::size_t TelinkWriteChannel::write(const unsigned char * packets, std::size_t size, std::size_t count) {
+    if (this->fd < 0 || count == 0) return 0;
+    if (size > this->mtu) {
+      std::cerr << "Packet size " << size << " exceeds write channel MTU " << this->mtu << std::endl;
+      return 0;
+    }
+
+    /* one datagram per packet, handed to the kernel in as few calls as the buffer allows */
+    std::vector<struct iovec> iov(count);
+    std::vector<struct mmsghdr> messages(count);
+    for (std::size_t i=0; i<count; i++) {
+      iov[i].iov_base = const_cast<unsigned char*>(packets + i*size);
+      iov[i].iov_len = size;
+      messages[i] = {};
+      messages[i].msg_hdr.msg_iov = &iov[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::size_t written = 0;
+    while (written < count) {
+      int n = sendmmsg(this->fd, &messages[written], count - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n > 0) {
+        written += n;
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+        // buffer is full: wait until bluetoothd forwarded earlier packets
+        struct pollfd pfd = {this->fd, POLLOUT, 0};
+        int ready = poll(&pfd, 1, this->timeout);
+        if (ready < 0 && errno == EINTR)
+          continue;
+        if (ready > 0 && !(pfd.revents & (POLLERR | POLLHUP)))
+          continue;
+        if (ready == 0) {
+          std::cerr << "Write channel stalled, " << count - written << " packets not sent" << std::endl;
+          break;
+        }
+      }
+      std::cerr << "Write channel closed" << std::endl;
+      this->release();
+      break;
+    }
+    return written;
+  }
+
+}
@@ -0,0 +1,92 @@
+/** \file telink_write_channel.h
+ *  Write-without-response channel to a GATT characteristic, acquired from BlueZ.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#ifndef __TELINK_WRITE_CHANNEL_H__
+#define __TELINK_WRITE_CHANNEL_H__
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace telink {
+
+  /** \brief Default time to wait for buffer space, in milliseconds. */
+  #define WRITE_CHANNEL_TIMEOUT 1000
+
+  /** \class TelinkWriteChannel
+   *  \brief Socket to a GATT characteristic obtained with BlueZ AcquireWrite.
+   *
+   *  Each datagram written to the socket is sent by bluetoothd as an ATT write command, which
+   *  is not acknowledged, so several packets can go out in one connection event. Flow control
+   *  comes from the socket buffer: when it is full, writing waits until bluetoothd has
+   *  forwarded earlier packets to the controller.
+   */
+  class TelinkWriteChannel {
+  private:
+    /** \property int fd
+     *  \brief Socket descriptor, or -1 if closed.
+     */
+    int fd = -1;
+
+    /** \property uint16_t mtu
+     *  \brief Largest write size accepted by the channel.
+     */
+    uint16_t mtu = 0;
+
+    /** \property int timeout
+     *  \brief Time to wait for buffer space, in milliseconds.
+     */
+    int timeout = WRITE_CHANNEL_TIMEOUT;
+
+  public:
+    TelinkWriteChannel() {}
+    TelinkWriteChannel(const TelinkWriteChannel &) = delete;
+    TelinkWriteChannel & operator=(const TelinkWriteChannel &) = delete;
+    ~TelinkWriteChannel();
+
+    /** \fn bool acquire(const std::string & object_path)
+     *  \brief Acquires a write channel from BlueZ.
+     *  \param object_path : D-Bus object path of the GATT characteristic.
+     *  \returns true on success.
+     */
+    bool acquire(const std::string & object_path);
+
+    /** \fn void release()
+     *  \brief Closes the channel.
+     */
+    void release();
+
+    /** \fn bool is_open() const
+     *  \brief Tells if the channel can be written to.
+     *  \returns true if open.
+     */
+    bool is_open() const { return this->fd >= 0; }
+
+    /** \fn uint16_t get_mtu() const
+     *  \brief Returns the largest write size accepted by the channel.
+     *  \returns the size in bytes.
+     */
+    uint16_t get_mtu() const { return this->mtu; }
+
+    /** \fn void set_timeout(int timeout)
+     *  \brief Sets the time to wait for buffer space before giving up.
+     *  \param timeout : time in milliseconds.
+     */
+    void set_timeout(int timeout) { this->timeout = timeout; }
+
+    /** \fn std::size_t write(const unsigned char * packets, std::size_t size, std::size_t count)
+     *  \brief Writes packets, waiting for buffer space as needed. The channel is closed if
+     *  the link is lost.
+     *  \param packets : count x size bytes.
+     *  \param size : size of a packet.
+     *  \param count : number of packets.
+     *  \returns the number of packets written.
+     */
+    std::size_t write(const unsigned char * packets, std::size_t size, std::size_t count);
+  };
+
+}
+
+#endif // __TELINK_WRITE_CHANNEL_H__